@@ -5,14 +5,72 @@
 // IR format definitions
 #include "reil_ir.h"
 
+// binary IR serialization format definitions
+#include "reil_serial.h"
+
 #define MAX_INST_LEN 30
 
 #define REIL_ERROR -1
 
+// translator options
+#define REIL_OPT_EXT_INSN   0x00000001  // emit extended instructions set
+
+// optimization passes
+#define REIL_PASS_CONST_FOLDING 0x00000001  // evaluate and propagate constants
+#define REIL_PASS_COPY_PROP     0x00000002  // propagate and coalesce copies
+#define REIL_PASS_SUBEXP        0x00000004  // eliminate common subexpressions
+#define REIL_PASS_DEAD_CODE     0x00000008  // eliminate dead code
+#define REIL_PASS_ALL           0x0000000f
+#define REIL_PASS_KEEP_FLAGS    0x00000100  // flags are live at the function exit
+#define REIL_PASS_SUBEXP_LOCAL  0x00000200  // eliminate subexpressions within basic blocks only
+
+// interpreter options
+#define REIL_VM_OPT_JIT     0x00000001  // compile hot basic blocks to host code
+#define REIL_VM_OPT_TAINT   0x00000002  // track taint of registers and memory bytes
+#define REIL_VM_OPT_COVERAGE 0x00000004 // collect edge coverage and basic block hit counters
+
+// default size of the edge coverage map
+#define REIL_VM_COV_MAP_SIZE 0x10000
+
+// access flags of mapped memory
+#define REIL_VM_MEM_READ    0x00000001
+#define REIL_VM_MEM_WRITE   0x00000002
+
+// interpreter exit codes
+#define REIL_VM_ERR_CODE    -2  // unable to read IR code of the machine instruction
+#define REIL_VM_ERR_READ    -3  // memory read error
+#define REIL_VM_ERR_WRITE   -4  // memory write error
+#define REIL_VM_ERR_INSN    -5  // invalid IR instruction
+#define REIL_VM_ERR_TAINT   -6  // execution was stopped by taint handler
+
+// tainted values reported to the taint handler
+#define REIL_VM_TAINT_JCC   1   // condition or target of JCC
+#define REIL_VM_TAINT_LDM   2   // memory read address
+#define REIL_VM_TAINT_STM   3   // memory write address
+
 typedef void * reil_t;
 typedef enum _reil_arch_t { ARCH_X86 } reil_arch_t;
 typedef int (* reil_inst_handler_t)(reil_inst_t *inst, void *context);
 
+typedef void * reil_vm_t;
+typedef void * reil_serial_t;
+
+// must return number of IR instructions of machine instruction at addr or REIL_ERROR
+typedef int (* reil_vm_code_read_t)(reil_addr_t addr, reil_inst_t *insn_list, int insn_max, void *context);
+
+// must return REIL_ERROR if memory is not accessible
+typedef int (* reil_vm_mem_read_t)(reil_addr_t addr, int size, unsigned char *buff, void *context);
+typedef int (* reil_vm_mem_write_t)(reil_addr_t addr, int size, unsigned char *buff, void *context);
+
+/*
+    Taint labels of each byte of value are packed into the bytes of taint argument,
+    handler must return REIL_ERROR to stop the execution.
+*/
+typedef int (* reil_vm_taint_handler_t)(
+    int kind, reil_addr_t addr, reil_inum_t inum, 
+    reil_const_t val, reil_const_t taint, void *context
+);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -20,11 +78,77 @@ extern "C" {
 void reil_inst_print(reil_inst_t *inst);
 
 reil_t reil_init(reil_arch_t arch, reil_inst_handler_t handler, void *context);
+reil_t reil_init_ex(reil_arch_t arch, unsigned int opts, reil_inst_handler_t handler, void *context);
 void reil_close(reil_t reil);
 
 int reil_translate(reil_t reil, reil_addr_t addr, unsigned char *buff, int len);
 int reil_translate_insn(reil_t reil, reil_addr_t addr, unsigned char *buff, int len);
 
+int reil_optimize(reil_inst_t *insn_list, int insn_count, unsigned int passes);
+
+reil_vm_t reil_vm_init(
+    reil_arch_t arch, 
+    reil_vm_code_read_t code_read, 
+    reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write, 
+    void *context
+);
+reil_vm_t reil_vm_init_ex(
+    reil_arch_t arch, unsigned int opts, 
+    reil_vm_code_read_t code_read, 
+    reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write, 
+    void *context
+);
+void reil_vm_close(reil_vm_t vm);
+
+int reil_vm_reg_get(reil_vm_t vm, const char *name, reil_const_t *val);
+int reil_vm_reg_set(reil_vm_t vm, const char *name, reil_const_t val);
+int reil_vm_reg_count(reil_vm_t vm);
+const char *reil_vm_reg_name(reil_vm_t vm, int num);
+
+void reil_vm_reset(reil_vm_t vm);
+void reil_vm_flush(reil_vm_t vm);
+void reil_vm_invalidate(reil_vm_t vm, reil_addr_t addr, int size);
+
+int reil_vm_map(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *buff, int flags);
+int reil_vm_unmap(reil_vm_t vm, reil_addr_t addr, int size);
+
+int reil_vm_run(reil_vm_t vm, reil_addr_t addr, reil_addr_t *err_addr, reil_inum_t *err_inum);
+
+void reil_vm_taint_handler(reil_vm_t vm, reil_vm_taint_handler_t handler);
+void reil_vm_taint_reset(reil_vm_t vm);
+int reil_vm_taint_reg_get(reil_vm_t vm, const char *name, reil_const_t *taint);
+int reil_vm_taint_reg_set(reil_vm_t vm, const char *name, reil_const_t taint);
+int reil_vm_taint_mem_get(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *labels);
+int reil_vm_taint_mem_set(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *labels);
+
+int reil_vm_coverage_set_map(reil_vm_t vm, unsigned char *buff, int size);
+unsigned char *reil_vm_coverage_get_map(reil_vm_t vm, int *size);
+int reil_vm_coverage_hits(reil_vm_t vm, reil_addr_t *addr, reil_const_t *hits, int max);
+void reil_vm_coverage_reset(reil_vm_t vm);
+
+/*
+    Streaming reader and writer of the binary IR format, see reil_serial.h.
+    Raw instruction information returned by reil_serial_read() is valid
+    until the next call of reil_serial_read().
+*/
+reil_serial_t reil_serial_open_write(const char *path, unsigned int flags);
+reil_serial_t reil_serial_open_read(const char *path);
+int reil_serial_close(reil_serial_t serial);
+
+int reil_serial_write(reil_serial_t serial, reil_inst_t *inst);
+int reil_serial_read(reil_serial_t serial, reil_inst_t *inst);
+
+/*
+    Scans over the columns of IR instructions fields, column is an array of
+    little endian unsigned integers of given width (1, 2, 4 or 8 bytes).
+    reil_columns_filter() clears mask bytes of values that are out of the
+    [lo, hi] range and returns number of non zero mask bytes,
+    reil_columns_histogram() adds number of occurrences of each value below
+    max for non zero mask bytes (mask is optional) to the counts array.
+*/
+int reil_columns_filter(const void *column, int width, int count, reil_const_t lo, reil_const_t hi, unsigned char *mask);
+int reil_columns_histogram(const void *column, int width, int count, const unsigned char *mask, unsigned int *counts, int max);
+
 #ifdef __cplusplus
 }
 #endif
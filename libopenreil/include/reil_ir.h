@@ -8,6 +8,7 @@
 #define IOPT_RET        0x00000002
 #define IOPT_BB_END     0x00000004
 #define IOPT_ASM_END    0x00000008
+#define IOPT_ELIMINATED 0x00000010
 
 typedef enum _reil_op_t 
 { 
@@ -33,7 +34,15 @@ typedef enum _reil_op_t
     I_XOR,      // binary xor
     I_NOT,      // binary not  
     I_EQ,       // equation
-    I_LT        // less than
+    I_LT,       // less than
+
+    // extended instructions, see REIL_OPT_EXT_INSN
+    I_SAR,      // arithmetic shift right
+    I_ROL,      // rotate left
+    I_ROR,      // rotate right
+    I_SEXT,     // sign extension
+    I_NEQ,      // not equal
+    I_LE        // less or equal
 
 } reil_op_t;
 
@@ -0,0 +1,150 @@
+#ifndef _REIL_OPTIMIZER_H_
+#define _REIL_OPTIMIZER_H_
+
+// function entry or unknown code that defines all of the registers
+#define REIL_OPT_DEF_ENTRY -1
+
+typedef struct _reil_opt_def_t
+{
+    int insn;   // index of instruction that defines variable
+    int var;    // variable number
+
+} reil_opt_def_t;
+
+typedef struct _reil_opt_use_t
+{
+    int insn;   // index of instruction that uses variable
+    int arg;    // 0 for a, 1 for b and 2 for c argument
+    int var;    // variable number
+
+    // list of reaching definitions in def_list
+    int defs_first, defs_count;
+
+} reil_opt_use_t;
+
+typedef struct _reil_opt_bb_t
+{
+    int first, last;    // instructions range
+    bool exit;          // control flow can leave function at the end of this block
+    vector<int> succ;   // successor basic blocks
+
+} reil_opt_bb_t;
+
+typedef struct _reil_opt_vn_t
+{
+    // operation, value numbers of arguments and size of the result
+    reil_op_t op;
+    int a, b;
+    reil_size_t size;
+
+    // constant value or memory state number for LDM
+    reil_const_t val;
+
+    int vn;         // value number of the expression
+    int var, insn;  // variable that holds the value and instruction that set it
+    int next;       // next entry with the same hash
+
+} reil_opt_vn_t;
+
+class CReilOptimizer
+{
+public:
+
+    CReilOptimizer(reil_inst_t *insn_list, int insn_count, unsigned int passes);
+
+    int optimize(void);
+
+    static bool evaluate(reil_inst_t *insn, reil_const_t *val);
+
+private:
+
+    void analyze(void);
+    void build_cfg(void);
+    void build_dom(void);
+    void build_vars(void);
+    void build_chains(void);
+
+    int var_get(int n, reil_arg_t *arg);
+    bool is_flag(int var);
+    bool is_removable(int n);
+    bool is_barrier(int n);
+    bool is_modified(reil_arg_t *arg, int from, int to);
+
+    reil_arg_t *insn_arg(int n, int arg);
+    bool has_dst(int n);
+
+    void def_add(int n, int var);
+    void live_all_regs(vector<int> &last_def, unsigned long long *in, bool flags);
+    void eliminate(int n);
+
+    int vn_hash(reil_opt_vn_t *entry);
+    int vn_find(reil_opt_vn_t *key, int from);
+    void vn_insert(reil_opt_vn_t *entry);
+    void vn_pop(int count);
+    int vn_new(void);
+    int vn_def(int d);
+    int vn_var(int bb, int var);
+    int vn_arg(int n, int bb, int arg);
+
+    bool fold_constants(void);
+    bool propagate_copies(void);
+    bool coalesce_copies(void);
+    bool eliminate_subexpressions(void);
+    bool eliminate_dead_code(void);
+
+    int compact(void);
+
+    reil_inst_t *insn_list;
+    int insn_count;
+    unsigned int passes;
+
+    // control flow graph
+    vector<reil_opt_bb_t> bb_list;
+    vector<int> insn_bb;
+
+    // immediate dominators and dominator tree preorder of basic blocks
+    vector<int> bb_idom, bb_order;
+
+    // the only predecessor of each basic block or -1
+    vector<int> bb_pred;
+
+    // register and temp variables, temps are local for machine instruction
+    map<pair<string, reil_addr_t>, int> var_map;
+    vector<reil_arg_t> var_list;
+    vector<int> reg_list, insn_var;
+
+    // definitions and uses of variables
+    vector<reil_opt_def_t> def_list;
+    vector<reil_opt_use_t> use_list;
+    vector<vector<int> > var_defs;
+
+    // definitions and uses ranges for each instruction
+    vector<int> insn_def, insn_use;
+
+    // compact def-use chains
+    vector<int> use_defs;
+    vector<int> def_uses_first, def_uses;
+
+    // number of uses of each definition including implicit ones
+    vector<int> def_live;
+
+    // definitions that reach the beginning of each basic block
+    vector<unsigned long long> bb_in;
+    int def_words;
+
+    // scoped hash table of available expressions
+    vector<int> vn_head;
+    vector<reil_opt_vn_t> vn_list;
+
+    // value numbers of definitions and variables at the basic block entry
+    vector<int> vn_defs;
+    map<pair<int, int>, int> vn_entry;
+
+    // definitions of variables in the current basic block
+    vector<int> vn_local;
+
+    // hash table entry of expression that calculates each value number
+    vector<int> vn_key;
+};
+
+#endif
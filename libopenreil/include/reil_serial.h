@@ -0,0 +1,89 @@
+
+#ifndef _REIL_SERIAL_H_
+#define _REIL_SERIAL_H_
+
+/*
+    Binary REIL serialization format, all values are little endian:
+
+        header      reil_serial_header_t
+        block       reil_serial_block_t followed by data_len bytes of
+                    block data that is zlib compressed when REIL_SERIAL_BLOCK_ZLIB
+                    flag is set
+        ...
+
+    Decompressed block data (raw_len bytes) consists of the string table
+    (32-bit strings count, then 32-bit length and bytes of each string) and
+    array of fixed width reil_serial_rec_t records. Register names, assembly
+    text and instruction bytes are stored in the string table, addresses are
+    stored as difference with the address of the previous record of the same
+    block, so each block can be decoded independently.
+*/
+
+#define REIL_SERIAL_MAGIC "REILBIN"
+#define REIL_SERIAL_VERSION 1
+
+// file header flags
+#define REIL_SERIAL_ZLIB 0x0001   // compress blocks with zlib
+
+// block header flags
+#define REIL_SERIAL_BLOCK_ZLIB 0x0001
+
+// record attributes
+#define REIL_SERIAL_ATTR_ASM    0x01  // str_mnem and str_op are present
+#define REIL_SERIAL_ATTR_BIN    0x02  // str_bin is present
+#define REIL_SERIAL_ATTR_FLAGS  0x04  // flags field is present
+#define REIL_SERIAL_ATTR_EXT    0x08  // str_ext is present
+
+// default number of records in block
+#define REIL_SERIAL_BLOCK_SIZE 0x1000
+
+// string index value for absent string
+#define REIL_SERIAL_STR_NONE 0xffffffff
+
+typedef struct _reil_serial_header_t
+{
+    char magic[8];
+    unsigned short version;
+    unsigned short flags;
+    unsigned int reserved;
+
+} reil_serial_header_t;
+
+typedef struct _reil_serial_block_t
+{
+    unsigned int count;         // number of records
+    unsigned int raw_len;       // size of decompressed block data
+    unsigned int data_len;      // size of stored block data
+    unsigned int flags;         // REIL_SERIAL_BLOCK_*
+
+} reil_serial_block_t;
+
+typedef struct _reil_serial_arg_t
+{
+    unsigned char type;
+    unsigned char size;
+    unsigned short reserved;
+    unsigned int name;          // string index of the register name
+    unsigned long long val;     // value of the constant
+
+} reil_serial_arg_t;
+
+typedef struct _reil_serial_rec_t
+{
+    unsigned long long addr;    // difference with the previous record address
+    unsigned short inum;
+    unsigned char op;
+    unsigned char size;         // machine instruction size
+    unsigned char attr;         // REIL_SERIAL_ATTR_*
+    unsigned char reserved[3];
+    unsigned int flags;
+    unsigned int str_mnem;
+    unsigned int str_op;
+    unsigned int str_bin;
+    unsigned int str_ext;       // string with opaque extended attributes
+    unsigned int reserved_1;
+    reil_serial_arg_t a, b, c;
+
+} reil_serial_rec_t;
+
+#endif
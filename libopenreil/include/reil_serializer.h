@@ -0,0 +1,54 @@
+
+#ifndef _REIL_SERIALIZER_H_
+#define _REIL_SERIALIZER_H_
+
+class CReilSerialWriter
+{
+public:
+
+    CReilSerialWriter(FILE *fd, unsigned int flags);
+    ~CReilSerialWriter();
+
+    bool write_header(void);
+    bool write(reil_inst_t *inst);
+    bool flush(void);
+
+private:
+
+    unsigned int put_str(const char *data, size_t len);
+    void put_arg(reil_serial_arg_t *rec, reil_arg_t *arg);
+
+    FILE *fd;
+    unsigned int flags;
+    reil_addr_t prev_addr;
+
+    vector<reil_serial_rec_t> records;
+    vector<string> strings;
+    map<string, unsigned int> strings_index;
+};
+
+class CReilSerialReader
+{
+public:
+
+    CReilSerialReader(FILE *fd);
+    ~CReilSerialReader();
+
+    bool read_header(void);
+    int read(reil_inst_t *inst);
+
+private:
+
+    int read_block(void);
+    bool get_str(unsigned int index, const char **data, size_t *len);
+    bool get_arg(reil_arg_t *arg, reil_serial_arg_t *rec);
+
+    FILE *fd;
+    reil_addr_t prev_addr;
+    size_t current;
+
+    vector<reil_serial_rec_t> records;
+    vector<string> strings;
+};
+
+#endif
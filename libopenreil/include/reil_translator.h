@@ -19,11 +19,13 @@ public:
     string reason;
 };
 
+void reil_assert(bool condition, string reason);
+
 class CReilFromBilTranslator
 {
 public:
     
-    CReilFromBilTranslator(VexArch arch, reil_inst_handler_t handler, void *context); 
+    CReilFromBilTranslator(VexArch arch, unsigned int opts, reil_inst_handler_t handler, void *context); 
     ~CReilFromBilTranslator();
 
     void reset_state(bap_block_t *block);    
@@ -55,18 +57,25 @@ private:
     Stmt *get_bil_stmt(int pos);
 
     void check_cjmp_false_target(Exp *target);
+
+    void process_bil_rotates(bap_block_t *block);
     
     void process_bil_arshift(reil_inst_t *reil_inst);
+    void process_bil_rotate(reil_inst_t *reil_inst);
+    void process_bil_sext(reil_inst_t *reil_inst);
     void process_bil_neq(reil_inst_t *reil_inst);
     void process_bil_le(reil_inst_t *reil_inst);
     bool process_bil_cast(Exp *exp, reil_inst_t *reil_inst);
 
+    void lower_ext_inst(reil_inst_t *reil_inst);
+
     void free_bil_exp(Exp *exp);
     Exp *process_bil_exp(Exp *exp);    
     
     Exp *process_bil_inst(reil_op_t inst, uint64_t inst_flags, Exp *c, Exp *exp);
 
     VexArch guest;
+    unsigned int options;
 
     bap_block_t *current_block;
     int current_stmt;
@@ -85,7 +94,7 @@ class CReilTranslator
 {
 public:
 
-    CReilTranslator(VexArch arch, reil_inst_handler_t handler, void *context);
+    CReilTranslator(VexArch arch, unsigned int opts, reil_inst_handler_t handler, void *context);
     ~CReilTranslator();
 
     int process_inst(address_t addr, uint8_t *data, int size);
@@ -0,0 +1,279 @@
+#ifndef _REIL_VM_H_
+#define _REIL_VM_H_
+
+// initial size of the buffer for IR instructions of the machine instruction
+#define REIL_VM_MAX_INSN 0x100
+
+// maximum number of machine instructions in predecoded basic block
+#define REIL_VM_MAX_BLOCK_LEN 0x40
+
+// number of entries in direct mapped cache of basic blocks
+#define REIL_VM_CACHE_SIZE 0x400
+
+// memory pages with predecoded code are tracked to detect self-modifying code
+#define REIL_VM_PAGE_BITS 12
+#define REIL_VM_FILTER_SIZE 0x1000
+
+// two-level table of host memory pages that covers 32-bit address space
+#define REIL_VM_PAGE_SIZE (1 << REIL_VM_PAGE_BITS)
+#define REIL_VM_TABLE_BITS 10
+#define REIL_VM_TABLE_SIZE (1 << REIL_VM_TABLE_BITS)
+#define REIL_VM_DIR_SIZE (1 << (32 - REIL_VM_PAGE_BITS - REIL_VM_TABLE_BITS))
+
+// number of executions of basic block before its JIT compilation
+#define REIL_VM_JIT_THRESHOLD 0x10
+
+// operations of the predecoded code
+typedef enum _reil_vm_op_t
+{
+    VM_NONE,
+    VM_JCC,
+    VM_STM,
+    VM_LDM,
+    VM_STR,
+    VM_ADD,
+    VM_SUB,
+    VM_NEG,
+    VM_MUL,
+    VM_SHL,
+    VM_SHR,
+    VM_AND,
+    VM_OR,
+    VM_XOR,
+    VM_NOT,
+    VM_EQ,
+    VM_LT,
+    VM_NEQ,
+    VM_LE,
+    VM_EVAL,        // any other instruction, see CReilVM::evaluate()
+    VM_ASM_END,     // end of the machine instruction
+    VM_INVALID,     // invalid instruction
+    VM_TAINT,       // taint propagation, dispatches to the handler of operation
+    VM_OP_COUNT
+
+} reil_vm_op_t;
+
+typedef struct _reil_vm_arg_t
+{
+    reil_type_t type;
+    reil_size_t size;
+    reil_const_t mask;  // mask for argument size
+    reil_const_t val;   // value of the constant argument
+    int reg;            // register file index of the register or temp argument
+
+} reil_vm_arg_t;
+
+typedef struct _reil_vm_insn_t
+{
+    const void *handler;    // handler address for direct threaded dispatch
+    reil_vm_op_t vm_op;
+    reil_op_t op;
+    reil_inum_t inum;
+    reil_vm_arg_t a, b, c;
+    reil_const_t mask;      // mask for result that includes numpy promotion
+    int bits;               // bit width of evaluation
+    int asm_num;            // machine instruction index
+
+} reil_vm_insn_t;
+
+typedef struct _reil_vm_asm_t
+{
+    reil_addr_t addr, next;
+
+    // temp registers that must be reset after the execution
+    int temp_first, temp_count;
+
+} reil_vm_asm_t;
+
+struct _reil_vm_jit_exit_t;
+
+// predecoded basic block
+typedef struct _reil_vm_block_t
+{
+    reil_addr_t addr, end;
+    bool invalid;
+
+    vector<reil_vm_insn_t> insn_list;
+    vector<reil_vm_asm_t> asm_list;
+    vector<int> temp_list;
+
+    // number of executions and compiled code
+    unsigned int exec_count;
+    const void *jit_code, *jit_body;
+
+    // exits of compiled code and exits of other blocks that jump to this one
+    vector<struct _reil_vm_jit_exit_t *> jit_exits, jit_links;
+
+    // coverage map location and hit counter of the block address
+    unsigned int cov_loc;
+    reil_const_t *cov_hits;
+
+} reil_vm_block_t;
+
+// AFL-style edge coverage map
+typedef struct _reil_vm_cov_t
+{
+    unsigned char *map;
+    unsigned int mask;  // map size minus one
+    unsigned int prev;  // location of the previous basic block shifted by one
+
+} reil_vm_cov_t;
+
+// host memory page mapped into the guest address space
+typedef struct _reil_vm_page_t
+{
+    unsigned char *read;    // NULL if page is not readable
+    unsigned char *write;   // NULL if page is not writeable
+
+} reil_vm_page_t;
+
+// exit of compiled basic block to the constant address
+typedef struct _reil_vm_jit_exit_t
+{
+    const void **slot;          // indirect jump slot of compiled code
+    const void *stub;           // code that returns to the interpreter loop
+    reil_addr_t addr;
+    reil_vm_block_t *block;     // owner, NULL if block was deleted
+    reil_vm_block_t *target;    // linked basic block
+
+} reil_vm_jit_exit_t;
+
+// state shared between the VM and compiled code
+typedef struct _reil_vm_jit_ctx_t
+{
+    reil_const_t *regs;
+    reil_vm_page_t **pages;
+    reil_addr_t next;
+    reil_vm_jit_exit_t *exit;   // taken exit if it's not linked yet
+
+} reil_vm_jit_ctx_t;
+
+class CReilVMJit;
+
+class CReilVM
+{
+public:
+
+    CReilVM(
+        reil_arch_t arch, unsigned int opts,
+        reil_vm_code_read_t code_read,
+        reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write,
+        void *context
+    );
+
+    ~CReilVM();
+
+    int reg_num(const char *name);
+    int reg_count(void);
+    const char *reg_name(int num);
+    reil_const_t reg_get(int num);
+    void reg_set(int num, reil_const_t val);
+
+    void reset(void);
+    void flush(void);
+    void invalidate(reil_addr_t addr, int size);
+
+    bool mem_map(reil_addr_t addr, int size, unsigned char *buff, int flags);
+    bool mem_unmap(reil_addr_t addr, int size);
+
+    int run(reil_addr_t addr);
+
+    void taint_set_handler(reil_vm_taint_handler_t handler);
+    void taint_reset(void);
+    reil_const_t taint_reg_get(int num);
+    void taint_reg_set(int num, reil_const_t taint);
+    void taint_mem_get(reil_addr_t addr, int size, unsigned char *labels);
+    void taint_mem_set(reil_addr_t addr, int size, unsigned char *labels);
+
+    bool coverage_set_map(unsigned char *buff, int size);
+    unsigned char *coverage_get_map(int *size);
+    int coverage_hits(reil_addr_t *addr, reil_const_t *hits, int max);
+    void coverage_reset(void);
+
+    static bool evaluate(
+        reil_op_t op,
+        reil_size_t a_size, reil_const_t a,
+        reil_size_t b_size, reil_const_t b,
+        reil_const_t *val
+    );
+
+    // location of the last error
+    reil_addr_t err_addr;
+    reil_inum_t err_inum;
+
+private:
+
+    friend class CReilVMJit;
+
+    int read_code(reil_addr_t addr);
+
+    reil_vm_block_t *get_block(reil_addr_t addr);
+    reil_vm_block_t *decode_block(reil_addr_t addr);
+    void decode_insn(reil_vm_block_t *block, reil_vm_insn_t *dst, reil_inst_t *src);
+    void decode_arg(reil_vm_block_t *block, reil_vm_arg_t *dst, reil_arg_t *src);
+
+    void block_add(reil_vm_block_t *block);
+    void block_remove(reil_vm_block_t *block);
+    void collect(void);
+
+    int execute(reil_vm_block_t *block, reil_addr_t *next);
+    int mem_load(reil_addr_t addr, reil_size_t size, reil_const_t *val);
+    int mem_store(reil_addr_t addr, reil_size_t size, reil_const_t val);
+    reil_vm_page_t *mem_page(reil_addr_t addr, int size);
+
+    int taint_insn(reil_vm_block_t *block, reil_vm_insn_t *insn);
+    int taint_report(int kind, reil_vm_block_t *block, reil_vm_insn_t *insn, 
+                     reil_const_t val, reil_const_t taint);
+    unsigned char *taint_byte(reil_addr_t addr, bool alloc);
+    reil_const_t taint_load(reil_addr_t addr, int len);
+    void taint_store(reil_addr_t addr, int len, reil_const_t taint);
+    void taint_temp_reset(reil_vm_block_t *block, reil_vm_asm_t *info);
+
+    reil_vm_code_read_t code_read;
+    reil_vm_mem_read_t mem_read;
+    reil_vm_mem_write_t mem_write;
+    void *context;
+
+    // register file, temps are zeroed after each machine instruction
+    map<string, int> reg_map;
+    vector<string> reg_names;
+    vector<reil_const_t> regs;
+    int reg_ip;
+
+    // predecoded basic blocks
+    map<reil_addr_t, reil_vm_block_t *> block_map;
+    reil_vm_block_t *block_cache[REIL_VM_CACHE_SIZE];
+
+    // invalidated blocks that can be still in use
+    vector<reil_vm_block_t *> block_garbage;
+    bool running;
+
+    // basic blocks of each memory page and counters of them
+    map<reil_addr_t, vector<reil_vm_block_t *> > code_pages;
+    int code_filter[REIL_VM_FILTER_SIZE];
+
+    // handlers of predecoded code operations
+    const void **handlers;
+
+    vector<reil_inst_t> code_buff;
+
+    // host memory pages that are accessed without callbacks
+    reil_vm_page_t *pages[REIL_VM_DIR_SIZE];
+
+    // compiler of hot basic blocks, NULL if JIT is disabled
+    CReilVMJit *jit;
+
+    // shadow registers and memory with taint labels, see REIL_VM_OPT_TAINT
+    bool taint;
+    vector<reil_const_t> taint_regs;
+    unsigned char **taint_pages[REIL_VM_DIR_SIZE];
+    reil_vm_taint_handler_t taint_handler;
+
+    // edge coverage and hit counters of basic blocks, see REIL_VM_OPT_COVERAGE
+    bool coverage;
+    reil_vm_cov_t cov;
+    vector<unsigned char> cov_buff;
+    map<reil_addr_t, reil_const_t> cov_hits;
+};
+
+#endif
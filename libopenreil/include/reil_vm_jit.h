@@ -0,0 +1,89 @@
+#ifndef _REIL_VM_JIT_H_
+#define _REIL_VM_JIT_H_
+
+// size of executable memory chunk for compiled code
+#define REIL_VM_JIT_CHUNK_SIZE 0x100000
+
+class CReilVMJit
+{
+public:
+
+    CReilVMJit(CReilVM *vm);
+    ~CReilVMJit();
+
+    static bool is_supported(void);
+
+    bool compile(reil_vm_block_t *block);
+    int execute(reil_vm_block_t *block, reil_addr_t *next);
+
+    void link(reil_vm_jit_exit_t *exit, reil_vm_block_t *target);
+    void unlink(reil_vm_block_t *block);
+    void reset(void);
+
+private:
+
+    unsigned char *alloc(size_t size);
+
+    void emit(unsigned char val);
+    void emit_32(unsigned int val);
+    void emit_64(reil_const_t val);
+    void emit_rex(bool w, int reg, int index, int base);
+    void emit_modrm(int reg, int base, int index, int scale, int disp);
+
+    void emit_mov_imm(int reg, reil_const_t val);
+    void emit_mov_load(int reg, int base, int disp);
+    void emit_mov_store(int base, int disp, int reg);
+    void emit_mov_store_zero(int base, int disp);
+    void emit_alu(int op, int dst, int src);
+    void emit_mask(int reg, reil_const_t mask);
+    void emit_call(const void *func);
+    size_t emit_jcc(int cc);
+    size_t emit_jmp(void);
+    void emit_label(size_t fixup);
+    void emit_leave(void);
+
+    reil_const_t emit_arg(int reg, reil_vm_arg_t *arg);
+    void emit_result(reil_vm_insn_t *insn, reil_const_t bound);
+    void emit_page(bool write, int len, vector<size_t> &slow);
+    void emit_ldm(reil_vm_insn_t *insn);
+    void emit_stm(reil_vm_insn_t *insn);
+    void emit_helper(const void *func, reil_vm_insn_t *insn);
+    void emit_temps(reil_vm_block_t *block, int asm_num);
+    void emit_exit(reil_vm_block_t *block, reil_addr_t addr);
+    void emit_coverage(reil_vm_block_t *block);
+
+    static reil_const_t arg_val(CReilVM *vm, reil_vm_arg_t *arg);
+
+    // called from compiled code
+    static int helper_load(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr);
+    static int helper_store(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr);
+    static int helper_eval(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr);
+    static int helper_invalid(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr);
+    static int helper_invalidate(CReilVM *vm, reil_addr_t addr, int size);
+
+    CReilVM *vm;
+    reil_vm_jit_ctx_t ctx;
+
+    // last taken exit that wasn't linked to the next block
+    reil_vm_jit_exit_t *exit;
+
+    // code of the current basic block
+    vector<unsigned char> code;
+    vector<size_t> leave_fixups;
+
+    // register whose value is in RAX and mask of that value
+    int cache_reg;
+    reil_const_t cache_mask;
+
+    // exits of the current basic block with locations of slot and stub
+    vector<pair<reil_vm_jit_exit_t *, pair<size_t, size_t> > > exit_list;
+
+    // executable memory
+    vector<pair<unsigned char *, size_t> > chunks;
+    size_t chunk_used;
+
+    // exits can be referenced after deletion of their basic blocks
+    vector<reil_vm_jit_exit_t *> exit_pool;
+};
+
+#endif
@@ -5,6 +5,9 @@
 #include <assert.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
 
 // libasmir includes
 #include "irtoir.h"
@@ -12,6 +15,9 @@
 // OpenREIL includes
 #include "libopenreil.h"
 #include "reil_translator.h"
+#include "reil_optimizer.h"
+#include "reil_vm.h"
+#include "reil_serializer.h"
 
 #define STR_ARG_EMPTY " "
 #define STR_VAR(_name_, _t_) "(" + (_name_) + ", " + to_string_size((_t_)) + ")"
@@ -23,6 +29,14 @@ typedef struct _reil_context
 
 } reil_context;
 
+typedef struct _reil_serial_context
+{
+    FILE *fd;
+    CReilSerialWriter *writer;
+    CReilSerialReader *reader;
+
+} reil_serial_context;
+
 string to_string_constant(reil_const_t val, reil_size_t size)
 {
     stringstream s;
@@ -90,6 +104,11 @@ extern "C" void reil_inst_print(reil_inst_t *inst)
 }
 
 extern "C" reil_t reil_init(reil_arch_t arch, reil_inst_handler_t handler, void *context)
+{
+    return reil_init_ex(arch, 0, handler, context);
+}
+
+extern "C" reil_t reil_init_ex(reil_arch_t arch, unsigned int opts, reil_inst_handler_t handler, void *context)
 {
     VexArch guest;
 
@@ -110,7 +129,7 @@ extern "C" reil_t reil_init(reil_arch_t arch, reil_inst_handler_t handler, void
     assert(c);
 
     // create new translator instance
-    c->translator = new CReilTranslator(guest, handler, context);
+    c->translator = new CReilTranslator(guest, opts, handler, context);
     assert(c->translator);
 
     return c;
@@ -182,3 +201,426 @@ extern "C" int reil_translate(reil_t reil, reil_addr_t addr, unsigned char *buff
 
     return translated;
 }
+
+extern "C" int reil_optimize(reil_inst_t *insn_list, int insn_count, unsigned int passes)
+{
+    try
+    {
+        CReilOptimizer optimizer(insn_list, insn_count, passes);
+
+        // optimize code and return new instructions count
+        return optimizer.optimize();
+    }
+    catch (CReilTranslatorException e)
+    {
+        fprintf(stderr, "Exception occurs: %s\n", e.reason.c_str());
+    }
+
+    return REIL_ERROR;
+}
+
+extern "C" reil_vm_t reil_vm_init(
+    reil_arch_t arch, 
+    reil_vm_code_read_t code_read, 
+    reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write, 
+    void *context)
+{
+    return reil_vm_init_ex(arch, 0, code_read, mem_read, mem_write, context);
+}
+
+extern "C" reil_vm_t reil_vm_init_ex(
+    reil_arch_t arch, unsigned int opts, 
+    reil_vm_code_read_t code_read, 
+    reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write, 
+    void *context)
+{
+    try
+    {
+        CReilVM *vm = new CReilVM(arch, opts, code_read, mem_read, mem_write, context);
+        assert(vm);
+
+        return vm;
+    }
+    catch (CReilTranslatorException e)
+    {
+        fprintf(stderr, "Exception occurs: %s\n", e.reason.c_str());
+    }
+
+    return NULL;
+}
+
+extern "C" void reil_vm_close(reil_vm_t vm)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    delete c;
+}
+
+extern "C" int reil_vm_reg_get(reil_vm_t vm, const char *name, reil_const_t *val)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // unknown registers have zero value
+    *val = c->reg_get(c->reg_num(name));
+    return 0;
+}
+
+extern "C" int reil_vm_reg_set(reil_vm_t vm, const char *name, reil_const_t val)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->reg_set(c->reg_num(name), val);
+    return 0;
+}
+
+extern "C" int reil_vm_reg_count(reil_vm_t vm)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    return c->reg_count();
+}
+
+extern "C" const char *reil_vm_reg_name(reil_vm_t vm, int num)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    if (num < 0 || num >= c->reg_count()) return NULL;
+
+    return c->reg_name(num);
+}
+
+extern "C" void reil_vm_reset(reil_vm_t vm)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->reset();
+}
+
+extern "C" void reil_vm_flush(reil_vm_t vm)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->flush();
+}
+
+extern "C" void reil_vm_invalidate(reil_vm_t vm, reil_addr_t addr, int size)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // drop predecoded code of given memory range
+    c->invalidate(addr, size);
+}
+
+extern "C" int reil_vm_map(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *buff, int flags)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // access memory range directly without callbacks
+    return c->mem_map(addr, size, buff, flags) ? 0 : REIL_ERROR;
+}
+
+extern "C" int reil_vm_unmap(reil_vm_t vm, reil_addr_t addr, int size)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    return c->mem_unmap(addr, size) ? 0 : REIL_ERROR;
+}
+
+extern "C" int reil_vm_run(reil_vm_t vm, reil_addr_t addr, reil_addr_t *err_addr, reil_inum_t *err_inum)
+{
+    int ret = 0;
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // execute code until error
+    ret = c->run(addr);
+
+    if (err_addr) *err_addr = c->err_addr;
+    if (err_inum) *err_inum = c->err_inum;
+
+    return ret;
+}
+
+extern "C" void reil_vm_taint_handler(reil_vm_t vm, reil_vm_taint_handler_t handler)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->taint_set_handler(handler);
+}
+
+extern "C" void reil_vm_taint_reset(reil_vm_t vm)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // clear taint of all registers and memory
+    c->taint_reset();
+}
+
+extern "C" int reil_vm_taint_reg_get(reil_vm_t vm, const char *name, reil_const_t *taint)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    *taint = c->taint_reg_get(c->reg_num(name));
+    return 0;
+}
+
+extern "C" int reil_vm_taint_reg_set(reil_vm_t vm, const char *name, reil_const_t taint)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->taint_reg_set(c->reg_num(name), taint);
+    return 0;
+}
+
+extern "C" int reil_vm_taint_mem_get(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *labels)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->taint_mem_get(addr, size, labels);
+    return 0;
+}
+
+extern "C" int reil_vm_taint_mem_set(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *labels)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->taint_mem_set(addr, size, labels);
+    return 0;
+}
+
+extern "C" int reil_vm_coverage_set_map(reil_vm_t vm, unsigned char *buff, int size)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // use caller specified buffer for edge coverage map
+    return c->coverage_set_map(buff, size) ? 0 : REIL_ERROR;
+}
+
+extern "C" unsigned char *reil_vm_coverage_get_map(reil_vm_t vm, int *size)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    return c->coverage_get_map(size);
+}
+
+extern "C" int reil_vm_coverage_hits(reil_vm_t vm, reil_addr_t *addr, reil_const_t *hits, int max)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    // returns number of executed basic blocks
+    return c->coverage_hits(addr, hits, max);
+}
+
+extern "C" void reil_vm_coverage_reset(reil_vm_t vm)
+{
+    CReilVM *c = (CReilVM *)vm;
+    assert(c);
+
+    c->coverage_reset();
+}
+
+// number of column items that are processed by vectorized inner loop
+#define REIL_COLUMNS_CHUNK 64
+
+template <typename T> int reil_columns_filter_t(const T * __restrict column, int count, T lo, T hi, unsigned char * __restrict mask)
+{
+    T range = hi - lo;
+    int ret = 0, i = 0;
+
+    /*
+        Inner loop has constant trip count and no branches, 
+        so compiler is able to vectorize it even with -O2.
+    */
+    for (; i + REIL_COLUMNS_CHUNK <= count; i += REIL_COLUMNS_CHUNK)
+    {
+        unsigned char n = 0;
+
+        for (int j = 0; j < REIL_COLUMNS_CHUNK; j += 1)
+        {
+            unsigned char m = mask[i + j] & (unsigned char)((T)(column[i + j] - lo) <= range);
+
+            mask[i + j] = m;
+            n += m != 0;
+        }
+
+        ret += n;
+    }
+
+    for (; i < count; i += 1)
+    {
+        mask[i] = mask[i] & (unsigned char)((T)(column[i] - lo) <= range);
+        ret += mask[i] != 0;
+    }
+
+    return ret;
+}
+
+template <typename T> void reil_columns_histogram_t(const T *column, int count, const unsigned char *mask, unsigned int *counts, int max)
+{
+    for (int i = 0; i < count; i += 1)
+    {
+        if ((mask == NULL || mask[i] != 0) && column[i] < (reil_const_t)max)
+        {
+            counts[column[i]] += 1;
+        }
+    }
+}
+
+extern "C" int reil_columns_filter(const void *column, int width, int count, reil_const_t lo, reil_const_t hi, unsigned char *mask)
+{
+    if (lo > hi)
+    {
+        // empty range
+        memset(mask, 0, count);
+        return 0;
+    }
+
+    switch (width)
+    {
+    case 1:
+
+        // values that don't fit the column width can't match
+        if (lo > 0xff) { memset(mask, 0, count); return 0; }
+
+        return reil_columns_filter_t<uint8_t>((const uint8_t *)column, count, 
+                                              (uint8_t)lo, (uint8_t)min<reil_const_t>(hi, 0xff), mask);
+    case 2:
+
+        if (lo > 0xffff) { memset(mask, 0, count); return 0; }
+
+        return reil_columns_filter_t<uint16_t>((const uint16_t *)column, count, 
+                                               (uint16_t)lo, (uint16_t)min<reil_const_t>(hi, 0xffff), mask);
+    case 4:
+
+        if (lo > 0xffffffff) { memset(mask, 0, count); return 0; }
+
+        return reil_columns_filter_t<uint32_t>((const uint32_t *)column, count, 
+                                               (uint32_t)lo, (uint32_t)min<reil_const_t>(hi, 0xffffffff), mask);
+    case 8:
+
+        return reil_columns_filter_t<uint64_t>((const uint64_t *)column, count, 
+                                               (uint64_t)lo, (uint64_t)hi, mask);
+    }
+
+    return REIL_ERROR;
+}
+
+extern "C" int reil_columns_histogram(const void *column, int width, int count, const unsigned char *mask, unsigned int *counts, int max)
+{
+    switch (width)
+    {
+    case 1: reil_columns_histogram_t<uint8_t>((const uint8_t *)column, count, mask, counts, max); break;
+    case 2: reil_columns_histogram_t<uint16_t>((const uint16_t *)column, count, mask, counts, max); break;
+    case 4: reil_columns_histogram_t<uint32_t>((const uint32_t *)column, count, mask, counts, max); break;
+    case 8: reil_columns_histogram_t<uint64_t>((const uint64_t *)column, count, mask, counts, max); break;
+    default: return REIL_ERROR;
+    }
+
+    return 0;
+}
+
+extern "C" reil_serial_t reil_serial_open_write(const char *path, unsigned int flags)
+{
+    FILE *fd = fopen(path, "wb");
+    if (fd == NULL)
+    {
+        return NULL;
+    }
+
+    reil_serial_context *c = (reil_serial_context *)malloc(sizeof(reil_serial_context));
+    assert(c);
+
+    c->fd = fd;
+    c->reader = NULL;
+    c->writer = new CReilSerialWriter(fd, flags);
+    assert(c->writer);
+
+    if (!c->writer->write_header())
+    {
+        reil_serial_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+extern "C" reil_serial_t reil_serial_open_read(const char *path)
+{
+    FILE *fd = fopen(path, "rb");
+    if (fd == NULL)
+    {
+        return NULL;
+    }
+
+    reil_serial_context *c = (reil_serial_context *)malloc(sizeof(reil_serial_context));
+    assert(c);
+
+    c->fd = fd;
+    c->writer = NULL;
+    c->reader = new CReilSerialReader(fd);
+    assert(c->reader);
+
+    if (!c->reader->read_header())
+    {
+        reil_serial_close(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+extern "C" int reil_serial_close(reil_serial_t serial)
+{
+    reil_serial_context *c = (reil_serial_context *)serial;
+    bool ok = true;
+    assert(c);
+
+    if (c->writer)
+    {
+        // write the last block, truncated file must be reported
+        ok = c->writer->flush();
+        delete c->writer;
+    }
+
+    if (c->reader) delete c->reader;
+
+    if (fclose(c->fd) != 0) ok = false;
+    free(c);
+
+    return ok ? 0 : REIL_ERROR;
+}
+
+extern "C" int reil_serial_write(reil_serial_t serial, reil_inst_t *inst)
+{
+    reil_serial_context *c = (reil_serial_context *)serial;
+    assert(c && c->writer);
+
+    return c->writer->write(inst) ? 0 : REIL_ERROR;
+}
+
+extern "C" int reil_serial_read(reil_serial_t serial, reil_inst_t *inst)
+{
+    reil_serial_context *c = (reil_serial_context *)serial;
+    assert(c && c->reader);
+
+    return c->reader->read(inst);
+}
@@ -0,0 +1,1386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// libasmir includes
+#include "irtoir.h"
+
+using namespace std;
+
+// OpenREIL includes
+#include "libopenreil.h"
+#include "reil_translator.h"
+#include "reil_optimizer.h"
+
+// maximum number of optimization passes over the same code
+#define REIL_OPT_MAX_ITER 32
+
+#define BITS_WORD 64
+#define BITS_WORDS(_n_) (((_n_) + BITS_WORD - 1) / BITS_WORD)
+
+#define BIT_GET(_s_, _n_) (((_s_)[(_n_) / BITS_WORD] >> ((_n_) % BITS_WORD)) & 1)
+#define BIT_SET(_s_, _n_) ((_s_)[(_n_) / BITS_WORD] |= (1ULL << ((_n_) % BITS_WORD)))
+#define BIT_CLR(_s_, _n_) ((_s_)[(_n_) / BITS_WORD] &= ~(1ULL << ((_n_) % BITS_WORD)))
+
+#define IS_VAR(_arg_) ((_arg_)->type == A_REG || (_arg_)->type == A_TEMP)
+
+typedef pair<reil_addr_t, reil_inum_t> REIL_OPT_LOC;
+
+static int reil_size_bits(reil_size_t size)
+{
+    switch (size)
+    {
+    case U1: return 1;
+    case U8: return 8;
+    case U16: return 16;
+    case U32: return 32;
+    case U64: return 64;
+    }
+
+    assert(0);
+}
+
+static reil_const_t reil_size_mask(reil_size_t size)
+{
+    int bits = reil_size_bits(size);
+
+    return bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+static int64_t reil_sign_extend(reil_const_t val, reil_size_t size)
+{
+    int bits = reil_size_bits(size);
+
+    val &= reil_size_mask(size);
+
+    if (bits < 64 && (val >> (bits - 1)) & 1)
+    {
+        // set higher bits if sign bit is set
+        val |= ~reil_size_mask(size);
+    }
+
+    return (int64_t)val;
+}
+
+static bool reil_arg_is_var(reil_arg_t *arg, const char *name)
+{
+    return IS_VAR(arg) && strcmp(arg->name, name) == 0;
+}
+
+static bool reil_op_commutative(reil_op_t op)
+{
+    switch (op)
+    {
+    case I_ADD: case I_MUL: case I_SMUL:
+    case I_AND: case I_OR: case I_XOR:
+    case I_EQ: case I_NEQ: return true;
+    default: return false;
+    }
+}
+
+static REIL_OPT_LOC reil_inst_next(reil_inst_t *insn)
+{
+    if (insn->flags & IOPT_ASM_END)
+    {
+        // first IR instruction of the next machine instruction
+        return REIL_OPT_LOC(insn->raw_info.addr + insn->raw_info.size, 0);
+    }
+
+    return REIL_OPT_LOC(insn->raw_info.addr, insn->inum + 1);
+}
+
+static void reil_dfs_postorder(vector<vector<int> > &succs, int from,
+                               vector<bool> &visited, vector<int> &order)
+{
+    vector<pair<int, int> > stack(1, make_pair(from, 0));
+
+    visited[from] = true;
+
+    while (stack.size() > 0)
+    {
+        int b = stack.back().first, next = stack.back().second;
+
+        if (next < (int)succs[b].size())
+        {
+            int s = succs[b][next];
+
+            stack.back().second += 1;
+
+            if (!visited[s])
+            {
+                visited[s] = true;
+                stack.push_back(make_pair(s, 0));
+            }
+        }
+        else
+        {
+            order.push_back(b);
+            stack.pop_back();
+        }
+    }
+}
+
+CReilOptimizer::CReilOptimizer(reil_inst_t *insn_list, int insn_count, unsigned int passes)
+{
+    this->insn_list = insn_list;
+    this->insn_count = insn_count;
+    this->passes = passes;
+}
+
+bool CReilOptimizer::evaluate(reil_inst_t *insn, reil_const_t *val)
+{
+    reil_const_t a = 0, b = 0, ret = 0;
+    reil_size_t size = insn->a.size;
+    int bits = 0;
+
+    if (insn->a.type != A_CONST) return false;
+    if (insn->b.type != A_CONST && insn->b.type != A_NONE) return false;
+
+    a = insn->a.val & reil_size_mask(insn->a.size);
+
+    if (insn->b.type == A_CONST)
+    {
+        b = insn->b.val & reil_size_mask(insn->b.size);
+
+        // the same as VM does: result has the size of the biggest argument
+        if (insn->b.size > size) size = insn->b.size;
+    }
+
+    bits = reil_size_bits(size);
+
+    switch (insn->op)
+    {
+    case I_STR: ret = a; break;
+    case I_ADD: ret = a + b; break;
+    case I_SUB: ret = a - b; break;
+    case I_MUL: ret = a * b; break;
+    case I_NEG: ret = -a; break;
+    case I_AND: ret = a & b; break;
+    case I_OR:  ret = a | b; break;
+    case I_XOR: ret = a ^ b; break;
+    case I_NOT: ret = ~a; break;
+    case I_EQ:  ret = a == b ? 1 : 0; break;
+    case I_LT:  ret = a < b ? 1 : 0; break;
+    case I_NEQ: ret = a != b ? 1 : 0; break;
+    case I_LE:  ret = a <= b ? 1 : 0; break;
+
+    case I_DIV:
+    case I_MOD:
+
+        if (b == 0) return false;
+
+        ret = insn->op == I_DIV ? a / b : a % b;
+        break;
+
+    case I_SMUL:
+
+        ret = (reil_const_t)(reil_sign_extend(a, size) * reil_sign_extend(b, size));
+        break;
+
+    case I_SDIV:
+    case I_SMOD:
+        {
+            int64_t sa = reil_sign_extend(a, size), sb = reil_sign_extend(b, size);
+
+            // Rounding of negative values is not the same across
+            // C and Python code, don't touch such expressions.
+            if (sb <= 0 || sa < 0) return false;
+
+            ret = (reil_const_t)(insn->op == I_SDIV ? sa / sb : sa % sb);
+            break;
+        }
+
+    case I_SHL:
+    case I_SHR:
+    case I_SAR:
+
+        if (b >= (reil_const_t)bits) return false;
+
+        if (insn->op == I_SHL) ret = a << b;
+        else if (insn->op == I_SHR) ret = a >> b;
+        else ret = (reil_const_t)(reil_sign_extend(a, size) >> b);
+
+        break;
+
+    case I_ROL:
+    case I_ROR:
+        {
+            int count = 0;
+
+            bits = reil_size_bits(insn->a.size);
+            count = (int)(b % bits);
+
+            if (insn->op == I_ROR) count = (bits - count) % bits;
+            if (count == 0) { ret = a; break; }
+
+            ret = (a << count) | (a >> (bits - count));
+            size = insn->a.size;
+            break;
+        }
+
+    case I_SEXT:
+
+        ret = (reil_const_t)reil_sign_extend(a, insn->a.size);
+        size = U64;
+        break;
+
+    default:
+
+        // JCC, STM, LDM, UNK and NONE
+        return false;
+    }
+
+    *val = ret & reil_size_mask(size) & reil_size_mask(insn->c.size);
+    return true;
+}
+
+reil_arg_t *CReilOptimizer::insn_arg(int n, int arg)
+{
+    reil_inst_t *insn = &insn_list[n];
+
+    switch (arg)
+    {
+    case 0: return &insn->a;
+    case 1: return &insn->b;
+    case 2: return &insn->c;
+    }
+
+    assert(0);
+}
+
+bool CReilOptimizer::has_dst(int n)
+{
+    reil_inst_t *insn = &insn_list[n];
+
+    switch (insn->op)
+    {
+    case I_NONE:
+    case I_UNK:
+    case I_JCC:
+    case I_STM:
+
+        // instruction has no destination argument
+        return false;
+
+    default:
+
+        return IS_VAR(&insn->c);
+    }
+}
+
+int CReilOptimizer::var_get(int n, reil_arg_t *arg)
+{
+    if (!IS_VAR(arg)) return -1;
+
+    // VM resets temp registers after each machine instruction
+    pair<string, reil_addr_t> name(arg->name, arg->type == A_TEMP ? insn_list[n].raw_info.addr : 0);
+    map<pair<string, reil_addr_t>, int>::iterator it = var_map.find(name);
+
+    if (it != var_map.end()) return it->second;
+
+    // register new variable
+    int var = var_list.size();
+
+    var_map[name] = var;
+    var_list.push_back(*arg);
+
+    if (arg->type == A_REG) reg_list.push_back(var);
+
+    return var;
+}
+
+bool CReilOptimizer::is_flag(int var)
+{
+    // all of the 1-bit registers are flags
+    return var_list[var].type == A_REG && var_list[var].size == U1;
+}
+
+bool CReilOptimizer::is_barrier(int n)
+{
+    reil_inst_t *insn = &insn_list[n];
+
+    // Function calls and untranslated instructions can read
+    // and write any register.
+    return insn->op == I_UNK || (insn->op == I_JCC && (insn->flags & IOPT_CALL));
+}
+
+bool CReilOptimizer::is_removable(int n)
+{
+    reil_inst_t *insn = &insn_list[n];
+
+    if (insn->flags & IOPT_ELIMINATED) return false;
+
+    return has_dst(n);
+}
+
+bool CReilOptimizer::is_modified(reil_arg_t *arg, int from, int to)
+{
+    for (int n = from; n < to; n += 1)
+    {
+        reil_inst_t *insn = &insn_list[n];
+
+        if (is_barrier(n) && arg->type == A_REG) return true;
+
+        if (has_dst(n) && strcmp(insn->c.name, arg->name) == 0) return true;
+    }
+
+    return false;
+}
+
+void CReilOptimizer::eliminate(int n)
+{
+    reil_inst_t *insn = &insn_list[n];
+
+    insn->op = I_NONE;
+    insn->flags |= IOPT_ELIMINATED;
+
+    memset(&insn->a, 0, sizeof(reil_arg_t));
+    memset(&insn->b, 0, sizeof(reil_arg_t));
+    memset(&insn->c, 0, sizeof(reil_arg_t));
+
+    insn->a.type = insn->b.type = insn->c.type = A_NONE;
+}
+
+void CReilOptimizer::build_cfg(void)
+{
+    map<REIL_OPT_LOC, int> loc_map;
+    vector<bool> leader(insn_count, false);
+
+    bb_list.clear();
+    insn_bb.assign(insn_count, -1);
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        REIL_OPT_LOC loc(insn_list[n].raw_info.addr, insn_list[n].inum);
+
+        reil_assert(n == 0 || loc_map.rbegin()->first < loc, "instructions are not sorted");
+        loc_map[loc] = n;
+    }
+
+    leader[0] = true;
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        reil_inst_t *insn = &insn_list[n];
+        bool bb_end = insn->op == I_JCC || (insn->flags & (IOPT_BB_END | IOPT_RET));
+
+        if (insn->op == I_JCC && !(insn->flags & IOPT_CALL) && insn->c.type == A_CONST)
+        {
+            map<REIL_OPT_LOC, int>::iterator it = loc_map.find(REIL_OPT_LOC(insn->c.val, 0));
+
+            // jump target is a start of the basic block
+            if (it != loc_map.end()) leader[it->second] = true;
+        }
+
+        if (n < insn_count - 1 && (bb_end || reil_inst_next(insn) !=
+            REIL_OPT_LOC(insn_list[n + 1].raw_info.addr, insn_list[n + 1].inum)))
+        {
+            leader[n + 1] = true;
+        }
+    }
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        if (leader[n])
+        {
+            reil_opt_bb_t bb;
+
+            bb.first = bb.last = n;
+            bb.exit = false;
+            bb_list.push_back(bb);
+        }
+
+        bb_list.back().last = n;
+        insn_bb[n] = bb_list.size() - 1;
+    }
+
+    for (vector<reil_opt_bb_t>::iterator bb = bb_list.begin(); bb != bb_list.end(); ++bb)
+    {
+        reil_inst_t *insn = &insn_list[bb->last];
+        bool fallthrough = true;
+
+        if (insn->flags & IOPT_RET)
+        {
+            // end of the function
+            bb->exit = true;
+            continue;
+        }
+
+        if (insn->op == I_JCC && !(insn->flags & IOPT_CALL))
+        {
+            map<REIL_OPT_LOC, int>::iterator it = loc_map.end();
+
+            if (insn->c.type == A_CONST) it = loc_map.find(REIL_OPT_LOC(insn->c.val, 0));
+
+            // jump to the unknown location leaves the function
+            if (it == loc_map.end()) bb->exit = true;
+            else bb->succ.push_back(insn_bb[it->second]);
+
+            // check for unconditional jump
+            if (insn->a.type == A_CONST && insn->a.val != 0) fallthrough = false;
+        }
+
+        if (fallthrough)
+        {
+            map<REIL_OPT_LOC, int>::iterator it = loc_map.find(reil_inst_next(insn));
+
+            if (it == loc_map.end()) bb->exit = true;
+            else if (find(bb->succ.begin(), bb->succ.end(), insn_bb[it->second]) == bb->succ.end())
+            {
+                bb->succ.push_back(insn_bb[it->second]);
+            }
+        }
+    }
+}
+
+void CReilOptimizer::build_dom(void)
+{
+    int count = bb_list.size(), root = count;
+    vector<vector<int> > preds(count + 1), succs(count + 1), children(count + 1);
+    vector<int> order, num(count + 1, -1), idom(count + 1, -1);
+    vector<bool> visited(count + 1, false);
+
+    for (int i = 0; i < count; i += 1)
+    {
+        succs[i] = bb_list[i].succ;
+
+        for (vector<int>::iterator it = succs[i].begin(); it != succs[i].end(); ++it)
+        {
+            preds[*it].push_back(i);
+        }
+    }
+
+    for (int i = 0; i < count; i += 1)
+    {
+        // blocks that can be reached from outside are successors of the virtual root
+        if (i == 0 || preds[i].empty())
+        {
+            preds[i].push_back(root);
+            succs[root].push_back(i);
+        }
+    }
+
+    reil_dfs_postorder(succs, root, visited, order);
+
+    for (int i = 0; i < count; i += 1)
+    {
+        if (!visited[i])
+        {
+            // unreachable loop
+            preds[i].push_back(root);
+            succs[root].push_back(i);
+
+            reil_dfs_postorder(succs, i, visited, order);
+        }
+    }
+
+    order.erase(find(order.begin(), order.end(), root));
+    order.push_back(root);
+    reverse(order.begin(), order.end());
+
+    for (int i = 0; i < (int)order.size(); i += 1) num[order[i]] = i;
+
+    idom[root] = root;
+
+    // Cooper, Harvey and Kennedy iterative algorithm
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+
+        for (vector<int>::iterator it = order.begin() + 1; it != order.end(); ++it)
+        {
+            int b = *it, new_idom = -1;
+
+            for (vector<int>::iterator p = preds[b].begin(); p != preds[b].end(); ++p)
+            {
+                int x = *p;
+
+                if (idom[x] == -1) continue;
+
+                for (int y = new_idom; y != -1 && x != y;)
+                {
+                    while (num[x] > num[y]) x = idom[x];
+                    while (num[y] > num[x]) y = idom[y];
+                }
+
+                new_idom = x;
+            }
+
+            if (idom[b] != new_idom)
+            {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    bb_idom.assign(count, -1);
+    bb_pred.assign(count, -1);
+    bb_order.clear();
+
+    for (int i = 0; i < count; i += 1)
+    {
+        if (idom[i] != root) bb_idom[i] = idom[i];
+        if (preds[i].size() == 1 && preds[i][0] != root) bb_pred[i] = preds[i][0];
+
+        children[idom[i]].push_back(i);
+    }
+
+    vector<int> stack(1, root);
+
+    // dominator tree preorder
+    while (stack.size() > 0)
+    {
+        int b = stack.back();
+
+        stack.pop_back();
+
+        if (b != root) bb_order.push_back(b);
+
+        stack.insert(stack.end(), children[b].rbegin(), children[b].rend());
+    }
+}
+
+void CReilOptimizer::build_vars(void)
+{
+    var_map.clear();
+    var_list.clear();
+    reg_list.clear();
+
+    insn_var.resize(insn_count * 3);
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        for (int i = 0; i < 3; i += 1) insn_var[n * 3 + i] = var_get(n, insn_arg(n, i));
+    }
+}
+
+void CReilOptimizer::def_add(int n, int var)
+{
+    reil_opt_def_t def;
+
+    def.insn = n;
+    def.var = var;
+
+    var_defs[var].push_back(def_list.size());
+    def_list.push_back(def);
+}
+
+void CReilOptimizer::live_all_regs(vector<int> &last_def, unsigned long long *in, bool flags)
+{
+    for (vector<int>::iterator reg = reg_list.begin(); reg != reg_list.end(); ++reg)
+    {
+        int var = *reg;
+
+        if (is_flag(var) && !flags) continue;
+
+        if (last_def[var] != -1)
+        {
+            def_live[last_def[var]] += 1;
+            continue;
+        }
+
+        for (vector<int>::iterator it = var_defs[var].begin(); it != var_defs[var].end(); ++it)
+        {
+            if (BIT_GET(in, *it)) def_live[*it] += 1;
+        }
+    }
+}
+
+void CReilOptimizer::build_chains(void)
+{
+    int vars = var_list.size();
+    bool keep_flags = (passes & REIL_PASS_KEEP_FLAGS) != 0;
+
+    def_list.clear();
+    use_list.clear();
+    use_defs.clear();
+
+    var_defs.assign(vars, vector<int>());
+    insn_def.assign(insn_count + 1, 0);
+    insn_use.assign(insn_count + 1, 0);
+
+    // initial values of variables at the function entry
+    for (int var = 0; var < vars; var += 1) def_add(REIL_OPT_DEF_ENTRY, var);
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        int dst = has_dst(n) ? insn_var[n * 3 + 2] : -1;
+
+        insn_def[n] = def_list.size();
+
+        if (is_barrier(n))
+        {
+            // barrier instruction defines all of the registers
+            for (vector<int>::iterator it = reg_list.begin(); it != reg_list.end(); ++it)
+            {
+                def_add(n, *it);
+            }
+        }
+        else if (dst != -1)
+        {
+            def_add(n, dst);
+        }
+    }
+
+    insn_def[insn_count] = def_list.size();
+
+    int defs = def_list.size(), words = BITS_WORDS(defs);
+    vector<unsigned long long> bb_out(bb_list.size() * words, 0);
+    vector<vector<int> > bb_gen(bb_list.size());
+    vector<int> preds(bb_list.size(), 0);
+
+    vector<int> last_def(vars, -1);
+
+    bb_in.assign(bb_list.size() * words, 0);
+    def_words = words;
+
+    for (int i = 0; i < (int)bb_list.size(); i += 1)
+    {
+        reil_opt_bb_t *bb = &bb_list[i];
+        int first = insn_def[bb->first], last = insn_def[bb->last + 1];
+
+        for (int d = first; d < last; d += 1) last_def[def_list[d].var] = d;
+
+        // collect the last definitions of each variable in basic block
+        for (int d = first; d < last; d += 1)
+        {
+            if (last_def[def_list[d].var] == d) bb_gen[i].push_back(d);
+        }
+
+        for (int d = first; d < last; d += 1) last_def[def_list[d].var] = -1;
+
+        for (vector<int>::iterator it = bb->succ.begin(); it != bb->succ.end(); ++it)
+        {
+            preds[*it] += 1;
+        }
+    }
+
+    vector<int> worklist;
+    vector<bool> pending(bb_list.size(), true);
+
+    for (int i = bb_list.size() - 1; i >= 0; i -= 1)
+    {
+        if (i == 0 || preds[i] == 0)
+        {
+            // basic block can be reached from outside
+            for (int var = 0; var < vars; var += 1) BIT_SET(&bb_in[i * words], var);
+        }
+
+        worklist.push_back(i);
+    }
+
+    // solve reaching definitions equations
+    while (worklist.size() > 0)
+    {
+        int i = worklist.back();
+        unsigned long long *in = &bb_in[i * words], *out = &bb_out[i * words];
+        vector<unsigned long long> tmp(in, in + words);
+
+        worklist.pop_back();
+        pending[i] = false;
+
+        for (vector<int>::iterator it = bb_gen[i].begin(); it != bb_gen[i].end(); ++it)
+        {
+            vector<int> &kill = var_defs[def_list[*it].var];
+
+            // kill all of the other definitions of the same variable
+            for (vector<int>::iterator d = kill.begin(); d != kill.end(); ++d) BIT_CLR(&tmp[0], *d);
+
+            BIT_SET(&tmp[0], *it);
+        }
+
+        if (equal(tmp.begin(), tmp.end(), out)) continue;
+
+        copy(tmp.begin(), tmp.end(), out);
+
+        for (vector<int>::iterator it = bb_list[i].succ.begin(); it != bb_list[i].succ.end(); ++it)
+        {
+            unsigned long long *succ_in = &bb_in[*it * words];
+
+            for (int w = 0; w < words; w += 1) succ_in[w] |= out[w];
+
+            if (!pending[*it])
+            {
+                pending[*it] = true;
+                worklist.push_back(*it);
+            }
+        }
+    }
+
+    def_live.assign(defs, 0);
+
+    // build use-def chains
+    for (int i = 0; i < (int)bb_list.size(); i += 1)
+    {
+        reil_opt_bb_t *bb = &bb_list[i];
+        unsigned long long *in = &bb_in[i * words];
+
+        for (int n = bb->first; n <= bb->last; n += 1)
+        {
+            reil_inst_t *insn = &insn_list[n];
+
+            insn_use[n] = use_list.size();
+
+            for (int arg = 0; arg < 3; arg += 1)
+            {
+                reil_opt_use_t use;
+
+                if (arg == 2 && insn->op != I_JCC && insn->op != I_STM) break;
+                if ((use.var = insn_var[n * 3 + arg]) == -1) continue;
+
+                use.insn = n;
+                use.arg = arg;
+                use.defs_first = use_defs.size();
+
+                if (last_def[use.var] != -1)
+                {
+                    // variable was defined in the same basic block
+                    use_defs.push_back(last_def[use.var]);
+                }
+                else
+                {
+                    vector<int> &reach = var_defs[use.var];
+
+                    for (vector<int>::iterator it = reach.begin(); it != reach.end(); ++it)
+                    {
+                        if (BIT_GET(in, *it)) use_defs.push_back(*it);
+                    }
+                }
+
+                use.defs_count = use_defs.size() - use.defs_first;
+                use_list.push_back(use);
+            }
+
+            if (is_barrier(n))
+            {
+                // Assume that called function is not using flags
+                // that was set by the caller.
+                live_all_regs(last_def, in, insn->op == I_UNK || keep_flags);
+            }
+
+            for (int d = insn_def[n]; d < insn_def[n + 1]; d += 1)
+            {
+                last_def[def_list[d].var] = d;
+            }
+        }
+
+        // registers are live at the function exit
+        if (bb->exit) live_all_regs(last_def, in, keep_flags);
+
+        for (int d = insn_def[bb->first]; d < insn_def[bb->last + 1]; d += 1)
+        {
+            last_def[def_list[d].var] = -1;
+        }
+    }
+
+    insn_use[insn_count] = use_list.size();
+
+    def_uses_first.assign(defs + 1, 0);
+    def_uses.assign(use_defs.size(), 0);
+
+    // build def-use chains from use-def chains
+    for (vector<int>::iterator it = use_defs.begin(); it != use_defs.end(); ++it)
+    {
+        def_uses_first[*it + 1] += 1;
+        def_live[*it] += 1;
+    }
+
+    for (int d = 0; d < defs; d += 1) def_uses_first[d + 1] += def_uses_first[d];
+
+    vector<int> pos(def_uses_first.begin(), def_uses_first.end() - 1);
+
+    for (int u = 0; u < (int)use_list.size(); u += 1)
+    {
+        reil_opt_use_t *use = &use_list[u];
+
+        for (int i = use->defs_first; i < use->defs_first + use->defs_count; i += 1)
+        {
+            def_uses[pos[use_defs[i]]++] = u;
+        }
+    }
+}
+
+void CReilOptimizer::analyze(void)
+{
+    build_cfg();
+    build_vars();
+    build_chains();
+}
+
+bool CReilOptimizer::fold_constants(void)
+{
+    vector<int> worklist;
+    vector<bool> pending(insn_count, true);
+    bool changed = false;
+
+    for (int n = insn_count - 1; n >= 0; n -= 1) worklist.push_back(n);
+
+    while (worklist.size() > 0)
+    {
+        int n = worklist.back();
+        reil_inst_t *insn = &insn_list[n];
+        reil_const_t val = 0;
+
+        worklist.pop_back();
+        pending[n] = false;
+
+        if (!has_dst(n) || !evaluate(insn, &val)) continue;
+
+        if (insn->op != I_STR || insn->a.size != insn->c.size)
+        {
+            // replace constant expression with it's value
+            insn->op = I_STR;
+            insn->a.type = A_CONST;
+            insn->a.size = insn->c.size;
+            insn->a.val = val;
+            insn->b.type = A_NONE;
+
+            changed = true;
+        }
+
+        int d = insn_def[n];
+
+        for (int i = def_uses_first[d]; i < def_uses_first[d + 1]; i += 1)
+        {
+            reil_opt_use_t *use = &use_list[def_uses[i]];
+            reil_arg_t *arg = insn_arg(use->insn, use->arg);
+
+            // propagate constant only if it's a single reaching definition
+            if (use->defs_count != 1 || !reil_arg_is_var(arg, insn->c.name) ||
+                arg->size != insn->c.size) continue;
+
+            arg->type = A_CONST;
+            arg->val = val;
+            changed = true;
+
+            if (!pending[use->insn])
+            {
+                pending[use->insn] = true;
+                worklist.push_back(use->insn);
+            }
+        }
+    }
+
+    return changed;
+}
+
+bool CReilOptimizer::propagate_copies(void)
+{
+    bool changed = false;
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        reil_inst_t *insn = &insn_list[n];
+
+        // STR var_a, , var_c
+        if (insn->op != I_STR || !has_dst(n) || !IS_VAR(&insn->a) ||
+            insn->a.size != insn->c.size || reil_arg_is_var(&insn->a, insn->c.name)) continue;
+
+        int d = insn_def[n];
+
+        for (int i = def_uses_first[d]; i < def_uses_first[d + 1]; i += 1)
+        {
+            reil_opt_use_t *use = &use_list[def_uses[i]];
+            reil_arg_t *arg = insn_arg(use->insn, use->arg);
+
+            if (use->defs_count != 1 || use->insn <= n || insn_bb[use->insn] != insn_bb[n] ||
+                !reil_arg_is_var(arg, insn->c.name) || arg->size != insn->c.size) continue;
+
+            // temp can't be used outside of it's machine instruction
+            if (insn->a.type == A_TEMP &&
+                insn_list[use->insn].raw_info.addr != insn->raw_info.addr) continue;
+
+            // source value must be the same at the point of use
+            if (is_modified(&insn->a, n + 1, use->insn)) continue;
+
+            arg->type = insn->a.type;
+            strcpy(arg->name, insn->a.name);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+bool CReilOptimizer::coalesce_copies(void)
+{
+    bool changed = false;
+
+    for (int n = 0; n < insn_count; n += 1)
+    {
+        reil_inst_t *insn = &insn_list[n];
+
+        // STR temp, , var
+        if (insn->op != I_STR || !has_dst(n) || insn->a.type != A_TEMP ||
+            insn->a.size != insn->c.size || reil_arg_is_var(&insn->a, insn->c.name)) continue;
+
+        reil_opt_use_t *use = &use_list[insn_use[n]];
+
+        if (use->defs_count != 1) continue;
+
+        int d = use_defs[use->defs_first], p = def_list[d].insn;
+
+        // temp must be set in the same basic block and used only once
+        if (p == REIL_OPT_DEF_ENTRY || p >= n || insn_bb[p] != insn_bb[n] ||
+            is_barrier(p) || def_live[d] != 1) continue;
+
+        reil_inst_t *prev = &insn_list[p];
+
+        if (!reil_arg_is_var(&prev->c, insn->a.name) || prev->c.size != insn->a.size) continue;
+
+        bool touched = false;
+
+        for (int i = p + 1; i < n && !touched; i += 1)
+        {
+            if (is_barrier(i) && insn->c.type == A_REG) touched = true;
+
+            // check that destination is not used or modified between instructions
+            for (int arg = 0; arg < 3; arg += 1)
+            {
+                if (reil_arg_is_var(insn_arg(i, arg), insn->c.name)) touched = true;
+            }
+        }
+
+        if (touched) continue;
+
+        // set value of destination argument directly
+        memcpy(&prev->c, &insn->c, sizeof(reil_arg_t));
+        eliminate(n);
+
+        changed = true;
+    }
+
+    return changed;
+}
+
+int CReilOptimizer::vn_hash(reil_opt_vn_t *entry)
+{
+    unsigned long long ret = entry->op;
+
+    ret = ret * 31 + (unsigned int)entry->a;
+    ret = ret * 31 + (unsigned int)entry->b;
+    ret = ret * 31 + entry->size;
+    ret = ret * 31 + entry->val;
+
+    return (int)((ret ^ (ret >> 29)) & (vn_head.size() - 1));
+}
+
+int CReilOptimizer::vn_find(reil_opt_vn_t *key, int from)
+{
+    for (int i = from; i != -1; i = vn_list[i].next)
+    {
+        reil_opt_vn_t *entry = &vn_list[i];
+
+        if (entry->op == key->op && entry->a == key->a && entry->b == key->b &&
+            entry->size == key->size && entry->val == key->val)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void CReilOptimizer::vn_insert(reil_opt_vn_t *entry)
+{
+    int h = vn_hash(entry);
+
+    // newer entries are placed at the beginning of the list
+    entry->next = vn_head[h];
+    vn_head[h] = vn_list.size();
+
+    if (vn_key[entry->vn] == -1) vn_key[entry->vn] = vn_list.size();
+
+    vn_list.push_back(*entry);
+}
+
+void CReilOptimizer::vn_pop(int count)
+{
+    // remove entries of the scope that was left
+    while ((int)vn_list.size() > count)
+    {
+        reil_opt_vn_t *entry = &vn_list.back();
+
+        vn_head[vn_hash(entry)] = entry->next;
+
+        if (vn_key[entry->vn] == (int)vn_list.size() - 1) vn_key[entry->vn] = -1;
+
+        vn_list.pop_back();
+    }
+}
+
+int CReilOptimizer::vn_new(void)
+{
+    // expression that defines value is not known yet
+    vn_key.push_back(-1);
+
+    return vn_key.size() - 1;
+}
+
+int CReilOptimizer::vn_def(int d)
+{
+    if (vn_defs[d] == -1)
+    {
+        // values of entry and barrier definitions are unknown
+        vn_defs[d] = vn_new();
+    }
+
+    return vn_defs[d];
+}
+
+int CReilOptimizer::vn_var(int bb, int var)
+{
+    if (vn_local[var] != -1)
+    {
+        // variable was defined in the same basic block
+        return vn_def(vn_local[var]);
+    }
+
+    pair<int, int> key(bb, var);
+    map<pair<int, int>, int>::iterator it = vn_entry.find(key);
+
+    if (it != vn_entry.end()) return it->second;
+
+    unsigned long long *in = &bb_in[bb * def_words];
+    int ret = -1, count = 0;
+
+    for (vector<int>::iterator d = var_defs[var].begin(); d != var_defs[var].end(); ++d)
+    {
+        if (BIT_GET(in, *d))
+        {
+            ret = *d;
+            count += 1;
+        }
+    }
+
+    if (count == 1)
+    {
+        // single reaching definition dominates the basic block
+        ret = vn_def(ret);
+    }
+    else
+    {
+        // merge of different values, like phi function of SSA form
+        ret = vn_new();
+    }
+
+    vn_entry[key] = ret;
+    return ret;
+}
+
+int CReilOptimizer::vn_arg(int n, int bb, int arg)
+{
+    reil_arg_t *src = insn_arg(n, arg);
+
+    if (src->type == A_NONE) return -1;
+    if (src->type != A_CONST) return vn_var(bb, insn_var[n * 3 + arg]);
+
+    reil_opt_vn_t key;
+
+    // constants of the same size and value has the same number
+    key.op = I_NONE;
+    key.a = key.b = -1;
+    key.size = src->size;
+    key.val = src->val & reil_size_mask(src->size);
+
+    int found = vn_find(&key, vn_head[vn_hash(&key)]);
+
+    if (found != -1) return vn_list[found].vn;
+
+    key.vn = vn_new();
+    key.var = key.insn = -1;
+
+    vn_insert(&key);
+    return key.vn;
+}
+
+bool CReilOptimizer::eliminate_subexpressions(void)
+{
+    bool changed = false, local = (passes & REIL_PASS_SUBEXP_LOCAL) != 0;
+    int buckets = 64;
+
+    // basic blocks and hash table sizes of the current scope
+    vector<pair<int, int> > scope;
+
+    // memory state at the end of each basic block
+    vector<int> bb_mem(bb_list.size(), -1);
+
+    while (buckets < insn_count * 2) buckets *= 2;
+
+    vn_head.assign(buckets, -1);
+    vn_list.clear();
+    vn_entry.clear();
+    vn_defs.assign(def_list.size(), -1);
+    vn_local.assign(var_list.size(), -1);
+    vn_key.clear();
+
+    //
+    // Value numbering over the dominator tree: expressions that was
+    // computed in dominating basic blocks are available in the current
+    // one, variables with a single reaching definition has the value
+    // number of this definition.
+    //
+    for (vector<int>::iterator it = bb_order.begin(); it != bb_order.end(); ++it)
+    {
+        int bb = *it, parent = local ? -1 : bb_idom[bb];
+        int mem = -1;
+
+        if (parent != -1 && bb_pred[bb] == parent)
+        {
+            // memory contents is the same as at the end of the dominator
+            mem = bb_mem[parent];
+        }
+        else
+        {
+            mem = vn_new();
+        }
+
+        while (scope.size() > 0 && scope.back().first != parent)
+        {
+            // leave basic blocks that are not dominating the current one
+            vn_pop(scope.back().second);
+            scope.pop_back();
+        }
+
+        scope.push_back(make_pair(bb, (int)vn_list.size()));
+
+        for (int n = bb_list[bb].first; n <= bb_list[bb].last; n += 1)
+        {
+            reil_inst_t *insn = &insn_list[n];
+
+            if (is_barrier(n) || insn->op == I_STM)
+            {
+                // memory contents was changed
+                mem = vn_new();
+            }
+
+            if (!is_barrier(n) && has_dst(n) && vn_defs[insn_def[n]] == -1)
+            {
+                int var = insn_var[n * 3 + 2], vn = -1;
+                reil_opt_vn_t key;
+
+                key.op = insn->op;
+                key.a = vn_arg(n, bb, 0);
+                key.b = vn_arg(n, bb, 1);
+                key.size = insn->c.size;
+                key.val = insn->op == I_LDM ? mem : 0;
+
+                if (reil_op_commutative(insn->op) && key.a > key.b) swap(key.a, key.b);
+
+                if (insn->op == I_STR && insn->a.size == insn->c.size)
+                {
+                    // copy has the same value as it's source
+                    vn = key.a;
+                }
+                else
+                {
+                    int found = vn_find(&key, vn_head[vn_hash(&key)]);
+
+                    if (found != -1) vn = vn_list[found].vn;
+
+                    for (; found != -1; found = vn_find(&key, vn_list[found].next))
+                    {
+                        reil_opt_vn_t *entry = &vn_list[found];
+
+                        // temps are local for machine instruction
+                        if (var_list[entry->var].type == A_TEMP &&
+                            insn_list[entry->insn].raw_info.addr != insn->raw_info.addr) continue;
+
+                        // check that variable still holds the value
+                        if (entry->var == var || vn_var(bb, entry->var) != vn) continue;
+
+                        // use previously calculated value
+                        insn->op = I_STR;
+                        memcpy(&insn->a, &var_list[entry->var], sizeof(reil_arg_t));
+                        memset(&insn->b, 0, sizeof(reil_arg_t));
+                        insn->b.type = A_NONE;
+
+                        changed = true;
+                        break;
+                    }
+                }
+
+                if (vn != -1 && vn_var(bb, var) == vn)
+                {
+                    // variable already has this value
+                    vn_defs[insn_def[n]] = vn;
+                    eliminate(n);
+
+                    changed = true;
+                    continue;
+                }
+
+                if (vn == -1) vn = vn_new();
+
+                if (vn_key[vn] != -1)
+                {
+                    // variable is one more holder of existing value
+                    key = vn_list[vn_key[vn]];
+                }
+
+                if (vn_key[vn] != -1 || insn->op != I_STR || insn->a.size != insn->c.size)
+                {
+                    key.vn = vn;
+                    key.var = var;
+                    key.insn = n;
+
+                    vn_insert(&key);
+                }
+
+                vn_defs[insn_def[n]] = vn;
+            }
+
+            for (int d = insn_def[n]; d < insn_def[n + 1]; d += 1)
+            {
+                vn_local[def_list[d].var] = d;
+            }
+        }
+
+        for (int d = insn_def[bb_list[bb].first]; d < insn_def[bb_list[bb].last + 1]; d += 1)
+        {
+            vn_local[def_list[d].var] = -1;
+        }
+
+        bb_mem[bb] = mem;
+    }
+
+    return changed;
+}
+
+bool CReilOptimizer::eliminate_dead_code(void)
+{
+    vector<int> worklist;
+    bool changed = false;
+
+    for (int n = insn_count - 1; n >= 0; n -= 1)
+    {
+        if (is_removable(n) && def_live[insn_def[n]] == 0) worklist.push_back(n);
+    }
+
+    while (worklist.size() > 0)
+    {
+        int n = worklist.back();
+
+        worklist.pop_back();
+
+        if (insn_list[n].flags & IOPT_ELIMINATED) continue;
+
+        for (int u = insn_use[n]; u < insn_use[n + 1]; u += 1)
+        {
+            reil_opt_use_t *use = &use_list[u];
+
+            for (int i = use->defs_first; i < use->defs_first + use->defs_count; i += 1)
+            {
+                int d = use_defs[i], p = def_list[d].insn;
+
+                // check if instruction that sets used value is dead now
+                if ((def_live[d] -= 1) == 0 && p != REIL_OPT_DEF_ENTRY && is_removable(p))
+                {
+                    worklist.push_back(p);
+                }
+            }
+        }
+
+        eliminate(n);
+        changed = true;
+    }
+
+    return changed;
+}
+
+int CReilOptimizer::compact(void)
+{
+    int count = 0;
+
+    for (int n = 0; n < insn_count;)
+    {
+        reil_addr_t addr = insn_list[n].raw_info.addr;
+        unsigned long long flags = 0;
+        int first = count, end = n;
+
+        // find the end of the machine instruction
+        while (end < insn_count && insn_list[end].raw_info.addr == addr) end += 1;
+
+        for (int i = n; i < end; i += 1)
+        {
+            reil_inst_t *insn = &insn_list[i];
+
+            if (insn->flags & IOPT_ELIMINATED)
+            {
+                // keep basic block end information
+                flags |= insn->flags & IOPT_BB_END;
+                continue;
+            }
+
+            insn_list[count] = *insn;
+            insn_list[count].inum = count - first;
+            insn_list[count].flags &= ~IOPT_ASM_END;
+            count += 1;
+
+            flags = 0;
+        }
+
+        if (count == first)
+        {
+            // For CFG consistence we need to keep I_NONE instruction
+            // if whole machine instruction was eliminated.
+            insn_list[count] = insn_list[n];
+            insn_list[count].inum = 0;
+            insn_list[count].flags = IOPT_ELIMINATED;
+            count += 1;
+        }
+
+        insn_list[count - 1].flags |= IOPT_ASM_END | flags;
+        n = end;
+    }
+
+    return count;
+}
+
+int CReilOptimizer::optimize(void)
+{
+    bool changed = true;
+
+    if (insn_count <= 0) return insn_count;
+
+    for (int i = 0; i < REIL_OPT_MAX_ITER && changed; i += 1)
+    {
+        changed = false;
+
+        if (passes & REIL_PASS_CONST_FOLDING)
+        {
+            analyze();
+            changed |= fold_constants();
+        }
+
+        if (passes & REIL_PASS_COPY_PROP)
+        {
+            analyze();
+            changed |= propagate_copies();
+
+            analyze();
+            changed |= coalesce_copies();
+        }
+
+        if (passes & REIL_PASS_SUBEXP)
+        {
+            analyze();
+            build_dom();
+            changed |= eliminate_subexpressions();
+        }
+
+        if (passes & REIL_PASS_DEAD_CODE)
+        {
+            analyze();
+            changed |= eliminate_dead_code();
+        }
+    }
+
+    return compact();
+}
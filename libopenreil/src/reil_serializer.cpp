@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#ifdef REIL_SERIAL_ZLIB_SUPPORT
+
+// block compression is available only when library is linked with zlib
+#include <zlib.h>
+
+#endif
+
+using namespace std;
+
+// OpenREIL includes
+#include "libopenreil.h"
+#include "reil_serializer.h"
+
+/*
+    Records are written as is, so both reader and writer assume
+    little endian host byte order.
+*/
+static bool reil_serial_read_u32(const string &data, size_t *ptr, unsigned int *val)
+{
+    if (*ptr + sizeof(unsigned int) > data.size())
+    {
+        return false;
+    }
+
+    memcpy(val, data.data() + *ptr, sizeof(unsigned int));
+    *ptr += sizeof(unsigned int);
+
+    return true;
+}
+
+static void reil_serial_write_u32(string &data, unsigned int val)
+{
+    data.append((char *)&val, sizeof(unsigned int));
+}
+//----------------------------------------------------------------------
+CReilSerialWriter::CReilSerialWriter(FILE *fd, unsigned int flags)
+{
+    this->fd = fd;
+    this->flags = flags;
+    this->prev_addr = 0;
+
+#ifndef REIL_SERIAL_ZLIB_SUPPORT
+
+    // store blocks uncompressed
+    this->flags &= ~REIL_SERIAL_ZLIB;
+#endif
+}
+
+CReilSerialWriter::~CReilSerialWriter()
+{
+    flush();
+}
+
+bool CReilSerialWriter::write_header(void)
+{
+    reil_serial_header_t header;
+
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, REIL_SERIAL_MAGIC);
+
+    header.version = REIL_SERIAL_VERSION;
+    header.flags = (unsigned short)flags;
+
+    return fwrite(&header, sizeof(header), 1, fd) == 1;
+}
+
+unsigned int CReilSerialWriter::put_str(const char *data, size_t len)
+{
+    string str(data, len);
+    map<string, unsigned int>::iterator it = strings_index.find(str);
+
+    if (it != strings_index.end())
+    {
+        // string is already in the table of current block
+        return it->second;
+    }
+
+    unsigned int index = strings.size();
+
+    strings.push_back(str);
+    strings_index[str] = index;
+
+    return index;
+}
+
+void CReilSerialWriter::put_arg(reil_serial_arg_t *rec, reil_arg_t *arg)
+{
+    rec->type = (unsigned char)arg->type;
+    rec->size = (unsigned char)arg->size;
+    rec->name = REIL_SERIAL_STR_NONE;
+
+    if (arg->type == A_REG || arg->type == A_TEMP)
+    {
+        rec->name = put_str(arg->name, strnlen(arg->name, REIL_MAX_NAME_LEN));
+    }
+    else if (arg->type == A_CONST)
+    {
+        rec->val = arg->val;
+    }
+}
+
+bool CReilSerialWriter::write(reil_inst_t *inst)
+{
+    reil_serial_rec_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+
+    rec.addr = inst->raw_info.addr - prev_addr;
+    rec.inum = inst->inum;
+    rec.op = (unsigned char)inst->op;
+    rec.size = (unsigned char)inst->raw_info.size;
+    rec.str_mnem = rec.str_op = rec.str_bin = rec.str_ext = REIL_SERIAL_STR_NONE;
+
+    prev_addr = inst->raw_info.addr;
+
+    if (inst->flags != 0)
+    {
+        rec.attr |= REIL_SERIAL_ATTR_FLAGS;
+        rec.flags = (unsigned int)inst->flags;
+    }
+
+    if (inst->inum == 0)
+    {
+        // raw instruction information is saved with the first IR instruction
+        if (inst->raw_info.data != NULL)
+        {
+            rec.attr |= REIL_SERIAL_ATTR_BIN;
+            rec.str_bin = put_str((char *)inst->raw_info.data, inst->raw_info.size);
+        }
+
+        if (inst->raw_info.str_mnem != NULL && inst->raw_info.str_op != NULL)
+        {
+            rec.attr |= REIL_SERIAL_ATTR_ASM;
+            rec.str_mnem = put_str(inst->raw_info.str_mnem, strlen(inst->raw_info.str_mnem));
+            rec.str_op = put_str(inst->raw_info.str_op, strlen(inst->raw_info.str_op));
+        }
+    }
+
+    put_arg(&rec.a, &inst->a);
+    put_arg(&rec.b, &inst->b);
+    put_arg(&rec.c, &inst->c);
+
+    records.push_back(rec);
+
+    if (records.size() >= REIL_SERIAL_BLOCK_SIZE)
+    {
+        return flush();
+    }
+
+    return true;
+}
+
+bool CReilSerialWriter::flush(void)
+{
+    if (records.size() == 0)
+    {
+        return true;
+    }
+
+    reil_serial_block_t block;
+    string raw;
+
+    reil_serial_write_u32(raw, strings.size());
+
+    for (vector<string>::iterator it = strings.begin(); it != strings.end(); ++it)
+    {
+        reil_serial_write_u32(raw, it->size());
+        raw.append(*it);
+    }
+
+    raw.append((char *)&records[0], records.size() * sizeof(reil_serial_rec_t));
+
+    memset(&block, 0, sizeof(block));
+
+    block.count = records.size();
+    block.raw_len = block.data_len = raw.size();
+
+    // next block has it's own string table and addresses base
+    records.clear();
+    strings.clear();
+    strings_index.clear();
+    prev_addr = 0;
+
+#ifdef REIL_SERIAL_ZLIB_SUPPORT
+
+    if (flags & REIL_SERIAL_ZLIB)
+    {
+        uLongf data_len = compressBound(raw.size());
+        vector<Bytef> data(data_len);
+
+        if (compress(&data[0], &data_len, (Bytef *)raw.data(), raw.size()) == Z_OK &&
+            data_len < raw.size())
+        {
+            block.data_len = data_len;
+            block.flags |= REIL_SERIAL_BLOCK_ZLIB;
+
+            return fwrite(&block, sizeof(block), 1, fd) == 1 &&
+                   fwrite(&data[0], data_len, 1, fd) == 1;
+        }
+    }
+#endif
+
+    return fwrite(&block, sizeof(block), 1, fd) == 1 &&
+           fwrite(raw.data(), raw.size(), 1, fd) == 1;
+}
+//----------------------------------------------------------------------
+CReilSerialReader::CReilSerialReader(FILE *fd)
+{
+    this->fd = fd;
+    this->prev_addr = 0;
+    this->current = 0;
+}
+
+CReilSerialReader::~CReilSerialReader()
+{
+
+}
+
+bool CReilSerialReader::read_header(void)
+{
+    reil_serial_header_t header;
+
+    if (fread(&header, sizeof(header), 1, fd) != 1)
+    {
+        return false;
+    }
+
+    if (memcmp(header.magic, REIL_SERIAL_MAGIC, sizeof(REIL_SERIAL_MAGIC)) != 0 ||
+        header.version != REIL_SERIAL_VERSION)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+int CReilSerialReader::read_block(void)
+{
+    reil_serial_block_t block;
+    string raw, data;
+    size_t ptr = 0;
+    unsigned int count = 0;
+
+    records.clear();
+    strings.clear();
+    current = 0;
+    prev_addr = 0;
+
+    size_t len = fread(&block, 1, sizeof(block), fd);
+    if (len == 0 && feof(fd))
+    {
+        // end of the file
+        return 0;
+    }
+
+    if (len != sizeof(block) || block.count == 0)
+    {
+        return REIL_ERROR;
+    }
+
+    data.resize(block.data_len);
+
+    if (block.data_len > 0 && fread(&data[0], block.data_len, 1, fd) != 1)
+    {
+        return REIL_ERROR;
+    }
+
+    if (block.flags & REIL_SERIAL_BLOCK_ZLIB)
+    {
+#ifdef REIL_SERIAL_ZLIB_SUPPORT
+
+        uLongf raw_len = block.raw_len;
+
+        raw.resize(block.raw_len);
+
+        if (uncompress((Bytef *)&raw[0], &raw_len, (Bytef *)data.data(), data.size()) != Z_OK ||
+            raw_len != block.raw_len)
+        {
+            return REIL_ERROR;
+        }
+#else
+        // compressed blocks are not supported
+        return REIL_ERROR;
+#endif
+    }
+    else
+    {
+        if (block.raw_len != block.data_len)
+        {
+            return REIL_ERROR;
+        }
+
+        raw.swap(data);
+    }
+
+    if (!reil_serial_read_u32(raw, &ptr, &count))
+    {
+        return REIL_ERROR;
+    }
+
+    for (unsigned int i = 0; i < count; i += 1)
+    {
+        unsigned int str_len = 0;
+
+        if (!reil_serial_read_u32(raw, &ptr, &str_len) || ptr + str_len > raw.size())
+        {
+            return REIL_ERROR;
+        }
+
+        strings.push_back(raw.substr(ptr, str_len));
+        ptr += str_len;
+    }
+
+    if ((raw.size() - ptr) != (size_t)block.count * sizeof(reil_serial_rec_t))
+    {
+        return REIL_ERROR;
+    }
+
+    records.resize(block.count);
+    memcpy(&records[0], raw.data() + ptr, block.count * sizeof(reil_serial_rec_t));
+
+    return 1;
+}
+
+bool CReilSerialReader::get_str(unsigned int index, const char **data, size_t *len)
+{
+    if (index >= strings.size())
+    {
+        return false;
+    }
+
+    *data = strings[index].c_str();
+    *len = strings[index].size();
+
+    return true;
+}
+
+bool CReilSerialReader::get_arg(reil_arg_t *arg, reil_serial_arg_t *rec)
+{
+    const char *name = NULL;
+    size_t len = 0;
+
+    memset(arg, 0, sizeof(reil_arg_t));
+
+    if (rec->type > A_CONST || rec->size > U64)
+    {
+        return false;
+    }
+
+    arg->type = (reil_type_t)rec->type;
+    arg->size = (reil_size_t)rec->size;
+
+    if (arg->type == A_REG || arg->type == A_TEMP)
+    {
+        if (!get_str(rec->name, &name, &len) || len >= REIL_MAX_NAME_LEN)
+        {
+            return false;
+        }
+
+        memcpy(arg->name, name, len);
+    }
+    else if (arg->type == A_CONST)
+    {
+        arg->val = rec->val;
+    }
+
+    return true;
+}
+
+int CReilSerialReader::read(reil_inst_t *inst)
+{
+    if (current >= records.size())
+    {
+        int ret = read_block();
+        if (ret != 1)
+        {
+            return ret;
+        }
+    }
+
+    reil_serial_rec_t *rec = &records[current];
+    const char *data = NULL;
+    size_t len = 0;
+
+    memset(inst, 0, sizeof(reil_inst_t));
+
+    if (rec->op > I_LE)
+    {
+        return REIL_ERROR;
+    }
+
+    inst->raw_info.addr = prev_addr + rec->addr;
+    inst->raw_info.size = rec->size;
+    inst->inum = rec->inum;
+    inst->op = (reil_op_t)rec->op;
+
+    if (rec->attr & REIL_SERIAL_ATTR_FLAGS)
+    {
+        inst->flags = rec->flags;
+    }
+
+    if (rec->attr & REIL_SERIAL_ATTR_BIN)
+    {
+        if (!get_str(rec->str_bin, &data, &len) || len != rec->size)
+        {
+            return REIL_ERROR;
+        }
+
+        inst->raw_info.data = (unsigned char *)data;
+    }
+
+    if (rec->attr & REIL_SERIAL_ATTR_ASM)
+    {
+        if (!get_str(rec->str_mnem, &data, &len))
+        {
+            return REIL_ERROR;
+        }
+
+        inst->raw_info.str_mnem = (char *)data;
+
+        if (!get_str(rec->str_op, &data, &len))
+        {
+            return REIL_ERROR;
+        }
+
+        inst->raw_info.str_op = (char *)data;
+    }
+
+    if (!get_arg(&inst->a, &rec->a) ||
+        !get_arg(&inst->b, &rec->b) ||
+        !get_arg(&inst->c, &rec->c))
+    {
+        return REIL_ERROR;
+    }
+
+    prev_addr = inst->raw_info.addr;
+    current += 1;
+
+    return 1;
+}
@@ -37,7 +37,8 @@ const char *reil_inst_name[] =
     "STR", "STM", "LDM", 
     "ADD", "SUB", "NEG", "MUL", "DIV", "MOD", "SMUL", "SDIV", "SMOD", 
     "SHL", "SHR", "AND", "OR", "XOR", "NOT",
-    "EQ", "LT"
+    "EQ", "LT", 
+    "SAR", "ROL", "ROR", "SEXT", "NEQ", "LE"
 };
 
 reil_op_t reil_inst_map_binop[] = 
@@ -49,20 +50,20 @@ reil_op_t reil_inst_map_binop[] =
     /* MOD      */ I_MOD,      
     /* LSHIFT   */ I_SHL,   
     /* RSHIFT   */ I_SHR,  
-    /* ARSHIFT  */ I_NONE,
-    /* LROTATE  */ I_NONE,  
-    /* RROTATE  */ I_NONE,  
+    /* ARSHIFT  */ I_SAR,
+    /* LROTATE  */ I_ROL,  
+    /* RROTATE  */ I_ROR,  
     /* LOGICAND */ I_AND, 
     /* LOGICOR  */ I_OR,
     /* BITAND   */ I_AND,  
     /* BITOR    */ I_OR,       
     /* XOR      */ I_XOR,      
     /* EQ       */ I_EQ,
-    /* NEQ      */ I_NONE,  
+    /* NEQ      */ I_NEQ,  
     /* GT       */ I_NONE,       
     /* LT       */ I_LT,       
     /* GE       */ I_NONE,
-    /* LE       */ I_NONE, 
+    /* LE       */ I_LE, 
     /* SDIVIDE  */ I_SDIV, 
     /* SMOD     */ I_SMOD   
 };
@@ -125,9 +126,10 @@ void Relative::destroy(Constant *expr)
     delete expr;
 }
 
-CReilFromBilTranslator::CReilFromBilTranslator(VexArch arch, reil_inst_handler_t handler, void *context)
+CReilFromBilTranslator::CReilFromBilTranslator(VexArch arch, unsigned int opts, reil_inst_handler_t handler, void *context)
 {
     guest = arch;
+    options = opts;
     inst_handler = handler;
     inst_handler_context = context;
     reset_state(NULL);
@@ -573,6 +575,156 @@ void CReilFromBilTranslator::process_bil_arshift(reil_inst_t *reil_inst)
     free_bil_exp(tmp_6);
 }
 
+void CReilFromBilTranslator::process_bil_rotate(reil_inst_t *reil_inst)
+{
+    reil_inst_t new_inst;
+    reil_size_t size_dst = reil_inst->c.size;
+    reil_op_t op_first = I_SHL, op_second = I_SHR;
+
+    if (reil_inst->op == I_ROR)
+    {
+        // rotate right uses opposite shifts direction
+        op_first = I_SHR;
+        op_second = I_SHL;
+    }
+
+    Exp *tmp_0 = temp_operand(convert_operand_size(reil_inst->b.size), reil_inst->inum);
+
+    // calculate shift size for the bits that was shifted out
+    // SUB digits, shift, tmp_0
+    NEW_INST(I_SUB, reil_inst->inum);
+    new_inst.a.type = A_CONST;
+    new_inst.a.size = reil_inst->b.size;
+    new_inst.a.val = reil_cast_bits(size_dst);
+    COPY_ARG(&new_inst.b, &reil_inst->b);
+    convert_operand(tmp_0, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    Exp *tmp_1 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
+
+    // shift source value
+    // SHL src, shift, tmp_1
+    NEW_INST(op_first, reil_inst->inum);
+    COPY_ARG(&new_inst.a, &reil_inst->a);
+    COPY_ARG(&new_inst.b, &reil_inst->b);
+    convert_operand(tmp_1, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    Exp *tmp_2 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
+
+    // get bits that was shifted out
+    // SHR src, tmp_0, tmp_2
+    NEW_INST(op_second, reil_inst->inum);
+    COPY_ARG(&new_inst.a, &reil_inst->a);
+    convert_operand(tmp_0, &new_inst.b);
+    convert_operand(tmp_2, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    // join both parts of the result
+    // OR tmp_1, tmp_2, dst
+    reil_inst->op = I_OR;
+    convert_operand(tmp_1, &reil_inst->a);
+    convert_operand(tmp_2, &reil_inst->b);
+
+    free_bil_exp(tmp_0);
+    free_bil_exp(tmp_1);
+    free_bil_exp(tmp_2);
+}
+
+void CReilFromBilTranslator::process_bil_sext(reil_inst_t *reil_inst)
+{
+    reil_inst_t new_inst;
+    reil_size_t size_src = reil_inst->a.size;
+    reil_size_t size_dst = reil_inst->c.size;
+
+    Exp *tmp_0 = temp_operand(convert_operand_size(size_src), reil_inst->inum);            
+
+    // get sign bit of the source value
+    // AND src, mask, tmp_0
+    NEW_INST(I_AND, reil_inst->inum);
+    COPY_ARG(&new_inst.a, &reil_inst->a);
+    new_inst.b.type = A_CONST;
+    new_inst.b.size = new_inst.a.size;
+    new_inst.b.val = reil_cast_mask_sign(new_inst.b.size);
+    convert_operand(tmp_0, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    Exp *tmp_1 = temp_operand(REG_1, reil_inst->inum);
+
+    // check if sign bit is zero
+    // EQ tmp_0, 0, tmp_1
+    NEW_INST(I_EQ, reil_inst->inum);
+    convert_operand(tmp_0, &new_inst.a);
+    new_inst.b.type = A_CONST;
+    new_inst.b.size = new_inst.a.size;
+    new_inst.b.val = 0;
+    convert_operand(tmp_1, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    Exp *tmp_2 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
+
+    // extend value size
+    // OR tmp_1, 0, tmp_2
+    NEW_INST(I_OR, reil_inst->inum);
+    convert_operand(tmp_1, &new_inst.a);
+    new_inst.b.type = A_CONST;
+    new_inst.b.size = size_dst;
+    new_inst.b.val = 0;
+    convert_operand(tmp_2, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    Exp *tmp_3 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
+
+    // set all bits if sign bit of source value was set
+    // SUB tmp_2, 1, tmp_3
+    NEW_INST(I_SUB, reil_inst->inum);
+    convert_operand(tmp_2, &new_inst.a);
+    new_inst.b.type = A_CONST;
+    new_inst.b.size = size_dst;
+    new_inst.b.val = 1;
+    convert_operand(tmp_3, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    Exp *tmp_4 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
+
+    // clear lower bits of the result
+    // AND tmp_3, mask, tmp_4
+    NEW_INST(I_AND, reil_inst->inum);
+    convert_operand(tmp_3, &new_inst.a);
+    new_inst.b.type = A_CONST;
+    new_inst.b.size = size_dst;
+    new_inst.b.val = reil_cast_mask(size_dst) & ~reil_cast_mask(size_src);
+    convert_operand(tmp_4, &new_inst.c);
+
+    process_reil_inst(&new_inst);
+    reil_inst->inum += 1;
+
+    // join result with the source value
+    // OR src, tmp_4, dst
+    reil_inst->op = I_OR;
+    convert_operand(tmp_4, &reil_inst->b);
+
+    free_bil_exp(tmp_0);
+    free_bil_exp(tmp_1);
+    free_bil_exp(tmp_2);
+    free_bil_exp(tmp_3);
+    free_bil_exp(tmp_4);
+}
+
 void CReilFromBilTranslator::process_bil_neq(reil_inst_t *reil_inst)
 {
     reil_inst_t new_inst;
@@ -591,8 +743,8 @@ void CReilFromBilTranslator::process_bil_neq(reil_inst_t *reil_inst)
 
     // NOT tmp, c
     reil_inst->op = I_NOT;   
-    convert_operand(tmp, &new_inst.a);
-    convert_operand(NULL, &new_inst.b);
+    convert_operand(tmp, &reil_inst->a);
+    convert_operand(NULL, &reil_inst->b);
 
     free_bil_exp(tmp);
 }
@@ -626,8 +778,8 @@ void CReilFromBilTranslator::process_bil_le(reil_inst_t *reil_inst)
 
     // OR tmp_0, tmp_1, c
     reil_inst->op = I_OR;   
-    convert_operand(tmp_0, &new_inst.a);
-    convert_operand(tmp_1, &new_inst.b);
+    convert_operand(tmp_0, &reil_inst->a);
+    convert_operand(tmp_1, &reil_inst->b);
 
     free_bil_exp(tmp_0);
     free_bil_exp(tmp_1);
@@ -691,91 +843,9 @@ bool CReilFromBilTranslator::process_bil_cast(Exp *exp, reil_inst_t *reil_inst)
     case CAST_SIGNED:
         {
             // cast to signed
-            reil_size_t size_src = reil_inst->a.size;
-            reil_size_t size_dst = reil_inst->c.size;
-
-            reil_assert(size_dst > size_src, "invalid signed cast");
-            
-            Exp *tmp_0 = temp_operand(convert_operand_size(reil_inst->a.size), reil_inst->inum);            
-
-            // get sign bit of the source value
-            // AND src, mask, tmp_0
-            NEW_INST(I_AND, reil_inst->inum);
-            COPY_ARG(&new_inst.a, &reil_inst->a);
-            new_inst.b.type = A_CONST;
-            new_inst.b.size = new_inst.a.size;
-            new_inst.b.val = reil_cast_mask_sign(new_inst.b.size);
-            convert_operand(tmp_0, &new_inst.c);
+            reil_assert(reil_inst->c.size > reil_inst->a.size, "invalid signed cast");
 
-            process_reil_inst(&new_inst);
-            reil_inst->inum += 1;
-
-            Exp *tmp_1 = temp_operand(REG_1, reil_inst->inum);
-
-            // check if sign bit is zero
-            // EQ tmp_0, 0, tmp_1
-            NEW_INST(I_EQ, reil_inst->inum);
-            convert_operand(tmp_0, &new_inst.a);
-            new_inst.b.type = A_CONST;
-            new_inst.b.size = new_inst.a.size;
-            new_inst.b.val = 0;
-            convert_operand(tmp_1, &new_inst.c);
-
-            process_reil_inst(&new_inst);
-            reil_inst->inum += 1;
-
-            Exp *tmp_2 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
-
-            // extend value size
-            // OR tmp_1, 0, tmp_2
-            NEW_INST(I_OR, reil_inst->inum);
-            convert_operand(tmp_1, &new_inst.a);
-            new_inst.b.type = A_CONST;
-            new_inst.b.size = size_dst;
-            new_inst.b.val = 0;
-            convert_operand(tmp_2, &new_inst.c);
-
-            process_reil_inst(&new_inst);
-            reil_inst->inum += 1;
-
-            Exp *tmp_3 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
-
-            // set all bits if sign bit of source value was set
-            // SUB tmp_2, 1, tmp_3
-            NEW_INST(I_SUB, reil_inst->inum);
-            convert_operand(tmp_2, &new_inst.a);
-            new_inst.b.type = A_CONST;
-            new_inst.b.size = size_dst;
-            new_inst.b.val = 1;
-            convert_operand(tmp_3, &new_inst.c);
-
-            process_reil_inst(&new_inst);
-            reil_inst->inum += 1;
-
-            Exp *tmp_4 = temp_operand(convert_operand_size(size_dst), reil_inst->inum);
-
-            // clear lower bits of the result
-            // AND tmp_3, mask, tmp_4
-            NEW_INST(I_AND, reil_inst->inum);
-            convert_operand(tmp_3, &new_inst.a);
-            new_inst.b.type = A_CONST;
-            new_inst.b.size = size_dst;
-            new_inst.b.val = reil_cast_mask(size_dst) & ~reil_cast_mask(size_src);
-            convert_operand(tmp_4, &new_inst.c);
-
-            process_reil_inst(&new_inst);
-            reil_inst->inum += 1;
-
-            // join result with the source value
-            // OR src, tmp_4, dst
-            reil_inst->op = I_OR;
-            convert_operand(tmp_4, &reil_inst->b);
-
-            free_bil_exp(tmp_0);
-            free_bil_exp(tmp_1);
-            free_bil_exp(tmp_2);
-            free_bil_exp(tmp_3);
-            free_bil_exp(tmp_4);
+            reil_inst->op = I_SEXT;
 
             return true;
         }    
@@ -784,6 +854,21 @@ bool CReilFromBilTranslator::process_bil_cast(Exp *exp, reil_inst_t *reil_inst)
     return false;
 }
 
+void CReilFromBilTranslator::lower_ext_inst(reil_inst_t *reil_inst)
+{
+    // replace extended instruction with the equivalent classic REIL code
+    switch (reil_inst->op)
+    {
+    case I_SAR: process_bil_arshift(reil_inst); break;
+    case I_ROL: process_bil_rotate(reil_inst); break;
+    case I_ROR: process_bil_rotate(reil_inst); break;
+    case I_SEXT: process_bil_sext(reil_inst); break;
+    case I_NEQ: process_bil_neq(reil_inst); break;
+    case I_LE: process_bil_le(reil_inst); break;
+    default: break;
+    }
+}
+
 Exp *CReilFromBilTranslator::process_bil_inst(reil_op_t inst, uint64_t inst_flags, Exp *c, Exp *exp)
 {
     reil_inst_t reil_inst;
@@ -838,7 +923,6 @@ Exp *CReilFromBilTranslator::process_bil_inst(reil_op_t inst, uint64_t inst_flag
     }
 
     bool binary_logic = false;
-    bool is_arshift = false, is_neq = false, is_le = false;
     
     // get a and b operands values from expression
     if (exp->exp_type == BINOP)
@@ -854,22 +938,7 @@ Exp *CReilFromBilTranslator::process_bil_inst(reil_op_t inst, uint64_t inst_flag
             binary_logic = true;
         }
 
-        if (binop->binop_type == ARSHIFT)
-        {
-            is_arshift = true;
-        }
-        else if (binop->binop_type == NEQ)
-        {
-            is_neq = true;
-        }
-        else if (binop->binop_type == LE)
-        {
-            is_le = true;
-        }
-        else
-        {
-            reil_assert(reil_inst.op != I_NONE, "invalid binop expression");
-        }        
+        reil_assert(reil_inst.op != I_NONE, "invalid binop expression");
 
         a = binop->lhs;
         b = binop->rhs;
@@ -997,20 +1066,10 @@ Exp *CReilFromBilTranslator::process_bil_inst(reil_op_t inst, uint64_t inst_flag
         }
     }    
 
-    if (is_arshift)
-    {
-        // generate code for BAP ARSHIFT
-        process_bil_arshift(&reil_inst);
-    }
-    else if (is_neq)
-    {
-        // generate code for BAP NEQ
-        process_bil_neq(&reil_inst);
-    }
-    else if (is_le)
+    if (!(options & REIL_OPT_EXT_INSN))
     {
-        // generate code for BAP LE
-        process_bil_le(&reil_inst);   
+        // generate classic REIL code for BAP ARSHIFT, LROTATE, NEQ, etc.
+        lower_ext_inst(&reil_inst);
     }
 
     // add assembled REIL instruction
@@ -1046,6 +1105,210 @@ void CReilFromBilTranslator::check_cjmp_false_target(Exp *target)
     }
 }
 
+int bil_temp_uses(Exp *exp, string &name)
+{
+    if (exp == NULL)
+    {
+        return 0;
+    }
+
+    switch (exp->exp_type)
+    {
+    case TEMP: return ((Temp *)exp)->name == name ? 1 : 0;
+    case BINOP: return bil_temp_uses(((BinOp *)exp)->lhs, name) + bil_temp_uses(((BinOp *)exp)->rhs, name);
+    case UNOP: return bil_temp_uses(((UnOp *)exp)->exp, name);
+    case CAST: return bil_temp_uses(((Cast *)exp)->exp, name);
+    case MEM: return bil_temp_uses(((Mem *)exp)->addr, name);
+    default: return 0;
+    }
+}
+
+int bil_temp_uses(Stmt *s, string &name)
+{
+    switch (s->stmt_type)
+    {
+    case MOVE:
+        {
+            Move *move = (Move *)s;
+            int ret = bil_temp_uses(move->rhs, name);
+
+            if (move->lhs->exp_type == MEM)
+            {
+                // memory write address
+                ret += bil_temp_uses(((Mem *)move->lhs)->addr, name);
+            }
+
+            return ret;
+        }
+
+    case CJMP: return bil_temp_uses(((CJmp *)s)->cond, name) + bil_temp_uses(((CJmp *)s)->t_target, name);
+    case JMP: return bil_temp_uses(((Jmp *)s)->target, name);
+    case EXPSTMT: return bil_temp_uses(((ExpStmt *)s)->exp, name);
+    default: return 0;
+    }
+}
+
+bool bil_temp_def(Stmt *s, string &name)
+{
+    // check if statement sets value of the given variable
+    return s->stmt_type == MOVE && 
+           ((Move *)s)->lhs->exp_type == TEMP && ((Temp *)((Move *)s)->lhs)->name == name;
+}
+
+bool bil_const_shift(Stmt *s, binop_type_t binop_type, Temp **val, const_val_t *count)
+{
+    if (s->stmt_type != MOVE || ((Move *)s)->rhs->exp_type != BINOP)
+    {
+        return false;
+    }
+
+    BinOp *binop = (BinOp *)((Move *)s)->rhs;
+    Exp *rhs = binop->rhs;
+
+    if (binop->binop_type != binop_type || binop->lhs->exp_type != TEMP)
+    {
+        return false;
+    }
+
+    if (rhs->exp_type == CAST && ((Cast *)rhs)->cast_type == CAST_UNSIGNED)
+    {
+        // shift count is usually casted to the shifted value type
+        rhs = ((Cast *)rhs)->exp;
+    }
+
+    if (rhs->exp_type != CONSTANT)
+    {
+        return false;
+    }
+
+    *val = (Temp *)binop->lhs;
+    *count = ((Constant *)rhs)->val;
+
+    return true;
+}
+
+void CReilFromBilTranslator::process_bil_rotates(bap_block_t *block)
+{
+    vector<Stmt *> *stmts = block->bap_ir;
+
+    /*
+        VEX has no rotate operations, so, x86 rotates are looks like:
+
+            T_1 = (T_0 << N);
+            T_2 = (T_0 >> (BITS - N));
+            T_3 = (T_1 | T_2);
+
+        Replace such code with single LROTATE when both of the shifted
+        values are not used anywhere else.
+    */
+    for (size_t i = 0; i < stmts->size(); i++)
+    {
+        Stmt *s = stmts->at(i);
+
+        if (s->stmt_type != MOVE || ((Move *)s)->rhs->exp_type != BINOP)
+        {
+            continue;
+        }
+
+        BinOp *binop = (BinOp *)((Move *)s)->rhs;
+        if (binop->binop_type != BITOR || 
+            binop->lhs->exp_type != TEMP || binop->rhs->exp_type != TEMP)
+        {
+            continue;
+        }
+
+        int def_l = -1, def_r = -1;
+        string name_l = ((Temp *)binop->lhs)->name;
+        string name_r = ((Temp *)binop->rhs)->name;
+
+        // find statements that sets OR operands
+        for (int n = (int)i - 1; n >= 0; n--)
+        {
+            if (def_l == -1 && bil_temp_def(stmts->at(n), name_l)) def_l = n;
+            if (def_r == -1 && bil_temp_def(stmts->at(n), name_r)) def_r = n;
+        }
+
+        if (def_l == -1 || def_r == -1 || def_l == def_r)
+        {
+            continue;
+        }
+
+        Temp *val_shl = NULL, *val_shr = NULL;
+        const_val_t count_shl = 0, count_shr = 0;
+        int def_shl = def_l, def_shr = def_r;
+
+        if (!bil_const_shift(stmts->at(def_shl), LSHIFT, &val_shl, &count_shl))
+        {
+            // operands are in reverse order
+            def_shl = def_r;
+            def_shr = def_l;
+
+            if (!bil_const_shift(stmts->at(def_shl), LSHIFT, &val_shl, &count_shl))
+            {
+                continue;
+            }
+        }
+
+        if (!bil_const_shift(stmts->at(def_shr), RSHIFT, &val_shr, &count_shr))
+        {
+            continue;
+        }
+
+        const_val_t bits = Exp::reg_to_bits(val_shl->typ);
+
+        if (val_shl->name != val_shr->name || 
+            count_shl == 0 || count_shr == 0 || count_shl + count_shr != bits)
+        {
+            continue;
+        }
+
+        bool matched = true;
+        string name_val = val_shl->name;
+
+        for (size_t n = min(def_shl, def_shr) + 1; n < i; n++)
+        {
+            // shifted value must stay the same untill OR
+            if (bil_temp_def(stmts->at(n), name_val))
+            {
+                matched = false;
+                break;
+            }
+        }
+
+        for (size_t n = 0; n < stmts->size() && matched; n++)
+        {
+            // shifted values must be used only by OR
+            if (n != i && (bil_temp_uses(stmts->at(n), name_l) > 0 || 
+                           bil_temp_uses(stmts->at(n), name_r) > 0))
+            {
+                matched = false;
+            }
+        }
+
+        if (!matched)
+        {
+            continue;
+        }
+
+#ifdef DBG_BAP
+
+        printf("// rotate: %s\n", s->tostring().c_str());
+#endif
+        // replace OR with LROTATE
+        Exp *rotate = new BinOp(LROTATE, val_shl->clone(), new Constant(val_shl->typ, count_shl));
+        
+        Exp::destroy(((Move *)s)->rhs);
+        ((Move *)s)->rhs = rotate;
+
+        // remove unused shifts
+        Stmt::destroy(stmts->at(def_shl));
+        Stmt::destroy(stmts->at(def_shr));
+
+        stmts->at(def_shl) = new Comment("folded into rotate");
+        stmts->at(def_shr) = new Comment("folded into rotate");
+    }
+}
+
 void CReilFromBilTranslator::process_bil_stmt(Stmt *s, uint64_t inst_flags)
 {
     switch (s->stmt_type)
@@ -1441,6 +1704,12 @@ void CReilFromBilTranslator::process_bil(reil_raw_t *raw_info, bap_block_t *bloc
 
         goto _end;
     }
+
+    if (options & REIL_OPT_EXT_INSN)
+    {
+        // fold VEX shift sequences into the rotates
+        process_bil_rotates(block);
+    }
     
     for (int i = 0; i < size; i++)
     {
@@ -1503,13 +1772,13 @@ _end:
     return;
 }
 
-CReilTranslator::CReilTranslator(VexArch arch, reil_inst_handler_t handler, void *context)
+CReilTranslator::CReilTranslator(VexArch arch, unsigned int opts, reil_inst_handler_t handler, void *context)
 {
     // initialize libasmir
     translate_init();
 
     guest = arch;
-    translator = new CReilFromBilTranslator(arch, handler, context);
+    translator = new CReilFromBilTranslator(arch, opts, handler, context);
     assert(translator);
 }
 
@@ -0,0 +1,1583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// libasmir includes
+#include "irtoir.h"
+
+using namespace std;
+
+// OpenREIL includes
+#include "libopenreil.h"
+#include "reil_translator.h"
+#include "reil_vm.h"
+#include "reil_vm_jit.h"
+
+static int reil_size_bits(reil_size_t size)
+{
+    switch (size)
+    {
+    case U1: return 1;
+    case U8: return 8;
+    case U16: return 16;
+    case U32: return 32;
+    case U64: return 64;
+    }
+
+    assert(0);
+}
+
+static reil_const_t reil_bits_mask(int bits)
+{
+    return bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+static int64_t reil_bits_sign_extend(reil_const_t val, int bits)
+{
+    val &= reil_bits_mask(bits);
+
+    if (bits < 64 && (val >> (bits - 1)) & 1)
+    {
+        // set higher bits if sign bit is set
+        val |= ~reil_bits_mask(bits);
+    }
+
+    return (int64_t)val;
+}
+
+// mask of taint value bytes for given argument size
+static reil_const_t reil_taint_mask(reil_size_t size)
+{
+    return size == U1 ? 0xff : reil_bits_mask(reil_size_bits(size));
+}
+
+// union of labels of all bytes
+static reil_const_t reil_taint_union(reil_const_t taint)
+{
+    taint |= taint >> 32;
+    taint |= taint >> 16;
+    taint |= taint >> 8;
+
+    return taint & 0xff;
+}
+
+// each byte gets labels of all bytes
+static reil_const_t reil_taint_spread(reil_const_t taint)
+{
+    return reil_taint_union(taint) * 0x0101010101010101ULL;
+}
+
+// each byte gets labels of all lower bytes, like carry propagation does
+static reil_const_t reil_taint_carry(reil_const_t taint)
+{
+    taint |= taint << 8;
+    taint |= taint << 16;
+    taint |= taint << 32;
+
+    return taint;
+}
+
+// mask of non-zero bytes of the value
+static reil_const_t reil_taint_nonzero(reil_const_t val)
+{
+    reil_const_t ret = 0;
+
+    for (int i = 0; i < 64; i += 8)
+    {
+        if ((val >> i) & 0xff) ret |= 0xffULL << i;
+    }
+
+    return ret;
+}
+
+// shift taint by the number of bits, partially shifted bytes taint both destination bytes
+static reil_const_t reil_taint_shift(reil_const_t taint, reil_const_t count, bool left)
+{
+    reil_const_t lo = count / 8, hi = (count + 7) / 8, ret = 0;
+
+    if (lo < 8) ret |= left ? taint << (lo * 8) : taint >> (lo * 8);
+    if (hi < 8) ret |= left ? taint << (hi * 8) : taint >> (hi * 8);
+
+    return ret;
+}
+
+// location of basic block in the coverage map
+static unsigned int reil_cov_loc(reil_addr_t addr)
+{
+    unsigned int h = (unsigned int)addr ^ (unsigned int)(addr >> 32);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/*
+    Python VM evaluates expressions using numpy scalars, 1-bit
+    values are represented as 8-bit integers.
+*/
+static int reil_size_bits_numpy(reil_size_t size)
+{
+    return size == U1 ? 8 : reil_size_bits(size);
+}
+
+CReilVM::CReilVM(
+    reil_arch_t arch, unsigned int opts,
+    reil_vm_code_read_t code_read,
+    reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write,
+    void *context)
+{
+    this->code_read = code_read;
+    this->mem_read = mem_read;
+    this->mem_write = mem_write;
+    this->context = context;
+
+    switch (arch)
+    {
+    case ARCH_X86:
+
+        reg_ip = reg_num("R_EIP");
+        break;
+
+    default:
+
+        reil_assert(false, "unknown architecture");
+    }
+
+    code_buff.resize(REIL_VM_MAX_INSN);
+
+    memset(block_cache, 0, sizeof(block_cache));
+    memset(code_filter, 0, sizeof(code_filter));
+    memset(pages, 0, sizeof(pages));
+    memset(taint_pages, 0, sizeof(taint_pages));
+
+    running = false;
+    jit = NULL;
+
+    taint = (opts & REIL_VM_OPT_TAINT) != 0;
+    taint_handler = NULL;
+
+    coverage = (opts & REIL_VM_OPT_COVERAGE) != 0;
+    memset(&cov, 0, sizeof(cov));
+
+    if (coverage)
+    {
+        coverage_set_map(NULL, REIL_VM_COV_MAP_SIZE);
+    }
+
+    // compiled code doesn't track taint
+    if ((opts & REIL_VM_OPT_JIT) && !taint && CReilVMJit::is_supported())
+    {
+        // compile hot basic blocks to the host code
+        jit = new CReilVMJit(this);
+    }
+
+    // get handlers of predecoded code operations
+    execute(NULL, NULL);
+
+    err_addr = 0;
+    err_inum = 0;
+}
+
+CReilVM::~CReilVM()
+{
+    flush();
+    collect();
+
+    for (int i = 0; i < REIL_VM_DIR_SIZE; i += 1)
+    {
+        if (pages[i])
+        {
+            delete [] pages[i];
+        }
+    }
+
+    if (jit)
+    {
+        delete jit;
+    }
+
+    taint_reset();
+}
+
+int CReilVM::reg_num(const char *name)
+{
+    map<string, int>::iterator it = reg_map.find(name);
+    if (it != reg_map.end())
+    {
+        return it->second;
+    }
+
+    // allocate new register
+    int num = (int)regs.size();
+
+    reg_map[name] = num;
+    reg_names.push_back(name);
+    regs.push_back(0);
+    taint_regs.push_back(0);
+
+    return num;
+}
+
+int CReilVM::reg_count(void)
+{
+    return (int)regs.size();
+}
+
+const char *CReilVM::reg_name(int num)
+{
+    reil_assert(num >= 0 && num < reg_count(), "invalid register number");
+
+    return reg_names[num].c_str();
+}
+
+reil_const_t CReilVM::reg_get(int num)
+{
+    reil_assert(num >= 0 && num < reg_count(), "invalid register number");
+
+    return regs[num];
+}
+
+void CReilVM::reg_set(int num, reil_const_t val)
+{
+    reil_assert(num >= 0 && num < reg_count(), "invalid register number");
+
+    regs[num] = val;
+}
+
+void CReilVM::reset(void)
+{
+    // set all registers to zero
+    fill(regs.begin(), regs.end(), 0);
+}
+
+void CReilVM::flush(void)
+{
+    // delete all of the predecoded basic blocks
+    while (block_map.size() > 0)
+    {
+        block_remove(block_map.begin()->second);
+    }
+
+    if (jit && !running)
+    {
+        // free compiled code
+        jit->reset();
+    }
+}
+
+void CReilVM::invalidate(reil_addr_t addr, int size)
+{
+    reil_addr_t page = addr >> REIL_VM_PAGE_BITS;
+    reil_addr_t page_last = (addr + size - 1) >> REIL_VM_PAGE_BITS;
+
+    for (; page <= page_last; page += 1)
+    {
+        if (code_filter[page % REIL_VM_FILTER_SIZE] == 0)
+        {
+            // there's no predecoded code at this page
+            continue;
+        }
+
+        map<reil_addr_t, vector<reil_vm_block_t *> >::iterator it = code_pages.find(page);
+        if (it == code_pages.end())
+        {
+            continue;
+        }
+
+        // block_remove() modifies pages map
+        vector<reil_vm_block_t *> block_list = it->second;
+
+        for (size_t i = 0; i < block_list.size(); i += 1)
+        {
+            reil_vm_block_t *block = block_list[i];
+
+            if (!block->invalid && block->addr < addr + size && addr < block->end)
+            {
+                // memory range overlaps basic block code
+                block_remove(block);
+            }
+        }
+    }
+}
+
+bool CReilVM::mem_map(reil_addr_t addr, int size, unsigned char *buff, int flags)
+{
+    if ((addr & (REIL_VM_PAGE_SIZE - 1)) != 0 || (size & (REIL_VM_PAGE_SIZE - 1)) != 0 ||
+        addr + size > 0x100000000ULL || size <= 0)
+    {
+        // range must be page aligned and fit into the table
+        return false;
+    }
+
+    for (int offs = 0; offs < size; offs += REIL_VM_PAGE_SIZE)
+    {
+        reil_addr_t page = (addr + offs) >> REIL_VM_PAGE_BITS;
+        reil_vm_page_t **table = &pages[page >> REIL_VM_TABLE_BITS];
+
+        if (*table == NULL)
+        {
+            *table = new reil_vm_page_t[REIL_VM_TABLE_SIZE];
+            memset(*table, 0, sizeof(reil_vm_page_t) * REIL_VM_TABLE_SIZE);
+        }
+
+        reil_vm_page_t *entry = &(*table)[page & (REIL_VM_TABLE_SIZE - 1)];
+
+        entry->read = (flags & REIL_VM_MEM_READ) ? buff + offs : NULL;
+        entry->write = (flags & REIL_VM_MEM_WRITE) ? buff + offs : NULL;
+    }
+
+    return true;
+}
+
+bool CReilVM::mem_unmap(reil_addr_t addr, int size)
+{
+    return mem_map(addr, size, NULL, 0);
+}
+
+bool CReilVM::evaluate(
+    reil_op_t op,
+    reil_size_t a_size, reil_const_t a,
+    reil_size_t b_size, reil_const_t b,
+    reil_const_t *val)
+{
+    int a_bits = reil_size_bits_numpy(a_size), b_bits = reil_size_bits_numpy(b_size);
+    int bits = a_bits > b_bits ? a_bits : b_bits;
+
+    // signed values of arguments
+    int64_t sa = reil_bits_sign_extend(a, a_bits), sb = reil_bits_sign_extend(b, b_bits);
+    int64_t s_min = reil_bits_sign_extend(1ULL << (bits - 1), bits);
+
+    reil_const_t mask = reil_bits_mask(bits), ret = 0;
+    bool is_signed = false;
+
+    switch (op)
+    {
+    case I_STR: ret = a; break;
+    case I_ADD: ret = a + b; break;
+    case I_SUB: ret = a - b; break;
+    case I_NEG: ret = -a; break;
+    case I_MUL: ret = a * b; break;
+    case I_AND: ret = a & b; break;
+    case I_OR:  ret = a | b; break;
+    case I_XOR: ret = a ^ b; break;
+    case I_NOT: ret = ~a; break;
+    case I_EQ:  ret = a == b ? 1 : 0; break;
+    case I_LT:  ret = a < b ? 1 : 0; break;
+    case I_NEQ: ret = a != b ? 1 : 0; break;
+    case I_LE:  ret = a <= b ? 1 : 0; break;
+
+    // numpy returns zero on division by zero
+    case I_DIV: ret = b == 0 ? 0 : a / b; break;
+    case I_MOD: ret = b == 0 ? 0 : a % b; break;
+
+    case I_SHL: ret = b >= (reil_const_t)bits ? 0 : a << b; break;
+    case I_SHR: ret = b >= (reil_const_t)bits ? 0 : a >> b; break;
+
+    case I_SMUL:
+
+        ret = (reil_const_t)sa * (reil_const_t)sb;
+        is_signed = true;
+        break;
+
+    case I_SDIV:
+
+        if (sb == 0)
+        {
+            ret = 0;
+        }
+        else if (sb == -1)
+        {
+            // avoid overflow on minimal value division
+            ret = sa == s_min ? (reil_const_t)sa : (reil_const_t)(-sa);
+        }
+        else
+        {
+            int64_t q = sa / sb;
+
+            // numpy rounds the quotient towards negative infinity
+            if (sa % sb != 0 && (sa < 0) != (sb < 0)) q -= 1;
+
+            ret = (reil_const_t)q;
+        }
+
+        is_signed = true;
+        break;
+
+    case I_SMOD:
+
+        if (sb == 0 || sb == -1)
+        {
+            ret = 0;
+        }
+        else
+        {
+            int64_t r = sa % sb;
+
+            // numpy remainder has the same sign as divisor
+            if (r != 0 && (r < 0) != (sb < 0)) r += sb;
+
+            ret = (reil_const_t)r;
+        }
+
+        is_signed = true;
+        break;
+
+    case I_SAR:
+
+        if ((reil_const_t)sb >= (reil_const_t)bits) ret = sa < 0 ? ~0ULL : 0;
+        else ret = (reil_const_t)(sa >> sb);
+
+        is_signed = true;
+        break;
+
+    case I_SEXT:
+
+        ret = (reil_const_t)sa;
+        bits = a_bits;
+        is_signed = true;
+        break;
+
+    case I_ROL:
+    case I_ROR:
+        {
+            int count = 0;
+
+            // rotate uses the real argument size
+            bits = reil_size_bits(a_size);
+            mask = reil_bits_mask(bits);
+            count = (int)(b % bits);
+
+            if (op == I_ROR) count = (bits - count) % bits;
+
+            ret = count == 0 ? a : (a << count) | ((a & mask) >> (bits - count));
+            break;
+        }
+
+    default:
+
+        // JCC, STM, LDM, UNK and NONE
+        return false;
+    }
+
+    if (is_signed)
+    {
+        // negative values of signed expressions are extended to 64 bits
+        *val = (reil_const_t)reil_bits_sign_extend(ret, bits);
+    }
+    else
+    {
+        *val = ret & mask;
+    }
+
+    return true;
+}
+
+void CReilVM::decode_arg(reil_vm_block_t *block, reil_vm_arg_t *dst, reil_arg_t *src)
+{
+    memset(dst, 0, sizeof(reil_vm_arg_t));
+
+    dst->type = src->type;
+    dst->size = src->size;
+    dst->reg = -1;
+
+    if (src->type == A_NONE)
+    {
+        return;
+    }
+
+    dst->mask = reil_bits_mask(reil_size_bits(src->size));
+
+    if (src->type == A_CONST)
+    {
+        dst->val = src->val & dst->mask;
+        return;
+    }
+
+    dst->reg = reg_num(src->name);
+
+    if (src->type == A_TEMP)
+    {
+        vector<int>::iterator first = block->temp_list.begin() + block->asm_list.back().temp_first;
+
+        if (find(first, block->temp_list.end(), dst->reg) == block->temp_list.end())
+        {
+            // temp register of the current machine instruction
+            block->temp_list.push_back(dst->reg);
+        }
+    }
+}
+
+void CReilVM::decode_insn(reil_vm_block_t *block, reil_vm_insn_t *dst, reil_inst_t *src)
+{
+    bool need_a = true, need_b = true, need_c = true;
+
+    memset(dst, 0, sizeof(reil_vm_insn_t));
+
+    dst->op = src->op;
+    dst->inum = src->inum;
+    dst->asm_num = (int)block->asm_list.size() - 1;
+
+    decode_arg(block, &dst->a, &src->a);
+    decode_arg(block, &dst->b, &src->b);
+    decode_arg(block, &dst->c, &src->c);
+
+    // numpy promotes result to the biggest argument type
+    dst->bits = reil_size_bits_numpy(src->a.size);
+
+    if (src->b.type != A_NONE && reil_size_bits_numpy(src->b.size) > dst->bits)
+    {
+        dst->bits = reil_size_bits_numpy(src->b.size);
+    }
+
+    dst->mask = reil_bits_mask(dst->bits) & dst->c.mask;
+
+    switch (src->op)
+    {
+    case I_NONE: dst->vm_op = VM_NONE; need_a = need_b = need_c = false; break;
+    case I_JCC: dst->vm_op = VM_JCC; need_b = false; break;
+    case I_STM: dst->vm_op = VM_STM; need_b = false; break;
+    case I_LDM: dst->vm_op = VM_LDM; need_b = false; break;
+    case I_STR: dst->vm_op = VM_STR; need_b = false; dst->mask = dst->c.mask; break;
+    case I_NEG: dst->vm_op = VM_NEG; need_b = false; break;
+    case I_NOT: dst->vm_op = VM_NOT; need_b = false; break;
+    case I_ADD: dst->vm_op = VM_ADD; break;
+    case I_SUB: dst->vm_op = VM_SUB; break;
+    case I_MUL: dst->vm_op = VM_MUL; break;
+    case I_SHL: dst->vm_op = VM_SHL; break;
+    case I_SHR: dst->vm_op = VM_SHR; break;
+    case I_AND: dst->vm_op = VM_AND; break;
+    case I_OR:  dst->vm_op = VM_OR; break;
+    case I_XOR: dst->vm_op = VM_XOR; break;
+    case I_EQ:  dst->vm_op = VM_EQ; dst->mask = dst->c.mask; break;
+    case I_LT:  dst->vm_op = VM_LT; dst->mask = dst->c.mask; break;
+    case I_NEQ: dst->vm_op = VM_NEQ; dst->mask = dst->c.mask; break;
+    case I_LE:  dst->vm_op = VM_LE; dst->mask = dst->c.mask; break;
+
+    case I_DIV: case I_MOD:
+    case I_SMUL: case I_SDIV: case I_SMOD:
+    case I_SAR: case I_ROL: case I_ROR:
+
+        dst->vm_op = VM_EVAL;
+        dst->mask = dst->c.mask;
+        break;
+
+    case I_SEXT:
+
+        dst->vm_op = VM_EVAL;
+        dst->mask = dst->c.mask;
+        need_b = false;
+        break;
+
+    default:
+
+        dst->vm_op = VM_INVALID;
+        break;
+    }
+
+    if ((need_a && dst->a.type == A_NONE) || 
+        (need_b && dst->b.type == A_NONE) || (need_c && dst->c.type == A_NONE))
+    {
+        // missing argument
+        dst->vm_op = VM_INVALID;
+    }
+    else if (dst->vm_op != VM_JCC && dst->vm_op != VM_STM && need_c && dst->c.reg == -1)
+    {
+        // result must be stored to register
+        dst->vm_op = VM_INVALID;
+    }
+    else if ((dst->vm_op == VM_STM && dst->a.size == U1) ||
+             (dst->vm_op == VM_LDM && dst->c.size == U1))
+    {
+        // invalid memory access size
+        dst->vm_op = VM_INVALID;
+    }
+
+    dst->handler = handlers == NULL ? NULL : handlers[taint ? VM_TAINT : dst->vm_op];
+}
+
+int CReilVM::read_code(reil_addr_t addr)
+{
+    int count = 0;
+
+    while (true)
+    {
+        // query IR instructions of the machine instruction
+        count = code_read(addr, &code_buff[0], (int)code_buff.size(), context);
+        if (count <= 0)
+        {
+            return REIL_ERROR;
+        }
+
+        if (count <= (int)code_buff.size())
+        {
+            return count;
+        }
+
+        // buffer is too small, try again
+        code_buff.resize(count);
+    }
+}
+
+reil_vm_block_t *CReilVM::decode_block(reil_addr_t addr)
+{
+    reil_vm_block_t *block = new reil_vm_block_t;
+
+    block->addr = block->end = addr;
+    block->invalid = false;
+    block->exec_count = 0;
+    block->jit_code = block->jit_body = NULL;
+
+    for (int n = 0; n < REIL_VM_MAX_BLOCK_LEN; n += 1)
+    {
+        int count = 0;
+        bool stop = false;
+
+        if ((count = read_code(block->end)) == REIL_ERROR)
+        {
+            if (n == 0)
+            {
+                // unable to read first instruction
+                delete block;
+                return NULL;
+            }
+
+            /*
+                Stop at unreadable instruction, execution will
+                fail only when it reaches this address.
+            */
+            break;
+        }
+
+        reil_vm_asm_t info;
+        reil_inst_t *last = &code_buff[count - 1];
+
+        info.addr = block->end;
+        info.next = last->raw_info.addr + last->raw_info.size;
+        info.temp_first = (int)block->temp_list.size();
+        info.temp_count = 0;
+
+        block->asm_list.push_back(info);
+
+        for (int i = 0; i < count; i += 1)
+        {
+            reil_vm_insn_t insn;
+            reil_inst_t *src = &code_buff[i];
+
+            decode_insn(block, &insn, src);
+            block->insn_list.push_back(insn);
+
+            if (src->op == I_JCC && src->a.type == A_CONST && src->a.val != 0)
+            {
+                // unconditional jump
+                stop = true;
+            }
+        }
+
+        block->asm_list.back().temp_count = (int)block->temp_list.size() - info.temp_first;
+
+        // end of the machine instruction
+        reil_vm_insn_t insn;
+
+        memset(&insn, 0, sizeof(insn));
+        insn.vm_op = VM_ASM_END;
+        insn.inum = last->inum;
+        insn.asm_num = (int)block->asm_list.size() - 1;
+        insn.handler = handlers == NULL ? NULL : handlers[taint ? VM_TAINT : VM_ASM_END];
+
+        block->insn_list.push_back(insn);
+        block->end = info.next;
+
+        if (stop || (last->flags & (IOPT_BB_END | IOPT_RET)))
+        {
+            // end of the basic block
+            break;
+        }
+    }
+
+    // hit counters are preserved when block is decoded again
+    block->cov_loc = reil_cov_loc(addr);
+    block->cov_hits = coverage ? &cov_hits[addr] : NULL;
+
+    return block;
+}
+
+void CReilVM::block_add(reil_vm_block_t *block)
+{
+    block_map[block->addr] = block;
+
+    reil_addr_t page = block->addr >> REIL_VM_PAGE_BITS;
+    reil_addr_t page_last = (block->end - 1) >> REIL_VM_PAGE_BITS;
+
+    for (; page <= page_last; page += 1)
+    {
+        // track code pages to detect self-modifying code
+        code_pages[page].push_back(block);
+        code_filter[page % REIL_VM_FILTER_SIZE] += 1;
+    }
+}
+
+void CReilVM::block_remove(reil_vm_block_t *block)
+{
+    block->invalid = true;
+
+    if (jit)
+    {
+        // compiled code must not jump into this block
+        jit->unlink(block);
+    }
+
+    map<reil_addr_t, reil_vm_block_t *>::iterator it = block_map.find(block->addr);
+    if (it != block_map.end() && it->second == block)
+    {
+        block_map.erase(it);
+    }
+
+    if (block_cache[block->addr % REIL_VM_CACHE_SIZE] == block)
+    {
+        block_cache[block->addr % REIL_VM_CACHE_SIZE] = NULL;
+    }
+
+    reil_addr_t page = block->addr >> REIL_VM_PAGE_BITS;
+    reil_addr_t page_last = (block->end - 1) >> REIL_VM_PAGE_BITS;
+
+    for (; page <= page_last; page += 1)
+    {
+        vector<reil_vm_block_t *> &block_list = code_pages[page];
+
+        block_list.erase(remove(block_list.begin(), block_list.end(), block), block_list.end());
+        if (block_list.size() == 0)
+        {
+            code_pages.erase(page);
+        }
+
+        code_filter[page % REIL_VM_FILTER_SIZE] -= 1;
+    }
+
+    // block might be executing right now, delete it later
+    block_garbage.push_back(block);
+
+    if (!running)
+    {
+        collect();
+    }
+}
+
+void CReilVM::collect(void)
+{
+    for (size_t i = 0; i < block_garbage.size(); i += 1)
+    {
+        delete block_garbage[i];
+    }
+
+    block_garbage.clear();
+}
+
+reil_vm_block_t *CReilVM::get_block(reil_addr_t addr)
+{
+    reil_vm_block_t *block = block_cache[addr % REIL_VM_CACHE_SIZE];
+
+    if (block != NULL && block->addr == addr)
+    {
+        return block;
+    }
+
+    map<reil_addr_t, reil_vm_block_t *>::iterator it = block_map.find(addr);
+    if (it != block_map.end())
+    {
+        block = it->second;
+    }
+    else
+    {
+        // decode new basic block
+        if ((block = decode_block(addr)) == NULL)
+        {
+            return NULL;
+        }
+
+        block_add(block);
+    }
+
+    block_cache[addr % REIL_VM_CACHE_SIZE] = block;
+
+    return block;
+}
+
+reil_vm_page_t *CReilVM::mem_page(reil_addr_t addr, int size)
+{
+    if (addr > 0xffffffff || (addr & (REIL_VM_PAGE_SIZE - 1)) + size > REIL_VM_PAGE_SIZE)
+    {
+        // out of the table or crosses pages boundary
+        return NULL;
+    }
+
+    reil_vm_page_t *table = pages[addr >> (REIL_VM_PAGE_BITS + REIL_VM_TABLE_BITS)];
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    return &table[(addr >> REIL_VM_PAGE_BITS) & (REIL_VM_TABLE_SIZE - 1)];
+}
+
+int CReilVM::mem_load(reil_addr_t addr, reil_size_t size, reil_const_t *val)
+{
+    unsigned char buff[sizeof(reil_const_t)];
+    int len = reil_size_bits(size) / 8;
+    reil_vm_page_t *page = mem_page(addr, len);
+
+    if (page && page->read)
+    {
+        // mapped host memory
+        memcpy(buff, page->read + (addr & (REIL_VM_PAGE_SIZE - 1)), len);
+    }
+    else if (mem_read == NULL || mem_read(addr, len, buff, context) == REIL_ERROR)
+    {
+        err_addr = addr;
+        return REIL_VM_ERR_READ;
+    }
+
+    *val = 0;
+
+    // target memory is little endian
+    for (int i = len - 1; i >= 0; i -= 1)
+    {
+        *val = (*val << 8) | buff[i];
+    }
+
+    return 0;
+}
+
+int CReilVM::mem_store(reil_addr_t addr, reil_size_t size, reil_const_t val)
+{
+    unsigned char buff[sizeof(reil_const_t)];
+    int len = reil_size_bits(size) / 8;
+
+    for (int i = 0; i < len; i += 1)
+    {
+        buff[i] = (unsigned char)(val >> (i * 8));
+    }
+
+    reil_vm_page_t *page = mem_page(addr, len);
+
+    if (page && page->write)
+    {
+        // mapped host memory
+        memcpy(page->write + (addr & (REIL_VM_PAGE_SIZE - 1)), buff, len);
+    }
+    else if (mem_write == NULL || mem_write(addr, len, buff, context) == REIL_ERROR)
+    {
+        err_addr = addr;
+        return REIL_VM_ERR_WRITE;
+    }
+
+    if (code_filter[(addr >> REIL_VM_PAGE_BITS) % REIL_VM_FILTER_SIZE] != 0 ||
+        code_filter[((addr + len - 1) >> REIL_VM_PAGE_BITS) % REIL_VM_FILTER_SIZE] != 0)
+    {
+        // self-modifying code
+        invalidate(addr, len);
+    }
+
+    return 0;
+}
+
+#if defined(__GNUC__)
+
+// use labels as values for direct threaded dispatch
+#define VM_THREADED
+
+#endif
+
+#ifdef VM_THREADED
+
+#define VM_HANDLER(_op_) _handler_##_op_:
+#define VM_DISPATCH() goto *insn->handler
+
+#else
+
+#define VM_HANDLER(_op_) case _op_:
+#define VM_DISPATCH() goto _dispatch
+
+#endif
+
+#define VM_NEXT() insn += 1; VM_DISPATCH()
+
+#define ARG_VAL(_arg_) ((_arg_)->type == A_CONST ? (_arg_)->val : regs[(_arg_)->reg] & (_arg_)->mask)
+
+#define RESULT(_insn_, _val_) regs[(_insn_)->c.reg] = (_val_) & (_insn_)->mask
+
+int CReilVM::execute(reil_vm_block_t *block, reil_addr_t *next)
+{
+#ifdef VM_THREADED
+
+    // must be in the same order as reil_vm_op_t members
+    static const void *table[] = 
+    {
+        &&_handler_VM_NONE, &&_handler_VM_JCC, &&_handler_VM_STM, &&_handler_VM_LDM,
+        &&_handler_VM_STR, &&_handler_VM_ADD, &&_handler_VM_SUB, &&_handler_VM_NEG,
+        &&_handler_VM_MUL, &&_handler_VM_SHL, &&_handler_VM_SHR, &&_handler_VM_AND,
+        &&_handler_VM_OR, &&_handler_VM_XOR, &&_handler_VM_NOT, &&_handler_VM_EQ,
+        &&_handler_VM_LT, &&_handler_VM_NEQ, &&_handler_VM_LE, &&_handler_VM_EVAL,
+        &&_handler_VM_ASM_END, &&_handler_VM_INVALID, &&_handler_VM_TAINT
+    };
+
+    if (block == NULL)
+    {
+        // decoder needs handlers addresses
+        handlers = table;
+        return 0;
+    }
+
+#else
+
+    if (block == NULL)
+    {
+        handlers = NULL;
+        return 0;
+    }
+
+#endif
+
+    int ret = 0;
+    reil_const_t val = 0, count = 0;
+    reil_vm_insn_t *insn = &block->insn_list[0];
+    reil_vm_asm_t *info = NULL;
+
+#ifdef VM_THREADED
+
+    VM_DISPATCH();
+
+#else
+
+_dispatch:
+
+    if (taint && (ret = taint_insn(block, insn)) != 0)
+    {
+        goto _err;
+    }
+
+    switch (insn->vm_op)
+    {
+
+#endif
+
+    VM_HANDLER(VM_NONE)
+
+        VM_NEXT();
+
+    VM_HANDLER(VM_JCC)
+
+        if (ARG_VAL(&insn->a) != 0)
+        {
+            // condition was taken
+            *next = ARG_VAL(&insn->c);
+            goto _end;
+        }
+
+        VM_NEXT();
+
+    VM_HANDLER(VM_STM)
+
+        ret = mem_store(ARG_VAL(&insn->c), insn->a.size, ARG_VAL(&insn->a));
+        if (ret != 0) goto _err;
+
+        VM_NEXT();
+
+    VM_HANDLER(VM_LDM)
+
+        ret = mem_load(ARG_VAL(&insn->a), insn->c.size, &val);
+        if (ret != 0) goto _err;
+
+        regs[insn->c.reg] = val;
+        VM_NEXT();
+
+    VM_HANDLER(VM_STR)
+
+        RESULT(insn, ARG_VAL(&insn->a));
+        VM_NEXT();
+
+    VM_HANDLER(VM_ADD)
+
+        RESULT(insn, ARG_VAL(&insn->a) + ARG_VAL(&insn->b));
+        VM_NEXT();
+
+    VM_HANDLER(VM_SUB)
+
+        RESULT(insn, ARG_VAL(&insn->a) - ARG_VAL(&insn->b));
+        VM_NEXT();
+
+    VM_HANDLER(VM_NEG)
+
+        RESULT(insn, -ARG_VAL(&insn->a));
+        VM_NEXT();
+
+    VM_HANDLER(VM_MUL)
+
+        RESULT(insn, ARG_VAL(&insn->a) * ARG_VAL(&insn->b));
+        VM_NEXT();
+
+    VM_HANDLER(VM_SHL)
+
+        count = ARG_VAL(&insn->b);
+        RESULT(insn, count >= (reil_const_t)insn->bits ? 0 : ARG_VAL(&insn->a) << count);
+        VM_NEXT();
+
+    VM_HANDLER(VM_SHR)
+
+        count = ARG_VAL(&insn->b);
+        RESULT(insn, count >= (reil_const_t)insn->bits ? 0 : ARG_VAL(&insn->a) >> count);
+        VM_NEXT();
+
+    VM_HANDLER(VM_AND)
+
+        RESULT(insn, ARG_VAL(&insn->a) & ARG_VAL(&insn->b));
+        VM_NEXT();
+
+    VM_HANDLER(VM_OR)
+
+        RESULT(insn, ARG_VAL(&insn->a) | ARG_VAL(&insn->b));
+        VM_NEXT();
+
+    VM_HANDLER(VM_XOR)
+
+        RESULT(insn, ARG_VAL(&insn->a) ^ ARG_VAL(&insn->b));
+        VM_NEXT();
+
+    VM_HANDLER(VM_NOT)
+
+        RESULT(insn, ~ARG_VAL(&insn->a));
+        VM_NEXT();
+
+    VM_HANDLER(VM_EQ)
+
+        RESULT(insn, ARG_VAL(&insn->a) == ARG_VAL(&insn->b) ? 1 : 0);
+        VM_NEXT();
+
+    VM_HANDLER(VM_LT)
+
+        RESULT(insn, ARG_VAL(&insn->a) < ARG_VAL(&insn->b) ? 1 : 0);
+        VM_NEXT();
+
+    VM_HANDLER(VM_NEQ)
+
+        RESULT(insn, ARG_VAL(&insn->a) != ARG_VAL(&insn->b) ? 1 : 0);
+        VM_NEXT();
+
+    VM_HANDLER(VM_LE)
+
+        RESULT(insn, ARG_VAL(&insn->a) <= ARG_VAL(&insn->b) ? 1 : 0);
+        VM_NEXT();
+
+    VM_HANDLER(VM_EVAL)
+
+        evaluate(insn->op,
+                 insn->a.size, ARG_VAL(&insn->a),
+                 insn->b.type == A_NONE ? insn->a.size : insn->b.size,
+                 insn->b.type == A_NONE ? 0 : ARG_VAL(&insn->b),
+                 &val);
+
+        RESULT(insn, val);
+        VM_NEXT();
+
+    VM_HANDLER(VM_ASM_END)
+
+        info = &block->asm_list[insn->asm_num];
+
+        for (int i = 0; i < info->temp_count; i += 1)
+        {
+            // reset temp registers of the machine instruction
+            regs[block->temp_list[info->temp_first + i]] = 0;
+        }
+
+        regs[reg_ip] = info->next;
+
+        if (block->invalid || insn->asm_num == (int)block->asm_list.size() - 1)
+        {
+            // go to the next machine instruction
+            *next = info->next;
+            return 0;
+        }
+
+        VM_NEXT();
+
+    VM_HANDLER(VM_INVALID)
+
+        ret = REIL_VM_ERR_INSN;
+        goto _err;
+
+#ifdef VM_THREADED
+
+    VM_HANDLER(VM_TAINT)
+
+        // propagate taint before the instruction execution
+        if ((ret = taint_insn(block, insn)) != 0) goto _err;
+
+        goto *handlers[insn->vm_op];
+
+#else
+
+    default:
+
+        ret = REIL_VM_ERR_INSN;
+        goto _err;
+    }
+
+#endif
+
+_end:
+
+    info = &block->asm_list[insn->asm_num];
+
+    for (int i = 0; i < info->temp_count; i += 1)
+    {
+        regs[block->temp_list[info->temp_first + i]] = 0;
+    }
+
+    if (taint)
+    {
+        taint_temp_reset(block, info);
+    }
+
+    return 0;
+
+_err:
+
+    if (ret == REIL_VM_ERR_INSN || ret == REIL_VM_ERR_TAINT)
+    {
+        err_addr = block->asm_list[insn->asm_num].addr;
+    }
+
+    err_inum = insn->inum;
+
+    return ret;
+}
+
+int CReilVM::run(reil_addr_t addr)
+{
+    int ret = 0;
+    reil_vm_block_t *block = NULL;
+
+    running = true;
+
+    // new execution starts from empty edge
+    cov.prev = 0;
+
+    while (true)
+    {
+        if ((block = get_block(addr)) == NULL)
+        {
+            // unable to read code
+            err_addr = addr;
+            err_inum = 0;
+
+            ret = REIL_VM_ERR_CODE;
+            break;
+        }
+
+        if (jit && block->jit_code == NULL && (block->exec_count += 1) >= REIL_VM_JIT_THRESHOLD)
+        {
+            // compile hot basic block, try again later on failure
+            if (!jit->compile(block)) block->exec_count = 0;
+        }
+
+        if (coverage && block->jit_code == NULL)
+        {
+            // compiled code updates coverage by itself
+            cov.map[(block->cov_loc ^ cov.prev) & cov.mask] += 1;
+            cov.prev = block->cov_loc >> 1;
+
+            *block->cov_hits += 1;
+        }
+
+        if (block->jit_code)
+        {
+            // compiled code can execute many basic blocks
+            if ((ret = jit->execute(block, &addr)) != 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            regs[reg_ip] = addr;
+
+            if ((ret = execute(block, &addr)) != 0)
+            {
+                break;
+            }
+        }
+
+        // delete invalidated blocks
+        collect();
+    }
+
+    running = false;
+    collect();
+
+    return ret;
+}
+
+void CReilVM::taint_set_handler(reil_vm_taint_handler_t handler)
+{
+    taint_handler = handler;
+}
+
+void CReilVM::taint_reset(void)
+{
+    fill(taint_regs.begin(), taint_regs.end(), 0);
+
+    for (int i = 0; i < REIL_VM_DIR_SIZE; i += 1)
+    {
+        if (taint_pages[i] == NULL)
+        {
+            continue;
+        }
+
+        for (int n = 0; n < REIL_VM_TABLE_SIZE; n += 1)
+        {
+            if (taint_pages[i][n])
+            {
+                delete [] taint_pages[i][n];
+            }
+        }
+
+        delete [] taint_pages[i];
+        taint_pages[i] = NULL;
+    }
+}
+
+reil_const_t CReilVM::taint_reg_get(int num)
+{
+    reil_assert(num >= 0 && num < reg_count(), "invalid register number");
+
+    return taint_regs[num];
+}
+
+void CReilVM::taint_reg_set(int num, reil_const_t taint)
+{
+    reil_assert(num >= 0 && num < reg_count(), "invalid register number");
+
+    taint_regs[num] = taint;
+}
+
+void CReilVM::taint_mem_get(reil_addr_t addr, int size, unsigned char *labels)
+{
+    for (int i = 0; i < size; i += 1)
+    {
+        unsigned char *byte = taint_byte(addr + i, false);
+
+        labels[i] = byte ? *byte : 0;
+    }
+}
+
+void CReilVM::taint_mem_set(reil_addr_t addr, int size, unsigned char *labels)
+{
+    for (int i = 0; i < size; i += 1)
+    {
+        // shadow memory is allocated only for tainted bytes
+        unsigned char *byte = taint_byte(addr + i, labels[i] != 0);
+
+        if (byte) *byte = labels[i];
+    }
+}
+
+unsigned char *CReilVM::taint_byte(reil_addr_t addr, bool alloc)
+{
+    if (addr > 0xffffffff)
+    {
+        // out of the table
+        return NULL;
+    }
+
+    unsigned char ***table = &taint_pages[addr >> (REIL_VM_PAGE_BITS + REIL_VM_TABLE_BITS)];
+
+    if (*table == NULL)
+    {
+        if (!alloc) return NULL;
+
+        *table = new unsigned char *[REIL_VM_TABLE_SIZE];
+        memset(*table, 0, sizeof(unsigned char *) * REIL_VM_TABLE_SIZE);
+    }
+
+    unsigned char **page = &(*table)[(addr >> REIL_VM_PAGE_BITS) & (REIL_VM_TABLE_SIZE - 1)];
+
+    if (*page == NULL)
+    {
+        if (!alloc) return NULL;
+
+        *page = new unsigned char[REIL_VM_PAGE_SIZE];
+        memset(*page, 0, REIL_VM_PAGE_SIZE);
+    }
+
+    return *page + (addr & (REIL_VM_PAGE_SIZE - 1));
+}
+
+reil_const_t CReilVM::taint_load(reil_addr_t addr, int len)
+{
+    reil_const_t ret = 0;
+
+    for (int i = 0; i < len; i += 1)
+    {
+        unsigned char *byte = taint_byte(addr + i, false);
+
+        if (byte) ret |= (reil_const_t)*byte << (i * 8);
+    }
+
+    return ret;
+}
+
+void CReilVM::taint_store(reil_addr_t addr, int len, reil_const_t taint)
+{
+    for (int i = 0; i < len; i += 1)
+    {
+        unsigned char label = (unsigned char)(taint >> (i * 8));
+        unsigned char *byte = taint_byte(addr + i, label != 0);
+
+        if (byte) *byte = label;
+    }
+}
+
+void CReilVM::taint_temp_reset(reil_vm_block_t *block, reil_vm_asm_t *info)
+{
+    for (int i = 0; i < info->temp_count; i += 1)
+    {
+        taint_regs[block->temp_list[info->temp_first + i]] = 0;
+    }
+}
+
+int CReilVM::taint_report(
+    int kind, reil_vm_block_t *block, reil_vm_insn_t *insn, 
+    reil_const_t val, reil_const_t taint)
+{
+    if (taint_handler == NULL)
+    {
+        return 0;
+    }
+
+    reil_addr_t addr = block->asm_list[insn->asm_num].addr;
+
+    if (taint_handler(kind, addr, insn->inum, val, taint, context) == REIL_ERROR)
+    {
+        // stop before the instruction execution
+        return REIL_VM_ERR_TAINT;
+    }
+
+    return 0;
+}
+
+#define TAINT_VAL(_arg_) ((_arg_)->reg == -1 ? 0 : taint_regs[(_arg_)->reg] & reil_taint_mask((_arg_)->size))
+
+int CReilVM::taint_insn(reil_vm_block_t *block, reil_vm_insn_t *insn)
+{
+    int ret = 0, len = 0;
+    reil_const_t ta = TAINT_VAL(&insn->a), tb = TAINT_VAL(&insn->b), tc = TAINT_VAL(&insn->c);
+    reil_const_t top = 0, taint = 0;
+
+    switch (insn->vm_op)
+    {
+    case VM_NONE:
+    case VM_INVALID:
+
+        return 0;
+
+    case VM_ASM_END:
+
+        taint_temp_reset(block, &block->asm_list[insn->asm_num]);
+        return 0;
+
+    case VM_JCC:
+
+        if (ta | tc)
+        {
+            return taint_report(REIL_VM_TAINT_JCC, block, insn, ARG_VAL(&insn->a), ta | tc);
+        }
+
+        return 0;
+
+    case VM_STM:
+
+        if (tc && (ret = taint_report(REIL_VM_TAINT_STM, block, insn, ARG_VAL(&insn->c), tc)) != 0)
+        {
+            return ret;
+        }
+
+        // stored value taint goes to the shadow memory
+        taint_store(ARG_VAL(&insn->c), reil_size_bits(insn->a.size) / 8, ta);
+        return 0;
+
+    case VM_LDM:
+
+        if (ta && (ret = taint_report(REIL_VM_TAINT_LDM, block, insn, ARG_VAL(&insn->a), ta)) != 0)
+        {
+            return ret;
+        }
+
+        taint = taint_load(ARG_VAL(&insn->a), reil_size_bits(insn->c.size) / 8);
+        break;
+
+    case VM_STR:
+    case VM_OR:
+    case VM_NOT:
+
+        taint = ta | tb;
+        break;
+
+    case VM_AND:
+
+        taint = ta | tb;
+
+        // zero bytes of constant clear taint
+        if (insn->a.type == A_CONST) taint &= reil_taint_nonzero(insn->a.val);
+        if (insn->b.type == A_CONST) taint &= reil_taint_nonzero(insn->b.val);
+        break;
+
+    case VM_XOR:
+    case VM_SUB:
+
+        if (insn->a.reg != -1 && insn->a.reg == insn->b.reg)
+        {
+            // result doesn't depend on the argument value
+            taint = 0;
+            break;
+        }
+
+        taint = insn->vm_op == VM_XOR ? ta | tb : reil_taint_carry(ta | tb);
+        break;
+
+    case VM_ADD:
+    case VM_NEG:
+    case VM_MUL:
+
+        taint = reil_taint_carry(ta | tb);
+        break;
+
+    case VM_SHL:
+    case VM_SHR:
+
+        if (tb)
+        {
+            // tainted shift count
+            taint = reil_taint_spread(ta | tb);
+            break;
+        }
+
+        taint = reil_taint_shift(ta, ARG_VAL(&insn->b), insn->vm_op == VM_SHL);
+        break;
+
+    case VM_EQ:
+    case VM_LT:
+    case VM_NEQ:
+    case VM_LE:
+
+        taint = reil_taint_union(ta | tb);
+        break;
+
+    case VM_EVAL:
+
+        len = insn->a.size == U1 ? 1 : reil_size_bits(insn->a.size) / 8;
+        top = (ta >> ((len - 1) * 8)) & 0xff;
+
+        if (insn->op == I_SEXT)
+        {
+            // sign extension bytes get taint of the sign bit
+            taint = ta | reil_taint_carry(top << ((len - 1) * 8));
+        }
+        else if (insn->op == I_SAR && tb == 0)
+        {
+            taint = reil_taint_shift(ta, ARG_VAL(&insn->b), false);
+
+            // sign bit is copied into the shifted bytes
+            if (top) taint |= reil_taint_spread(top);
+        }
+        else
+        {
+            // DIV, MOD, SMUL, SDIV, SMOD, ROL, ROR and SAR with tainted count
+            taint = reil_taint_spread(ta | tb);
+        }
+
+        break;
+
+    default:
+
+        return 0;
+    }
+
+    taint_regs[insn->c.reg] = taint & reil_taint_mask(insn->c.size);
+
+    return 0;
+}
+
+bool CReilVM::coverage_set_map(unsigned char *buff, int size)
+{
+    if (!coverage || size <= 0 || (size & (size - 1)) != 0)
+    {
+        // size must be a power of two
+        return false;
+    }
+
+    if (buff == NULL)
+    {
+        // use own buffer
+        cov_buff.assign(size, 0);
+        buff = &cov_buff[0];
+    }
+
+    cov.map = buff;
+    cov.mask = (unsigned int)size - 1;
+
+    return true;
+}
+
+unsigned char *CReilVM::coverage_get_map(int *size)
+{
+    if (size)
+    {
+        *size = coverage ? (int)cov.mask + 1 : 0;
+    }
+
+    return cov.map;
+}
+
+int CReilVM::coverage_hits(reil_addr_t *addr, reil_const_t *hits, int max)
+{
+    int count = 0;
+
+    for (map<reil_addr_t, reil_const_t>::iterator it = cov_hits.begin(); it != cov_hits.end(); ++it)
+    {
+        if (count < max)
+        {
+            addr[count] = it->first;
+            hits[count] = it->second;
+        }
+
+        count += 1;
+    }
+
+    return count;
+}
+
+void CReilVM::coverage_reset(void)
+{
+    if (!coverage)
+    {
+        return;
+    }
+
+    memset(cov.map, 0, cov.mask + 1);
+
+    for (map<reil_addr_t, reil_const_t>::iterator it = cov_hits.begin(); it != cov_hits.end(); ++it)
+    {
+        // predecoded blocks are referencing these counters
+        it->second = 0;
+    }
+
+    cov.prev = 0;
+}
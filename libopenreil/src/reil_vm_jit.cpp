@@ -0,0 +1,1056 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+
+// compiler emits SysV x86-64 code into mmap() allocated memory
+#define JIT_SUPPORTED
+
+#include <sys/mman.h>
+
+#endif
+
+// libasmir includes
+#include "irtoir.h"
+
+using namespace std;
+
+// OpenREIL includes
+#include "libopenreil.h"
+#include "reil_translator.h"
+#include "reil_vm.h"
+#include "reil_vm_jit.h"
+
+// host registers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R11 11
+#define R12 12
+#define R13 13
+
+// two-operand instructions opcodes
+#define OP_ADD  0x01
+#define OP_OR   0x09
+#define OP_AND  0x21
+#define OP_SUB  0x29
+#define OP_XOR  0x31
+#define OP_CMP  0x39
+#define OP_TEST 0x85
+
+// conditions codes
+#define CC_B    0x2
+#define CC_AE   0x3
+#define CC_E    0x4
+#define CC_NE   0x5
+#define CC_BE   0x6
+#define CC_A    0x7
+
+/*
+    Register usage of compiled code:
+
+      RBX - pointer to reil_vm_jit_ctx_t
+      R12 - register file of the VM
+      R13 - table of mapped host memory pages
+
+    Other registers are scratch, compiled basic blocks are sharing
+    the same stack frame so they can jump to each other directly.
+*/
+#define CTX_OFFS(_field_) ((int)offsetof(reil_vm_jit_ctx_t, _field_))
+#define REG_OFFS(_reg_) ((_reg_) * (int)sizeof(reil_const_t))
+
+static int reil_size_len(reil_size_t size)
+{
+    switch (size)
+    {
+    case U8: return 1;
+    case U16: return 2;
+    case U32: return 4;
+    case U64: return 8;
+    default: return 0;
+    }
+}
+
+CReilVMJit::CReilVMJit(CReilVM *vm)
+{
+    this->vm = vm;
+
+    memset(&ctx, 0, sizeof(ctx));
+
+    exit = NULL;
+    cache_reg = -1;
+    cache_mask = 0;
+    chunk_used = 0;
+}
+
+CReilVMJit::~CReilVMJit()
+{
+    reset();
+}
+
+bool CReilVMJit::is_supported(void)
+{
+#ifdef JIT_SUPPORTED
+
+    return true;
+#else
+
+    return false;
+#endif
+}
+
+void CReilVMJit::reset(void)
+{
+#ifdef JIT_SUPPORTED
+
+    for (size_t i = 0; i < chunks.size(); i += 1)
+    {
+        munmap(chunks[i].first, chunks[i].second);
+    }
+
+#endif
+
+    for (size_t i = 0; i < exit_pool.size(); i += 1)
+    {
+        delete exit_pool[i];
+    }
+
+    chunks.clear();
+    exit_pool.clear();
+
+    chunk_used = 0;
+    exit = NULL;
+}
+
+unsigned char *CReilVMJit::alloc(size_t size)
+{
+#ifdef JIT_SUPPORTED
+
+    size = (size + 0xf) & ~(size_t)0xf;
+
+    if (chunks.size() == 0 || chunk_used + size > chunks.back().second)
+    {
+        size_t chunk_size = size > REIL_VM_JIT_CHUNK_SIZE ? size : REIL_VM_JIT_CHUNK_SIZE;
+
+        void *chunk = mmap(
+            NULL, chunk_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+        );
+
+        if (chunk == MAP_FAILED)
+        {
+            return NULL;
+        }
+
+        chunks.push_back(make_pair((unsigned char *)chunk, chunk_size));
+        chunk_used = 0;
+    }
+
+    unsigned char *ptr = chunks.back().first + chunk_used;
+
+    chunk_used += size;
+
+    return ptr;
+#else
+
+    return NULL;
+#endif
+}
+
+void CReilVMJit::emit(unsigned char val)
+{
+    code.push_back(val);
+}
+
+void CReilVMJit::emit_32(unsigned int val)
+{
+    for (int i = 0; i < 4; i += 1)
+    {
+        emit((unsigned char)(val >> (i * 8)));
+    }
+}
+
+void CReilVMJit::emit_64(reil_const_t val)
+{
+    emit_32((unsigned int)val);
+    emit_32((unsigned int)(val >> 32));
+}
+
+void CReilVMJit::emit_rex(bool w, int reg, int index, int base)
+{
+    unsigned char rex = 0x40;
+
+    if (w) rex |= 8;
+    if (reg >= 8) rex |= 4;
+    if (index >= 8) rex |= 2;
+    if (base >= 8) rex |= 1;
+
+    if (rex != 0x40)
+    {
+        emit(rex);
+    }
+}
+
+void CReilVMJit::emit_modrm(int reg, int base, int index, int scale, int disp)
+{
+    // always use 32-bit displacement
+    if (index < 0 && (base & 7) != 4)
+    {
+        emit(0x80 | ((reg & 7) << 3) | (base & 7));
+    }
+    else
+    {
+        int ss = scale == 8 ? 3 : (scale == 4 ? 2 : (scale == 2 ? 1 : 0));
+
+        emit(0x80 | ((reg & 7) << 3) | 4);
+        emit((ss << 6) | (((index < 0 ? 4 : index) & 7) << 3) | (base & 7));
+    }
+
+    emit_32((unsigned int)disp);
+}
+
+void CReilVMJit::emit_mov_imm(int reg, reil_const_t val)
+{
+    if (val <= 0xffffffff)
+    {
+        // mov r32, imm32 zero-extends the value
+        emit_rex(false, 0, -1, reg);
+        emit(0xb8 | (reg & 7));
+        emit_32((unsigned int)val);
+    }
+    else
+    {
+        emit_rex(true, 0, -1, reg);
+        emit(0xb8 | (reg & 7));
+        emit_64(val);
+    }
+}
+
+void CReilVMJit::emit_mov_load(int reg, int base, int disp)
+{
+    emit_rex(true, reg, -1, base);
+    emit(0x8b);
+    emit_modrm(reg, base, -1, 1, disp);
+}
+
+void CReilVMJit::emit_mov_store(int base, int disp, int reg)
+{
+    emit_rex(true, reg, -1, base);
+    emit(0x89);
+    emit_modrm(reg, base, -1, 1, disp);
+}
+
+void CReilVMJit::emit_mov_store_zero(int base, int disp)
+{
+    emit_rex(true, 0, -1, base);
+    emit(0xc7);
+    emit_modrm(0, base, -1, 1, disp);
+    emit_32(0);
+}
+
+void CReilVMJit::emit_alu(int op, int dst, int src)
+{
+    emit_rex(true, src, -1, dst);
+    emit(op);
+    emit(0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void CReilVMJit::emit_mask(int reg, reil_const_t mask)
+{
+    if (mask == ~0ULL)
+    {
+        return;
+    }
+    else if (mask == 0xffffffff)
+    {
+        // mov r32, r32 clears high bits
+        emit_rex(false, reg, -1, reg);
+        emit(0x89);
+        emit(0xc0 | ((reg & 7) << 3) | (reg & 7));
+    }
+    else if (mask < 0x80000000)
+    {
+        // and r64, imm32
+        emit_rex(true, 0, -1, reg);
+        emit(0x81);
+        emit(0xe0 | (reg & 7));
+        emit_32((unsigned int)mask);
+    }
+    else
+    {
+        emit_mov_imm(R11, mask);
+        emit_alu(OP_AND, reg, R11);
+    }
+}
+
+void CReilVMJit::emit_call(const void *func)
+{
+    // mov rax, func ; call rax
+    emit_mov_imm(RAX, (reil_const_t)func);
+    emit(0xff);
+    emit(0xd0);
+}
+
+size_t CReilVMJit::emit_jcc(int cc)
+{
+    emit(0x0f);
+    emit(0x80 | cc);
+    emit_32(0);
+
+    return code.size() - 4;
+}
+
+size_t CReilVMJit::emit_jmp(void)
+{
+    emit(0xe9);
+    emit_32(0);
+
+    return code.size() - 4;
+}
+
+void CReilVMJit::emit_label(size_t fixup)
+{
+    unsigned int rel = (unsigned int)(code.size() - (fixup + 4));
+
+    for (int i = 0; i < 4; i += 1)
+    {
+        code[fixup + i] = (unsigned char)(rel >> (i * 8));
+    }
+}
+
+void CReilVMJit::emit_leave(void)
+{
+    // jump to the epilogue, return value is in EAX
+    leave_fixups.push_back(emit_jmp());
+}
+
+reil_const_t CReilVMJit::emit_arg(int reg, reil_vm_arg_t *arg)
+{
+    // returns mask of bits that might be set in the loaded value
+    if (arg->type == A_CONST)
+    {
+        emit_mov_imm(reg, arg->val);
+
+        if (reg == RAX) cache_reg = -1;
+
+        return arg->val;
+    }
+
+    if (arg->reg == cache_reg)
+    {
+        // value of the register is already in RAX
+        if (reg != RAX)
+        {
+            emit_alu(0x89, reg, RAX);
+        }
+
+        if ((cache_mask & ~arg->mask) == 0)
+        {
+            return cache_mask;
+        }
+    }
+    else
+    {
+        emit_mov_load(reg, R12, REG_OFFS(arg->reg));
+    }
+
+    emit_mask(reg, arg->mask);
+
+    if (reg == RAX) cache_reg = -1;
+
+    return arg->mask;
+}
+
+void CReilVMJit::emit_result(reil_vm_insn_t *insn, reil_const_t bound)
+{
+    if ((bound & ~insn->mask) != 0)
+    {
+        emit_mask(RAX, insn->mask);
+    }
+
+    emit_mov_store(R12, REG_OFFS(insn->c.reg), RAX);
+
+    // next instructions can use the result without loading it
+    cache_reg = insn->c.reg;
+    cache_mask = bound & insn->mask;
+}
+
+void CReilVMJit::emit_page(bool write, int len, vector<size_t> &slow)
+{
+    assert(sizeof(reil_vm_page_t) == 16);
+
+    /*
+        Look up the host page for the guest address in RAX, on success
+        RDX holds host page address and RCX holds offset within the page.
+    */
+
+    // mov rcx, rax ; shr rcx, 32 ; jnz slow
+    emit_alu(0x89, RCX, RAX);
+    emit(0x48); emit(0xc1); emit(0xe9); emit(32);
+    slow.push_back(emit_jcc(CC_NE));
+
+    // mov ecx, eax ; shr ecx, PAGE_BITS + TABLE_BITS
+    emit(0x89); emit(0xc1);
+    emit(0xc1); emit(0xe9); emit(REIL_VM_PAGE_BITS + REIL_VM_TABLE_BITS);
+
+    // mov rdx, [r13 + rcx * 8] ; test rdx, rdx ; jz slow
+    emit_rex(true, RDX, RCX, R13);
+    emit(0x8b);
+    emit_modrm(RDX, R13, RCX, 8, 0);
+    emit_alu(OP_TEST, RDX, RDX);
+    slow.push_back(emit_jcc(CC_E));
+
+    // mov ecx, eax ; shr ecx, PAGE_BITS ; and ecx, TABLE_SIZE - 1 ; shl ecx, 4
+    emit(0x89); emit(0xc1);
+    emit(0xc1); emit(0xe9); emit(REIL_VM_PAGE_BITS);
+    emit(0x81); emit(0xe1); emit_32(REIL_VM_TABLE_SIZE - 1);
+    emit(0xc1); emit(0xe1); emit(4);
+
+    // mov rdx, [rdx + rcx + offset] ; test rdx, rdx ; jz slow
+    emit_rex(true, RDX, RCX, RDX);
+    emit(0x8b);
+    emit_modrm(RDX, RDX, RCX, 1, write ? offsetof(reil_vm_page_t, write) : offsetof(reil_vm_page_t, read));
+    emit_alu(OP_TEST, RDX, RDX);
+    slow.push_back(emit_jcc(CC_E));
+
+    // mov ecx, eax ; and ecx, PAGE_SIZE - 1 ; cmp ecx, PAGE_SIZE - len ; ja slow
+    emit(0x89); emit(0xc1);
+    emit(0x81); emit(0xe1); emit_32(REIL_VM_PAGE_SIZE - 1);
+    emit(0x81); emit(0xf9); emit_32(REIL_VM_PAGE_SIZE - len);
+    slow.push_back(emit_jcc(CC_A));
+}
+
+void CReilVMJit::emit_ldm(reil_vm_insn_t *insn)
+{
+    vector<size_t> slow;
+    size_t done = 0;
+
+    emit_arg(RAX, &insn->a);
+    emit_page(false, reil_size_len(insn->c.size), slow);
+
+    // load value from [rdx + rcx], host and target are little endian
+    switch (insn->c.size)
+    {
+    case U8: emit(0x0f); emit(0xb6); break;
+    case U16: emit(0x0f); emit(0xb7); break;
+    case U32: emit(0x8b); break;
+    case U64: emit(0x48); emit(0x8b); break;
+    default: assert(0);
+    }
+
+    emit_modrm(RAX, RDX, RCX, 1, 0);
+    emit_mov_store(R12, REG_OFFS(insn->c.reg), RAX);
+    done = emit_jmp();
+
+    for (size_t i = 0; i < slow.size(); i += 1)
+    {
+        emit_label(slow[i]);
+    }
+
+    // memory is not mapped, use callback
+    emit_helper((const void *)&helper_load, insn);
+    emit_label(done);
+}
+
+void CReilVMJit::emit_stm(reil_vm_insn_t *insn)
+{
+    vector<size_t> slow;
+    size_t done = 0, clean = 0;
+    int len = reil_size_len(insn->a.size);
+
+    emit_arg(R8, &insn->a);
+    emit_arg(RAX, &insn->c);
+    emit_page(true, len, slow);
+
+    // store value from R8 to [rdx + rcx]
+    switch (insn->a.size)
+    {
+    case U8: emit(0x44); emit(0x88); break;
+    case U16: emit(0x66); emit(0x44); emit(0x89); break;
+    case U32: emit(0x44); emit(0x89); break;
+    case U64: emit(0x4c); emit(0x89); break;
+    default: assert(0);
+    }
+
+    emit_modrm(R8, RDX, RCX, 1, 0);
+
+    // mov ecx, eax ; shr ecx, PAGE_BITS ; and ecx, FILTER_SIZE - 1
+    emit(0x89); emit(0xc1);
+    emit(0xc1); emit(0xe9); emit(REIL_VM_PAGE_BITS);
+    emit(0x81); emit(0xe1); emit_32(REIL_VM_FILTER_SIZE - 1);
+
+    // mov rdx, code_filter ; cmp dword [rdx + rcx * 4], 0 ; je clean
+    emit_mov_imm(RDX, (reil_const_t)vm->code_filter);
+    emit(0x83);
+    emit_modrm(7, RDX, RCX, 4, 0);
+    emit(0);
+    clean = emit_jcc(CC_E);
+
+    // self-modifying code
+    emit_alu(0x89, RSI, RAX);
+    emit_mov_imm(RDI, (reil_const_t)vm);
+    emit_mov_imm(RDX, len);
+    emit_call((const void *)&helper_invalidate);
+    emit_mov_load(R12, RBX, CTX_OFFS(regs));
+
+    emit_label(clean);
+    done = emit_jmp();
+
+    for (size_t i = 0; i < slow.size(); i += 1)
+    {
+        emit_label(slow[i]);
+    }
+
+    // memory is not mapped, use callback
+    emit_helper((const void *)&helper_store, insn);
+    emit_label(done);
+}
+
+void CReilVMJit::emit_helper(const void *func, reil_vm_insn_t *insn)
+{
+    // helper(vm, insn, rax)
+    emit_alu(0x89, RDX, RAX);
+    emit_mov_imm(RDI, (reil_const_t)vm);
+    emit_mov_imm(RSI, (reil_const_t)insn);
+    emit_call(func);
+
+    // register file might be reallocated by callbacks
+    emit_mov_load(R12, RBX, CTX_OFFS(regs));
+
+    // test eax, eax ; jnz epilogue
+    emit(0x85); emit(0xc0);
+    leave_fixups.push_back(emit_jcc(CC_NE));
+}
+
+void CReilVMJit::emit_temps(reil_vm_block_t *block, int asm_num)
+{
+    reil_vm_asm_t *info = &block->asm_list[asm_num];
+
+    for (int i = 0; i < info->temp_count; i += 1)
+    {
+        // reset temp registers of the machine instruction
+        emit_mov_store_zero(R12, REG_OFFS(block->temp_list[info->temp_first + i]));
+    }
+}
+
+void CReilVMJit::emit_coverage(reil_vm_block_t *block)
+{
+    // mov rcx, &vm->cov
+    emit_mov_imm(RCX, (reil_const_t)&vm->cov);
+
+    // mov eax, [rcx + prev] ; xor eax, loc ; and eax, [rcx + mask]
+    emit(0x8b);
+    emit_modrm(RAX, RCX, -1, 1, offsetof(reil_vm_cov_t, prev));
+    emit(0x35);
+    emit_32(block->cov_loc);
+    emit(0x23);
+    emit_modrm(RAX, RCX, -1, 1, offsetof(reil_vm_cov_t, mask));
+
+    // mov rdx, [rcx + map] ; inc byte [rdx + rax]
+    emit_mov_load(RDX, RCX, offsetof(reil_vm_cov_t, map));
+    emit(0xfe);
+    emit_modrm(0, RDX, RAX, 1, 0);
+
+    // mov dword [rcx + prev], loc >> 1
+    emit(0xc7);
+    emit_modrm(0, RCX, -1, 1, offsetof(reil_vm_cov_t, prev));
+    emit_32(block->cov_loc >> 1);
+
+    // mov rax, block->cov_hits ; inc qword [rax]
+    emit_mov_imm(RAX, (reil_const_t)block->cov_hits);
+    emit(0x48); emit(0xff);
+    emit_modrm(0, RAX, -1, 1, 0);
+}
+
+void CReilVMJit::emit_exit(reil_vm_block_t *block, reil_addr_t addr)
+{
+    reil_vm_jit_exit_t *item = new reil_vm_jit_exit_t;
+    size_t slot = 0, stub = 0;
+
+    item->slot = NULL;
+    item->stub = NULL;
+    item->addr = addr;
+    item->block = block;
+    item->target = NULL;
+
+    exit_pool.push_back(item);
+    block->jit_exits.push_back(item);
+
+    // jmp [rip + slot], slot points either to the stub or to the linked block
+    emit(0xff); emit(0x25);
+    emit_32(0);
+    slot = code.size() - 4;
+    stub = code.size();
+
+    // return exit information to the VM
+    emit_mov_imm(RAX, addr);
+    emit_mov_store(RBX, CTX_OFFS(next), RAX);
+    emit_mov_imm(RAX, (reil_const_t)item);
+    emit_mov_store(RBX, CTX_OFFS(exit), RAX);
+
+    // xor eax, eax
+    emit(0x31); emit(0xc0);
+    emit_leave();
+
+    exit_list.push_back(make_pair(item, make_pair(slot, stub)));
+}
+
+bool CReilVMJit::compile(reil_vm_block_t *block)
+{
+    size_t body = 0, epilogue = 0, slots = 0;
+    unsigned char *ptr = NULL;
+
+    if (!is_supported())
+    {
+        return false;
+    }
+
+    code.clear();
+    leave_fixups.clear();
+    exit_list.clear();
+
+    // push rbx ; push r12 ; push r13 ; mov rbx, rdi
+    emit(0x53);
+    emit(0x41); emit(0x54);
+    emit(0x41); emit(0x55);
+    emit_alu(0x89, RBX, RDI);
+
+    // linked basic blocks are jumping here
+    body = code.size();
+
+    emit_mov_load(R12, RBX, CTX_OFFS(regs));
+    emit_mov_load(R13, RBX, CTX_OFFS(pages));
+    emit_mov_imm(RAX, block->addr);
+    emit_mov_store(R12, REG_OFFS(vm->reg_ip), RAX);
+
+    if (vm->coverage)
+    {
+        // linked blocks are not going through the main loop
+        emit_coverage(block);
+    }
+
+    cache_reg = -1;
+
+    for (size_t i = 0; i < block->insn_list.size(); i += 1)
+    {
+        reil_vm_insn_t *insn = &block->insn_list[i];
+        reil_vm_asm_t *info = &block->asm_list[insn->asm_num];
+        reil_const_t bound_a = 0, bound_b = 0;
+        size_t skip = 0, zero = 0, done = 0;
+
+        switch (insn->vm_op)
+        {
+        case VM_NONE:
+
+            break;
+
+        case VM_JCC:
+
+            if (insn->a.type == A_CONST && insn->a.val == 0)
+            {
+                // condition is never taken
+                break;
+            }
+
+            if (insn->a.type != A_CONST)
+            {
+                emit_arg(RAX, &insn->a);
+                emit_alu(OP_TEST, RAX, RAX);
+                skip = emit_jcc(CC_E);
+            }
+
+            if (insn->c.type == A_CONST)
+            {
+                emit_temps(block, insn->asm_num);
+                emit_exit(block, insn->c.val);
+            }
+            else
+            {
+                emit_arg(RAX, &insn->c);
+                emit_temps(block, insn->asm_num);
+                emit_mov_store(RBX, CTX_OFFS(next), RAX);
+                emit_mov_store_zero(RBX, CTX_OFFS(exit));
+
+                // xor eax, eax
+                emit(0x31); emit(0xc0);
+                emit_leave();
+            }
+
+            if (insn->a.type != A_CONST)
+            {
+                emit_label(skip);
+            }
+
+            break;
+
+        case VM_STM:
+
+            emit_stm(insn);
+            break;
+
+        case VM_LDM:
+
+            emit_ldm(insn);
+            break;
+
+        case VM_STR:
+
+            bound_a = emit_arg(RAX, &insn->a);
+            emit_result(insn, bound_a);
+            continue;
+
+        case VM_ADD:
+        case VM_SUB:
+        case VM_AND:
+        case VM_OR:
+        case VM_XOR:
+
+            bound_b = emit_arg(RCX, &insn->b);
+            bound_a = emit_arg(RAX, &insn->a);
+
+            switch (insn->vm_op)
+            {
+            case VM_ADD: emit_alu(OP_ADD, RAX, RCX); bound_a = ~0ULL; break;
+            case VM_SUB: emit_alu(OP_SUB, RAX, RCX); bound_a = ~0ULL; break;
+            case VM_AND: emit_alu(OP_AND, RAX, RCX); bound_a &= bound_b; break;
+            case VM_OR: emit_alu(OP_OR, RAX, RCX); bound_a |= bound_b; break;
+            default: emit_alu(OP_XOR, RAX, RCX); bound_a |= bound_b; break;
+            }
+
+            emit_result(insn, bound_a);
+            continue;
+
+        case VM_MUL:
+
+            emit_arg(RCX, &insn->b);
+            emit_arg(RAX, &insn->a);
+
+            // imul rax, rcx
+            emit(0x48); emit(0x0f); emit(0xaf); emit(0xc1);
+            emit_result(insn, ~0ULL);
+            continue;
+
+        case VM_NEG:
+        case VM_NOT:
+
+            emit_arg(RAX, &insn->a);
+
+            // neg rax or not rax
+            emit(0x48); emit(0xf7); emit(insn->vm_op == VM_NEG ? 0xd8 : 0xd0);
+            emit_result(insn, ~0ULL);
+            continue;
+
+        case VM_SHL:
+        case VM_SHR:
+
+            if (insn->b.type == A_CONST)
+            {
+                bound_a = emit_arg(RAX, &insn->a);
+
+                if (insn->b.val >= (reil_const_t)insn->bits)
+                {
+                    // shift count is too big, xor eax, eax
+                    emit(0x31); emit(0xc0);
+                    bound_a = 0;
+                }
+                else
+                {
+                    // shl rax, imm8 or shr rax, imm8
+                    emit(0x48); emit(0xc1); emit(insn->vm_op == VM_SHL ? 0xe0 : 0xe8);
+                    emit((unsigned char)insn->b.val);
+                }
+            }
+            else
+            {
+                emit_arg(RCX, &insn->b);
+                bound_a = emit_arg(RAX, &insn->a);
+
+                // cmp rcx, bits ; jae zero
+                emit(0x48); emit(0x81); emit(0xf9); emit_32(insn->bits);
+                zero = emit_jcc(CC_AE);
+
+                // shl rax, cl or shr rax, cl
+                emit(0x48); emit(0xd3); emit(insn->vm_op == VM_SHL ? 0xe0 : 0xe8);
+                done = emit_jmp();
+
+                // shift count is too big, xor eax, eax
+                emit_label(zero);
+                emit(0x31); emit(0xc0);
+
+                emit_label(done);
+            }
+
+            // right shift doesn't set new bits
+            emit_result(insn, insn->vm_op == VM_SHR ? bound_a : ~0ULL);
+            continue;
+
+        case VM_EQ:
+        case VM_LT:
+        case VM_NEQ:
+        case VM_LE:
+
+            emit_arg(RCX, &insn->b);
+            emit_arg(RAX, &insn->a);
+            emit_alu(OP_CMP, RAX, RCX);
+
+            // setcc al ; movzx eax, al
+            emit(0x0f);
+
+            switch (insn->vm_op)
+            {
+            case VM_EQ: emit(0x90 | CC_E); break;
+            case VM_LT: emit(0x90 | CC_B); break;
+            case VM_NEQ: emit(0x90 | CC_NE); break;
+            default: emit(0x90 | CC_BE); break;
+            }
+
+            emit(0xc0);
+            emit(0x0f); emit(0xb6); emit(0xc0);
+            emit_result(insn, 1);
+            continue;
+
+        case VM_EVAL:
+
+            emit_helper((const void *)&helper_eval, insn);
+            break;
+
+        case VM_ASM_END:
+
+            emit_temps(block, insn->asm_num);
+            emit_mov_imm(RAX, info->next);
+            emit_mov_store(R12, REG_OFFS(vm->reg_ip), RAX);
+
+            if (insn->asm_num == (int)block->asm_list.size() - 1)
+            {
+                // go to the next basic block
+                emit_exit(block, info->next);
+                break;
+            }
+
+            // mov rax, &block->invalid ; cmp byte [rax], 0 ; je skip
+            emit_mov_imm(RAX, (reil_const_t)&block->invalid);
+            emit(0x80); emit(0x38); emit(0);
+            skip = emit_jcc(CC_E);
+
+            // basic block was modified by its own code
+            emit_mov_imm(RAX, info->next);
+            emit_mov_store(RBX, CTX_OFFS(next), RAX);
+            emit_mov_store_zero(RBX, CTX_OFFS(exit));
+            emit(0x31); emit(0xc0);
+            emit_leave();
+
+            emit_label(skip);
+            break;
+
+        default:
+
+            // mov rax, addr
+            emit_mov_imm(RAX, info->addr);
+            emit_helper((const void *)&helper_invalid, insn);
+            break;
+        }
+
+        // RAX was modified or result wasn't stored from it
+        cache_reg = -1;
+    }
+
+    // pop r13 ; pop r12 ; pop rbx ; ret
+    epilogue = code.size();
+
+    emit(0x41); emit(0x5d);
+    emit(0x41); emit(0x5c);
+    emit(0x5b);
+    emit(0xc3);
+
+    for (size_t i = 0; i < leave_fixups.size(); i += 1)
+    {
+        size_t fixup = leave_fixups[i];
+        unsigned int rel = (unsigned int)(epilogue - (fixup + 4));
+
+        for (int n = 0; n < 4; n += 1)
+        {
+            code[fixup + n] = (unsigned char)(rel >> (n * 8));
+        }
+    }
+
+    // jump slots are placed after the code
+    slots = (code.size() + 7) & ~(size_t)7;
+
+    if ((ptr = alloc(slots + exit_list.size() * sizeof(void *))) == NULL)
+    {
+        block->jit_exits.clear();
+        return false;
+    }
+
+    memcpy(ptr, &code[0], code.size());
+
+    for (size_t i = 0; i < exit_list.size(); i += 1)
+    {
+        reil_vm_jit_exit_t *item = exit_list[i].first;
+        size_t fixup = exit_list[i].second.first;
+
+        item->slot = (const void **)(ptr + slots + i * sizeof(void *));
+        item->stub = ptr + exit_list[i].second.second;
+
+        *item->slot = item->stub;
+
+        // RIP relative address of the slot
+        unsigned int rel = (unsigned int)((unsigned char *)item->slot - (ptr + fixup + 4));
+
+        for (int n = 0; n < 4; n += 1)
+        {
+            ptr[fixup + n] = (unsigned char)(rel >> (n * 8));
+        }
+    }
+
+    block->jit_code = ptr;
+    block->jit_body = ptr + body;
+
+    return true;
+}
+
+int CReilVMJit::execute(reil_vm_block_t *block, reil_addr_t *next)
+{
+    int ret = 0;
+
+    if (exit != NULL && exit->block != NULL && exit->addr == block->addr)
+    {
+        // chain previous block with this one
+        link(exit, block);
+    }
+
+    ctx.regs = &vm->regs[0];
+    ctx.pages = vm->pages;
+    ctx.exit = NULL;
+
+    ret = ((int (*)(reil_vm_jit_ctx_t *))block->jit_code)(&ctx);
+
+    exit = ret == 0 ? ctx.exit : NULL;
+    *next = ctx.next;
+
+    return ret;
+}
+
+void CReilVMJit::link(reil_vm_jit_exit_t *exit, reil_vm_block_t *target)
+{
+    if (exit->target != NULL)
+    {
+        return;
+    }
+
+    *exit->slot = target->jit_body;
+
+    exit->target = target;
+    target->jit_links.push_back(exit);
+}
+
+void CReilVMJit::unlink(reil_vm_block_t *block)
+{
+    for (size_t i = 0; i < block->jit_links.size(); i += 1)
+    {
+        reil_vm_jit_exit_t *exit = block->jit_links[i];
+
+        // other blocks must return to the VM instead of jumping here
+        *exit->slot = exit->stub;
+        exit->target = NULL;
+    }
+
+    for (size_t i = 0; i < block->jit_exits.size(); i += 1)
+    {
+        reil_vm_jit_exit_t *exit = block->jit_exits[i];
+
+        if (exit->target != NULL && exit->target != block)
+        {
+            vector<reil_vm_jit_exit_t *> &links = exit->target->jit_links;
+
+            links.erase(remove(links.begin(), links.end(), exit), links.end());
+        }
+
+        // block might be executing right now, it must return to the VM
+        *exit->slot = exit->stub;
+        exit->target = NULL;
+        exit->block = NULL;
+    }
+
+    block->jit_links.clear();
+    block->jit_exits.clear();
+}
+
+reil_const_t CReilVMJit::arg_val(CReilVM *vm, reil_vm_arg_t *arg)
+{
+    return arg->type == A_CONST ? arg->val : vm->regs[arg->reg] & arg->mask;
+}
+
+int CReilVMJit::helper_load(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr)
+{
+    reil_const_t val = 0;
+    int ret = vm->mem_load(addr, insn->c.size, &val);
+
+    vm->jit->ctx.regs = &vm->regs[0];
+
+    if (ret != 0)
+    {
+        vm->err_inum = insn->inum;
+        return ret;
+    }
+
+    vm->regs[insn->c.reg] = val;
+
+    return 0;
+}
+
+int CReilVMJit::helper_store(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr)
+{
+    int ret = vm->mem_store(addr, insn->a.size, arg_val(vm, &insn->a));
+
+    vm->jit->ctx.regs = &vm->regs[0];
+
+    if (ret != 0)
+    {
+        vm->err_inum = insn->inum;
+        return ret;
+    }
+
+    return 0;
+}
+
+int CReilVMJit::helper_eval(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t /* addr */)
+{
+    reil_const_t val = 0;
+
+    CReilVM::evaluate(insn->op,
+                      insn->a.size, arg_val(vm, &insn->a),
+                      insn->b.type == A_NONE ? insn->a.size : insn->b.size,
+                      insn->b.type == A_NONE ? 0 : arg_val(vm, &insn->b),
+                      &val);
+
+    vm->regs[insn->c.reg] = val & insn->mask;
+
+    return 0;
+}
+
+int CReilVMJit::helper_invalid(CReilVM *vm, reil_vm_insn_t *insn, reil_addr_t addr)
+{
+    vm->err_addr = addr;
+    vm->err_inum = insn->inum;
+
+    return REIL_VM_ERR_INSN;
+}
+
+int CReilVMJit::helper_invalidate(CReilVM *vm, reil_addr_t addr, int size)
+{
+    vm->invalidate(addr, size);
+
+    return 0;
+}
@@ -14,13 +14,39 @@ IOPT_BB_END     = 0x00000004
 IOPT_ASM_END    = 0x00000008
 IOPT_ELIMINATED = 0x00000010
 
+# translator options
+REIL_OPT_EXT_INSN = 0x00000001
+
+# native optimizer passes
+REIL_PASS_CONST_FOLDING = 0x00000001
+REIL_PASS_COPY_PROP     = 0x00000002
+REIL_PASS_SUBEXP        = 0x00000004
+REIL_PASS_DEAD_CODE     = 0x00000008
+REIL_PASS_ALL           = 0x0000000f
+REIL_PASS_KEEP_FLAGS    = 0x00000100
+REIL_PASS_SUBEXP_LOCAL  = 0x00000200
+
+# native interpreter options
+REIL_VM_OPT_JIT = 0x00000001
+REIL_VM_OPT_TAINT = 0x00000002
+REIL_VM_OPT_COVERAGE = 0x00000004
+
+# default size of the native interpreter edge coverage map
+REIL_VM_COV_MAP_SIZE = 0x10000
+
+# kinds of tainted values reported by native interpreter
+REIL_VM_TAINT_JCC = 1
+REIL_VM_TAINT_LDM = 2
+REIL_VM_TAINT_STM = 3
+
 MAX_INST_LEN = 30
 
 REIL_NAMES_INSN = [ 'NONE', 'UNK',  'JCC', 
                     'STR',  'STM',  'LDM', 
                     'ADD',  'SUB',  'NEG', 'MUL', 'DIV', 'MOD', 'SMUL', 'SDIV', 'SMOD', 
                     'SHL',  'SHR',  'AND', 'OR',  'XOR', 'NOT',
-                    'EQ',   'LT' ]
+                    'EQ',   'LT',
+                    'SAR',  'ROL',  'ROR', 'SEXT', 'NEQ', 'LE' ]
 
 REIL_NAMES_SIZE = [ '1', '8', '16', '32', '64' ]
 
@@ -43,6 +69,9 @@ create_globals(REIL_NAMES_INSN, 'REIL_INSN', 'I_')
 create_globals(REIL_NAMES_SIZE, 'REIL_SIZE', 'U')
 create_globals(REIL_NAMES_ARG, 'REIL_ARG', 'A_')
 
+# extended instructions that can be lowered to the classic REIL
+REIL_INSN_EXT = [ I_SAR, I_ROL, I_ROR, I_SEXT, I_NEQ, I_LE ]
+
 
 ARG_TYPE = 0
 ARG_SIZE = 1
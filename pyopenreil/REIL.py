@@ -1,4 +1,4 @@
-import json, base64, unittest, copy
+import os, json, base64, struct, marshal, mmap, zlib, bisect, unittest, copy
 from abc import ABCMeta, abstractmethod
 from sets import Set
 
@@ -504,6 +504,77 @@ class Insn(object):
 
         self.set_flag(IOPT_ELIMINATED)   
 
+    def lower(self, temp):
+
+        if not self.op in REIL_INSN_EXT: 
+
+            # classic REIL instruction
+            return [ self.clone() ]
+
+        ret = []
+        bits = lambda size: { U1: 1, U8: 8, U16: 16, U32: 32, U64: 64 }[size]
+        mask = lambda size: (1L << bits(size)) - 1
+        const = lambda size, val: Arg(A_CONST, size, val = val)
+
+        def insn(op, a, b, c):
+
+            ret.append(Insn(op = op, size = self.size, ir_addr = self.ir_addr(), 
+                            a = a, b = b, c = c))
+            return c
+
+        if self.op == I_SAR:
+
+            # fill higher bits of SHR result with the sign bit
+            t0 = insn(I_AND, self.a, const(self.a.size, 1L << (bits(self.a.size) - 1)), temp(self.a.size))
+            t1 = insn(I_EQ, t0, const(self.a.size, 0), temp(U1))
+            t2 = insn(I_OR, t1, const(self.c.size, 0), temp(self.c.size))
+            t3 = insn(I_SUB, t2, const(self.c.size, 1), temp(self.c.size))
+            t4 = insn(I_SUB, const(self.c.size, bits(self.c.size)), self.b, temp(self.c.size))
+            t5 = insn(I_SHL, t3, t4, temp(self.c.size))
+            t6 = insn(I_SHR, self.a, self.b, temp(self.c.size))
+            insn(I_OR, t5, t6, self.c)
+
+        elif self.op in [ I_ROL, I_ROR ]:
+
+            # join shifted value with the bits that was shifted out
+            first, second = ( I_SHL, I_SHR ) if self.op == I_ROL else ( I_SHR, I_SHL )
+
+            t0 = insn(I_SUB, const(self.b.size, bits(self.c.size)), self.b, temp(self.b.size))
+            t1 = insn(first, self.a, self.b, temp(self.c.size))
+            t2 = insn(second, self.a, t0, temp(self.c.size))
+            insn(I_OR, t1, t2, self.c)
+
+        elif self.op == I_SEXT:
+
+            # set higher bits of the result if sign bit is set
+            t0 = insn(I_AND, self.a, const(self.a.size, 1L << (bits(self.a.size) - 1)), temp(self.a.size))
+            t1 = insn(I_EQ, t0, const(self.a.size, 0), temp(U1))
+            t2 = insn(I_OR, t1, const(self.c.size, 0), temp(self.c.size))
+            t3 = insn(I_SUB, t2, const(self.c.size, 1), temp(self.c.size))
+            t4 = insn(I_AND, t3, const(self.c.size, mask(self.c.size) & ~mask(self.a.size)), 
+                      temp(self.c.size))
+            insn(I_OR, self.a, t4, self.c)
+
+        elif self.op == I_NEQ:
+
+            t0 = insn(I_EQ, self.a, self.b, temp(self.c.size))
+            insn(I_NOT, t0, Arg(), self.c)
+
+        elif self.op == I_LE:
+
+            t0 = insn(I_EQ, self.a, self.b, temp(self.c.size))
+            t1 = insn(I_LT, self.a, self.b, temp(self.c.size))
+            insn(I_OR, t0, t1, self.c)
+
+        # first instruction keeps information about machine instruction
+        ret[0].attr = self.attr.copy()
+        ret[0].attr[IATTR_FLAGS] = 0
+
+        # last instruction keeps optional REIL flags
+        ret[-1].set_flag(self.get_attr(IATTR_FLAGS))
+
+        return ret
+
 
 class TestInsn(unittest.TestCase):
 
@@ -712,6 +783,299 @@ class TestInsnJson(unittest.TestCase):
         assert js.from_json(self.json_data) == self.test_data
 
 
+class InsnBin(object):
+
+    #
+    # Binary instructions format, see libopenreil/include/reil_serial.h
+    # for description. Instructions are grouped into independently
+    # decodable blocks with fixed width records, own string table for
+    # register names, assembly text and instruction bytes, and optional
+    # zlib compression.
+    #
+    MAGIC = 'REILBIN\0'
+    VERSION = 1
+
+    FLAG_ZLIB = 0x0001
+    BLOCK_ZLIB = 0x0001
+
+    ATTR_ASM    = 0x01
+    ATTR_BIN    = 0x02
+    ATTR_FLAGS  = 0x04
+    ATTR_EXT    = 0x08
+
+    BLOCK_SIZE = 0x1000
+    STR_NONE = 0xffffffff
+
+    HEADER = struct.Struct('<8sHHI')
+    BLOCK = struct.Struct('<IIII')
+    RECORD = struct.Struct('<QHBBB3xIIIIII' + 'BBHIQ' * 3)
+
+    ADDR_MASK = 0xffffffffffffffff
+
+    @classmethod
+    def is_bin(self, path):
+
+        with open(path, 'rb') as fd: 
+
+            return fd.read(len(self.MAGIC)) == self.MAGIC
+
+
+class InsnBinWriter(InsnBin):
+
+    def __init__(self, fd, compress = False, block_size = None):
+
+        self.fd, self.compress = fd, compress
+        self.block_size = self.BLOCK_SIZE if block_size is None else block_size
+        self._reset()
+
+        flags = self.FLAG_ZLIB if compress else 0
+        self.fd.write(self.HEADER.pack(self.MAGIC, self.VERSION, flags, 0))
+
+    def _reset(self):
+
+        self.records, self.strings, self.strings_index = [], [], {}
+        self.prev_addr = 0
+
+    def _put_str(self, data):
+
+        try: 
+
+            return self.strings_index[data]
+
+        except KeyError:
+
+            # add new string to the table of current block
+            index = self.strings_index[data] = len(self.strings)
+            self.strings.append(data)
+            return index
+
+    def _put_arg(self, arg):
+
+        if len(arg) == 0: return ( A_NONE, 0, 0, self.STR_NONE, 0 )
+        elif Arg_type(arg) == A_CONST: return ( A_CONST, Arg_size(arg), 0, self.STR_NONE, Arg_val(arg) )
+
+        return ( Arg_type(arg), Arg_size(arg), 0, self._put_str(Arg_name(arg)), 0 )
+
+    def write(self, insn):
+
+        insn = insn.serialize() if isinstance(insn, Insn) else insn
+        attr = Insn_attr(insn).copy()
+
+        addr, mask = Insn_addr(insn), 0
+        str_mnem = str_op = str_bin = str_ext = self.STR_NONE
+
+        if attr.has_key(IATTR_FLAGS): mask |= self.ATTR_FLAGS
+        if attr.has_key(IATTR_BIN): 
+
+            mask |= self.ATTR_BIN
+            str_bin = self._put_str(attr.pop(IATTR_BIN))
+
+        if attr.has_key(IATTR_ASM):
+
+            mask |= self.ATTR_ASM
+            str_mnem, str_op = map(self._put_str, attr.pop(IATTR_ASM))
+
+        flags = attr.pop(IATTR_FLAGS, 0)
+
+        if len(attr) > 0:
+
+            # attributes that are not known to the native code
+            mask |= self.ATTR_EXT
+            str_ext = self._put_str(marshal.dumps(attr))
+
+        args = sum(map(self._put_arg, Insn_args(insn)), ())
+
+        self.records.append(self.RECORD.pack((addr - self.prev_addr) & self.ADDR_MASK, \
+                                             Insn_inum(insn), Insn_op(insn), Insn_size(insn), mask, flags, \
+                                             str_mnem, str_op, str_bin, str_ext, 0, *args))
+        self.prev_addr = addr
+
+        if len(self.records) >= self.block_size: self.flush()
+
+    def flush(self):
+
+        if len(self.records) == 0: return
+
+        data = [ struct.pack('<I', len(self.strings)) ]
+        for item in self.strings: data += [ struct.pack('<I', len(item)), item ]
+
+        raw = ''.join(data + self.records)
+        data, flags = raw, 0
+        count = len(self.records)
+
+        # next block has it's own string table and addresses base
+        self._reset()
+
+        if self.compress:
+
+            temp = zlib.compress(raw)
+            if len(temp) < len(raw): data, flags = temp, self.BLOCK_ZLIB
+
+        self.fd.write(self.BLOCK.pack(count, len(raw), len(data), flags) + data)
+
+    def close(self):
+
+        self.flush()
+
+
+class InsnBinReader(InsnBin):
+
+    def __init__(self, fd):
+
+        header = fd.read(self.HEADER.size)
+
+        if len(header) != self.HEADER.size: raise Error('Invalid binary instructions header')
+
+        magic, version, flags, _ = self.HEADER.unpack(header)
+
+        if magic != self.MAGIC or version != self.VERSION:
+
+            raise Error('Unsupported binary instructions format')
+
+        self.fd = fd
+
+    def _read_block(self):
+
+        header = self.fd.read(self.BLOCK.size)
+
+        if len(header) == 0: return None
+        if len(header) != self.BLOCK.size: raise Error('Unexpected end of binary instructions data')
+
+        count, raw_len, data_len, flags = self.BLOCK.unpack(header)
+        data = self.fd.read(data_len)
+
+        if len(data) != data_len: raise Error('Unexpected end of binary instructions data')
+        if flags & self.BLOCK_ZLIB: data = zlib.decompress(data)        
+        if len(data) != raw_len or count == 0: raise Error('Invalid binary instructions block')
+
+        strings, ptr = [], 4
+
+        for i in range(struct.unpack_from('<I', data)[0]):
+
+            str_len, = struct.unpack_from('<I', data, ptr)
+            strings.append(data[ptr + 4 : ptr + 4 + str_len])
+            ptr += 4 + str_len
+
+        if len(data) - ptr != count * self.RECORD.size: raise Error('Invalid binary instructions block')
+
+        return strings, data, ptr, count
+
+    def __iter__(self):
+
+        while True:
+
+            block = self._read_block()
+            if block is None: break
+
+            strings, data, ptr, count = block
+            prev_addr = 0
+
+            def arg(a_type, a_size, a_name, a_val):
+
+                if a_type == A_NONE: return ()
+                elif a_type == A_CONST: return a_type, a_size, a_val
+
+                return a_type, a_size, strings[a_name]
+
+            for i in range(count):
+
+                rec = self.RECORD.unpack_from(data, ptr + i * self.RECORD.size)
+
+                addr, inum, op, size, mask, flags, str_mnem, str_op, str_bin, str_ext = rec[: 10]
+                a, b, c = rec[11 : 16], rec[16 : 21], rec[21 : 26]
+
+                addr = prev_addr = (prev_addr + addr) & self.ADDR_MASK
+                attr = marshal.loads(strings[str_ext]) if mask & self.ATTR_EXT else {}
+
+                if mask & self.ATTR_FLAGS: attr[IATTR_FLAGS] = flags
+                if mask & self.ATTR_BIN: attr[IATTR_BIN] = strings[str_bin]
+                if mask & self.ATTR_ASM: attr[IATTR_ASM] = ( strings[str_mnem], strings[str_op] )
+
+                yield ( ( addr, size ), inum, op, \
+                        ( arg(a[0], a[1], a[3], a[4]), arg(b[0], b[1], b[3], b[4]), arg(c[0], c[1], c[3], c[4]) ), attr )
+
+
+class TestInsnBin(unittest.TestCase):
+
+    def setUp(self):
+
+        # instructions with all kinds of arguments and attributes
+        self.test_data = [ ((0x1000, 2), 0, I_STR, ((A_REG, U32, 'R_ECX'), (), (A_REG, U32, 'R_EAX')), 
+                            { IATTR_FLAGS: 0, IATTR_ASM: ( 'mov', 'eax, ecx' ), IATTR_BIN: '\x89\xc8' }),
+                           ((0x1000, 2), 1, I_ADD, ((A_TEMP, U32, 'V_00'), (A_CONST, U32, 0xffffffffL), 
+                                                    (A_TEMP, U32, 'V_01')), 
+                            { IATTR_FLAGS: IOPT_ASM_END, IATTR_NEXT: ( 0x1002, 0 ) }),
+                           ((0x800, 1), 0, I_NONE, ((), (), ()), 
+                            { IATTR_FLAGS: IOPT_ASM_END | IOPT_RET }),
+                           ((0xffffffff80000000L, 1), 0, I_JCC, ((A_CONST, U1, 1), (), (A_CONST, U64, 0)), 
+                            { IATTR_FLAGS: IOPT_ASM_END }) ]
+
+    def _round_trip(self, **kwargs):
+
+        from StringIO import StringIO
+
+        fd = StringIO()
+        writer = InsnBinWriter(fd, **kwargs)
+
+        for insn in self.test_data: writer.write(insn)
+
+        writer.close()        
+        fd.seek(0)
+
+        return list(InsnBinReader(fd)), fd.getvalue()
+
+    def test(self):
+
+        assert InsnBin.RECORD.size == 88
+
+        # blocks are not compressed by default, C reader might be built without zlib
+        data, raw = self._round_trip()
+        assert data == self.test_data and InsnBin.HEADER.unpack(raw[: InsnBin.HEADER.size])[2] == 0
+
+        for compress in [ False, True ]:
+
+            for block_size in [ 1, 3, None ]:
+
+                data, _ = self._round_trip(compress = compress, block_size = block_size)
+                assert data == self.test_data
+
+    def test_strings(self):
+
+        self.test_data = [ ((addr, 1), 0, I_STR, ((A_REG, U32, 'R_EAX'), (), (A_REG, U32, 'R_EBX')), 
+                            { IATTR_FLAGS: IOPT_ASM_END }) for addr in range(0x100) ]
+
+        # register names are stored once per block
+        data, raw = self._round_trip(compress = False)
+        assert data == self.test_data and raw.count('R_EAX') == 1
+
+        data, raw = self._round_trip(compress = False, block_size = 0x10)
+        assert data == self.test_data and raw.count('R_EAX') == 0x10
+
+        # compressed blocks are smaller
+        data, raw_zlib = self._round_trip(compress = True)
+        assert data == self.test_data and len(raw_zlib) < len(raw)
+
+    def test_error(self):
+
+        from StringIO import StringIO
+
+        _, raw = self._round_trip(compress = False)
+
+        try: 
+
+            list(InsnBinReader(StringIO(raw[: -1])))
+            assert False
+
+        except Error: pass
+
+        try: 
+
+            InsnBinReader(StringIO('REILJSON' + raw[8 :]))
+            assert False
+
+        except Error: pass
+
+
 class InsnList(list):
 
     def __str__(self):
@@ -762,6 +1126,59 @@ class InsnList(list):
 
         return out_state
 
+    def lower(self):
+
+        ret, insn_list = InsnList(), []
+
+        def _lower(insn_list):
+
+            temps = [ -1 ]
+
+            for insn in insn_list:
+
+                for arg in [ insn.a, insn.b, insn.c ]:
+
+                    if arg.type == A_TEMP and arg.name[2:].isdigit(): 
+
+                        temps.append(int(arg.name[2:]))
+
+            # allocate new temp registers after already used ones
+            temps = [ max(temps) + 1 ]
+
+            def _temp(size):
+
+                temps[0] += 1
+                return Arg(A_TEMP, size, 'V_%.2d' % (temps[0] - 1))
+
+            lowered = []
+            for insn in insn_list: lowered += insn.lower(_temp)
+
+            # update IR instructions numbers
+            for inum in range(0, len(lowered)): lowered[inum].inum = inum
+
+            return lowered
+
+        for insn in self:
+
+            if len(insn_list) > 0 and insn_list[-1].addr != insn.addr:
+
+                # lower previous machine instruction
+                ret += _lower(insn_list)
+                insn_list = []
+
+            insn_list.append(insn)
+
+        return InsnList(ret + _lower(insn_list))
+
+    def optimize(self, passes = REIL_PASS_ALL):
+
+        import translator
+
+        # run native optimization passes over the whole list
+        insn_list = translator.optimize(map(lambda insn: insn.serialize(), self), passes)
+
+        return InsnList(map(lambda insn: Insn(insn), insn_list))
+
 
 class TestInsnList(unittest.TestCase):
 
@@ -822,6 +1239,71 @@ class TestInsnList(unittest.TestCase):
         assert eax == SymVal('R_EAX', U32) + SymAny() + SymAny() \
                    == SymVal('R_EAX', U32) + SymVal('R_ECX', U32) + SymAny()
 
+    def test_optimize(self):
+
+        # add test data to the storage
+        self.storage.clear()
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov edx, 1'), addr = 0L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('add ecx, edx'), addr = 5L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 7L))
+
+        insn = InsnList(self.storage.get_insn(0) + self.storage.get_insn(5) + \
+                        self.storage.get_insn(7))
+
+        # run all of the native optimizations
+        insn = insn.optimize()
+
+        print '\n', insn
+
+        '''
+            Check for correct resulting code:
+
+            00000000.00     STR             1:32,                 ,         R_EDX:32
+            00000005.00     ADD         R_ECX:32,             1:32,         R_ECX:32
+            00000007.00     LDM         R_ESP:32,                 ,          V_01:32
+            00000007.01     ADD         R_ESP:32,             4:32,         R_ESP:32
+            00000007.02     JCC              1:1,                 ,          V_01:32
+        '''
+        assert len(insn) == 5
+        assert map(lambda insn: insn.ir_addr(), insn) == [ ( 0, 0 ), ( 5, 0 ), ( 7, 0 ), ( 7, 1 ), ( 7, 2 ) ]
+        assert map(lambda insn: insn.op, insn) == [ I_STR, I_ADD, I_LDM, I_ADD, I_JCC ]
+
+        # check for propagated constant and coalesced temp registers
+        assert insn[1].a.name == 'R_ECX' and insn[1].b.get_val() == 1 and insn[1].c.name == 'R_ECX'
+        assert insn[3].a.name == 'R_ESP' and insn[3].c.name == 'R_ESP'
+
+        # check for machine instructions information
+        assert insn[0].has_attr(IATTR_ASM) and insn[2].has_attr(IATTR_BIN)
+        assert insn[0].has_flag(IOPT_ASM_END) and insn[4].has_flag(IOPT_RET)
+
+    def test_optimize_subexpressions(self):
+
+        # add test data to the storage
+        self.storage.clear()
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov eax, [ecx+4]'), addr = 0L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('test eax, eax'), addr = 3L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('jz $+5'), addr = 5L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov ebx, [ecx+4]'), addr = 7L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 10L))
+
+        insn = InsnList(self.storage.get_insn(0) + self.storage.get_insn(3) + \
+                        self.storage.get_insn(5) + self.storage.get_insn(7) + \
+                        self.storage.get_insn(10))
+
+        def _load(passes):
+
+            insn_list = insn.optimize(passes)
+
+            print '\n', insn_list
+
+            return filter(lambda insn: insn.addr == 7 and insn.op == I_LDM, insn_list)
+
+        # memory load from dominating basic block was reused
+        assert len(_load(REIL_PASS_ALL)) == 0
+
+        # value numbering within basic blocks keeps it untouched
+        assert len(_load(REIL_PASS_ALL | REIL_PASS_SUBEXP_LOCAL)) == 1
+
 
 class BasicBlock(InsnList):
     
@@ -1257,115 +1739,384 @@ class TestGraph(unittest.TestCase):
     	assert len(c.out_edges) == 0 and len(a.in_edges) == 0
 
 
-class CFGraphNode(GraphNode):    
+class DomTree(object):
 
-    def __str__(self):
+    '''
+        Dominator tree of the graph with nodes numbered from 0 to N - 1,
+        succs is a list of successors indexes of each node. Immediate
+        dominators are computed with algorithm from "A Simple, Fast 
+        Dominance Algorithm" by Cooper, Harvey and Kennedy.
+    '''
 
-        return '%x.%.2x' % self.item.ir_addr
+    def __init__(self, succs, entry = 0):
 
-    def key(self):
+        count = len(succs)
 
-        return self.item.ir_addr
+        # iterative DFS to get nodes postorder
+        order, visited, stack = [], [ False ] * count, [ ( entry, 0 ) ]
+        visited[entry] = True
 
-    def text(self):
+        while len(stack) > 0:
 
-        return '%s - %s' % (self.item.first.ir_addr(), self.item.last.ir_addr())
+            n, i = stack.pop()
 
+            if i < len(succs[n]):
 
-class CFGraphEdge(GraphEdge):
+                stack.append(( n, i + 1 ))
 
-    def __str__(self):
+                m = succs[n][i]
+                if not visited[m]:
 
-        return ''
+                    visited[m] = True
+                    stack.append(( m, 0 ))
 
+            else: order.append(n)
 
-class CFGraph(Graph):    
+        # nodes that are reachable from the entry in reverse postorder
+        order.reverse()
 
-    NODE = CFGraphNode
-    EDGE = CFGraphEdge
+        num, preds = [ None ] * count, [ [] for n in range(0, count) ]
 
-    def eliminate_dead_code(self):
+        for i in range(0, len(order)): num[order[i]] = i
 
-        pass    
+        for n in order:
 
+            for m in succs[n]: preds[m].append(n)
 
-class CFGraphBuilder(object):
+        idom = [ None ] * count
+        idom[entry] = entry
 
-    def __init__(self, storage):
+        def _intersect(a, b):
 
-        self.arch = storage.arch
-        self.storage = storage
+            while a != b:
 
-    def process_node(self, bb, state, context): 
+                while num[a] > num[b]: a = idom[a]
+                while num[b] > num[a]: b = idom[b]
 
-        pass
+            return a
 
-    def get_insn(self, ir_addr):
+        updated = True
+        while updated:
 
-        return self.storage.get_insn(ir_addr)    
+            updated = False
 
-    def _get_bb(self, addr):
+            for n in order[1:]:
 
-        insn_list = InsnList()
-        
-        while True:
+                new = None
 
-            # translate single assembly instruction
-            insn_list += self.get_insn(addr)
-            insn = insn_list[-1]
+                for m in preds[n]:
 
-            # check for basic block end
-            if insn.has_flag(IOPT_BB_END): break
+                    if idom[m] is not None:
 
-            addr += insn.size
+                        new = m if new is None else _intersect(m, new)
 
-        return insn_list    
+                if idom[n] != new:
 
-    def get_bb(self, ir_addr):
+                    idom[n] = new
+                    updated = True
 
-        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)
-        addr, inum = ir_addr
+        self.entry, self.order, self.idom = entry, order, idom
+        self.children = [ [] for n in range(0, count) ]
 
-        inum = 0 if inum is None else inum
-        last = inum
+        for n in order[1:]: self.children[idom[n]].append(n)
 
-        # translate assembly basic block at given address
-        insn_list = self._get_bb(addr)        
+        # DFS intervals of dominator tree nodes for constant time dominance check
+        self.pre, self.post = [ None ] * count, [ None ] * count
+        stack, i = [ ( entry, False ) ], 0
 
-        # split it into the IR basic blocks
-        for insn in insn_list[inum:]:
+        while len(stack) > 0:
 
-            last += 1
-            if insn.has_flag(IOPT_BB_END): 
+            n, leave = stack.pop()
 
-                return BasicBlock(insn_list[inum:last])
+            if leave: 
 
-    def traverse(self, ir_addr, state = None, context = None):
+                self.post[n] = i
 
-        stack, nodes, edges = [], [], []
-        cfg = CFGraph()
+            else:
 
-        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)        
-        state = {} if state is None else state        
+                self.pre[n] = i
+                stack.append(( n, True ))
+                stack += [ ( m, False ) for m in self.children[n] ]
 
-        def _process_node(bb, state, context):
+            i += 1
 
-            if bb.ir_addr not in nodes: 
+    def dominates(self, a, b):
 
-                nodes.append(bb.ir_addr)
-                self.process_node(bb, state, context)
+        if self.pre[a] is None or self.pre[b] is None: return False
 
-        def _process_edge(edge):
+        return self.pre[a] <= self.pre[b] and self.post[b] <= self.post[a]
 
-            if edge not in edges: edges.append(edge)
 
-        # iterative pre-order CFG traversal
-        while True:
+class TestDomTree(unittest.TestCase):
+
+    def test(self):
+
+        #
+        # 0 -> 1 -> 2 -> 4 -> 5
+        #      |         ^
+        #      +--> 3 ---+    6 (unreachable) -> 4
+        #           ^ |
+        #           +-+
+        #
+        succs = [ [ 1 ], [ 2, 3 ], [ 4 ], [ 3, 4 ], [ 5 ], [], [ 4 ] ]
+        tree = DomTree(succs)
+
+        assert tree.idom == [ 0, 0, 1, 1, 1, 4, None ]
+        assert tree.order[0] == 0 and not 6 in tree.order
+        assert tree.dominates(1, 5) and tree.dominates(4, 4)
+        assert not tree.dominates(2, 4) and not tree.dominates(3, 4)
+        assert not tree.dominates(6, 4) and not tree.dominates(0, 6)
+
+
+class CFGraphNode(GraphNode):    
+
+    def __str__(self):
+
+        return '%x.%.2x' % self.item.ir_addr
+
+    def key(self):
+
+        return self.item.ir_addr
+
+    def text(self):
+
+        return '%s - %s' % (self.item.first.ir_addr(), self.item.last.ir_addr())
+
+
+class CFGraphEdge(GraphEdge):
+
+    def __str__(self):
+
+        return ''
+
+
+class CFGraph(Graph):    
+
+    NODE = CFGraphNode
+    EDGE = CFGraphEdge
+
+    def __init__(self):
+
+        super(CFGraph, self).__init__()
+
+        self.entry = None
+        self._invalidate()
+
+    def _invalidate(self):
+
+        # graph was changed, dominators needs to be computed again
+        self._dom_tree, self._postdom_tree = None, None
+
+    def add_node(self, item):
+
+        self._invalidate()
+
+        return super(CFGraph, self).add_node(item)
+
+    def del_node(self, item, remove_from_list = True):
+
+        self._invalidate()
+
+        super(CFGraph, self).del_node(item, remove_from_list = remove_from_list)
+
+    def add_edge(self, node_from, node_to, name = None):
+
+        self._invalidate()
+
+        return super(CFGraph, self).add_edge(node_from, node_to, name = name)
+
+    def del_edge(self, edge):
+
+        self._invalidate()
+
+        super(CFGraph, self).del_edge(edge)
+
+    def _get_tree(self, post):
+
+        keys = self.nodes.keys()
+        index = dict([ ( keys[n], n ) for n in range(0, len(keys)) ])
+
+        if not index.has_key(self.entry):
+
+            raise Error('CFG entry node is not set')
+
+        if post:
+
+            #
+            # Post-dominators are dominators of reversed graph with
+            # virtual exit node that has edges from all of the nodes
+            # without successors.
+            #
+            succs = [ [ index[edge.node_from.key()] for edge in self.nodes[key].in_edges ] \
+                      for key in keys ]
+
+            succs.append(filter(lambda n: len(self.nodes[keys[n]].out_edges) == 0, \
+                                range(0, len(keys))))
+
+            return keys, index, DomTree(succs, entry = len(keys))
+
+        succs = [ [ index[edge.node_to.key()] for edge in self.nodes[key].out_edges ] \
+                  for key in keys ]
+
+        return keys, index, DomTree(succs, entry = index[self.entry])
+
+    def dom_tree(self):
+
+        if self._dom_tree is None: self._dom_tree = self._get_tree(False)
+        return self._dom_tree
+
+    def postdom_tree(self):
+
+        if self._postdom_tree is None: self._postdom_tree = self._get_tree(True)
+        return self._postdom_tree
+
+    def rpo(self):
+
+        keys, index, tree = self.dom_tree()
+
+        # nodes in reverse postorder starting from the entry
+        return [ keys[n] for n in tree.order ]
+
+    def idom(self, key):
+
+        keys, index, tree = self.dom_tree()
+        n = index[key]
+
+        # None for the entry node
+        return None if n == tree.entry or tree.idom[n] is None else keys[tree.idom[n]]
+
+    def ipdom(self, key):
+
+        keys, index, tree = self.postdom_tree()
+        n = tree.idom[index[key]]
+
+        # None for exit nodes and nodes that are not reaching exit
+        return None if n is None or n == tree.entry else keys[n]
+
+    def dominates(self, a, b):
+
+        keys, index, tree = self.dom_tree()
+        return tree.dominates(index[a], index[b])
+
+    def post_dominates(self, a, b):
+
+        keys, index, tree = self.postdom_tree()
+        return tree.dominates(index[a], index[b])
+
+    def eliminate_dead_code(self):
+
+        pass    
+
+
+class CFGraphBuilder(object):
+
+    def __init__(self, storage):
+
+        self.arch = storage.arch
+        self.storage = storage
+
+    def process_node(self, bb, state, context): 
+
+        pass
+
+    def get_insn(self, ir_addr):
+
+        return self.storage.get_insn(ir_addr)    
+
+    def _scan_insn(self, addr):
+
+        current = []
+
+        # read IR of consecutive machine instructions with single ordered scan
+        for insn in self.storage.iter_from(( addr, 0 )):
+
+            if insn.addr != addr or insn.inum != len(current): break
+
+            current.append(insn)
+
+            if insn.has_flag(IOPT_ASM_END):
+
+                yield current
+                addr, current = addr + insn.size, []
+
+    def _get_bb(self, addr):
+
+        insn_list = InsnList()
+        
+        while True:
+
+            # translate single assembly instruction
+            insn_list += self.get_insn(addr)
+            insn = insn_list[-1]
+
+            # check for basic block end
+            if insn.has_flag(IOPT_BB_END): break
+
+            addr += insn.size
+
+            # following instructions that are already in the storage
+            for item in self._scan_insn(addr):
+
+                insn_list += item
+                insn = item[-1]
+
+                if insn.has_flag(IOPT_BB_END): return insn_list
+
+                addr += insn.size
+
+        return insn_list    
+
+    def get_bb(self, ir_addr):
+
+        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)
+        addr, inum = ir_addr
+
+        inum = 0 if inum is None else inum
+        last = inum
+
+        # translate assembly basic block at given address
+        insn_list = self._get_bb(addr)        
+
+        # split it into the IR basic blocks
+        for insn in insn_list[inum:]:
+
+            last += 1
+            if insn.has_flag(IOPT_BB_END): 
+
+                return BasicBlock(insn_list[inum:last])
+
+    def traverse(self, ir_addr, state = None, context = None):
+
+        stack, nodes, edges, edges_list = [], Set(), Set(), []
+        cfg = CFGraph()
+
+        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)        
+        state = {} if state is None else state        
+
+        def _process_node(bb, state, context):
+
+            if bb.ir_addr not in nodes: 
+
+                nodes.add(bb.ir_addr)
+                self.process_node(bb, state, context)
+
+        def _process_edge(edge):
+
+            if edge not in edges: 
+
+                edges.add(edge)
+                edges_list.append(edge)
+
+        # iterative pre-order CFG traversal
+        while True:
 
             # query IR for basic block
             bb = self.get_bb(ir_addr)
             cfg.add_node(bb)
 
+            # first basic block is the entry of CFG
+            if cfg.entry is None: cfg.entry = bb.ir_addr
+
             _process_node(bb, state, context)
 
             # process immediate postdominators
@@ -1381,13 +2132,16 @@ class CFGraphBuilder(object):
             if lhs is not None: 
 
                 _process_edge(( bb.ir_addr, lhs ))
-                stack.append(( lhs, state.copy() ))
+
+                if not lhs in nodes:
+
+                    stack.append(( lhs, state.copy() ))
             
             try: ir_addr, state = stack.pop()
             except IndexError: break
 
         # add processed edges to the CFG
-        for edge in edges: cfg.add_edge(*edge)
+        for edge in edges_list: cfg.add_edge(*edge)
             
         return cfg
 
@@ -1430,6 +2184,40 @@ class TestCFGraphBuilder(unittest.TestCase):
         assert len(cfg.nodes) == 3
         assert len(cfg.edges) == 3
 
+    def test_dom(self):
+
+        from pyopenreil.utils import asm
+
+        code = ( 'test eax, eax',       # 0
+                 'jz _l',               # 2
+                 'inc ebx',             # 4
+                 '_l: ret' )            # 5
+
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = 0))
+        cfg = CFGraphBuilder(tr).traverse(0)
+
+        # jz is translated into conditional and unconditional IR branches
+        assert Set(cfg.nodes.keys()) == Set([ ( 0, 0 ), ( 2, 3 ), ( 4, 0 ), ( 5, 0 ) ])
+        assert cfg.entry == ( 0, 0 ) and cfg.rpo()[0] == ( 0, 0 )
+
+        assert cfg.idom(( 0, 0 )) is None
+        assert cfg.idom(( 2, 3 )) == ( 0, 0 )
+        assert cfg.idom(( 4, 0 )) == ( 2, 3 )
+        assert cfg.idom(( 5, 0 )) == ( 0, 0 )
+
+        assert cfg.dominates(( 0, 0 ), ( 4, 0 )) and not cfg.dominates(( 2, 3 ), ( 5, 0 ))
+
+        # basic blocks at 4 and 5 are both exits of the function
+        assert cfg.ipdom(( 2, 3 )) == ( 4, 0 )
+        assert cfg.ipdom(( 0, 0 )) is None and cfg.ipdom(( 4, 0 )) is None
+
+        assert cfg.post_dominates(( 4, 0 ), ( 2, 3 )) and not cfg.post_dominates(( 4, 0 ), ( 0, 0 ))
+
+        # dominators are updated after CFG modification
+        cfg.add_edge(( 2, 3 ), ( 5, 0 ))
+
+        assert cfg.idom(( 5, 0 )) == ( 0, 0 ) and cfg.ipdom(( 2, 3 )) is None
+
 
 class DFGraphNode(GraphNode):    
 
@@ -1514,6 +2302,9 @@ class DFGraph(Graph):
 
         self.deleted_nodes = Set()
 
+        # CFG and architecture of the function that graph was built for
+        self.cfg, self.arch = None, None
+
     def del_node(self, node):
 
         super(DFGraph, self).del_node(node, remove_from_list = False)
@@ -1523,81 +2314,62 @@ class DFGraph(Graph):
 
     def store(self, storage):
 
-        addr_list = Set()
+        insns = {}
         for node in self.nodes.values() + list(self.deleted_nodes): 
 
             insn = node.item
             if insn is not None:                
 
-                # collect list of available machine instructions including deleted ones
-                addr_list = addr_list.union([ insn.addr ])
-
-        for addr in addr_list:
-
-            # delete all IR for collected instructions
-            try: storage.del_insn(addr)
-            except StorageError: pass
-
-        # Instruction with inum == 0 is also contains
-        # metainformation about machine insturction.
-        # If such instruction was eliminated - we need to
-        # provide this information to next IR instruction of
-        # machine instruction.
-        for node in self.nodes.values():
+                # group IR instructions by machine instructions including deleted ones
+                insns.setdefault(insn.addr, {})[insn.inum] = insn
 
-            insn = node.item
-            if insn is None or \
-               insn.inum != 0 or not \
-               insn.has_flag(IOPT_ELIMINATED): continue            
-            
-            # find not eliminated IR instruction 
-            next = insn  
-            while next.has_flag(IOPT_ELIMINATED) and not \
-                  next.has_flag(IOPT_ASM_END):
+        if len(insns) == 0: return
 
-                next = self.nodes[( next.addr, next.inum + 1 )].item
+        insn_list = []
+        for addr in sorted(insns.keys()):
 
-            if next != insn:
+            items = [ insns[addr][inum] for inum in sorted(insns[addr].keys()) ]
+            alive = [ insn.clone() for insn in items if not insn.has_flag(IOPT_ELIMINATED) ]
 
-                # copy information about machine instruction
-                if insn.has_attr(IATTR_BIN): next.set_attr(IATTR_BIN, insn.get_attr(IATTR_BIN))
-                if insn.has_attr(IATTR_ASM): next.set_attr(IATTR_ASM, insn.get_attr(IATTR_ASM))
+            if len(alive) == 0:
 
-        relink = False
-        for node in self.nodes.values():
+                # For CFG consistence we need to insert I_NONE
+                # instruction if whole machine instruction was eliminated.
+                insn = items[0].clone()
+                insn.eliminate()
 
-            insn = node.item
-            if insn is not None:                
-            
-                if not insn.has_flag(IOPT_ELIMINATED):
+                alive = [ insn ]
 
-                    # put each node instruction into the storage
-                    storage.put_insn(insn.serialize())
+            first = items[0]
 
-                relink = True
+            # Instruction with inum == 0 is also contains
+            # metainformation about machine insturction.
+            # If such instruction was eliminated - we need to
+            # provide this information to next IR instruction of
+            # machine instruction.
+            if first.inum == 0 and first.has_flag(IOPT_ELIMINATED):
 
-        # update inums and flags
-        if relink: storage.fix_inums_and_flags()
+                # copy information about machine instruction
+                if first.has_attr(IATTR_BIN): alive[0].set_attr(IATTR_BIN, first.get_attr(IATTR_BIN))
+                if first.has_attr(IATTR_ASM): alive[0].set_attr(IATTR_ASM, first.get_attr(IATTR_ASM))
 
-        relink = False
-        for node in self.deleted_nodes:
+            # update inums and flags of the machine instruction only
+            for inum in range(0, len(alive)):
 
-            insn = node.item
+                insn = alive[inum]
+                insn.inum = inum
 
-            # For CFG consistence we need to insert I_NONE
-            # instruction if whole machine instruction was eliminated.
-            try: storage.get_insn(( insn.addr, 0 ))
-            except StorageError: 
+                insn.set_attr(IATTR_FLAGS, insn.get_attr(IATTR_FLAGS) & ~IOPT_ASM_END)
+                
+                if inum == len(alive) - 1: insn.set_flag(IOPT_ASM_END)
 
-                insn = insn.clone()
-                insn.inum = 0
+                insn_list.append(insn.serialize())
 
-                insn.eliminate()
-                storage.put_insn(insn.serialize())
-                relink = True
+            # delete all IR for collected instructions
+            storage.del_range(addr, addr + 1)
 
-        # update inums and flags
-        if relink: storage.fix_inums_and_flags()
+        # commit changes at once
+        storage.put_many(insn_list)
 
     def optimize_all(self, storage = None):
 
@@ -1608,9 +2380,9 @@ class DFGraph(Graph):
         
     def constant_folding(self, storage = None):
 
-        deleted_nodes = []
+        deleted_nodes, folded_nodes = [], []
 
-        from VM import Math
+        from SSA import SSAFunc, SCCP
 
         def _eliminate(node):
 
@@ -1618,111 +2390,100 @@ class DFGraph(Graph):
             deleted_nodes.append(node)
             return 1
 
-        def _evaluate(node): 
-
-            insn = node.item
-            val = Math(insn.a, insn.b).eval(insn.op)
-
-            if val is not None:
+        def _propagate(node, uses):
 
-                return Arg(A_CONST, insn.c.size, val = val)
-
-            else:
+            insn, names = node.item, Set()
 
-                return None
+            for name in [ 'a', 'b', 'c' ] if insn.op in [ I_JCC, I_STM ] else [ 'a', 'b' ]:
 
-        def _propagate_check(node):
+                arg = getattr(insn, name)
+                val = sccp.get_const(uses[arg.name]) if arg.is_var() else None
 
-            insn = node.item
+                if val is not None:
 
-            if insn.op in [ I_JCC, I_STM, I_NONE, I_UNK ]: 
+                    print 'Updating arg %s of DFG node "%s" to 0x%x' % (arg.name, node, val)
 
-                return False
+                    setattr(insn, name, Arg(A_CONST, arg.size, val = val))
+                    names.add(arg.name)
 
-            for arg in insn.src(get_all = True):
+            # instruction doesn't use this variables anymore
+            for edge in list(node.in_edges):
 
-                if arg.type != A_CONST: return False
+                if edge.name in names: self.del_edge(edge)
 
-            for arg in insn.dst(get_all = True):
+        print '*** Folding constants...'
 
-                if arg.type != A_TEMP: return False
+        if self.cfg is None: return
 
-            return True
+        # 
+        # Sparse conditional constant propagation over SSA form of the
+        # graph instructions. Basic blocks of CFG might have their own copies
+        # of instructions, use the ones that belongs to DFG nodes.
+        #
+        bb_list = [ BasicBlock([ self.nodes[insn.ir_addr()].item for insn in node.item ]) \
+                    for node in self.cfg.nodes.values() ]
 
-        def _propagate_do(node, arg):            
+        ssa = SSAFunc(self.arch, bb_list, self.cfg.entry)
+        sccp = SCCP(ssa)
 
-            for edge in node.out_edges:
+        for n in range(0, len(ssa.blocks)):
 
-                node_next = edge.node_to
-                insn_next = node_next.item
+            # leave code that is reachable only through never taken branches as is
+            if not sccp.executable[n]: continue
 
-                if insn_next.op == I_UNK:
+            for insn in ssa.blocks[n]:
 
-                    # Don't eliminate current instruction if any I_UNK
-                    # instructions uses it's results.
-                    return False
+                ir_addr = insn.ir_addr()
+                node = self.nodes[ir_addr]
 
-            for edge in node.out_edges:
+                if insn.op in [ I_NONE, I_UNK ] or insn.has_flag(IOPT_CALL): continue
 
-                node_next = edge.node_to
-                insn_next = node_next.item
+                if insn.op in [ I_JCC, I_STM, I_LDM ]:
 
-                print 'Updating arg %s of DFG node "%s" to %s' % (edge, node_next, arg)
+                    _propagate(node, ssa.insn_uses[ir_addr])
 
-                # Propagate constant value to immediate postdominators
-                # of current DFG node.
-                if insn_next.a.name == edge.name: insn_next.a = arg
-                if insn_next.b.name == edge.name: insn_next.b = arg
-                if insn_next.c.name == edge.name: insn_next.c = arg
+                    if insn.op == I_JCC and insn.a.type == A_CONST and insn.a.get_val() == 0:
 
-            return True        
+                        print 'DFG node "%s" is never taken branch' % node
+                        _eliminate(node)
 
-        def _constant_folding():
+                    continue
 
-            deleted, pending = 0, []  
+                val = sccp.get_const(ssa.insn_defs[ir_addr][insn.c.name])
 
-            # Collect list of DFG nodes that reprsesents instructions
-            # with constant source arguments and A_TEMP as destination argument.
-            for node in self.nodes.values():
+                if val is not None:
 
-                if node != self.entry_node and len(node.in_edges) == 0 and \
-                   _propagate_check(node):
+                    if insn.op != I_STR or insn.a.type != A_CONST:
 
-                    pending.append(node)
+                        print 'DFG node "%s" has constant value 0x%x' % (node, val)
 
-            for node in pending:
+                        # replace instruction with constant assignment
+                        insn.op = I_STR
+                        insn.a, insn.b = Arg(A_CONST, insn.c.size, val = val), Arg()
 
-                print 'DFG node "%s" has no input edges' % node
+                        for edge in list(node.in_edges): self.del_edge(edge)
 
-                # evaluate constant expression
-                arg = _evaluate(node)
-                if arg is None: 
-                
-                    # propagate constants information
-                    if _propagate_do(node, arg):
+                    folded_nodes.append(node)
 
-                        # delete node, it has no output edges anymore                        
-                        deleted += _eliminate(node)
+                else:
 
-            return deleted
+                    _propagate(node, ssa.insn_uses[ir_addr])
 
-        print '*** Folding constants...'
+        for node in folded_nodes:
 
-        while True:            
-        
-            # perform constants folding untill there will be some nodes to delete    
-            if _constant_folding() == 0: break
+            # delete temp registers assignments that has no users anymore
+            if node.item.c.type == A_TEMP and len(node.out_edges) == 0: _eliminate(node)
 
         # update global set of deleted DFG nodes
         self.deleted_nodes = self.deleted_nodes.union(deleted_nodes)
 
         if storage is not None: self.store(storage)
 
-    def eliminate_subexpressions(self, storage = None):
+    def eliminate_subexpressions(self, local = False, storage = None):
 
         deleted_nodes = []
 
-        from VM import Math
+        from SSA import SSAFunc, SSA_MEM
 
         def _eliminate(node):
 
@@ -1730,43 +2491,245 @@ class DFGraph(Graph):
             deleted_nodes.append(node)
             return 1
 
-        def _optimize_temp_regs():
+        def _eliminate_unused(node):
 
-            deleted, pending = 0, [] 
-            
-            # Collect list of DFG nodes that reprsesents STR instructions
-            # with A_TEMP or A_REG destination argument and non-constant source.
-            for node in self.nodes.values():
+            insn = node.item
 
-                insn = node.item
-                if insn is not None and insn.op == I_STR and \
-                   insn.a.type != A_CONST and \
-                   insn.c.type in [ A_REG, A_TEMP ]:
+            if not isinstance(insn, Insn) or len(node.out_edges) > 0 or \
+               insn.op in [ I_JCC, I_STM ] or insn.c.type != A_TEMP: return 0
 
-                    pending.append(node)
+            print 'DFG node "%s" has no output edges' % node
 
-            for node in pending:    
-                
-                # direction of DFG analysis
-                backward = node.item.c.type == A_REG                           
+            nodes_from = [ edge.node_from for edge in node.in_edges ]
+            deleted = _eliminate(node)
 
-                print 'DFG node "%s" sets value "%s" of "%s"' % \
-                       (node, node.item.a, node.item.c)                
-            
-                if backward:                    
+            # instructions that calculated it's arguments might be unused as well
+            for node_from in nodes_from: deleted += _eliminate_unused(node_from)
 
-                    insn = node.item
-                    
-                    if insn.a.type != A_TEMP:
+            return deleted
 
-                        # don't touch instructions that modifies real CPU registers
-                        continue
+        def _value_numbering():
 
-                    for edge in node.in_edges:
+            # 
+            # Hash based value numbering over SSA form of the graph instructions.
+            # Value number of constant is it's value and size, value number of
+            # expression is SSA value that computed it first, all other values
+            # (function entry, phi functions, memory, etc.) has their own numbers.
+            #
+            bb_list = [ BasicBlock([ self.nodes[insn.ir_addr()].item for insn in node.item ]) \
+                        for node in self.cfg.nodes.values() ]
 
-                        node_prev = edge.node_from
-                        out_edges = filter(lambda edge: edge.node_to != node,
-                                           node_prev.out_edges)
+            ssa = SSAFunc(self.arch, bb_list, self.cfg.entry)
+            # SSA value -> value number, expression -> [ value number, holders ]
+            deleted, vn, table, keys, stacks = 0, {}, {}, {}, {}
+
+            def _vn(arg, uses):
+
+                if arg.type == A_NONE: return None
+                if arg.type == A_CONST: return ( arg.get_val(), arg.size )
+
+                return vn.get(uses[arg.name], uses[arg.name])
+
+            def _current(var):
+
+                # current value of variable and DFG node that defines it
+                val = stacks[var][-1] if len(stacks.get(var, [])) > 0 else ssa.entry.get(var)
+
+                if val is None or ssa.is_phi(val): return None, None
+                if ssa.is_entry(val): return val, self.entry_node
+
+                return val, self.nodes[ssa.loc[val]]
+
+            def _add_edge(node_from, node_to, name):
+
+                for edge in node_from.out_edges:
+
+                    # such edge is already exists
+                    if edge.node_to == node_to and edge.name == name: return
+
+                self.add_edge(node_from, node_to, name)
+
+            def _visit(n, undo, pushed):
+
+                deleted = 0
+
+                for var, val in ssa.phi[n].items():
+
+                    stacks.setdefault(var, []).append(val)
+                    pushed.append(var)
+
+                for insn in ssa.blocks[n]:
+
+                    ir_addr = insn.ir_addr()
+                    node, defs = self.nodes[ir_addr], ssa.insn_defs[ir_addr]
+
+                    if insn.op in [ I_NONE, I_UNK, I_JCC, I_STM ] or insn.has_flag(IOPT_CALL) or \
+                       not insn.c.is_var():
+
+                        for var in defs.keys():
+
+                            stacks.setdefault(var, []).append(defs[var])
+                            pushed.append(var)
+
+                        continue
+
+                    uses, val = ssa.insn_uses[ir_addr], defs[insn.c.name]
+                    a, b = _vn(insn.a, uses), _vn(insn.b, uses)
+
+                    # load depends on the memory state
+                    if insn.op == I_LDM: b = vn.get(uses[SSA_MEM], uses[SSA_MEM])
+
+                    if insn.op in [ I_ADD, I_MUL, I_SMUL, I_AND, I_OR, I_XOR, I_EQ, I_NEQ ]:
+
+                        a, b = min(a, b), max(a, b)
+
+                    key = ( insn.op, a, b, insn.c.size )
+
+                    if insn.op == I_STR and insn.a.size == insn.c.size:
+
+                        # copy has the same value as it's source
+                        vn[val] = a
+                        key = keys.get(a)
+
+                    elif table.has_key(key):
+
+                        vn[val] = table[key][0]
+
+                        for arg, addr in reversed(table[key][1]):
+
+                            # temps are local for machine instruction
+                            if arg.type == A_TEMP and addr != insn.addr: continue
+
+                            cur, node_cur = _current(arg.name)
+
+                            if arg.name == insn.c.name or cur is None or vn.get(cur, cur) != vn[val]: 
+                                
+                                continue
+
+                            print 'DFG node "%s" value is available in %s' % (node, arg.name)
+
+                            # use previously calculated value
+                            insn.op, insn.a, insn.b = I_STR, Arg(arg.type, arg.size, arg.name), Arg()
+
+                            for edge in list(node.in_edges): 
+
+                                self.del_edge(edge)
+                                deleted += _eliminate_unused(edge.node_from)
+
+                            _add_edge(node_cur, node, arg.name)
+                            break
+
+                    cur, node_cur = _current(insn.c.name)
+
+                    if insn.c.type == A_TEMP and node_cur is not None and node_cur.key()[0] != insn.addr:
+
+                        # temps are local for machine instruction
+                        cur = None
+
+                    if cur is not None and vn.get(cur, cur) == vn.get(val, val):
+
+                        print 'DFG node "%s" sets the same value of %s' % (node, insn.c.name)
+
+                        # users of instruction results can use current value of the variable
+                        for edge in list(node.out_edges): 
+
+                            _add_edge(node_cur, edge.node_to, edge.name)
+
+                        deleted += _eliminate(node)
+                        continue
+
+                    if key is not None:
+
+                        # variable holds the value of expression
+                        entry = table.setdefault(key, ( vn.get(val, val), [] ))
+                        keys.setdefault(entry[0], key)
+
+                        entry[1].append(( Arg(insn.c.type, insn.c.size, insn.c.name), insn.addr ))
+                        undo.append(key)
+
+                    stacks.setdefault(insn.c.name, []).append(val)
+                    pushed.append(insn.c.name)
+
+                return deleted
+
+            def _leave(undo):
+
+                for key in reversed(undo):
+
+                    entry = table[key]
+                    entry[1].pop()
+
+                    if len(entry[1]) == 0: 
+
+                        del table[key]
+                        if keys.get(entry[0]) == key: del keys[entry[0]]
+
+            # walk over the dominator tree
+            stack = [ ( 0, None, None ) ]
+
+            while len(stack) > 0:
+
+                n, undo, pushed = stack.pop()
+
+                if undo is not None:
+
+                    # leave basic block
+                    _leave(undo)
+                    for var in reversed(pushed): stacks[var].pop()
+
+                    continue
+
+                undo, pushed = [], []
+                deleted += _visit(n, undo, pushed)
+
+                if local:
+
+                    # available expressions are not visible for other blocks
+                    _leave(undo)
+                    undo = []
+
+                stack.append(( n, undo, pushed ))
+                stack.extend([ ( m, None, None ) for m in reversed(ssa.children[n]) ])
+
+            return deleted
+
+        def _optimize_temp_regs():
+
+            deleted, pending = 0, [] 
+            
+            # Collect list of DFG nodes that reprsesents STR instructions
+            # with A_TEMP or A_REG destination argument and non-constant source.
+            for node in self.nodes.values():
+
+                insn = node.item
+                if insn is not None and insn.op == I_STR and \
+                   insn.a.type != A_CONST and \
+                   insn.c.type in [ A_REG, A_TEMP ]:
+
+                    pending.append(node)
+
+            for node in pending:    
+                
+                # direction of DFG analysis
+                backward = node.item.c.type == A_REG                           
+
+                print 'DFG node "%s" sets value "%s" of "%s"' % \
+                       (node, node.item.a, node.item.c)                
+            
+                if backward:                    
+
+                    insn = node.item
+                    
+                    if insn.a.type != A_TEMP:
+
+                        # don't touch instructions that modifies real CPU registers
+                        continue
+
+                    for edge in node.in_edges:
+
+                        node_prev = edge.node_from
+                        out_edges = filter(lambda edge: edge.node_to != node,
+                                           node_prev.out_edges)
 
                         insn_prev = node_prev.item
                         if insn_prev is None or \
@@ -1874,6 +2837,12 @@ class DFGraph(Graph):
 
             return deleted
 
+        if self.cfg is not None:
+
+            print '*** Eliminating common subexpressions...'
+
+            _value_numbering()
+
         print '*** Optimizing temp registers usage...'
         
         while True:
@@ -1940,109 +2909,179 @@ class DFGraphBuilder(object):
         self.arch = storage.arch
         self.storage = storage    
 
-    def _process_state(self, bb, state):
+    def _insn_args(self, insn):
 
-        updated = False
+        src = [ arg.name for arg in insn.src() ]
+        dst = [ arg.name for arg in insn.dst() ]            
 
-        if not hasattr(bb, 'input'): 
+        if insn.has_flag(IOPT_CALL):
 
-            # we visiting this basic block first time
-            bb.input = {}
+            #
+            # Function call.
+            #
+            # To make all of the things a bit more simpler we assuming that:
+            #   - target function can read and write all general purpose registers;
+            #   - target function is not using any flags that was set in current
+            #     function;
+            #
+            # Normally this approach works fine for code that was generated by HLL
+            # compilers, but some handwritten assembly junk can break it.
+            #
+            src = dst = self.arch.Registers.general
 
-        # create/update basic block input state information
-        for var, insn in state.items():
+        return src, dst
 
-            ir_addr = insn.ir_addr()
-            
-            if not bb.input.has_key(var): 
+    def _bits(self, val):
 
-                bb.input[var] = Set()
+        # enumerate indexes of bits that are set in bitvector
+        while val != 0:
 
-            if not ir_addr in bb.input[var]: 
+            low = val & -val
+            val ^= low
 
-                bb.input[var].add(ir_addr)
-                updated = True
+            yield low.bit_length() - 1
 
-        return updated
+    def traverse(self, ir_addr, state = None):                
 
-    def _process_bb(self, bb, state, dfg):        
+        state = {} if state is None else state
+        
+        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, 0)                
 
-        for insn in bb:
+        dfg = DFGraph()
+        cfg = CFGraphBuilder(self.storage).traverse(ir_addr)
 
-            node = dfg.add_node(insn)
+        dfg.cfg, dfg.arch = cfg, self.arch
 
-            src = [ arg.name for arg in insn.src() ]
-            dst = [ arg.name for arg in insn.dst() ]            
+        #
+        # Reaching definitions analysis. Each definition of variable
+        # (instruction and destination argument pair) has it's own index,
+        # sets of definitions are stored as bitvectors in Python long
+        # integers. Definitions with None instruction stands for values
+        # that variables have at function entry.
+        #
+        defs, var_defs = [], {}
 
-            if insn.has_flag(IOPT_CALL):
+        def _def(var, insn):
 
-                #
-                # Function call.
-                #
-                # To make all of the things a bit more simpler we assuming that:
-                #   - target function can read and write all general purpose registers;
-                #   - target function is not using any flags that was set in current
-                #     function;
-                #
-                # Normally this approach works fine for code that was generated by HLL
-                # compilers, but some handwritten assembly junk can break it.
-                #
-                src = dst = self.arch.Registers.general
+            defs.append(( var, insn ))
+            var_defs[var] = var_defs.get(var, 0) | (1L << (len(defs) - 1))
 
-            for arg in src:
-                
-                # create/find source node of DFG edge
-                try: node_from = dfg.add_node(state[arg])
-                except KeyError: node_from = dfg.entry_node                      
+            return len(defs) - 1
 
-                # create DFG edge for source argument of instruction
-                dfg.add_edge(node_from, node, arg)
+        def _var(var):
+
+            if not var_defs.has_key(var):
+
+                # definition of variable that reaches function entry
+                _def(var, state.get(var))
+
+        for var in state.keys(): _var(var)
+
+        blocks, succ, pred = {}, {}, {}
+
+        for node in cfg.nodes.values():
+
+            bb, insn_list, gen = node.item, [], {}
             
-            for arg in dst: 
+            for insn in bb:
 
-                # Update current state with information about registers
-                # that was changed by this instruction.
-                state[arg] = insn
+                src, dst = self._insn_args(insn)
 
-        # check for end of the function
-        if bb.get_successors() == ( None, None ):
+                for arg in src + dst: _var(arg)
 
-            for arg_name, insn in state.items():
+                # the last definition of variable in basic block is reaching it's end
+                insn_list.append(( insn, src, [ ( arg, _def(arg, insn) ) for arg in dst ] ))
+                for arg, num in insn_list[-1][2]: gen[arg] = num
 
-                # edge from last instruction that changed register to DFG exit node
-                dfg.add_edge(dfg.add_node(insn), dfg.exit_node.key(), arg_name)
+            blocks[bb.ir_addr] = ( bb, insn_list, gen )
 
-        return self._process_state(bb, state)
+            succ[bb.ir_addr] = filter(lambda addr: addr is not None, bb.get_successors())
+            for addr in succ[bb.ir_addr]: pred.setdefault(addr, []).append(bb.ir_addr)
 
-    def traverse(self, ir_addr, state = None):                
+        # initial state of function entry
+        entry = 0L
+        for var in var_defs.keys(): entry |= var_defs[var] & -var_defs[var]
 
-        stack = []
-        state = {} if state is None else state
+        gen_set, kill_set, in_set, out_set = {}, {}, {}, {}
         
-        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, 0)                
+        for key, ( bb, insn_list, gen ) in blocks.items():
 
-        dfg = DFGraph()
-        cfg = CFGraphBuilder(self.storage).traverse(ir_addr)
+            gen_set[key], kill_set[key] = 0L, 0L
 
-        while True:
+            for var, num in gen.items():
 
-            bb = cfg.node(ir_addr).item
+                gen_set[key] |= 1L << num
+                kill_set[key] |= var_defs[var]
 
-            # process basic block and update current state
-            updated = self._process_bb(bb, state, dfg) 
+            in_set[key], out_set[key] = 0L, gen_set[key]
 
-            #
-            # Process immediate postdominators of basic block untill it's
-            # input state information keeps updating.
-            #
-            if updated:
+        #
+        # Process basic blocks untill their output sets keeps updating,
+        # visiting them in reverse postorder reduces number of iterations.
+        #
+        worklist = cfg.rpo()
+        worklist.reverse()
 
-                lhs, rhs = bb.get_successors()                
-                if rhs is not None: stack.append(( rhs, state.copy() ))                  
-                if lhs is not None: stack.append(( lhs, state.copy() ))
-            
-            try: ir_addr, state = stack.pop()
-            except IndexError: break         
+        pending = Set(worklist)
+
+        while len(worklist) > 0:
+
+            key = worklist.pop()
+            pending.remove(key)
+
+            val = entry if key == ir_addr else 0L
+            for addr in pred.get(key, []): val |= out_set[addr]
+
+            in_set[key] = val
+            val = gen_set[key] | (val & ~kill_set[key])
+
+            if val != out_set[key]:
+
+                out_set[key] = val
+
+                for addr in succ[key]:
+
+                    if not addr in pending:
+
+                        worklist.append(addr)
+                        pending.add(addr)
+
+        # build DFG from the reaching definitions
+        for key, ( bb, insn_list, gen ) in blocks.items():
+
+            val = in_set[key]
+
+            for insn, src, dst in insn_list:
+
+                node = dfg.add_node(insn)
+
+                for arg in src:
+                    
+                    for num in self._bits(val & var_defs[arg]):
+
+                        # find source node of DFG edge
+                        insn_from = defs[num][1]
+                        node_from = dfg.entry_node if insn_from is None else dfg.add_node(insn_from)
+
+                        # create DFG edge for source argument of instruction
+                        dfg.add_edge(node_from, node, arg)
+
+                for arg, num in dst:
+
+                    # update current state with information about registers
+                    # that was changed by this instruction
+                    val = (val & ~var_defs[arg]) | (1L << num)
+
+            # check for end of the function
+            if len(succ[key]) == 0:
+
+                for num in self._bits(val):
+
+                    arg_name, insn = defs[num]
+                    if insn is not None:
+
+                        # edge from last instruction that changed register to DFG exit node
+                        dfg.add_edge(dfg.add_node(insn), dfg.exit_node.key(), arg_name)
 
         return dfg
 
@@ -2079,6 +3118,28 @@ class TestDFGraphBuilder(unittest.TestCase):
         edges = Set(map(lambda e: str(e), dfg.exit_node.in_edges))
         assert edges.issuperset(Set([ 'R_ESP', 'R_EDI', 'R_ESI', 'R_ECX' ]))        
 
+    def test_reaching(self):
+
+        # add test data to the storage
+        self.storage.clear()
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('test eax, eax'), addr = 0L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('jz $+4'), addr = 2L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov ebx, eax'), addr = 4L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov ecx, ebx'), addr = 6L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 8L))
+
+        dfg = DFGraphBuilder(self.storage).traverse(0)
+
+        # value of EBX comes from function entry or from mov
+        edges = filter(lambda e: e.name == 'R_EBX', dfg.node(( 6, 0 )).in_edges)
+        edges = Set(map(lambda e: e.node_from.key(), edges))
+        assert edges == Set([ dfg.entry_node.key(), ( 4, 1 ) ])
+
+        # both definitions are live at the end of the function
+        edges = filter(lambda e: e.name in [ 'R_EBX', 'R_ECX' ], dfg.exit_node.in_edges)
+        edges = Set(map(lambda e: ( e.node_from.key(), e.name ), edges))
+        assert edges == Set([ (( 4, 1 ), 'R_EBX'), (( 6, 1 ), 'R_ECX') ])
+
     def test_optimizations(self):
 
         # add test data to the storage
@@ -2122,7 +3183,7 @@ class TestDFGraphBuilder(unittest.TestCase):
             Check for correct resulting code:
 
             00000000.00     STR             1:32,                 ,         R_EDX:32
-            00000005.00     ADD         R_ECX:32,         R_EDX:32,         R_ECX:32
+            00000005.00     ADD         R_ECX:32,             1:32,         R_ECX:32
             00000007.00     LDM         R_ESP:32,                 ,          V_01:32
             00000007.01     ADD         R_ESP:32,             4:32,         R_ESP:32
             00000007.02     JCC              1:1,                 ,          V_01:32
@@ -2134,7 +3195,7 @@ class TestDFGraphBuilder(unittest.TestCase):
 
         assert storage.get_insn(5) == [ Insn(op = I_ADD, ir_addr = ( 5, 0 ), 
                                              a = Arg(A_REG, U32, 'R_ECX'),
-                                             b = Arg(A_REG, U32, 'R_EDX'),
+                                             b = Arg(A_CONST, U32, val = 1),
                                              c = Arg(A_REG, U32, 'R_ECX')) ]
 
         assert storage.get_insn(7) == [ Insn(op = I_LDM, ir_addr = ( 7, 0 ), 
@@ -2150,6 +3211,100 @@ class TestDFGraphBuilder(unittest.TestCase):
                                              a = Arg(A_CONST, U1, val = 1), 
                                              c = Arg(A_TEMP, U32, 'V_01')) ]
 
+    def test_store(self):
+
+        # add test data to the storage
+        self.storage.clear()
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov edx, 1'), addr = 0L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('jmp $+8'), addr = 5L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('add ecx, edx'), addr = 13L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 15L))
+
+        # instruction that doesn't belong to the function
+        other = Insn(op = I_NONE, ir_addr = ( 7, 1 ), size = 1)
+        self.storage.put_insn(other.serialize())
+
+        dfg = DFGraphBuilder(self.storage).traverse(0)
+        dfg.eliminate_dead_code()
+        dfg.constant_folding()
+        dfg.eliminate_subexpressions()
+        dfg.store(self.storage)
+
+        print '\n', self.storage
+
+        # only instructions of the graph must be updated
+        assert self.storage.get_range(7, 8) == [ other ]
+
+        for addr in [ 0, 5, 13, 15 ]:
+
+            insn_list = self.storage.get_range(addr, addr + 1)
+
+            assert map(lambda insn: insn.inum, insn_list) == range(0, len(insn_list))
+            assert map(lambda insn: insn.has_flag(IOPT_ASM_END), insn_list) == \
+                   [ False ] * (len(insn_list) - 1) + [ True ]
+
+        assert self.storage.get_insn(13)[0].op == I_ADD
+
+    def test_constant_folding(self):
+
+        # add test data to the storage
+        self.storage.clear()
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov eax, 1'), addr = 0L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('test eax, eax'), addr = 5L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('jz $+4'), addr = 7L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov ebx, eax'), addr = 9L))
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 11L))
+
+        dfg = DFGraphBuilder(self.storage).traverse(0)
+        dfg.eliminate_dead_code()
+        dfg.constant_folding(storage = self.storage)
+
+        print '\n', self.storage
+
+        # flags are known after test with constant
+        insn_list = self.storage.get_insn(5)
+        assert Insn(op = I_STR, ir_addr = ( 5, 0 ), a = Arg(A_CONST, U1, val = 0),
+                    c = Arg(A_REG, U1, 'R_ZF')) in map(lambda insn: insn.clone(), insn_list)
+
+        # never taken branch of jz was eliminated
+        insn_list = filter(lambda insn: insn.op == I_JCC, self.storage.get_insn(7))
+        assert len(insn_list) == 1 and insn_list[0].c.get_val() == 9
+
+        # constant was propagated into register assignment
+        insn_list = self.storage.get_insn(9)
+        assert len(insn_list) == 1 and insn_list[0].op == I_STR and \
+               insn_list[0].a == Arg(A_CONST, U32, val = 1)
+
+    def test_subexpressions(self):
+
+        def _load(local):
+
+            # add test data to the storage
+            self.storage.clear()
+            self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov eax, [ecx+4]'), addr = 0L))
+            self.storage.put_insn(self.tr.to_reil(self.asm.compile('test eax, eax'), addr = 3L))
+            self.storage.put_insn(self.tr.to_reil(self.asm.compile('jz $+5'), addr = 5L))
+            self.storage.put_insn(self.tr.to_reil(self.asm.compile('mov ebx, [ecx+4]'), addr = 7L))
+            self.storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 10L))
+
+            dfg = DFGraphBuilder(self.storage).traverse(0)
+            dfg.eliminate_dead_code()
+            dfg.eliminate_subexpressions(local = local, storage = self.storage)
+
+            print '\n', self.storage
+
+            return filter(lambda insn: insn.op == I_LDM, self.storage.get_insn(7))
+
+        # memory load from dominating basic block was reused
+        assert len(_load(False)) == 0
+
+        insn_list = self.storage.get_insn(7)
+        assert len(insn_list) == 1 and insn_list[0].op == I_STR and \
+               insn_list[0].a.name == 'R_EAX' and insn_list[0].c.name == 'R_EBX'
+
+        # local value numbering keeps it untouched
+        assert len(_load(True)) == 1
+
 
 class Reader(object):
 
@@ -2185,78 +3340,305 @@ class ReaderRaw(Reader):
         return self.read(addr, MAX_INST_LEN)
 
 
-class CodeStorage(object):
+class OrderedIndex(object):
 
-    __metaclass__ = ABCMeta
+    #
+    # Sorted list of keys that is split into the blocks of limited size,
+    # maxes keeps the biggest key of each block. Insertion and deletion
+    # need binary search and update of the single block.
+    #
+    BLOCK_SIZE = 0x200
 
-    reader = None
+    def __init__(self, keys = None, block_size = None):
 
-    @abstractmethod
-    def get_insn(self, ir_addr): pass
+        self.block_size = self.BLOCK_SIZE if block_size is None else block_size
+        self.clear()
 
-    @abstractmethod
-    def put_insn(self, insn_or_insn_list): pass
+        if keys is not None:
 
-    @abstractmethod
-    def size(self): pass
+            for key in keys: self.add(key)
 
-    @abstractmethod
-    def clear(self): pass
+    def __len__(self):
 
+        return self.count
 
-class CodeStorageMem(CodeStorage):    
+    def __iter__(self):
 
-    def __init__(self, arch, insn_list = None, from_file = None): 
+        return self.irange()
 
-        self.clear()
-        self.arch = get_arch(arch)
-        if insn_list is not None: self.put_insn(insn_list)
-        if from_file is not None: self.from_file(from_file)
+    def clear(self):
 
-    def __iter__(self):
+        self.blocks, self.maxes, self.count = [], [], 0
 
-        keys = self.items.keys()
-        keys.sort()
+    def add(self, key):
 
-        for k in keys: yield Insn(self._get_insn(k))   
+        if len(self.blocks) == 0:
 
-    def __str__(self):
+            self.blocks, self.maxes = [ [ key ] ], [ key ]
+            self.count = 1
+            return
 
-        return '\n'.join(map(lambda insn: str(insn), self))
+        # find block that must contain the key
+        pos = min(bisect.bisect_left(self.maxes, key), len(self.blocks) - 1)
+        block = self.blocks[pos]
 
-    def _get_key(self, insn):
+        bisect.insort(block, key)
+        self.maxes[pos] = block[-1]
+        self.count += 1
 
-        return Insn_addr(insn), Insn_inum(insn)
+        if len(block) > self.block_size * 2:
 
-    def _get_insn(self, ir_addr):
-        
-        try: return self.items[ir_addr]
-        except KeyError: raise StorageError(*ir_addr)    
+            # split big block into two halves
+            half = len(block) / 2
 
-    def _del_insn(self, ir_addr):
+            self.blocks[pos : pos + 1] = [ block[: half], block[half :] ]
+            self.maxes[pos : pos + 1] = [ block[half - 1], block[-1] ]
 
-        try: return self.items.pop(ir_addr)
-        except KeyError: raise StorageError(*ir_addr)
+    def update(self, keys):
 
-    def _put_insn(self, insn):
+        keys = list(keys)
 
-        self.items[self._get_key(insn)] = insn        
-    
-    def clear(self): 
+        if len(keys) < self.count / 8:
 
-        self.items = {}
+            for key in keys: self.add(key)
 
-    def size(self): 
+            return
 
-        return len(self.items)
+        # rebuild blocks when many keys are added at once
+        keys = sorted(keys + list(self.irange()))
+        size = self.block_size
 
-    def get_insn(self, ir_addr): 
+        self.blocks = [ keys[i : i + size] for i in range(0, len(keys), size) ]
+        self.maxes = map(lambda block: block[-1], self.blocks)
+        self.count = len(keys)
 
-        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)        
-        get_single, ret = True, InsnList()
+    def remove(self, key):
 
-        addr, inum = ir_addr
-        if inum is None: 
+        pos = bisect.bisect_left(self.maxes, key)
+        if pos == len(self.blocks): raise KeyError(key)
+
+        block = self.blocks[pos]
+        num = bisect.bisect_left(block, key)
+        if block[num] != key: raise KeyError(key)
+
+        del block[num]
+        self.count -= 1
+
+        if len(block) == 0:
+
+            del self.blocks[pos]
+            del self.maxes[pos]
+
+        else:
+
+            self.maxes[pos] = block[-1]
+
+    def irange(self, start = None, end = None):
+
+        key, find = start, bisect.bisect_left
+
+        while True:
+
+            # position is searched again for each block, so index can be modified while iterating
+            pos = 0 if key is None else find(self.maxes, key)
+            if pos >= len(self.blocks): return
+
+            block = self.blocks[pos]
+            items = block[0 if key is None else find(block, key) :]
+
+            for item in items:
+
+                if end is not None and item >= end: return
+                yield item
+
+            key, find = items[-1], bisect.bisect_right
+
+
+class TestOrderedIndex(unittest.TestCase):
+
+    def test(self):
+
+        import random
+
+        random.seed(0)
+
+        index, keys = OrderedIndex(block_size = 4), set()
+
+        for i in range(0x1000):
+
+            key = ( random.randrange(0x100), random.randrange(4) )
+
+            if key in keys and random.randrange(2):
+
+                index.remove(key)
+                keys.remove(key)
+
+            elif key not in keys:
+
+                index.add(key)
+                keys.add(key)
+
+        expected = sorted(keys)
+
+        assert len(index) == len(keys)
+        assert list(index) == expected
+        assert all(map(lambda block: 0 < len(block) <= 8, index.blocks))
+
+        start, end = ( 0x10, 1 ), ( 0x80, 0 )
+        assert list(index.irange(start, end)) == filter(lambda key: start <= key < end, expected)
+        assert list(index.irange(( 0x100, 0 ))) == []
+
+        # add many keys at once
+        index.update([ ( 0x100 + i, 0 ) for i in range(0x100) ])
+        expected += [ ( 0x100 + i, 0 ) for i in range(0x100) ]
+
+        assert list(index) == expected and len(index) == len(expected)
+
+        index.update([ ( 0x200, 0 ) ])
+        assert list(index.irange(( 0x1ff, 0 ))) == [ ( 0x1ff, 0 ), ( 0x200, 0 ) ]
+
+        # delete keys while iterating
+        for key in index.irange(): index.remove(key)
+
+        assert len(index) == 0 and len(index.blocks) == 0
+
+        try: 
+
+            index.remove(( 0, 0 ))
+            assert False
+
+        except KeyError: pass
+
+
+class CodeStorage(object):
+
+    __metaclass__ = ABCMeta
+
+    reader = None
+
+    @abstractmethod
+    def get_insn(self, ir_addr): pass
+
+    @abstractmethod
+    def put_insn(self, insn_or_insn_list): pass
+
+    @abstractmethod
+    def size(self): pass
+
+    @abstractmethod
+    def clear(self): pass
+
+    #
+    # Range queries: start and end are machine instruction addresses or
+    # (addr, inum) tuples, end is not included into the range.
+    #
+    @abstractmethod
+    def iter_from(self, ir_addr = None): pass
+
+    @abstractmethod
+    def get_range(self, start, end): pass
+
+    @abstractmethod
+    def del_range(self, start, end): pass
+
+    @abstractmethod
+    def put_many(self, insn_list): pass
+
+
+def range_key(ir_addr):
+
+    if ir_addr is None: return None
+
+    ir_addr = ir_addr if isinstance(ir_addr, tuple) else ( ir_addr, None )
+    addr, inum = ir_addr
+
+    return addr, 0 if inum is None else inum
+
+
+class CodeStorageMem(CodeStorage):    
+
+    def __init__(self, arch, insn_list = None, from_file = None): 
+
+        self.clear()
+        self.arch = get_arch(arch)
+        if insn_list is not None: self.put_insn(insn_list)
+        if from_file is not None: self.from_file(from_file)
+
+    def __iter__(self):
+
+        for insn in self._iter_range(None, None): yield Insn(insn)
+
+    def __str__(self):
+
+        return '\n'.join(map(lambda insn: str(insn), self))
+
+    def _get_key(self, insn):
+
+        return Insn_addr(insn), Insn_inum(insn)
+
+    def _iter_range(self, start, end):
+
+        for key in self.index.irange(start, end): yield self._get_insn(key)
+
+    def _del_range(self, start, end):
+
+        keys = map(lambda insn: ( Insn_addr(insn), Insn_inum(insn) ), self._iter_range(start, end))
+
+        for key in keys: self._del_insn(key)
+
+        return len(keys)
+
+    def _get_insn(self, ir_addr):
+        
+        try: return self.items[ir_addr]
+        except KeyError: raise StorageError(*ir_addr)    
+
+    def _del_insn(self, ir_addr):
+
+        try: insn = self.items.pop(ir_addr)
+        except KeyError: raise StorageError(*ir_addr)
+
+        self.index.remove(ir_addr)
+        return insn
+
+    def _put_insn(self, insn):
+
+        key = self._get_key(insn)
+
+        # keep ordered index of the instructions
+        if not self.items.has_key(key): self.index.add(key)
+
+        self.items[key] = insn        
+
+    def _put_many(self, insn_list):
+
+        keys = []
+
+        for insn in insn_list:
+
+            key = self._get_key(insn)
+            if not self.items.has_key(key): keys.append(key)
+
+            self.items[key] = insn
+
+        # insert new keys with single index update
+        self.index.update(set(keys))
+    
+    def clear(self): 
+
+        self.items, self.index = {}, OrderedIndex()
+
+    def size(self): 
+
+        return len(self.items)
+
+    def get_insn(self, ir_addr): 
+
+        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)        
+        get_single, ret = True, InsnList()
+
+        addr, inum = ir_addr
+        if inum is None: 
 
             # query all IR instructions for given machine instruction
             inum = 0
@@ -2300,14 +3682,45 @@ class CodeStorageMem(CodeStorage):
         if isinstance(insn_or_insn_list, list):
 
             # store instructions list
-            for insn in insn_or_insn_list: self._put_insn(get_data(insn))
+            self.put_many(insn_or_insn_list)
 
         else:
 
             # store single IR instruction
             self._put_insn(get_data(insn_or_insn_list))      
 
-    def to_file(self, path):
+    def put_many(self, insn_list):
+
+        get_data = lambda insn: insn.serialize() if isinstance(insn, Insn) else insn
+
+        self._put_many(map(get_data, insn_list))
+
+    def iter_from(self, ir_addr = None):
+
+        for insn in self._iter_range(range_key(ir_addr), None): yield Insn(insn)
+
+    def get_range(self, start, end):
+
+        return InsnList(map(Insn, self._iter_range(range_key(start), range_key(end))))
+
+    def del_range(self, start, end):
+
+        return self._del_range(range_key(start), range_key(end))
+
+    def to_file(self, path, binary = False, compress = False):
+
+        if binary:
+
+            with open(path, 'wb') as fd:
+
+                # dump all instructions in binary format
+                writer = InsnBinWriter(fd, compress = compress)
+
+                for insn in self: writer.write(insn)
+
+                writer.close()
+
+            return
 
         with open(path, 'w') as fd:
 
@@ -2316,6 +3729,15 @@ class CodeStorageMem(CodeStorage):
 
     def from_file(self, path):
 
+        if InsnBin.is_bin(path):
+
+            with open(path, 'rb') as fd:
+
+                # load instructions from binary format
+                for insn in InsnBinReader(fd): self._put_insn(insn)
+
+            return
+
         with open(path) as fd:        
         
             # load instructions from json
@@ -2337,23 +3759,27 @@ class CodeStorageMem(CodeStorage):
 
         return other.to_storage(self)
 
-    def fix_inums_and_flags(self):
+    def fix_inums_and_flags(self, start = None, end = None):
 
         addr, prev, inum = None, None, 0
         updated, deleted = [], []
 
-        for insn in self:
+        def _fix_asm_end(prev):
+
+            if prev is not None and not prev.has_flag(IOPT_ASM_END):
+
+                # set end of asm instruction flag for previous insn
+                prev.set_flag(IOPT_ASM_END)
+                updated.append(prev.serialize())
+
+        # start and end must point to the machine instructions boundaries
+        for insn in map(Insn, self._iter_range(range_key(start), range_key(end))):
             
             if addr != insn.addr:
 
                 # end of machine instruction
                 addr, inum = insn.addr, 0
-
-                if prev is not None and not prev.has_flag(IOPT_ASM_END):
-
-                    # set end of asm instruction flag for previous insn
-                    prev.set_flag(IOPT_ASM_END)
-                    updated.append(prev.serialize())
+                _fix_asm_end(prev)
 
             if insn.inum != inum:
 
@@ -2366,9 +3792,12 @@ class CodeStorageMem(CodeStorage):
             inum += 1
             prev = insn
 
+        # last instruction of the range
+        _fix_asm_end(prev)
+
         # commit instructions changes
         for ir_addr in deleted: self._del_insn(ir_addr)
-        for insn in updated: self._put_insn(insn)
+        self._put_many(updated)
 
 
 class TestCodeStorageMem(unittest.TestCase):
@@ -2419,131 +3848,1270 @@ class TestCodeStorageMem(unittest.TestCase):
 
         assert self.storage.size() == 0
 
+    def test_range(self):
 
-class CodeStorageTranslator(CodeStorage):
+        insn_list = []
 
-    class CFGraphBuilderFunc(CFGraphBuilder):
+        for addr, code in [ ( 0, 'push eax' ), ( 1, 'nop' ), ( 2, 'ret' ), ( 5, 'inc eax' ) ]:
 
-        def process_node(self, bb, state, context):
-            
-            self.func.add_bb(bb)
+            insn_list += self.tr.to_reil(self.asm.compile(code), addr = addr)
 
-        def traverse(self, arch, ir_addr):
+        self.storage.put_many(insn_list)
 
-            self.func = Func(arch, ir_addr)
+        expected = [ insn.serialize() for insn in CodeStorageMem(self.arch, insn_list) ]
+        serialize = lambda insn_list: [ insn.serialize() for insn in insn_list ]
 
-            CFGraphBuilder.traverse(self, ir_addr)
+        # ordered iteration from the given key
+        assert serialize(self.storage.iter_from()) == expected
+        assert serialize(self.storage.iter_from(2)) == filter(lambda insn: Insn_addr(insn) >= 2, expected)
+        assert serialize(self.storage.iter_from(( 0, 1 ))) == expected[1 :]
+        assert serialize(self.storage.iter_from(6)) == []
 
-    def __init__(self, reader, storage = None):
+        # end of the range is not included
+        assert serialize(self.storage.get_range(1, 5)) == \
+               filter(lambda insn: 1 <= Insn_addr(insn) < 5, expected)
 
-        import translator
-        
-        self.arch = get_arch(reader.arch)
-        self.translator = translator.Translator(reader.arch)
-        self.storage = CodeStorageMem(reader.arch) if storage is None else storage
-        self.reader = reader
+        assert serialize(self.storage.get_range(( 0, 1 ), ( 2, 1 ))) == \
+               filter(lambda insn: ( 0, 1 ) <= Insn_ir_addr(insn) < ( 2, 1 ), expected)
 
-    def translate_insn(self, data, addr):                
+        assert len(self.storage.get_range(3, 5)) == 0
 
-        src, dst = [], []
-        unk_insn = Insn(I_UNK, ir_addr = ( addr, 0 ))
-        unk_insn.set_flag(IOPT_ASM_END)        
+        # delete instructions of the range
+        assert self.storage.del_range(1, 3) == len(filter(lambda insn: 1 <= Insn_addr(insn) < 3, expected))
+        assert self.storage.del_range(1, 3) == 0
 
-        # generate IR instructions
-        ret = self.translator.to_reil(data, addr = addr)
+        assert serialize(self.storage) == filter(lambda insn: not 1 <= Insn_addr(insn) < 3, expected)
+        assert self.storage.size() == len(self.storage.get_range(0, 6))
 
-        #
-        # Convert untranslated instruction representation into the 
-        # single I_NONE IR instruction and save operands information
-        # into it's attributes.
-        #
-        for insn in ret:
+    def test_to_file(self):
 
-            if Insn_inum(insn) == 0:
+        import tempfile
 
-                attr = Insn_attr(insn)
-                if attr.has_key(IATTR_ASM): unk_insn.set_attr(IATTR_ASM, attr[IATTR_ASM])
-                if attr.has_key(IATTR_BIN): unk_insn.set_attr(IATTR_BIN, attr[IATTR_BIN])
+        insn_list = self.tr.to_reil(self.asm.compile('push eax'), addr = 0L) + \
+                    self.tr.to_reil(self.asm.compile('ret'), addr = 1L)
 
-            if Insn_op(insn) == I_UNK:
+        self.storage.put_insn(insn_list)
+        path = tempfile.mktemp()
 
-                args = Insn_args(insn)
-                a, c = Arg(args[0]), Arg(args[2])
+        try:
 
-                if a.type != A_NONE: src.append(a.serialize())
-                if c.type != A_NONE: dst.append(c.serialize())
+            for binary in [ False, True ]:
 
-                unk_insn.size = Insn_size(insn)
+                # format of the file is detected when loading
+                self.storage.to_file(path, binary = binary)
+                assert InsnBin.is_bin(path) == binary
 
-            else:
+                storage = CodeStorageMem(self.arch, from_file = path)
+                assert map(str, storage) == map(str, self.storage)
 
-                return ret
+            # unlike json binary format keeps attribute types
+            assert [ insn.serialize() for insn in storage ] == \
+                   [ insn.serialize() for insn in self.storage ]
 
-        if len(src) > 0: unk_insn.set_attr(IATTR_SRC, src)
-        if len(dst) > 0: unk_insn.set_attr(IATTR_DST, dst)
+        finally:
 
-        return [ unk_insn.serialize() ]
+            os.unlink(path)
 
-    def clear(self): 
 
-        self.storage.clear()
+class CodeStorageFile(CodeStorageMem):
 
-    def size(self): 
+    #
+    # Instructions are appended to the log file, memory mapped index file
+    # contains (addr, inum) -> log offset entries sorted by address. Changes
+    # that were made after the last flush() are kept in memory and restored
+    # from the log tail when storage is opened.
+    #
+    LOG_MAGIC = 'REILLOG\0'
+    IDX_MAGIC = 'REILIDX\0'
 
-        return self.storage.size()
+    # address, inum and length of serialized instruction (0 for deleted one)
+    rec_format = '<QHI'
 
-    def get_insn(self, ir_addr):
+    # magic, length of the log covered by index and number of entries
+    idx_header = '<8sQQ'
 
-        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)
-        ret = InsnList()
+    # address, inum and offset of the log record
+    idx_format = '<QHQ'
 
-        try: 
+    def __init__(self, arch, path, insn_list = None):
 
-            # query already translated IR instructions for this address
-            return self.storage.get_insn(ir_addr)
+        self.arch = get_arch(arch)
+        self.path, self.idx_path = path, path + '.idx'
+        self.log_map, self.idx_map = None, None
 
-        except StorageError:
+        self.log_fd = open(path, 'a+b')
+        self.log_len = os.fstat(self.log_fd.fileno()).st_size
 
-            if self.reader is None: raise ReadError(ir_addr[0])
+        if self.log_len == 0: 
 
-            # read instruction bytes from memory
-            data = self.reader.read_insn(ir_addr[0])
-            if data is None: raise ReadError(ir_addr[0])
+            self._log_write(self.LOG_MAGIC)
 
-            # translate to REIL
-            ret = self.translate_insn(data, ir_addr[0])
+        self._load()
 
-        # save to storage
-        for insn in ret: self.storage.put_insn(insn)
-        return self.storage.get_insn(ir_addr)
+        if insn_list is not None: self.put_insn(insn_list)
 
-    def put_insn(self, insn_or_insn_list):
+    def _log_write(self, data):
 
-        self.storage.put_insn(insn_or_insn_list)
+        # file position might be moved by _log_get()
+        self.log_fd.seek(0, os.SEEK_END)
+        self.log_fd.write(data)
+        self.log_len += len(data)
 
-    def get_bb(self, ir_addr):
-        
-        return CFGraphBuilder(self).get_bb(ir_addr)
+    def _log_get(self, offs, size):
 
-    def get_func(self, ir_addr):
+        if self.log_map is not None and offs + size <= len(self.log_map):
 
-        cfg = self.CFGraphBuilderFunc(self)
-        cfg.traverse(self.arch, ir_addr)
+            return self.log_map[offs : offs + size]
 
-        return cfg.func
+        self.log_fd.flush()
 
+        if self.log_map is None or self.log_len >= len(self.log_map) * 2:
 
-class TestCodeStorageTranslator(unittest.TestCase):
+            # remap the log only when it has doubled since the last time
+            self.log_map = mmap.mmap(self.log_fd.fileno(), 0, access = mmap.ACCESS_READ)
 
-    arch = ARCH_X86
+            return self.log_map[offs : offs + size]
 
-    def setUp(self):        
+        # read recently appended record without mapping
+        self.log_fd.seek(offs)
+        return self.log_fd.read(size)
 
-        # test assembly code
-        code = ( 'xor eax, eax', 'ret' )
-        
-        from pyopenreil.utils import asm
-        self.tr = CodeStorageTranslator(asm.Reader(self.arch, code))
+    def _idx_open(self):
+
+        self.idx_map, self.idx_count, self.idx_log_len = None, 0, len(self.LOG_MAGIC)
+
+        if not os.path.isfile(self.idx_path) or os.path.getsize(self.idx_path) == 0: return
+
+        with open(self.idx_path, 'rb') as fd:
+
+            idx_map = mmap.mmap(fd.fileno(), 0, access = mmap.ACCESS_READ)
+
+        magic, log_len, count = struct.unpack_from(self.idx_header, idx_map, 0)
+
+        # index must describe the same log
+        if magic != self.IDX_MAGIC or log_len > self.log_len: return
+
+        self.idx_map, self.idx_count, self.idx_log_len = idx_map, count, log_len
+
+    def _idx_entry(self, num):
+
+        offs = struct.calcsize(self.idx_header) + num * struct.calcsize(self.idx_format)
+        addr, inum, rec = struct.unpack_from(self.idx_format, self.idx_map, offs)
+
+        return ( addr, inum ), rec
+
+    def _idx_lower(self, ir_addr):
+
+        lo, hi = 0, self.idx_count
+
+        # binary search touches only the needed pages of the index
+        while lo < hi:
+
+            mid = (lo + hi) / 2
+            key, _ = self._idx_entry(mid)
+
+            if key < ir_addr: lo = mid + 1
+            else: hi = mid
+
+        return lo
+
+    def _idx_find(self, ir_addr):
+
+        num = self._idx_lower(ir_addr)
+
+        if num < self.idx_count:
+
+            key, rec = self._idx_entry(num)
+            if key == ir_addr: return rec
+
+        return None
+
+    def _find(self, ir_addr):
+
+        try: return self.pending[ir_addr]
+        except KeyError: return self._idx_find(ir_addr)
+
+    def _update(self, ir_addr, rec):
+
+        exists = self._find(ir_addr) is not None
+
+        if rec is not None and not exists: self.count += 1
+        if rec is None and exists: self.count -= 1
+
+        self.pending[ir_addr] = rec
+
+    def _load(self):
+
+        self._idx_open()
+        self.pending, self.count = {}, self.idx_count
+
+        offs, rec_size = self.idx_log_len, struct.calcsize(self.rec_format)
+
+        # apply changes that were made after the last flush
+        while offs + rec_size <= self.log_len:
+
+            addr, inum, size = struct.unpack(self.rec_format, self._log_get(offs, rec_size))
+            if offs + rec_size + size > self.log_len: break
+
+            self._update(( addr, inum ), offs if size > 0 else None)
+            offs += rec_size + size
+
+        if offs < self.log_len:
+
+            self.log_map = None
+
+            # drop torn record at the end of the log, new ones must follow the last valid one
+            self.log_fd.truncate(offs)
+            self.log_len = offs
+
+    def _entries(self, start = None):
+
+        pending = sorted(self.pending.items())
+        num = 0
+
+        if start is not None:
+
+            # skip entries that are below the range start
+            pending = pending[bisect.bisect_left(pending, ( start, )) :]
+
+        for i in range(0 if start is None else self._idx_lower(start), self.idx_count):
+
+            key, rec = self._idx_entry(i)
+
+            # merge index with the changes that were not flushed yet
+            while num < len(pending) and pending[num][0] <= key:
+
+                if pending[num][1] is not None: yield pending[num]
+                num += 1
+
+            if num > 0 and pending[num - 1][0] == key: continue
+
+            yield key, rec
+
+        for key, rec in pending[num :]:
+
+            if rec is not None: yield key, rec
+
+    def _iter_range(self, start, end):
+
+        for key, rec in self._entries(start): 
+
+            if end is not None and key >= end: break
+
+            yield self._read(rec)
+
+    def _read(self, rec):
+
+        rec_size = struct.calcsize(self.rec_format)
+        _, _, size = struct.unpack(self.rec_format, self._log_get(rec, rec_size))
+
+        return marshal.loads(self._log_get(rec + rec_size, size))
+
+    def _get_insn(self, ir_addr):
+
+        rec = self._find(ir_addr)
+        if rec is None: raise StorageError(*ir_addr)
+
+        return self._read(rec)
+
+    def _del_insn(self, ir_addr):
+
+        if self._find(ir_addr) is None: raise StorageError(*ir_addr)
+
+        self._log_write(struct.pack(self.rec_format, ir_addr[0], ir_addr[1], 0))
+        self._update(ir_addr, None)
+
+    def _put_many(self, insn_list):
+
+        for insn in insn_list: self._put_insn(insn)
+
+    def _put_insn(self, insn):
+
+        ir_addr = self._get_key(insn)
+        data = marshal.dumps(insn)
+
+        rec = self.log_len
+        self._log_write(struct.pack(self.rec_format, ir_addr[0], ir_addr[1], len(data)) + data)
+        self._update(ir_addr, rec)
+
+    def size(self):
+
+        return self.count
+
+    def clear(self):
+
+        self.log_map = self.idx_map = None
+
+        # truncate the log and remove index
+        self.log_fd.truncate(0)
+        self.log_len = 0
+        self._log_write(self.LOG_MAGIC)
+
+        if os.path.isfile(self.idx_path): os.unlink(self.idx_path)
+
+        self._load()
+
+    def flush(self):
+
+        self.log_fd.flush()
+        temp_path = self.idx_path + '.tmp'
+
+        with open(temp_path, 'wb') as fd:
+
+            # write new index with all of the changes
+            fd.write(struct.pack(self.idx_header, self.IDX_MAGIC, self.log_len, self.count))
+
+            for key, rec in self._entries(): 
+
+                fd.write(struct.pack(self.idx_format, key[0], key[1], rec))
+
+        os.rename(temp_path, self.idx_path)
+
+        self._idx_open()
+        self.pending = {}
+
+    def close(self):
+
+        self.flush()
+
+        self.log_map = self.idx_map = None
+        self.log_fd.close()
+
+
+class TestCodeStorageFile(TestCodeStorageMem):
+
+    def setUp(self):
+
+        import tempfile
+
+        TestCodeStorageMem.setUp(self)
+
+        self.path = tempfile.mktemp()
+        self.storage = CodeStorageFile(self.arch, self.path)
+
+    def tearDown(self):
+
+        self.storage.log_fd.close()
+
+        for path in [ self.path, self.path + '.idx' ]:
+
+            if os.path.isfile(path): os.unlink(path)
+
+    def test_reopen(self):
+
+        insn_list = self.tr.to_reil(self.asm.compile('push eax'), addr = 0L) + \
+                    self.tr.to_reil(self.asm.compile('nop'), addr = 1L)
+
+        self.storage.put_insn(insn_list)
+        self.storage.close()
+
+        storage = CodeStorageFile(self.arch, self.path)
+        assert storage.size() == len(insn_list)
+        assert [ insn.serialize() for insn in storage ] == \
+               [ insn.serialize() for insn in CodeStorageMem(self.arch, insn_list) ]
+
+        # changes that were not flushed must be restored from the log
+        storage.del_insn(1)
+        storage.put_insn(self.tr.to_reil(self.asm.compile('ret'), addr = 2L))
+        storage.put_insn(self.tr.to_reil(self.asm.compile('inc eax'), addr = 0L))
+        storage.log_fd.flush()
+
+        self.storage = CodeStorageFile(self.arch, self.path)
+        assert self.storage.size() == storage.size()
+        assert [ insn.serialize() for insn in self.storage ] == [ insn.serialize() for insn in storage ]
+        assert self.storage.get_insn(0) == storage.get_insn(0)
+
+        try: self.storage.get_insn(1)
+        except StorageError as e: assert e.addr == 1
+
+        storage.log_fd.close()
+
+    def test_torn_record(self):
+
+        insn_list = self.tr.to_reil(self.asm.compile('push eax'), addr = 0L)
+
+        self.storage.put_insn(insn_list)
+        self.storage.close()
+
+        with open(self.path, 'ab') as fd:
+
+            # record that was not written completely
+            fd.write(struct.pack(self.storage.rec_format, 1, 0, 0x100) + 'X' * 0x10)
+
+        self.storage = CodeStorageFile(self.arch, self.path)
+        assert self.storage.size() == len(insn_list)
+
+        # appended records must be found after reopen
+        self.storage.put_insn(self.tr.to_reil(self.asm.compile('nop'), addr = 1L))
+        self.storage.log_fd.flush()
+
+        storage = CodeStorageFile(self.arch, self.path)
+        assert storage.size() == self.storage.size()
+        assert [ insn.serialize() for insn in storage ] == \
+               [ insn.serialize() for insn in self.storage ]
+
+        storage.log_fd.close()
+
+    def test_log_map(self):
+
+        maps = []
+
+        # interleaved appends and reads must not remap the log each time
+        for addr in range(0x100):
+
+            self.storage.put_insn(self.tr.to_reil(self.asm.compile('nop'), addr = addr))
+            assert self.storage.get_insn(( addr, 0 )).addr == addr
+
+            if len(maps) == 0 or maps[-1] is not self.storage.log_map:
+
+                maps.append(self.storage.log_map)
+
+        assert len(maps) < 0x10
+
+
+class InsnColumn(object):
+
+    def __init__(self, fmt):
+
+        # column of little endian unsigned integers
+        self.fmt = struct.Struct('<' + fmt)
+        self.width = self.fmt.size
+        self.data = bytearray()
+
+    def __len__(self):
+
+        return len(self.data) / self.width
+
+    def __getitem__(self, n):
+
+        return self.fmt.unpack_from(self.data, n * self.width)[0]
+
+    def __setitem__(self, n, val):
+
+        self.fmt.pack_into(self.data, n * self.width, val)
+
+    def append(self, val):
+
+        self.data += self.fmt.pack(val)
+
+    def numpy(self):
+
+        import numpy
+
+        # copy of the column data that stays valid when column is modified
+        return numpy.frombuffer(self.data, dtype = '<u%d' % self.width).copy()
+
+
+class InsnColumns(object):
+
+    #
+    # Struct-of-arrays representation of IR instructions: each field is kept
+    # in the separate column, register names are replaced with numeric IDs.
+    # Filters are evaluated by native code for whole columns at once, see
+    # reil_columns_filter(), instruction tuples are built only for the
+    # selected rows.
+    #
+    COLUMNS = [ ( 'addr', 'Q' ), ( 'size', 'B' ), ( 'inum', 'H' ), ( 'op', 'B' ), 
+                ( 'flags', 'Q' ), ( 'valid', 'B' ) ] + \
+              sum([ [ ( arg + '_type', 'B' ), ( arg + '_size', 'B' ), 
+                      ( arg + '_reg', 'H' ), ( arg + '_val', 'Q' ) ] for arg in 'abc' ], [])
+
+    REG_NONE = 0xffff
+
+    def __init__(self, insn_list = None):
+
+        self.clear()
+
+        if insn_list is not None: 
+
+            for insn in insn_list: self.append(insn)
+
+    def __len__(self):
+
+        return len(self.columns['addr'])
+
+    def __iter__(self):
+
+        for row in range(len(self)):
+
+            if self.columns['valid'][row]: yield self.get(row)
+
+    def clear(self):
+
+        self.columns = dict(map(lambda c: ( c[0], InsnColumn(c[1]) ), self.COLUMNS))
+        self.names, self.names_index = [], {}
+        self.attr, self.deleted = {}, 0
+
+    def column(self, name):
+
+        return self.columns[name]
+
+    def reg_id(self, name):
+
+        return self.names_index.get(name, None)
+
+    def reg_name(self, reg_id):
+
+        return self.names[reg_id]
+
+    def _put_reg(self, name):
+
+        try:
+
+            return self.names_index[name]
+
+        except KeyError:
+
+            if len(self.names) >= self.REG_NONE: raise Error('Too many register names')
+
+            reg_id = self.names_index[name] = len(self.names)
+            self.names.append(name)
+            return reg_id
+
+    def _get_row(self, insn):
+
+        insn = insn.serialize() if isinstance(insn, Insn) else insn
+        attr = Insn_attr(insn).copy()
+
+        row = { 'addr': Insn_addr(insn), 'size': Insn_size(insn), 'inum': Insn_inum(insn), 
+                'op': Insn_op(insn), 'flags': attr.pop(IATTR_FLAGS, 0), 'valid': 1 }
+
+        for name, arg in zip('abc', Insn_args(insn)):
+
+            a_type = Arg_type(arg) if len(arg) > 0 else A_NONE
+            a_reg = self._put_reg(Arg_name(arg)) if a_type in [ A_REG, A_TEMP ] else self.REG_NONE
+
+            row.update({ name + '_type': a_type, name + '_size': Arg_size(arg) if len(arg) > 0 else 0,
+                         name + '_reg': a_reg, name + '_val': Arg_val(arg) if a_type == A_CONST else 0 })
+
+        return row, attr
+
+    def append(self, insn):
+
+        row, attr = self._get_row(insn)
+        n = len(self)
+
+        for name, val in row.iteritems(): self.columns[name].append(val)
+        if len(attr) > 0: self.attr[n] = attr
+
+        return n
+
+    def update(self, n, insn):
+
+        row, attr = self._get_row(insn)
+
+        for name, val in row.iteritems(): self.columns[name][n] = val
+
+        if len(attr) > 0: self.attr[n] = attr
+        elif self.attr.has_key(n): self.attr.pop(n)
+
+    def remove(self, n):
+
+        # mark row as deleted, it's space is reclaimed by compact()
+        self.columns['valid'][n] = 0
+        self.deleted += 1
+
+        if self.attr.has_key(n): self.attr.pop(n)
+
+    def get(self, n):
+
+        get = lambda name: self.columns[name][n]
+
+        def arg(name):
+
+            a_type = get(name + '_type')
+
+            if a_type == A_NONE: return ()
+            elif a_type == A_CONST: return a_type, get(name + '_size'), get(name + '_val')
+
+            return a_type, get(name + '_size'), self.names[get(name + '_reg')]
+
+        attr = self.attr[n].copy() if self.attr.has_key(n) else {}
+        attr[IATTR_FLAGS] = get('flags')
+
+        return ( ( get('addr'), get('size') ), get('inum'), get('op'), 
+                 ( arg('a'), arg('b'), arg('c') ), attr )
+
+    def compact(self):
+
+        # rebuild columns without deleted rows, returns map of old row numbers to new
+        ret, columns = {}, dict(map(lambda c: ( c[0], InsnColumn(c[1]) ), self.COLUMNS))
+        attr = {}
+
+        for n in range(len(self)):
+
+            if not self.columns['valid'][n]: continue
+
+            for name, column in columns.iteritems():
+
+                width = column.width
+                column.data += self.columns[name].data[n * width : (n + 1) * width]
+
+            ret[n] = len(columns['addr']) - 1
+            if self.attr.has_key(n): attr[ret[n]] = self.attr[n]
+
+        self.columns, self.attr, self.deleted = columns, attr, 0
+
+        return ret
+
+    def mask(self, **cond):
+
+        import translator
+
+        # deleted rows never match
+        ret = bytearray(self.columns['valid'].data)
+
+        for name, val in cond.items():
+
+            column = self.columns[name]
+
+            if name.endswith('_reg'):
+
+                # register name condition
+                val = self.reg_id(val)
+                if val is None: return bytearray(len(ret))
+
+            lo, hi = val if isinstance(val, tuple) else ( val, val )
+
+            if translator.columns_filter(column.data, column.width, lo, hi, ret) == 0: break
+
+        return ret
+
+    def rows(self, mask):
+
+        ret, n = [], mask.find('\x01')
+
+        # find() skips not matched rows in native code
+        while n != -1:
+
+            ret.append(n)
+            n = mask.find('\x01', n + 1)
+
+        return ret
+
+    def select(self, **cond):
+
+        return map(self.get, self.rows(self.mask(**cond)))
+
+    def count(self, **cond):
+
+        return self.mask(**cond).count('\x01')
+
+    def histogram(self, name, mask = None, limit = None):
+
+        import translator
+
+        column = self.columns[name]
+        mask = self.columns['valid'].data if mask is None else mask
+
+        if limit is None:
+
+            if column.width > 2: raise Error('Limit is required for column %s' % name)
+
+            limit = 1 << (column.width * 8)
+
+        counts = translator.columns_histogram(column.data, column.width, limit, mask)
+
+        return dict(filter(lambda item: item[1] > 0, enumerate(counts)))
+
+    def numpy(self):
+
+        # column name -> numpy array
+        return dict(map(lambda item: ( item[0], item[1].numpy() ), self.columns.items()))
+
+
+class CodeStorageColumns(CodeStorageMem):
+
+    #
+    # In memory storage that keeps instructions in InsnColumns instead of
+    # tuples, self.items maps (addr, inum) to the row number.
+    #
+    COMPACT_MIN = 0x1000
+
+    def clear(self):
+
+        self.items, self.index, self.columns = {}, OrderedIndex(), InsnColumns()
+
+    def _get_insn(self, ir_addr):
+
+        try: return self.columns.get(self.items[ir_addr])
+        except KeyError: raise StorageError(*ir_addr)
+
+    def _del_insn(self, ir_addr):
+
+        try: n = self.items.pop(ir_addr)
+        except KeyError: raise StorageError(*ir_addr)
+
+        self.index.remove(ir_addr)
+
+        insn = self.columns.get(n)
+        self.columns.remove(n)
+
+        if self.columns.deleted > self.COMPACT_MIN and self.columns.deleted * 2 > len(self.columns):
+
+            self.compact()
+
+        return insn
+
+    def _put_insn(self, insn):
+
+        key = self._get_key(insn)
+
+        if self.items.has_key(key): 
+
+            self.columns.update(self.items[key], insn)
+
+        else: 
+
+            self.items[key] = self.columns.append(insn)
+            self.index.add(key)
+
+    def _put_many(self, insn_list):
+
+        keys = []
+
+        for insn in insn_list:
+
+            key = self._get_key(insn)
+
+            if self.items.has_key(key): 
+
+                self.columns.update(self.items[key], insn)
+
+            else: 
+
+                self.items[key] = self.columns.append(insn)
+                keys.append(key)
+
+        # insert new keys with single index update
+        self.index.update(keys)
+
+    def compact(self):
+
+        rows = self.columns.compact()
+
+        for key, n in self.items.items(): self.items[key] = rows[n]
+
+    def mask(self, **cond):
+
+        return self.columns.mask(**cond)
+
+    def select(self, **cond):
+
+        return InsnList(map(Insn, self.columns.select(**cond)))
+
+    def histogram(self, name, mask = None, limit = None):
+
+        return self.columns.histogram(name, mask = mask, limit = limit)
+
+
+class TestCodeStorageColumns(TestCodeStorageMem):
+
+    def setUp(self):
+
+        TestCodeStorageMem.setUp(self)
+
+        self.storage = CodeStorageColumns(self.arch)
+
+    def _insn_list(self):
+
+        code = ( 'push ebp', 'mov ebp, esp', 'mov eax, [ebp + 8]', 'add eax, 0x10', 
+                 'mov [esp], eax', 'pop ebp', 'ret' )
+
+        ret, addr = [], 0x1000L
+
+        for insn in code:
+
+            data = self.asm.compile(insn)
+            ret += self.tr.to_reil(data, addr = addr)
+            addr += len(data)
+
+        return ret
+
+    def test_filter(self):
+
+        insn_list = map(Insn, self._insn_list())
+        self.storage.put_insn(insn_list)
+
+        check = lambda insn_list, pred: [ insn.serialize() for insn in insn_list if pred(insn) ]
+        select = lambda **cond: [ insn.serialize() for insn in self.storage.select(**cond) ]
+
+        # register name and opcode conditions
+        assert select(op = I_STR, a_reg = 'R_ESP') == \
+               check(insn_list, lambda insn: insn.op == I_STR and insn.a.name == 'R_ESP')
+
+        assert select(op = I_LDM) == check(insn_list, lambda insn: insn.op == I_LDM)
+        assert select(a_reg = 'R_UNKNOWN') == []
+
+        # range conditions
+        assert select(addr = ( 0x1001, 0x1003 ), c_type = A_TEMP) == \
+               check(insn_list, lambda insn: 0x1001 <= insn.addr <= 0x1003 and insn.c.type == A_TEMP)
+
+        assert select(b_type = A_CONST, b_val = 0x10) == \
+               check(insn_list, lambda insn: insn.b.type == A_CONST and insn.b.val == 0x10)
+
+        # opcodes histogram
+        hist = {}
+        for insn in insn_list: hist[insn.op] = hist.get(insn.op, 0) + 1
+
+        assert self.storage.histogram('op') == hist
+
+        # deleted rows are not matched
+        count = len(self.storage.select(op = I_LDM))
+        self.storage.del_insn(0x1000)
+
+        assert len(self.storage.select(op = I_LDM)) == count
+        assert len(self.storage.select(addr = 0x1000)) == 0
+        assert sum(self.storage.histogram('op').values()) == self.storage.size()
+
+        # reclaim space of deleted rows
+        self.storage.compact()
+
+        assert len(self.storage.columns) == self.storage.size()
+        assert [ insn.serialize() for insn in self.storage ] == \
+               [ insn.serialize() for insn in CodeStorageMem(self.arch, insn_list) if insn.addr != 0x1000 ]
+
+    def test_columns(self):
+
+        insn_list = self._insn_list()
+
+        # export of other storage contents
+        columns = InsnColumns(CodeStorageMem(self.arch, insn_list))
+
+        assert len(columns) == len(insn_list)
+        assert [ Insn(insn).serialize() for insn in columns ] == \
+               [ insn.serialize() for insn in CodeStorageMem(self.arch, insn_list) ]
+
+        # large columns are processed by vectorized part of the native code
+        columns = InsnColumns(insn_list * 10)
+        assert columns.count(op = I_STR, a_reg = 'R_EBP') == \
+               len(filter(lambda insn: Insn(insn).op == I_STR and Insn(insn).a.name == 'R_EBP', insn_list)) * 10
+
+        try: 
+
+            columns.histogram('addr')
+            assert False
+
+        except Error: pass
+
+        count = len(filter(lambda insn: Insn(insn).addr == 0x1000, insn_list))
+        assert columns.histogram('addr', limit = 0x1001) == { 0x1000: count * 10 }
+
+
+_translate_worker = None
+
+def _translate_worker_init(storage):
+
+    import translator
+
+    global _translate_worker
+
+    # worker process must not share native translator state with the parent
+    storage.translator = translator.Translator(storage.reader.arch, opts = storage.opts)
+    _translate_worker = storage
+
+def _translate_worker_bb(addr):
+
+    try:
+
+        return addr, _translate_worker._translate_bb(addr), False
+
+    except Exception:
+
+        return addr, [], True
+
+
+class CodeStorageTranslator(CodeStorage):
+
+    class CFGraphBuilderFunc(CFGraphBuilder):
+
+        def process_node(self, bb, state, context):
+            
+            self.func.add_bb(bb)
+
+        def traverse(self, arch, ir_addr):
+
+            self.func = Func(arch, ir_addr)
+
+            CFGraphBuilder.traverse(self, ir_addr)
+
+    # number of bytes to read for basic block translation
+    BB_READ_SIZE = 0x100
+
+    def __init__(self, reader, storage = None, opts = 0):
+
+        import translator
+        
+        self.arch = get_arch(reader.arch)
+        self.translator = translator.Translator(reader.arch, opts = opts)
+        self.storage = CodeStorageMem(reader.arch) if storage is None else storage
+        self.opts = opts
+        self.reader = reader
+
+    def translate_insn(self, data, addr):                
+
+        # generate IR instructions
+        return self.process_insn(self.translator.to_reil(data, addr = addr), addr)
+
+    def _translate_bb_range(self, addr):
+
+        try:
+
+            data = self.reader.read(addr, self.BB_READ_SIZE)
+
+        except Exception:
+
+            # reader might be unable to read the whole range
+            return None
+
+        if not data: return None
+
+        # translate instructions until the end of the basic block
+        buff, bounds, _ = self.translator.to_reil_range(data, addr = addr, bb = True)
+
+        if len(bounds) == 0: return None
+
+        return [ ( insn_addr, self.process_insn(buff[first : last], insn_addr) ) \
+                 for insn_addr, _, first, last in bounds ]
+
+    def _translate_bb(self, addr):
+
+        ret = self._translate_bb_range(addr)
+        if ret is not None: return ret
+
+        ret = []
+
+        while True:
+
+            # translate basic block instruction by instruction
+            data = self.reader.read_insn(addr)
+            if data is None: raise ReadError(addr)
+
+            insn_list = self.translate_insn(data, addr)
+            ret.append(( addr, insn_list ))
+
+            insn = Insn(insn_list[-1])
+            if insn.has_flag(IOPT_BB_END): return ret
+
+            addr += insn.size
+
+    def has_insn(self, addr):
+
+        try: 
+
+            self.storage.get_insn(( addr, 0 ))
+            return True
+
+        except StorageError: 
+
+            return False
+
+    def translate_bb(self, addr):
+
+        insn_list = self._translate_bb_range(addr)
+        if insn_list is None: return False
+
+        ret = []
+
+        for insn_addr, insn_data in insn_list:
+
+            # don't overwrite already existing instructions
+            if insn_addr != addr and self.has_insn(insn_addr): continue
+
+            ret += insn_data
+
+        self.storage.put_many(ret)
+        return True
+
+    def translate_range(self, start, end):
+
+        try:
+
+            data = self.reader.read(start, end - start)
+
+        except Exception:
+
+            # reader might be unable to read the whole range
+            return False
+
+        if not data: return False
+
+        # translate all of the instructions of the range with single call
+        buff, bounds, _ = self.translator.to_reil_range(data, addr = start)
+        ret = []
+
+        for insn_addr, _, first, last in bounds:
+
+            # don't overwrite already existing instructions
+            if self.has_insn(insn_addr): continue
+
+            ret += self.process_insn(buff[first : last], insn_addr)
+
+        self.storage.put_many(ret)
+        return True
+
+    def translate_parallel(self, addr_list, workers = None, chunk_size = 0x10):
+
+        import multiprocessing
+
+        # each worker process uses its own copy of translator
+        pool = multiprocessing.Pool(workers, _translate_worker_init, ( self, ))
+        known, errors = set(), []
+
+        queue = sorted(set(addr_list))
+
+        try:
+
+            while len(queue) > 0:
+
+                known.update(queue)
+                found = set()
+
+                # results are returned in the same order as addresses in the queue
+                for addr, bb, error in pool.imap(_translate_worker_bb, queue, chunk_size):
+
+                    if error: errors.append(addr)
+
+                    ret = []
+
+                    for insn_addr, insn_data in bb:
+
+                        known.add(insn_addr)
+                        if self.has_insn(insn_addr): continue
+
+                        for insn in insn_data: 
+
+                            insn = Insn(insn)
+                            ret.append(insn)
+
+                            # collect jump and call destinations
+                            jcc_loc = insn.jcc_loc()
+                            if jcc_loc is not None: found.add(jcc_loc[0])
+
+                        next = insn.next()
+                        if next is not None: found.add(next[0])
+
+                    # store whole basic block with single call
+                    self.storage.put_many(ret)
+
+                queue = sorted(found - known)
+
+        finally:
+
+            pool.close()
+            pool.join()
+
+        # addresses of basic blocks that can't be translated
+        return errors
+
+    def process_insn(self, ret, addr):
+
+        src, dst = [], []
+        unk_insn = Insn(I_UNK, ir_addr = ( addr, 0 ))
+        unk_insn.set_flag(IOPT_ASM_END)        
+
+        #
+        # Convert untranslated instruction representation into the 
+        # single I_NONE IR instruction and save operands information
+        # into it's attributes.
+        #
+        for insn in ret:
+
+            if Insn_inum(insn) == 0:
+
+                attr = Insn_attr(insn)
+                if attr.has_key(IATTR_ASM): unk_insn.set_attr(IATTR_ASM, attr[IATTR_ASM])
+                if attr.has_key(IATTR_BIN): unk_insn.set_attr(IATTR_BIN, attr[IATTR_BIN])
+
+            if Insn_op(insn) == I_UNK:
+
+                args = Insn_args(insn)
+                a, c = Arg(args[0]), Arg(args[2])
+
+                if a.type != A_NONE: src.append(a.serialize())
+                if c.type != A_NONE: dst.append(c.serialize())
+
+                unk_insn.size = Insn_size(insn)
+
+            else:
+
+                return ret
+
+        if len(src) > 0: unk_insn.set_attr(IATTR_SRC, src)
+        if len(dst) > 0: unk_insn.set_attr(IATTR_DST, dst)
+
+        return [ unk_insn.serialize() ]
+
+    def clear(self): 
+
+        self.storage.clear()
+
+    def size(self): 
+
+        return self.storage.size()
+
+    def get_insn(self, ir_addr):
+
+        ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, None)
+        ret = InsnList()
+
+        try: 
+
+            # query already translated IR instructions for this address
+            return self.storage.get_insn(ir_addr)
+
+        except StorageError:
+
+            if self.reader is None: raise ReadError(ir_addr[0])
+
+            if self.translate_bb(ir_addr[0]): 
+
+                return self.storage.get_insn(ir_addr)
+
+            # read instruction bytes from memory
+            data = self.reader.read_insn(ir_addr[0])
+            if data is None: raise ReadError(ir_addr[0])
+
+            # translate to REIL
+            ret = self.translate_insn(data, ir_addr[0])
+
+        # save to storage
+        for insn in ret: self.storage.put_insn(insn)
+        return self.storage.get_insn(ir_addr)
+
+    def put_insn(self, insn_or_insn_list):
+
+        self.storage.put_insn(insn_or_insn_list)
+
+    def put_many(self, insn_list):
+
+        self.storage.put_many(insn_list)
+
+    def iter_from(self, ir_addr = None):
+
+        return self.storage.iter_from(ir_addr)
+
+    def get_range(self, start, end):
+
+        start_addr, end_addr = range_key(start)[0], range_key(end)[0]
+
+        if self.reader is not None and end_addr > start_addr:
+
+            addr = start_addr
+
+            # check if the range is already translated
+            for insn in self.storage.iter_from(start_addr):
+
+                if insn.addr != addr or insn.addr >= end_addr: break
+                if insn.has_flag(IOPT_ASM_END): addr += insn.size
+
+            if addr < end_addr: self.translate_range(addr, end_addr)
+
+        return self.storage.get_range(start, end)
+
+    def del_range(self, start, end):
+
+        return self.storage.del_range(start, end)
+
+    def get_bb(self, ir_addr):
+        
+        return CFGraphBuilder(self).get_bb(ir_addr)
+
+    def get_func(self, ir_addr):
+
+        cfg = self.CFGraphBuilderFunc(self)
+        cfg.traverse(self.arch, ir_addr)
+
+        return cfg.func
+
+
+class TestCodeStorageTranslator(unittest.TestCase):
+
+    arch = ARCH_X86
+
+    def setUp(self):        
+
+        # test assembly code
+        code = ( 'xor eax, eax', 'ret' )
+        
+        from pyopenreil.utils import asm
+        self.tr = CodeStorageTranslator(asm.Reader(self.arch, code))
+
+    def test_range(self):
+
+        from pyopenreil.utils import asm
+
+        code = ( 'nop', 'inc eax', 'ret', 'nop' )
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = 0x1000))
+        data = tr.reader.read(0x1000, 4)
+
+        # translate all of the instructions
+        buff, bounds, errors = tr.translator.to_reil_range(data, addr = 0x1000)
+        assert [ ( addr, size ) for addr, size, _, _ in bounds ] == \
+               [ ( 0x1000, 1 ), ( 0x1001, 1 ), ( 0x1002, 1 ), ( 0x1003, 1 ) ]
+        assert len(errors) == 0 and bounds[-1][3] == len(buff)
+
+        for addr, size, first, last in bounds:
+
+            assert buff[first : last] == tr.translator.to_reil(data[addr - 0x1000 :], addr = addr)
+
+        # translate single basic block
+        buff, bounds, errors = tr.translator.to_reil_range(data, addr = 0x1000, bb = True)
+        assert len(bounds) == 3 and len(errors) == 0
+
+        # truncated instruction is reported as error
+        buff, bounds, errors = tr.translator.to_reil_range(data[: 2] + '\xe8\x00', addr = 0x1000)
+        assert len(bounds) == 2 and errors == [ 0x1002 ]
+
+        # whole basic block must be saved into the storage
+        tr.get_insn(0x1000)
+        tr.storage.get_insn(0x1002)
+
+        try: 
+
+            tr.storage.get_insn(0x1003)
+            assert False
+
+        except StorageError: pass
+
+        # instructions of the range are translated on demand
+        assert [ insn.addr for insn in tr.get_range(0x1001, 0x1004) if insn.inum == 0 ] == \
+               [ 0x1001, 0x1002, 0x1003 ]
+
+        tr.storage.get_insn(0x1003)
+
+        assert tr.del_range(0x1003, 0x1004) == 1
+        assert [ insn.addr for insn in tr.iter_from(0x1002) ] == [ 0x1002 ] * len(tr.get_insn(0x1002))
+
+    def test_parallel(self):
+
+        from pyopenreil.utils import asm
+
+        code = ( 'mov ecx, 3', 
+                 'l: call f', 
+                 'dec ecx', 
+                 'jnz l', 
+                 'ret', 
+                 'f: inc eax', 
+                 'jmp m',
+                 'nop',
+                 'm: ret' )
+
+        reader = asm.Reader(self.arch, code, addr = 0x1000)
+
+        # translate all of the code that is reachable from the entry point
+        tr = CodeStorageTranslator(reader)
+        assert tr.translate_parallel([ 0x1000 ], workers = 2) == []
+
+        addr_list = sorted(set([ insn.addr for insn in tr.storage ]))
+        assert addr_list == [ 0x1000, 0x1005, 0x100a, 0x100b, 0x100d, 0x100e, 0x100f, 0x1012 ]
+
+        # check for the same results as for serial translation
+        tr_serial = CodeStorageTranslator(reader)
+
+        for addr in addr_list:
+
+            assert tr.storage.get_insn(addr) == tr_serial.get_insn(addr)
 
     def test_unknown_insn_x86(self):
 
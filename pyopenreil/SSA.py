@@ -0,0 +1,877 @@
+import sys, os, unittest
+from sets import Set
+
+from REIL import *
+
+# name of the pseudo variable that represents memory state
+SSA_MEM = 'MEM'
+
+# predecessor index of the function entry edge
+SSA_ENTRY = -1
+
+
+class SSAFunc(object):
+
+    '''
+        SSA form of REIL function.
+
+        Basic blocks are numbered in reverse postorder starting from the
+        function entry, SSA values are integer indexes. Each value has
+        variable name, version and location: address of the defining IR
+        instruction, address of the basic block for phi functions or
+        None for values that variable has at the function entry.
+    '''
+
+    def __init__(self, arch, bb_list, ir_addr):
+
+        self.arch = arch
+        self.ir_addr = ir_addr if isinstance(ir_addr, tuple) else (ir_addr, 0)
+
+        # values information
+        self.var, self.version, self.loc = [], [], []
+        self.entry, self.versions = {}, {}
+
+        # phi functions of each block (var -> value) and their operands (pred -> value)
+        self.phi_args = {}
+
+        # values used and defined by IR instructions (ir_addr -> { name: value })
+        self.insn_uses, self.insn_defs = {}, {}
+
+        self._build_graph(bb_list)
+        self._build_dom()
+        self._build_frontier()
+        self._place_phi()
+        self._rename()
+        self._build_users()
+
+        del self.block_args
+
+    def __str__(self):
+
+        return self.to_str()
+
+    def _build_graph(self, bb_list):
+
+        bb_map, leaders = {}, Set([ bb.ir_addr for bb in bb_list ])
+
+        for bb in bb_list:
+
+            #
+            # Basic blocks of CFG ends only with branch instructions, so
+            # jump into the middle of basic block produces overlapping blocks.
+            # Split them to get a non-overlapping ones.
+            #
+            insn_list = []
+
+            for insn in bb:
+
+                if len(insn_list) > 0 and insn.ir_addr() in leaders:
+
+                    bb_map[insn_list[0].ir_addr()] = BasicBlock(insn_list)
+                    insn_list = []
+
+                insn_list.append(insn)
+
+            bb_map[insn_list[0].ir_addr()] = BasicBlock(insn_list)
+
+        order, visited, stack = [], Set([ self.ir_addr ]), [ ( self.ir_addr, 0 ) ]
+
+        def _succ(key):
+
+            ret = []
+
+            for addr in bb_map[key].get_successors():
+
+                if addr is not None and bb_map.has_key(addr) and not addr in ret:
+
+                    ret.append(addr)
+
+            return ret
+
+        # iterative DFS to get blocks postorder
+        while len(stack) > 0:
+
+            key, n = stack.pop()
+            succ = _succ(key)
+
+            if n < len(succ):
+
+                stack.append(( key, n + 1 ))
+
+                if not succ[n] in visited:
+
+                    visited.add(succ[n])
+                    stack.append(( succ[n], 0 ))
+
+            else: order.append(key)
+
+        order.reverse()
+
+        self.blocks = [ bb_map[key] for key in order ]
+        self.index = dict([ ( order[n], n ) for n in range(0, len(order)) ])
+        self.insn_block = {}
+
+        for n in range(0, len(order)):
+
+            for insn in self.blocks[n]: self.insn_block[insn.ir_addr()] = n
+
+        self.succs = [ [ self.index[key] for key in _succ(key) ] for key in order ]
+        self.preds = [ [] for n in order ]
+
+        # fall-through and branch target successors of each block
+        self.succ_next, self.succ_jcc = [], []
+
+        for key in order:
+
+            lhs, rhs = bb_map[key].get_successors()
+
+            self.succ_next.append(self.index.get(lhs))
+            self.succ_jcc.append(self.index.get(rhs))
+
+        for n in range(0, len(order)):
+
+            for m in self.succs[n]: self.preds[m].append(n)
+
+    def _build_dom(self):
+
+        # blocks are already numbered in reverse postorder
+        self.dom_tree = DomTree(self.succs)
+        self.idom, self.children = self.dom_tree.idom, self.dom_tree.children
+
+    def _build_frontier(self):
+
+        self.frontier = [ Set() for n in self.blocks ]
+
+        for n in range(0, len(self.blocks)):
+
+            preds = self.preds[n]
+
+            # function entry has additional incoming edge
+            if len(preds) < (1 if n == 0 else 2): continue
+
+            # immediate dominator of the function entry is it's incoming edge
+            stop = None if n == 0 else self.idom[n]
+
+            for m in preds:
+
+                runner = m
+                while runner != stop:
+
+                    self.frontier[runner].add(n)
+                    runner = None if runner == 0 else self.idom[runner]
+
+    def _insn_args(self, insn):
+
+        src = [ arg.name for arg in insn.src() ]
+        dst = [ arg.name for arg in insn.dst() ]
+
+        if insn.has_flag(IOPT_CALL):
+
+            # the same assumptions as in DFGraphBuilder
+            src = dst = list(self.arch.Registers.general)
+
+        if insn.op == I_LDM or insn.has_flag(IOPT_CALL):
+
+            src = src + [ SSA_MEM ]
+
+        if insn.op == I_STM or insn.has_flag(IOPT_CALL):
+
+            # memory write creates a new version of memory state
+            src, dst = src + [ SSA_MEM ], dst + [ SSA_MEM ]
+
+        return src, dst
+
+    def _place_phi(self):
+
+        defsites, globals = {}, Set()
+
+        # variables used and defined by each instruction of the block
+        self.block_args = [ map(self._insn_args, bb) for bb in self.blocks ]
+
+        for n in range(0, len(self.blocks)):
+
+            killed = Set()
+
+            for src, dst in self.block_args[n]:
+
+                # semi-pruned SSA: only variables that are live across blocks needs phi
+                for var in src:
+
+                    if not var in killed: globals.add(var)
+
+                for var in dst:
+
+                    killed.add(var)
+                    defsites.setdefault(var, Set()).add(n)
+
+        self.phi = [ {} for n in self.blocks ]
+
+        for var in globals:
+
+            placed, worklist = Set(), list(defsites.get(var, []))
+
+            while len(worklist) > 0:
+
+                n = worklist.pop()
+
+                for m in self.frontier[n]:
+
+                    if not m in placed:
+
+                        placed.add(m)
+                        self.phi[m][var] = self._new_value(var, self.blocks[m].ir_addr)
+                        self.phi_args[self.phi[m][var]] = {}
+
+                        worklist.append(m)
+
+    def _new_value(self, var, loc):
+
+        self.var.append(var)
+        self.version.append(None)
+        self.loc.append(loc)
+
+        return len(self.var) - 1
+
+    def _entry_value(self, var):
+
+        try: return self.entry[var]
+        except KeyError: pass
+
+        # variable value at the function entry always has version 0
+        self.var.append(var)
+        self.version.append(0)
+        self.loc.append(None)
+
+        self.entry[var] = len(self.var) - 1
+
+        return self.entry[var]
+
+    def _rename(self):
+
+        stacks = {}
+
+        def _top(var):
+
+            try: return stacks[var][-1]
+            except (KeyError, IndexError): return self._entry_value(var)
+
+        def _push(var, val):
+
+            # versions are numbered in order of dominator tree traversal
+            self.versions[var] = self.versions.get(var, 0) + 1
+            self.version[val] = self.versions[var]
+
+            stacks.setdefault(var, []).append(val)
+            pushed.append(var)
+
+        # entry edge provides initial values for phi functions of the first block
+        for var, val in self.phi[0].items():
+
+            self.phi_args[val][SSA_ENTRY] = self._entry_value(var)
+
+        # iterative pre-order traversal of dominator tree
+        stack = [ ( 0, None ) ]
+
+        while len(stack) > 0:
+
+            n, pushed = stack.pop()
+
+            if pushed is not None:
+
+                # leaving dominator tree node, restore variables state
+                for var in pushed: stacks[var].pop()
+                continue
+
+            pushed = []
+
+            for var, val in self.phi[n].items(): _push(var, val)
+
+            for insn, ( src, dst ) in zip(self.blocks[n], self.block_args[n]):
+
+                ir_addr = insn.ir_addr()
+
+                self.insn_uses[ir_addr] = dict([ ( var, _top(var) ) for var in src ])
+                self.insn_defs[ir_addr] = {}
+
+                for var in dst:
+
+                    val = self._new_value(var, ir_addr)
+
+                    self.insn_defs[ir_addr][var] = val
+                    _push(var, val)
+
+            for m in self.succs[n]:
+
+                # set phi operands of successors for the current edge
+                for var, val in self.phi[m].items(): self.phi_args[val][n] = _top(var)
+
+            stack.append(( n, pushed ))
+            for m in reversed(self.children[n]): stack.append(( m, None ))
+
+    def _build_users(self):
+
+        self.users = [ [] for val in self.var ]
+
+        for ir_addr, uses in self.insn_uses.items():
+
+            for val in uses.values():
+
+                if not ir_addr in self.users[val]: self.users[val].append(ir_addr)
+
+        for val, args in self.phi_args.items():
+
+            for arg in args.values():
+
+                if not val in self.users[arg]: self.users[arg].append(val)
+
+    def name(self, val):
+
+        return '%s.%d' % (self.var[val], self.version[val])
+
+    def is_phi(self, val):
+
+        return self.phi_args.has_key(val)
+
+    def is_entry(self, val):
+
+        return self.loc[val] is None
+
+    def get_def(self, ir_addr, var):
+
+        return self.insn_defs[ir_addr][var]
+
+    def get_use(self, ir_addr, var):
+
+        return self.insn_uses[ir_addr][var]
+
+    def get_block(self, ir_addr):
+
+        return self.index[ir_addr if isinstance(ir_addr, tuple) else (ir_addr, 0)]
+
+    def def_block(self, val):
+
+        if self.is_entry(val): return None
+        if self.is_phi(val): return self.index[self.loc[val]]
+
+        return self.insn_block[self.loc[val]]
+
+    def dominates(self, a, b):
+
+        # check if block a dominates block b
+        return self.dom_tree.dominates(a, b)
+
+    def values(self, var = None):
+
+        return [ val for val in range(0, len(self.var)) if var is None or self.var[val] == var ]
+
+    def to_str(self):
+
+        ret = ''
+
+        def _arg(arg, vals):
+
+            if not arg.is_var() or not vals.has_key(arg.name): return str(arg)
+
+            return '%s:%s' % (self.name(vals[arg.name]), arg.size_name())
+
+        for n in range(0, len(self.blocks)):
+
+            bb = self.blocks[n]
+            ret += '; BB %d %s : %s, idom %d\n' % \
+                   (n, bb.first.ir_addr(), bb.last.ir_addr(), self.idom[n])
+
+            for var, val in sorted(self.phi[n].items()):
+
+                args = sorted(self.phi_args[val].items())
+                args = ', '.join([ '%s:%s' % (self.name(arg), pred) for pred, arg in args ])
+
+                ret += '%25s = phi(%s)\n' % (self.name(val), args)
+
+            for insn in bb:
+
+                ir_addr = insn.ir_addr()
+                uses, defs = self.insn_uses[ir_addr], self.insn_defs[ir_addr]
+                c = _arg(insn.c, uses if insn.op in [ I_JCC, I_STM ] else defs)
+
+                ret += '%.8x.%.2x %7s %16s, %16s, %16s\n' % \
+                       (insn.addr, insn.inum, insn.op_name(),
+                        _arg(insn.a, uses), _arg(insn.b, uses), c)
+
+        return ret
+
+
+# lattice values of sparse conditional constant propagation
+SCCP_TOP = 'TOP'
+SCCP_BOTTOM = 'BOTTOM'
+
+
+class SCCP(object):
+
+    '''
+        Sparse conditional constant propagation over SSA form of REIL
+        function (Wegman and Zadeck). Value of each SSA value is
+        SCCP_TOP (not known yet), constant or SCCP_BOTTOM (not a constant),
+        blocks that are reachable only through never taken branches
+        are left not executable.
+    '''
+
+    # REIL type to number of bits of the host integer used by VM.Math
+    map_width = { U1: 8, U8: 8, U16: 16, U32: 32, U64: 64 }
+
+    def __init__(self, ssa):
+
+        self.ssa = ssa
+        self.value = [ SCCP_TOP ] * len(ssa.var)
+
+        # executable blocks and CFG edges (pred, succ)
+        self.executable = [ False ] * len(ssa.blocks)
+        self.edges = Set()
+
+        self.insns = {}
+
+        for bb in ssa.blocks:
+
+            for insn in bb: self.insns[insn.ir_addr()] = insn
+
+        # nothing is known about values that variables have at the function entry
+        for val in ssa.entry.values(): self.value[val] = SCCP_BOTTOM
+
+        self._run()
+
+    def _run(self):
+
+        ssa = self.ssa
+        self.flow, self.work = [ ( SSA_ENTRY, 0 ) ], []
+
+        while len(self.flow) > 0 or len(self.work) > 0:
+
+            while len(self.flow) > 0:
+
+                edge = self.flow.pop()
+                if edge in self.edges: continue
+
+                self.edges.add(edge)
+                n = edge[1]
+
+                # phi operands set was changed
+                for val in ssa.phi[n].values(): self._visit_phi(val)
+
+                if not self.executable[n]:
+
+                    self.executable[n] = True
+
+                    for insn in ssa.blocks[n]: self._visit_insn(insn)
+
+                    self._visit_branch(n)
+
+            while len(self.work) > 0:
+
+                for user in ssa.users[self.work.pop()]:
+
+                    if isinstance(user, tuple):
+
+                        n = ssa.insn_block[user]
+                        if not self.executable[n]: continue
+
+                        insn = self.insns[user]
+                        self._visit_insn(insn)
+
+                        if insn == ssa.blocks[n].last: self._visit_branch(n)
+
+                    elif self.executable[ssa.def_block(user)]:
+
+                        self._visit_phi(user)
+
+        del self.flow, self.work
+
+    def _set(self, val, new):
+
+        if self.value[val] != new:
+
+            # lattice values are only lowered, so each value is changed twice at most
+            self.value[val] = new
+            self.work.append(val)
+
+    def _arg(self, insn, arg):
+
+        if arg.type == A_CONST: return arg.get_val()
+
+        return self.value[self.ssa.insn_uses[insn.ir_addr()][arg.name]]
+
+    def _visit_phi(self, val):
+
+        ssa, ret = self.ssa, SCCP_TOP
+        n = ssa.def_block(val)
+
+        for pred, arg in ssa.phi_args[val].items():
+
+            # ignore operands that comes from not executable edges
+            if not ( pred, n ) in self.edges: continue
+
+            arg = self.value[arg]
+
+            if arg == SCCP_TOP: continue
+            if ret == SCCP_TOP: ret = arg
+            if ret != arg: ret = SCCP_BOTTOM
+
+        self._set(val, ret)
+
+    def _visit_insn(self, insn):
+
+        defs = self.ssa.insn_defs[insn.ir_addr()]
+        if len(defs) == 0: return
+
+        if insn.op in [ I_LDM, I_STM, I_UNK ] or insn.has_flag(IOPT_CALL) or \
+           insn.has_flag(IOPT_ELIMINATED):
+
+            # memory contents, calls and unknown instructions are not evaluated
+            for val in defs.values(): self._set(val, SCCP_BOTTOM)
+
+            return
+
+        self._set(defs[insn.c.name], self._evaluate(insn))
+
+    def _evaluate(self, insn):
+
+        a = self._arg(insn, insn.a)
+        b = None if insn.b.type == A_NONE else self._arg(insn, insn.b)
+
+        if a == SCCP_TOP or b == SCCP_TOP: return SCCP_TOP
+
+        if a == SCCP_BOTTOM or b == SCCP_BOTTOM:
+
+            if insn.op in [ I_AND, I_MUL, I_SMUL ] and 0 in [ a, b ]:
+
+                # result is zero regardless of other operand value
+                return 0L
+
+            if insn.a.is_var() and insn.a.name == insn.b.name:
+
+                # the same value on both sides
+                if insn.op in [ I_SUB, I_XOR, I_LT, I_NEQ ]: return 0L
+                if insn.op in [ I_EQ, I_LE ]: return 1L
+
+            return SCCP_BOTTOM
+
+        val = self.evaluate(insn.op, a, insn.a.size, b, insn.b.size)
+
+        return SCCP_BOTTOM if val is None else Arg(A_CONST, insn.c.size, val = val).get_val()
+
+    def _visit_branch(self, n):
+
+        ssa = self.ssa
+        insn = ssa.blocks[n].last
+        succs = ssa.succs[n]
+
+        if insn.op == I_JCC and not insn.has_flag(IOPT_CALL) and \
+           not insn.has_flag(IOPT_ELIMINATED):
+
+            cond = self._arg(insn, insn.a)
+
+            if cond == SCCP_TOP: 
+
+                succs = []
+
+            elif cond != SCCP_BOTTOM:
+
+                # only one of the branch targets is reachable
+                succ = ssa.succ_next[n] if cond == 0 else ssa.succ_jcc[n]
+                succs = [] if succ is None else [ succ ]
+
+        for m in succs: self.flow.append(( n, m ))
+
+    def evaluate(self, op, a, a_size, b = None, b_size = None):
+
+        '''
+            Evaluate REIL instruction with constant arguments, semantics
+            is the same as for VM.Math. Returns None when result is not
+            defined (division by zero and too large shift counts).
+        '''
+
+        width = self.map_width[a_size]
+        if b is not None: width = max(width, self.map_width[b_size])
+
+        mask = (1L << width) - 1
+
+        def _signed(val, size):
+
+            bits = self.map_width[size]
+            return val - (1L << bits) if val >> (bits - 1) & 1 else val
+
+        if op == I_STR: return a
+
+        signed = op in [ I_SMUL, I_SDIV, I_SMOD, I_SAR, I_SEXT ]
+
+        if signed:
+
+            a = _signed(a, a_size)
+            if b is not None: b = _signed(b, b_size)
+
+        if op in [ I_DIV, I_MOD, I_SDIV, I_SMOD ] and b == 0: return None
+        if op in [ I_SHL, I_SHR, I_SAR ] and not 0 <= b < width: return None
+
+        if op in [ I_ROL, I_ROR ]:
+
+            bits = { U1: 1, U8: 8, U16: 16, U32: 32, U64: 64 }[a_size]
+            count = b % bits
+
+            if op == I_ROR: count = (bits - count) % bits
+
+            return ((a << count) | (a >> (bits - count))) & ((1L << bits) - 1)
+
+        fn = { I_ADD: lambda: a + b,  I_SUB: lambda: a - b,
+               I_NEG: lambda: -a,     I_MUL: lambda: a * b,
+               I_DIV: lambda: a / b,  I_MOD: lambda: a % b,
+              I_SMUL: lambda: a * b, I_SDIV: lambda: a / b, 
+              I_SMOD: lambda: a % b,  I_SHL: lambda: a << b,
+               I_SHR: lambda: a >> b, I_SAR: lambda: a >> b,
+               I_AND: lambda: a & b,   I_OR: lambda: a | b,
+               I_XOR: lambda: a ^ b,  I_NOT: lambda: ~a,
+                I_EQ: lambda: a == b,  I_LT: lambda: a < b,
+               I_NEQ: lambda: a != b,  I_LE: lambda: a <= b,
+              I_SEXT: lambda: a }.get(op)
+
+        if fn is None: return None
+
+        ret = long(fn()) & mask
+
+        # signed result is extended to the destination size by caller
+        return ret - (mask + 1) if signed and ret >> (width - 1) else ret
+
+    def get_const(self, val):
+
+        ret = self.value[val]
+        return None if ret in [ SCCP_TOP, SCCP_BOTTOM ] else ret
+
+    def is_const(self, val):
+
+        return self.get_const(val) is not None
+
+
+class SSABuilder(object):
+
+    def __init__(self, storage):
+
+        self.arch = storage.arch
+        self.storage = storage
+
+    def traverse(self, ir_addr):
+
+        cfg = CFGraphBuilder(self.storage).traverse(ir_addr)
+        bb_list = [ node.item for node in cfg.nodes.values() ]
+
+        return SSAFunc(self.arch, bb_list, ir_addr)
+
+    def from_func(self, func):
+
+        return SSAFunc(self.arch, func.bb_list, func.addr)
+
+
+class TestSSA(unittest.TestCase):
+
+    arch = ARCH_X86
+
+    def _get_ssa(self, code):
+
+        from pyopenreil.utils import asm
+
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = 0))
+
+        return tr, SSABuilder(tr).traverse(0)
+
+    def _check(self, ssa):
+
+        for ir_addr, uses in ssa.insn_uses.items():
+
+            for val in uses.values():
+
+                # each use must be dominated by the definition
+                if not ssa.is_entry(val): 
+
+                    assert ssa.dominates(ssa.def_block(val), ssa.insn_block[ir_addr])
+
+    def test_dom(self):
+
+        code = ( 'test eax, eax',       # 0
+                 'jz _l',               # 2
+                 'inc ebx',             # 4
+                 '_l: mov ecx, ebx',    # 5
+                 'ret' )                # 7
+
+        tr, ssa = self._get_ssa(code)
+        self._check(ssa)
+
+        print '\n', ssa
+
+        bb_test, bb_inc, bb_mov = ssa.get_block(0), ssa.get_block(4), ssa.get_block(5)
+
+        # jz is translated into conditional and unconditional IR branches
+        bb_jmp = ssa.get_block(( 2, 3 ))
+
+        assert bb_test == 0
+        assert ssa.idom[bb_jmp] == bb_test and ssa.idom[bb_inc] == bb_jmp
+        assert ssa.idom[bb_mov] == bb_test
+        assert ssa.frontier[bb_inc] == Set([ bb_mov ])
+        assert ssa.dominates(bb_test, bb_mov) and not ssa.dominates(bb_inc, bb_mov)
+
+    def test_phi(self):
+
+        code = ( 'test eax, eax',       # 0
+                 'jz _l',               # 2
+                 'inc ebx',             # 4
+                 '_l: mov ecx, ebx',    # 5
+                 'ret' )                # 7
+
+        tr, ssa = self._get_ssa(code)
+        self._check(ssa)
+        bb_inc, bb_mov = ssa.get_block(4), ssa.get_block(5)
+
+        # EBX has phi at the join point
+        val = ssa.phi[bb_mov]['R_EBX']
+        args = ssa.phi_args[val]
+
+        assert len(ssa.values('R_EBX')) == 3
+        assert ssa.is_phi(val) and ssa.loc[val] == ( 5, 0 )
+        assert Set(args.keys()) == Set(ssa.preds[bb_mov])
+
+        # one operand is EBX value from function entry, other is the result of inc
+        assert Set(map(lambda v: ssa.loc[v] is None, args.values())) == Set([ True, False ])
+        assert ssa.entry['R_EBX'] in args.values()
+
+        # mov ecx, ebx uses phi result
+        insn = filter(lambda insn: insn.op == I_STR and insn.a.name == 'R_EBX', tr.get_insn(5))[0]
+        assert ssa.get_use(insn.ir_addr(), 'R_EBX') == val
+        assert insn.ir_addr() in ssa.users[val]
+
+        # no phi for temp registers and values that are not used later
+        assert not ssa.phi[bb_mov].has_key('V_00')
+
+    def test_loop(self):
+
+        code = ( 'xor eax, eax',        # 0
+                 'mov ecx, 10',         # 2
+                 '_l: add eax, ecx',    # 7
+                 'mov [esp], eax',      # 9
+                 'dec ecx',             # c
+                 'jnz _l',              # d
+                 'ret' )                # f
+
+        tr, ssa = self._get_ssa(code)
+        self._check(ssa)
+        bb_loop = ssa.get_block(7)
+
+        # loop header has phi for induction variable, accumulator and memory
+        assert Set([ 'R_EAX', 'R_ECX', SSA_MEM ]).issubset(Set(ssa.phi[bb_loop].keys()))
+
+        val = ssa.phi[bb_loop][SSA_MEM]
+        assert ssa.entry[SSA_MEM] in ssa.phi_args[val].values()
+
+        # memory write creates a new memory version
+        insn = filter(lambda insn: insn.op == I_STM, tr.get_insn(9))[0]
+        assert ssa.get_use(insn.ir_addr(), SSA_MEM) == val
+        assert ssa.get_def(insn.ir_addr(), SSA_MEM) in ssa.phi_args[val].values()
+
+        # each value has exactly one definition
+        assert len(ssa.insn_defs) == sum(map(len, ssa.blocks))
+
+        defs = []
+        for vals in ssa.insn_defs.values(): defs += vals.values()
+
+        assert len(defs) == len(Set(defs))
+
+    def test_entry_loop(self):
+
+        code = ( '_l: dec ecx',         # 0
+                 'jnz _l',              # 1
+                 'ret' )                # 3
+
+        tr, ssa = self._get_ssa(code)
+        self._check(ssa)
+
+        # loop to the function entry needs phi with operand for the entry edge
+        val = ssa.phi[0]['R_ECX']
+        args = ssa.phi_args[val]
+
+        assert Set(args.keys()) == Set([ SSA_ENTRY, ssa.get_block(( 1, 3 )) ])
+        assert args[SSA_ENTRY] == ssa.entry['R_ECX']
+
+        # value from the loop back edge is the result of dec
+        val = args[ssa.get_block(( 1, 3 ))]
+        assert ssa.loc[val][0] == 0 and ssa.var[val] == 'R_ECX'
+
+    def test_sccp(self):
+
+        code = ( 'xor eax, eax',        # 0
+                 'test ebx, ebx',       # 2
+                 'jz _l',               # 4
+                 'mov eax, 1',          # 6
+                 '_l: mov ecx, eax',    # b
+                 'test eax, eax',       # d
+                 'jnz _r',              # f
+                 'mov edx, 2',          # 11
+                 '_r: ret' )            # 16
+
+        tr, ssa = self._get_ssa(code)
+        sccp = SCCP(ssa)
+
+        print '\n', ssa
+
+        get_const = lambda ir_addr, var: sccp.get_const(ssa.get_def(ir_addr, var))
+
+        # both branches of the first jz are executable
+        assert sccp.executable[ssa.get_block(6)] and sccp.executable[ssa.get_block(0xb)]
+
+        # EAX has different values on each path
+        assert sccp.value[ssa.phi[ssa.get_block(0xb)]['R_EAX']] == SCCP_BOTTOM
+        assert get_const(( 6, 0 ), 'R_EAX') == 1 and get_const(( 0xb, 1 ), 'R_ECX') is None
+
+        code = code[: 3] + ( 'xor eax, eax', ) + code[4 :]
+
+        tr, ssa = self._get_ssa(code)
+        sccp = SCCP(ssa)
+
+        # EAX is zero on both paths, so jnz is never taken
+        assert sccp.get_const(ssa.phi[ssa.get_block(8)]['R_EAX']) == 0
+        assert get_const(( 8, 1 ), 'R_ECX') == 0
+
+        # jnz is translated into inverted conditional branch and jump to the target
+        bb_jnz, bb_jmp = ssa.get_block(8), ssa.get_block(( 0xc, 3 ))
+        assert sccp.executable[ssa.get_block(0xe)] and not sccp.executable[bb_jmp]
+        assert ( bb_jnz, ssa.succ_jcc[bb_jnz] ) in sccp.edges
+        assert not ( bb_jnz, bb_jmp ) in sccp.edges
+
+    def test_sccp_loop(self):
+
+        code = ( 'mov eax, 1',          # 0
+                 '_l: mov ebx, eax',    # 5
+                 'mov eax, 1',          # 7
+                 'dec ecx',             # c
+                 'jnz _l',              # d
+                 'ret' )                # f
+
+        tr, ssa = self._get_ssa(code)
+        sccp = SCCP(ssa)
+
+        # phi of the loop header has the same constant from both edges
+        assert sccp.get_const(ssa.phi[ssa.get_block(5)]['R_EAX']) == 1
+        assert sccp.get_const(ssa.get_def(( 5, 1 ), 'R_EBX')) == 1
+        assert sccp.value[ssa.phi[ssa.get_block(5)]['R_ECX']] == SCCP_BOTTOM
+
+    def test_sccp_eval(self):
+
+        sccp = SCCP.__new__(SCCP)
+
+        # the same semantics as VM.Math
+        assert sccp.evaluate(I_SAR, 0x80000010, U32, 4, U8) & 0xffffffff == 0xf8000001
+        assert sccp.evaluate(I_ROL, 0x80000010, U32, 4, U8) == 0x00000108
+        assert sccp.evaluate(I_SEXT, 0x80, U8) & 0xffffffff == 0xffffff80
+        assert sccp.evaluate(I_SUB, 1, U32, 2, U32) == 0xffffffff
+        assert sccp.evaluate(I_LT, 1, U8, 0x100, U16) == 1
+
+        # undefined results
+        assert sccp.evaluate(I_DIV, 1, U32, 0, U32) is None
+        assert sccp.evaluate(I_SHL, 1, U32, 32, U8) is None
+
+#
+# EoF
+#
@@ -49,11 +49,53 @@ class CpuInstructionError(CpuError):
         return 'Invalid instruction at %s.%.2d' % (hex(self.addr), self.inum)
 
 
+# memory page access flags
+MEM_READ  = 0x00000001
+MEM_WRITE = 0x00000002
+
+
+class MemPage(object):
+
+    def __init__(self, addr, size, flags = MEM_READ | MEM_WRITE):
+
+        self.addr, self.flags = addr, flags
+        self.data = bytearray(size)
+
+        # allocated bytes map, None if whole page was allocated
+        self.valid = bytearray(size)
+
+    def is_valid(self, offs, size):
+
+        return self.valid is None or self.valid.count('\0', offs, offs + size) == 0
+
+    def set_valid(self, offs, size):
+
+        if self.valid is None: return
+
+        self.valid[offs : offs + size] = '\1' * size
+
+        if self.valid.count('\0') == 0: self.valid = None
+
+    def copy(self):
+
+        page = MemPage(self.addr, len(self.data), flags = self.flags)
+        page.data[:] = self.data
+        page.valid = None if self.valid is None else bytearray(self.valid)
+
+        return page
+
+
 class Mem(object):
 
     # start address for memory allocations
     DEF_ALLOC_BASE = 0x11000000
 
+    # memory is allocated by pages stored in two-level table
+    PAGE_BITS = 12
+    PAGE_SIZE = 1 << PAGE_BITS
+    TABLE_BITS = 10
+    TABLE_SIZE = 1 << TABLE_BITS
+
     # REIL type to length map
     map_length = { U8: 1, U16: 2, U32: 4, U64: 8 }
 
@@ -65,11 +107,16 @@ class Mem(object):
 
     def __init__(self, data = None, reader = None, strict = True):
 
-        self.data = {} if data is None else None
+        self.clear()
         self.reader, self.strict = reader, strict
         self.alloc_base = self.DEF_ALLOC_BASE
         self.alloc_last = self.alloc_base
 
+        if data is not None:
+
+            # copy initial memory contents
+            for addr, val in data.items(): self.alloc(addr, data = val)
+
     def pack(self, size, val):
 
         return struct.pack(self.map_format[size], val)
@@ -80,31 +127,197 @@ class Mem(object):
 
     def clear(self):
 
-        self.data = {}
+        self.pages = {}
+
+        # pages and tables that are not shared with snapshots
+        self.owned, self.owned_tables = set(), set()
+
+    def snapshot(self):
+
+        # all existing pages will be copied on write
+        self.owned, self.owned_tables = set(), set()
+
+        return dict(self.pages), self.alloc_last
+
+    def restore(self, snapshot):
+
+        pages, self.alloc_last = snapshot
+
+        self.pages = dict(pages)
+        self.owned, self.owned_tables = set(), set()
+
+    def page(self, addr):
+
+        # get page that holds specified address
+        table = self.pages.get(addr >> (self.PAGE_BITS + self.TABLE_BITS))
+
+        return None if table is None else table[(addr >> self.PAGE_BITS) & (self.TABLE_SIZE - 1)]
+
+    def page_alloc(self, addr, flags = MEM_READ | MEM_WRITE):
+
+        page = self.page_owned(addr)
+        if page is not None: return page
+
+        num = addr >> self.PAGE_BITS
+        table = self.table_owned(num >> self.TABLE_BITS)
+
+        page = table[num & (self.TABLE_SIZE - 1)] = MemPage(num << self.PAGE_BITS, self.PAGE_SIZE, 
+                                                             flags = flags)
+        self.owned.add(page.addr)
+
+        return page
+
+    def table_owned(self, num):
+
+        table = self.pages.get(num)
+
+        if table is None:
+
+            table = self.pages[num] = [ None ] * self.TABLE_SIZE
+
+        elif not num in self.owned_tables:
+
+            # copy table that is shared with snapshot
+            table = self.pages[num] = list(table)
+
+        self.owned_tables.add(num)
+
+        return table
+
+    def page_owned(self, addr):
+
+        # get page that can be modified without affecting snapshots
+        page = self.page(addr)
+        if page is None or page.addr in self.owned: return page
+
+        num = page.addr >> self.PAGE_BITS
+        table = self.table_owned(num >> self.TABLE_BITS)
+
+        page = table[num & (self.TABLE_SIZE - 1)] = page.copy()
+        self.owned.add(page.addr)
+
+        return page
+
+    def page_list(self):
+
+        ret = []
+
+        for table in self.pages.values():
+
+            ret += filter(lambda page: page is not None, table)
+
+        return sorted(ret, key = lambda page: page.addr)
+
+    def split(self, addr, size):
+
+        # split memory range into the parts that belong to the single page
+        while size > 0:
+
+            offs = addr & (self.PAGE_SIZE - 1)
+            part = min(size, self.PAGE_SIZE - offs)
+
+            yield addr, offs, part
+
+            addr += part
+            size -= part
+
+    def protect(self, addr, size, flags):
+
+        # change access flags of allocated pages
+        for part_addr, _, _ in self.split(addr, size):
+
+            page = self.page_owned(part_addr)
+            if page is not None: page.flags = flags
 
     def _read(self, addr, size):
 
-        data = ''
+        offs = addr & (self.PAGE_SIZE - 1)
 
-        for i in range(0, size):
+        if offs + size <= self.PAGE_SIZE:
 
-            if not self.data.has_key(addr + i):
+            page = self.page(addr)
+
+            if page is None or page.flags & MEM_READ == 0 or not page.is_valid(offs, size):
 
                 raise MemReadError(addr)
 
-            data += self.data[addr + i]
+            return str(page.data[offs : offs + size])
 
-        return data
+        try:
+
+            # read range that crosses pages boundary
+            return ''.join(map(lambda part: self._read(part[0], part[2]), self.split(addr, size)))
+
+        except MemReadError:
+
+            raise MemReadError(addr)
 
     def _write(self, addr, size, data):
 
-        for i in range(0, size):
+        for part_addr, offs, part in self.split(addr, size):
+
+            page = self.page(part_addr)
 
-            if not self.data.has_key(addr + i):
+            if page is None or page.flags & MEM_WRITE == 0 or not page.is_valid(offs, part):
 
                 raise MemWriteError(addr)
 
-            self.data[addr + i] = data[i]
+        for part_addr, offs, part in self.split(addr, size):
+
+            self.page_owned(part_addr).data[offs : offs + part] = data[part_addr - addr : part_addr - addr + part]
+
+    def _fault(self, addr, size):
+
+        page = self.page_owned(addr)
+
+        try:
+
+            # try to read the whole page at first
+            data = self.reader.read(addr & ~(self.PAGE_SIZE - 1), self.PAGE_SIZE)
+
+        except Exception:
+
+            # readers like bin_BFD.Reader fails on addresses outside of image sections
+            data = None
+
+        if data is not None and len(data) == self.PAGE_SIZE:
+
+            if page is None:
+
+                page = self.page_alloc(addr)
+                page.data[:] = data
+                page.valid = None
+
+            else:
+
+                # keep contents of already allocated bytes
+                for i in range(0, self.PAGE_SIZE):
+
+                    if not page.valid[i]: page.data[i] = data[i]
+
+                page.valid = None
+
+            return True
+
+        # page is not entirely available, read only requested range
+        data = self.reader.read(addr, size)
+        if data is None: 
+
+            return False
+
+        for part_addr, offs, part in self.split(addr, len(data)):
+
+            page = self.page_alloc(part_addr)
+            if page.valid is None: continue
+
+            for i in range(0, part):
+
+                # keep contents of already allocated bytes
+                if not page.valid[offs + i]: page.data[offs + i] = data[part_addr - addr + i]
+
+            page.set_valid(offs, part)
+
+        return True
 
     def read(self, addr, size):
 
@@ -116,15 +329,17 @@ class Mem(object):
 
             if self.reader is None: raise
 
-            # invalid address, try to get the data from external memory reader
-            data = self.reader.read(addr, size)
-            if data is None: 
+            for part_addr, offs, part in self.split(addr, size):
 
-                raise
+                page = self.page(part_addr)
+                if page is not None and page.is_valid(offs, part): continue
 
-            # copy data from external storage
-            self.alloc(addr, data = data)
-            return data
+                # invalid address, try to get the data from external memory reader
+                if not self._fault(part_addr, part): 
+
+                    raise MemReadError(addr)
+
+            return self._read(addr, size)
 
     def write(self, addr, size, data):
 
@@ -134,6 +349,13 @@ class Mem(object):
 
         except MemWriteError:
 
+            for part_addr, _, _ in self.split(addr, size):
+
+                page = self.page(part_addr)
+
+                # write protected memory
+                if page is not None and page.flags & MEM_WRITE == 0: raise
+
             if self.strict:
 
                 if self.reader is None: raise
@@ -153,16 +375,21 @@ class Mem(object):
 
         return ret
 
-    def alloc(self, addr = None, size = None, data = None):
+    def alloc(self, addr = None, size = None, data = None, flags = MEM_READ | MEM_WRITE):
 
         size = len(data) if size is None and not data is None else size
         addr = self.alloc_addr(size) if addr is None else addr
 
-        for i in range(0, size):
+        data = '' if data is None else data[: size]
+        data += '\0' * (size - len(data))
+
+        for part_addr, offs, part in self.split(addr, size):
+
+            page = self.page_alloc(part_addr, flags = flags)
 
             # fill target memory range with specified data (or zeros)
-            byte = '\0' if data is None or i >= len(data) else data[i]
-            self.data[addr + i] = byte
+            page.data[offs : offs + part] = data[part_addr - addr : part_addr - addr + part]
+            page.set_valid(offs, part)
 
         return addr
 
@@ -216,17 +443,148 @@ class TestMem(unittest.TestCase):
         mem.store(0, U16, 0x4444)
         mem.store(0, U8, 0x88)
         
-        assert mem.data == { 0: chr(0x88), 1: chr(0x44), 2: chr(0x22), 3: chr(0x22),
-                             4: chr(0x11), 5: chr(0x11), 6: chr(0x11), 7: chr(0x11) }
+        assert mem.read(0, 8) == '\x88\x44\x22\x22\x11\x11\x11\x11'
         
         assert mem.load(0, U64) == val and \
                mem.load(0, U32) == val & 0xffffffff and \
                mem.load(0, U16) == val & 0xffff and \
                mem.load(0, U8) == val & 0xff
 
+    def test_pages(self):
+
+        class Reader(object):
+
+            def __init__(self, addr, data):
+
+                self.addr, self.data, self.reads = addr, data, []
+
+            def read(self, addr, size):
+
+                self.reads.append(( addr, size ))
+
+                if addr < self.addr or addr + size > self.addr + len(self.data): return None
+
+                return self.data[addr - self.addr : addr - self.addr + size]
+
+        # reader that knows exactly one page
+        reader = Reader(0x1000, ''.join(map(chr, range(0, 0x100))) * 0x10)
+        mem = Mem(reader = reader)
+
+        assert mem.load(0x1010, U32) == 0x13121110
+        assert mem.load(0x1ffc, U32) == 0xfffefdfc
+
+        # whole page must be loaded at once
+        assert reader.reads == [( 0x1000, Mem.PAGE_SIZE )]
+
+        # reader doesn't know whole page, only requested bytes must be loaded
+        reader = Reader(0x1ff0, 'ABCDEFGHIJKLMNOP')
+        mem = Mem(reader = reader)
+
+        mem.store(0x1ff0, U16, 0x4141)
+
+        assert mem.read(0x1ff0, 4) == 'AACD'
+        assert mem.read(0x1ff8, 8) == 'IJKLMNOP'
+
+        try:
+
+            mem.read(0x1fe0, 4)
+            assert False
+
+        except MemReadError as e: assert e.addr == 0x1fe0
+
+        class ReaderStrict(Reader):
+
+            def read(self, addr, size):
+
+                data = super(ReaderStrict, self).read(addr, size)
+
+                # reject addresses outside of the section like bin_BFD.Reader does
+                if data is None: raise Exception('Unable to find image section')
+
+                return data
+
+        # page base is outside of the section, requested bytes must be loaded anyway
+        reader = ReaderStrict(0x1ff0, 'ABCDEFGHIJKLMNOP')
+        mem = Mem(reader = reader)
+
+        assert mem.read(0x1ff4, 4) == 'EFGH'
+        assert reader.reads == [( 0x1000, Mem.PAGE_SIZE ), ( 0x1ff4, 4 )]
+
+        # check access to the range that crosses pages boundary
+        mem = Mem(strict = False)
+        mem.alloc(0x2ffe, data = 'ABCD')
+
+        assert mem.read(0x2ffe, 4) == 'ABCD'
+        assert map(lambda page: page.addr, mem.page_list()) == [ 0x2000, 0x3000 ]
+
+        mem.store(0x2fff, U16, 0x5858)
+        assert mem.read(0x2ffe, 4) == 'AXXD'
+
+        # check pages protection
+        mem.protect(0x3000, 1, MEM_READ)
+
+        try:
+
+            mem.store(0x2fff, U16, 0)
+            assert False
+
+        except MemWriteError: pass
+
+        assert mem.read(0x2ffe, 4) == 'AXXD'
+
+        mem.protect(0x3000, 1, 0)
+
+        try:
+
+            mem.read(0x3000, 1)
+            assert False
+
+        except MemReadError: pass
+
+    def test_snapshot(self):
+
+        mem = Mem(strict = False)
+        mem.alloc(0x1000, data = 'ABCD')
+        mem.alloc(0x2000, data = 'EFGH')
+
+        snapshot = mem.snapshot()
+        page = mem.page(0x2000)
+
+        mem.store(0x1000, U8, 0x58)
+        mem.alloc(0x5000, data = 'IJKL')
+
+        assert mem.read(0x1000, 4) == 'XBCD'
+        
+        # not modified pages must be shared
+        assert mem.page(0x2000) is page
+
+        mem.restore(snapshot)
+
+        assert mem.read(0x1000, 4) == 'ABCD'
+        assert map(lambda page: page.addr, mem.page_list()) == [ 0x1000, 0x2000 ]
+
+        # check multiple restores from the same snapshot
+        mem.protect(0x1000, 1, MEM_READ)
+        mem.restore(snapshot)
+        mem.store(0x1000, U8, 0x59)
+        mem.restore(snapshot)
+
+        assert mem.read(0x1000, 4) == 'ABCD'
+
 
 class Math(object):
 
+    # REIL type to numpy unsigned type map
+    map_type_u = { U1: numpy.uint8, U8: numpy.uint8, U16: numpy.uint16, 
+                   U32: numpy.uint32, U64: numpy.uint64 }
+
+    # REIL type to numpy signed type map
+    map_type_s = { U1: numpy.int8, U8: numpy.int8, U16: numpy.int16, 
+                   U32: numpy.int32, U64: numpy.int64 }
+
+    # REIL type to number of bits map
+    map_bits = { U1: 1, U8: 8, U16: 16, U32: 32, U64: 64 }
+
     def __init__(self, a = None, b = None):
 
         self.a, self.b = a, b    
@@ -238,28 +596,27 @@ class Math(object):
     def val_u(self, arg):
 
         # Arg to numpy unsigned integer
-        return None if arg is None else {
-            
-             U1: numpy.uint8, 
-             U8: numpy.uint8, 
-            U16: numpy.uint16,
-            U32: numpy.uint32, 
-            U64: numpy.uint64  
-
-        }[arg.size](self.val(arg))
+        return None if arg is None else self.map_type_u[arg.size](self.val(arg))
 
     def val_s(self, arg):
 
         # Arg to numpy signed integer
-        return None if arg is None else { 
+        return None if arg is None else self.map_type_s[arg.size](self.val_u(arg))
+
+    def result(self, val):
+
+        # numpy integer to Python integer
+        return val.item()
 
-             U1: numpy.int8, 
-             U8: numpy.int8, 
-            U16: numpy.int16,
-            U32: numpy.int32, 
-            U64: numpy.int64  
+    def eval_rot(self, a, b, left):
 
-        }[arg.size](self.val_u(arg))
+        # evaluate rotate expressions
+        bits = self.map_bits[a.size]
+        val, count = self.val(a), self.val(b) % bits
+
+        if not left: count = (bits - count) % bits
+
+        return ((val << count) | (val >> (bits - count))) & ((1L << bits) - 1)
 
     def eval(self, op, a = None, b = None):
 
@@ -267,12 +624,12 @@ class Math(object):
         b = self.b if b is None else b
 
         # evaluale unsigned/unsigned expressions
-        eval_u = lambda fn: fn(self.val_u(a), self.val_u(b)).item()
-        eval_s = lambda fn: fn(self.val_s(a), self.val_s(b)).item()        
+        eval_u = lambda fn: self.result(fn(self.val_u(a), self.val_u(b)))
+        eval_s = lambda fn: self.result(fn(self.val_s(a), self.val_s(b)))
 
         return { 
 
-            I_STR: lambda: a.get_val(),            
+            I_STR: lambda: self.val(a),
             I_ADD: lambda: eval_u(lambda a, b: a +  b ),
             I_SUB: lambda: eval_u(lambda a, b: a -  b ),            
             I_NEG: lambda: eval_u(lambda a, b:     -a ),
@@ -289,7 +646,13 @@ class Math(object):
             I_XOR: lambda: eval_u(lambda a, b: a ^  b ),            
             I_NOT: lambda: eval_u(lambda a, b:     ~a ),
              I_EQ: lambda: eval_u(lambda a, b: a == b ),
-             I_LT: lambda: eval_u(lambda a, b: a <  b ) 
+             I_LT: lambda: eval_u(lambda a, b: a <  b ),
+            I_SAR: lambda: eval_s(lambda a, b: a >> b ),
+            I_ROL: lambda: self.eval_rot(a, b, True),
+            I_ROR: lambda: self.eval_rot(a, b, False),
+           I_SEXT: lambda: eval_s(lambda a, b:      a ),
+            I_NEQ: lambda: eval_u(lambda a, b: a != b ),
+             I_LE: lambda: eval_u(lambda a, b: a <= b )
 
         }[op]()
 
@@ -300,6 +663,80 @@ class TestMath(unittest.TestCase):
 
         pass
 
+    def test_ext_insn(self):
+
+        val = lambda op, a, b, size: \
+              Arg(A_CONST, size, val = Math(a, b).eval(op)).get_val()
+
+        a = Arg(A_CONST, U32, val = 0x80000010)
+        b = Arg(A_CONST, U8, val = 4)
+
+        # check extended instructions semantics
+        assert val(I_SAR, a, b, U32) == 0xf8000001
+        assert val(I_ROL, a, b, U32) == 0x00000108
+        assert val(I_ROR, a, b, U32) == 0x08000001
+        assert val(I_SEXT, Arg(A_CONST, U8, val = 0x80), None, U32) == 0xffffff80
+        assert val(I_SEXT, Arg(A_CONST, U8, val = 0x7f), None, U32) == 0x7f
+        assert val(I_NEQ, a, a, U1) == 0 and val(I_NEQ, a, b, U1) == 1
+        assert val(I_LE, b, a, U1) == 1 and val(I_LE, a, a, U1) == 1 and val(I_LE, a, b, U1) == 0
+
+
+class MathLanes(Math):
+
+    # evaluates expressions for all lanes of CpuLanes at once, arguments are
+    # ArgLanes instances with numpy arrays of per-lane values
+
+    def val(self, arg):
+
+        return None if arg is None else arg.val
+
+    def val_u(self, arg):
+
+        return None if arg is None else self.val(arg).astype(self.map_type_u[arg.size])
+
+    def val_s(self, arg):
+
+        return None if arg is None else self.val_u(arg).astype(self.map_type_s[arg.size])
+
+    def result(self, val):
+
+        return val.astype(numpy.uint64)
+
+    def eval_rot(self, a, b, left):
+
+        bits = self.map_bits[a.size]
+        val, count = self.val(a), self.val(b) % bits
+
+        if not left: count = (bits - count) % bits
+
+        ret = ((val << count) | (val >> (bits - count))) & numpy.uint64((1L << bits) - 1)
+
+        # shift by the register width is undefined
+        return numpy.where(count == 0, val, ret)
+
+
+class TestMathLanes(unittest.TestCase):
+
+    def test(self):
+
+        vals = [ 0x80000010, 0x00000001, 0xffffffff, 0x12345678 ]
+        counts = [ 4, 0, 31, 16 ]
+
+        lanes = lambda vals, size: ArgLanes(size, numpy.array(vals, dtype = numpy.uint64))
+        
+        for op in [ I_ADD, I_SUB, I_MUL, I_DIV, I_SMUL, I_SDIV, I_SHL, I_SHR, I_SAR, 
+                    I_ROL, I_ROR, I_XOR, I_NOT, I_LT, I_LE, I_SEXT ]:
+
+            # compare results with scalar implementation
+            ret = MathLanes().eval(op, lanes(vals, U32), lanes(counts, U8))
+
+            for i in range(0, len(vals)):
+
+                a, b = Arg(A_CONST, U32, val = vals[i]), Arg(A_CONST, U8, val = counts[i])
+                val = Math().eval(op, a, b)
+
+                assert Arg(A_CONST, U64, val = val).get_val() == long(ret[i])
+
 
 class Reg(object):
 
@@ -317,6 +754,7 @@ class Cpu(object):
         self.mem = Mem() if mem is None else mem
         self.math = Math() if math is None else math
         self.arch = get_arch(arch)
+        self.trace = None
         self.reset()
 
     def set_storage(self, storage = None):
@@ -336,6 +774,23 @@ class Cpu(object):
 
             self.mem = mem
 
+    def snapshot(self):
+
+        regs = {}
+        regs.update(map(lambda reg: (reg.name, reg.val), 
+                        filter(lambda reg: not reg.is_temp, self.regs.values())))
+
+        # memory pages are shared with snapshot until they are modified
+        return regs, self.mem.snapshot()
+
+    def restore(self, snapshot):
+
+        regs, mem = snapshot
+
+        self.regs = {}
+        self.reset(regs = regs)
+        self.mem.restore(mem)
+
     def reset_temp(self):
 
         for name, reg in self.regs.items():
@@ -395,12 +850,22 @@ class Cpu(object):
 
         # store a to memory
         self.mem.store(c.get_val(), insn.a.size, a.get_val())
+
+        if self.trace is not None: 
+
+            self.trace.record_mem(Trace.REC_STM, c.get_val(), insn.a.size, a.get_val())
+
         return None
 
     def insn_ldm(self, insn, a, b, c):
 
         # read from memory to c
-        self.reg(insn.c.name).val = self.mem.load(a.get_val(), insn.c.size)
+        val = self.reg(insn.c.name).val = self.mem.load(a.get_val(), insn.c.size)
+
+        if self.trace is not None: 
+
+            self.trace.record_mem(Trace.REC_LDM, a.get_val(), insn.c.size, val)
+
         return None
 
     def insn_other(self, insn, a, b, c):
@@ -443,38 +908,56 @@ class Cpu(object):
 
         self.reg(self.arch.Registers.ip).val = val
 
-    def run(self, storage, addr = 0L):
+    def step(self, storage, addr):
+
+        try:
+
+            # query list of IR instructions from storage                
+            insn_list = storage.get_insn(addr)
+
+        except StorageError:
+
+            raise CpuReadError(addr)
+
+        if self.trace is not None: 
+
+            self.trace.record_insn(self, addr)
 
         next = addr
 
-        # use specified storage instance
-        self.set_storage(storage)        
-        self.set_ip(next)
+        for insn in insn_list:
 
-        while True:
-            
-            try:
+            # execute single instruction
+            next = self.execute(insn)
 
-                # query list of IR instructions from storage                
-                insn_list = storage.get_insn(next)
+            # check if JCC was taken
+            if next is not None: break
+            else: next, _ = insn.next()
 
-            except StorageError:
+            self.set_ip(next)
 
-                raise CpuReadError(next)
+        # remove temp registers
+        self.reset_temp()
 
-            for insn in insn_list:
+        # address of the next machine instruction
+        return next
 
-                # execute single instruction
-                next = self.execute(insn)
+    def run(self, storage, addr = 0L):
 
-                # check if JCC was taken
-                if next is not None: break
-                else: next, _ = insn.next()
+        next = addr
 
-                self.set_ip(next)
+        # use specified storage instance
+        self.set_storage(storage)        
+        self.set_ip(next)
 
-            # remove temp registers
-            self.reset_temp()
+        if self.trace is not None:
+
+            # registers and memory might be changed since the last run
+            self.trace.checkpoint(self)
+
+        while True:
+            
+            next = self.step(storage, next)
 
         self.set_storage()
 
@@ -510,67 +993,1358 @@ class Cpu(object):
         self.mem.dump(addr, size)
 
 
-class TestCpu(unittest.TestCase):
+class CpuNative(Cpu):
 
-    arch = ARCH_X86
+    def __init__(self, arch, mem = None, math = None, opts = 0, taint = None):
 
-    def test(self):     
+        import translator
 
-        code = ( 'mov eax, edx',
-                 'add eax, ecx', 
-                 'ret' )
+        self.storage = None
+        self.mapped = {}
+        self.coverage = None
 
-        addr, stack = 0x41414141, 0x42424242
+        # create native interpreter instance, see REIL_VM_OPT_JIT and REIL_VM_OPT_TAINT
+        self.vm = translator.Interpreter(arch, self.code_read, 
+                                         self.mem_read, self.mem_write, opts = opts, taint = taint)
 
-        # create reader and translator
-        from pyopenreil.utils import asm
-        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
-        
-        cpu = Cpu(self.arch)
+        if opts & REIL_VM_OPT_COVERAGE:
 
-        # set up stack pointer and input args
-        cpu.reg('esp').val = stack
-        cpu.reg('ecx').val = 1
-        cpu.reg('edx').val = 2
+            # AFL-style edge coverage map that is updated by interpreter in place
+            self.coverage = bytearray(REIL_VM_COV_MAP_SIZE)
+            self.vm.coverage_map(self.coverage)
 
-        # run untill ret
-        try: cpu.run(tr, addr)
-        except MemReadError as e: 
+        super(CpuNative, self).__init__(arch, mem = mem, math = math)
+
+    def code_read(self, addr):
+
+        try:
+
+            # query list of IR instructions from storage                
+            insn_list = self.storage.get_insn(addr)
+
+        except StorageError:
+
+            raise CpuReadError(addr)
+
+        return map(lambda insn: insn.serialize(), insn_list)
+
+    def mem_map(self, addr, size):
+
+        for part_addr, _, _ in self.mem.split(addr, size):
+
+            page = self.mem.page(part_addr)
+
+            # interpreter can access allocated pages without callbacks
+            if page is not None and page.valid is None and self.mapped.get(page.addr) is not page:
+
+                flags = page.flags
+
+                # writes to the page that is shared with snapshot must go trough Mem
+                if not page.addr in self.mem.owned: flags &= ~MEM_WRITE
+
+                self.vm.map(page.addr, page.data, flags)
+                self.mapped[page.addr] = page
+
+    def mem_unmap(self):
+
+        for addr in self.mapped.keys():
+
+            self.vm.unmap(addr, Mem.PAGE_SIZE)
+
+        self.mapped = {}
+
+    def mem_read(self, addr, size):
+
+        data = self.mem.read(addr, size)
+        self.mem_map(addr, size)
+
+        return data
+
+    def mem_write(self, addr, data):
+
+        self.mem.write(addr, len(data), data)
+        self.mem_map(addr, len(data))
+
+    def flush(self):
+
+        # drop predecoded instructions, must be called when storage contents were changed
+        self.vm.flush()
+
+    def taint_reset(self):
+
+        self.vm.taint_reset()
+
+    def taint_reg(self, name, taint = None):
+
+        # get/set taint labels of register bytes packed into integer
+        return self.vm.taint_reg(self.reg(name).name, taint)
+
+    def taint_mem(self, addr, size, labels = None):
+
+        # get/set taint labels of memory bytes
+        return self.vm.taint_mem(addr, size, labels)
+
+    def block_hits(self):
+
+        # basic block address -> number of executions
+        return self.vm.coverage_hits()
+
+    def coverage_reset(self):
+
+        self.vm.coverage_reset()
+
+    def reset(self, regs = None, mem = None):
+
+        super(CpuNative, self).reset(regs = regs, mem = mem)
+
+        self.flush()
+
+    def run(self, storage, addr = 0L):
+
+        import translator
+
+        if storage is not self.storage:
+
+            # predecoded instructions belong to other storage
+            self.storage = storage
+            self.flush()
+
+        # use specified storage instance
+        self.set_storage(storage)
+        self.vm.reset()
+
+        # memory pages or their flags might be changed since the last run
+        self.mem_unmap()
+
+        for name, reg in self.regs.items():
+
+            # copy registers values into the interpreter
+            if not reg.is_temp: self.vm.reg(name, reg.val)
+
+        try:
+
+            # run until error
+            code, err_addr, err_inum = self.vm.run(addr)
+
+        finally:
+
+            for name, val in self.vm.regs().items():
+
+                # copy registers values back
+                if name[:2] == 'R_': self.reg(name).val = val
+
+        if code == translator.VM_ERR_INSN:
+
+            raise CpuInstructionError(err_addr, err_inum)
+
+        elif code == translator.VM_ERR_READ:
+
+            raise MemReadError(err_addr)
+
+        elif code == translator.VM_ERR_WRITE:
+
+            raise MemWriteError(err_addr)
+
+        raise CpuReadError(err_addr)
+
+
+class TestCpu(unittest.TestCase):
+
+    arch = ARCH_X86
+    cpu = Cpu
+
+    def test(self):     
+
+        code = ( 'mov eax, edx',
+                 'add eax, ecx', 
+                 'ret' )
+
+        addr, stack = 0x41414141, 0x42424242
+
+        # create reader and translator
+        from pyopenreil.utils import asm
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
+        
+        cpu = self.cpu(self.arch)
+
+        # set up stack pointer and input args
+        cpu.reg('esp').val = stack
+        cpu.reg('ecx').val = 1
+        cpu.reg('edx').val = 2
+
+        # run untill ret
+        try: cpu.run(tr, addr)
+        except MemReadError as e: 
+
+            # exception on accessing to the stack
+            if e.addr != stack: raise
+
+        # check for correct return value
+        assert cpu.reg('eax').val == 3
+
+    def test_code_read(self):
+
+        addr, stack = 0x41414141, 0x42424242
+    
+        # test code that reads itself
+        code = ( 'nop', 'nop', 
+                 'nop', 'nop', 
+                 'mov eax, dword [%Xh]' % addr, 
+                 'ret' )
+
+        # create reader and translator
+        from pyopenreil.utils import asm
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
+
+        cpu = self.cpu(ARCH_X86)
+
+        # set up stack pointer
+        cpu.reg('esp').val = stack
+        
+        # run untill ret
+        try: cpu.run(tr, addr)
+        except MemReadError as e: 
 
             # exception on accessing to the stack
             if e.addr != stack: raise
 
-        # check for correct return value
-        assert cpu.reg('eax').val == 3
+        # check for correct return value
+        assert cpu.reg('eax').val == 0x90909090
+
+    def test_ext_insn(self):
+
+        # test code that uses extended instructions
+        code = InsnList([ Insn(op = I_SAR, size = 1, ir_addr = ( 0, 0 ),
+                               a = Arg(A_REG, U32, 'R_EAX'), b = Arg(A_CONST, U8, val = 3),
+                               c = Arg(A_TEMP, U32, 'V_00')),
+                          Insn(op = I_ROL, size = 1, ir_addr = ( 0, 1 ),
+                               a = Arg(A_TEMP, U32, 'V_00'), b = Arg(A_REG, U8, 'R_CL'),
+                               c = Arg(A_REG, U32, 'R_EBX')),
+                          Insn(op = I_SEXT, size = 1, ir_addr = ( 0, 2 ),
+                               a = Arg(A_REG, U16, 'R_DX'),
+                               c = Arg(A_REG, U32, 'R_EDX')),
+                          Insn(op = I_LE, size = 1, ir_addr = ( 0, 3 ),
+                               a = Arg(A_REG, U32, 'R_EBX'), b = Arg(A_REG, U32, 'R_EAX'),
+                               c = Arg(A_REG, U1, 'R_ZF'),
+                               attr = { IATTR_FLAGS: IOPT_ASM_END }) ])
+
+        def _run(insn_list):
+
+            cpu = self.cpu(ARCH_X86)
+
+            cpu.reg('eax').val = 0x80001234
+            cpu.reg('cl').val = 5
+            cpu.reg('dx').val = 0x8001
+
+            # run untill the end of the code
+            try: cpu.run(CodeStorageMem(ARCH_X86, insn_list), 0)
+            except CpuReadError as e: 
+
+                if e.addr != 1: raise
+
+            return map(lambda name: cpu.reg(name).val, [ 'ebx', 'edx', 'zf' ])
+        
+        lowered = code.lower()
+
+        # check for classic REIL code and correct inums
+        assert len(lowered) > len(code)
+        assert len(filter(lambda insn: insn.op in REIL_INSN_EXT, lowered)) == 0
+        assert map(lambda insn: insn.inum, lowered) == range(0, len(lowered))
+        assert lowered[-1].has_flag(IOPT_ASM_END)
+
+        # check that both versions of code gives the same results
+        assert _run(code) == _run(lowered) == [ 0x000048de, 0xffff8001, 1 ]
+
+
+class TestCpuNative(TestCpu):
+
+    cpu = CpuNative
+
+    def test_math(self):
+
+        code = ( 'mov eax, 1234h',
+                 'mov ecx, 40',
+                 'l: imul eax, ecx',
+                 'rol eax, 3',
+                 'xor eax, 0deadbeefh',
+                 'cdq',
+                 'idiv ecx',
+                 'shr edx, cl',
+                 'add eax, edx',
+                 'dec ecx',
+                 'jnz l',
+                 'ret' )
+
+        addr, stack = 0x41414141, 0x42424242
+
+        # create reader and translator
+        from pyopenreil.utils import asm
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
+
+        def _run(cpu):
+
+            cpu.reg('esp').val = stack
+
+            # run untill ret
+            try: cpu.run(tr, addr)
+            except MemReadError as e: 
+
+                if e.addr != stack: raise
+
+            return map(lambda name: cpu.reg(name).val, [ 'eax', 'ecx', 'edx', 'zf', 'cf' ])
+
+        # check that both implementations gives the same results
+        assert _run(Cpu(self.arch)) == _run(self.cpu(self.arch))
+
+    def test_code_error(self):
+
+        # conditional jump without the next instruction in the storage
+        storage = CodeStorageMem(self.arch, [ Insn(I_JCC, ir_addr = ( 0, 0 ), size = 1,
+                                                   a = Arg(A_REG, U1, 'R_ZF'),
+                                                   c = Arg(A_CONST, U32, val = 0x10),
+                                                   attr = { IATTR_FLAGS: IOPT_ASM_END }) ])
+        cpu = self.cpu(self.arch)
+        cpu.reg('zf').val = 1
+
+        # failed read of the next instruction must not be reported
+        try: cpu.run(storage, 0)
+        except CpuReadError as e: assert e.addr == 0x10
+
+
+class TestCpuNativeJit(TestCpuNative):
+
+    cpu = staticmethod(lambda arch: CpuNative(arch, opts = REIL_VM_OPT_JIT))
+
+
+class TestCpuNativeTaint(unittest.TestCase):
+
+    arch = ARCH_X86
+
+    def test(self):
+
+        code = ( 'mov eax, [esp + 4]',
+                 'movzx ecx, byte ptr [eax]',
+                 'mov edx, [esp + 8]',
+                 'add edx, ecx',
+                 'mov [esp + 8], edx',
+                 'xor ecx, ecx',
+                 'mov cl, [eax + 1]',
+                 'mov byte ptr [eax + ecx], 0',
+                 'cmp edx, 0',
+                 'jz l',
+                 'inc ebx',
+                 'l: ret' )
+
+        addr, ret, stack, buff = 0x41414141, 0x44444444, 0x42424242, 0x43434000
+        reports = []
+
+        def taint(kind, addr, inum, val, taint):
+
+            reports.append(( kind, addr ))
+
+        # create reader and translator
+        from pyopenreil.utils import asm
+        reader = asm.Reader(self.arch, code, addr = addr)
+        tr = CodeStorageTranslator(reader)
+
+        cpu = CpuNative(self.arch, opts = REIL_VM_OPT_TAINT, taint = taint)
+        cpu.mem.alloc(stack, data = struct.pack('III', ret, buff, 1))
+        cpu.mem.alloc(buff, data = 'AB' + '\0' * 0x100)
+
+        # first byte of input is tainted with label 1, second one with label 2
+        cpu.taint_mem(buff, 2, '\1\2')
+        cpu.reg('esp').val = stack
+
+        try: cpu.run(tr, addr)
+        except CpuReadError as e: 
+
+            if e.addr != ret: raise
+
+        # check taint of registers and memory
+        assert cpu.taint_reg('edx') == 0x01010101
+        assert cpu.taint_reg('ecx') == 0x02
+        assert cpu.taint_reg('ebx') == 0
+        assert cpu.taint_mem(stack + 8, 4) == '\1\1\1\1'
+        assert cpu.taint_mem(buff, 4) == '\1\2\0\0'
+
+        # tainted memory write address and JCC condition
+        assert reports == [ ( REIL_VM_TAINT_STM, addr + 0x16 ), ( REIL_VM_TAINT_JCC, addr + 0x1d ) ]
+
+        class Stop(Exception): pass
+
+        def stop(kind, addr, inum, val, taint): raise Stop()
+
+        cpu = CpuNative(self.arch, opts = REIL_VM_OPT_TAINT, taint = stop)
+        cpu.mem.alloc(stack, data = struct.pack('III', ret, buff, 1))
+        cpu.mem.alloc(buff, data = 'AB' + '\0' * 0x100)
+
+        cpu.taint_mem(buff, 1, 1)
+        cpu.reg('esp').val = stack
+
+        try: 
+
+            # handler can stop the execution before the tainted instruction
+            cpu.run(tr, addr)
+            assert False
+
+        except Stop: pass
+
+        assert cpu.reg('eip').val == addr + 0x1d and cpu.reg('ebx').val == 0
+
+
+class TestCpuNativeCoverage(unittest.TestCase):
+
+    arch = ARCH_X86
+
+    def test(self):
+
+        code = ( 'mov ecx, 0x80',
+                 'l: add eax, ecx',
+                 'dec ecx',
+                 'jnz l',
+                 'ret' )
+
+        addr, ret, stack = 0x41414141, 0x44444444, 0x42424242
+
+        # create reader and translator
+        from pyopenreil.utils import asm
+        reader = asm.Reader(self.arch, code, addr = addr)
+        tr = CodeStorageTranslator(reader)
+
+        # compiled code must update coverage in the same way as interpreter
+        for opts in [ REIL_VM_OPT_COVERAGE, REIL_VM_OPT_COVERAGE | REIL_VM_OPT_JIT ]:
+
+            cpu = CpuNative(self.arch, opts = opts)
+            cpu.mem.alloc(stack, data = struct.pack('I', ret))
+            cpu.reg('esp').val = stack
+
+            for i in range(2):
+
+                try: cpu.run(tr, addr)
+                except CpuReadError as e: 
+
+                    if e.addr != ret: raise
+
+                assert cpu.block_hits() == { addr: 1, addr + 5: 0x7f, addr + 10: 1 }
+
+                # entry edge, two loop edges and exit edge
+                edges = [ n for n in cpu.coverage if n != 0 ]
+                assert sorted(edges) == [ 1, 1, 1, 0x7e ]
+
+                cpu.coverage_reset()
+                cpu.reg('esp').val = stack
+
+            assert cpu.block_hits() == { addr: 0, addr + 5: 0, addr + 10: 0 }
+            assert sum(cpu.coverage) == 0
+
+
+class TraceError(Error):
+
+    pass
+
+
+class Trace(object):
+
+    # record kind is stored in two low bits of the record tag byte
+    REC_INSN_NEW = 0    # first execution of machine instruction: address
+    REC_INSN = 1        # machine instruction that was executed before: ID
+    REC_LDM = 2         # memory read: address delta, value
+    REC_STM = 3         # memory write: address delta, value
+
+    # REC_INSN_NEW tag with bit 2 set: CPU state checkpoint, see checkpoint()
+    REC_CHECKPOINT = 4
+
+    # instruction ID that doesn't fit into the tag
+    ID_EXT = 0x3f
+
+    # memory access size is stored in bits 2-3 of REC_LDM/REC_STM tag
+    size_list = [ U8, U16, U32, U64 ]
+
+    DEF_BUFF_SIZE = 0x10000
+
+    def __init__(self, path = None, buff_size = DEF_BUFF_SIZE, interval = None):
+
+        # records are collected in the buffer and flushed to file (or kept in memory)
+        self.buff, self.pos = bytearray(buff_size), 0
+        self.path, self.chunks = path, []
+        self.fd = None if path is None else open(path, 'wb')
+
+        # take CPU state checkpoint each interval instructions
+        self.interval, self.checkpoints = interval, []
+
+        # memory pages that was saved with the last checkpoint
+        self.saved_pages = {}
+
+        self.ids, self.last_addr, self.count = {}, 0L, 0
+
+    @classmethod
+    def open(cls, path):
+
+        # load saved trace for replay
+        trace = cls(buff_size = 0)
+
+        with open(path, 'rb') as fd: 
+
+            trace.chunks.append(fd.read())
+
+        pages = {}
+
+        for kind, count, _, data in trace.parse(checkpoints = True):
+
+            if kind == cls.REC_INSN: trace.count += 1
+            if kind != cls.REC_CHECKPOINT: continue
+
+            trace.checkpoints.append(( count, trace.load_checkpoint(data, pages) ))
+
+        return trace
+
+    def _varint(self, data, val):
+
+        val = long(val)
+
+        while val >= 0x80:
+
+            data.append((val & 0x7f) | 0x80)
+            val >>= 7
+
+        data.append(val)
+
+    def _varint_read(self, data, pos):
+
+        val, shift = 0L, 0
+
+        while True:
+
+            byte = data[pos]
+            val |= (byte & 0x7f) << shift
+            pos, shift = pos + 1, shift + 7
+
+            if byte & 0x80 == 0: return val, pos
+
+    def _put(self, data):
+
+        if self.pos + len(data) > len(self.buff): 
+
+            self.flush()
+
+        if len(data) > len(self.buff):
+
+            # record doesn't fit into the buffer
+            if self.fd is not None: self.fd.write(str(data))
+            else: self.chunks.append(str(data))
+
+            return
+
+        self.buff[self.pos : self.pos + len(data)] = data
+        self.pos += len(data)
+
+    def flush(self):
+
+        if self.pos == 0: return
+
+        chunk = str(self.buff[: self.pos])
+
+        if self.fd is not None: self.fd.write(chunk)
+        else: self.chunks.append(chunk)
+
+        self.pos = 0
+
+    def close(self):
+
+        self.flush()
+
+        if self.fd is not None: 
+
+            self.fd.close()
+            self.fd = None
+
+    def data(self):
+
+        self.flush()
+
+        if self.path is None: 
+
+            return ''.join(self.chunks)
+
+        if self.fd is not None: self.fd.flush()
+
+        with open(self.path, 'rb') as fd: 
+
+            return fd.read()
+
+    def checkpoint(self, cpu):
+
+        # memory pages are shared with checkpoint until they are modified
+        snapshot = cpu.snapshot()
+        self.checkpoints.append(( self.count, snapshot ))
+
+        regs, ( pages, alloc_last ) = snapshot
+        data, saved = bytearray(), {}
+
+        self._varint(data, self.count)
+        self._varint(data, len(regs))
+
+        for name, val in sorted(regs.items()):
+
+            self._varint(data, len(name))
+            data += name
+            self._varint(data, val)
+
+        self._varint(data, alloc_last)
+
+        page_list = []
+
+        for table in pages.values():
+
+            page_list += filter(lambda page: page is not None, table)
+
+        self._varint(data, len(page_list))
+
+        for page in sorted(page_list, key = lambda page: page.addr):
+
+            saved[page.addr] = page
+
+            self._varint(data, page.addr)
+            self._varint(data, page.flags)
+
+            if self.saved_pages.get(page.addr) is page:
+
+                # page wasn't modified since the last checkpoint
+                data.append(0)
+                continue
+
+            data.append(1 if page.valid is None else 2)
+            self._varint(data, len(page.data))
+
+            data += page.data
+            if page.valid is not None: data += page.valid
+
+        self.saved_pages = saved
+
+        # checkpoint is stored in the trace as well
+        record = bytearray([ self.REC_CHECKPOINT ])
+        self._varint(record, len(data))
+
+        self._put(record + data)
+
+    def load_checkpoint(self, data, pages):
+
+        data, pos = bytearray(data), 0
+
+        varint = lambda pos: self._varint_read(data, pos)
+
+        regs, tables, saved = {}, {}, {}
+
+        _, pos = varint(pos)
+        count, pos = varint(pos)
+
+        for i in range(0, count):
+
+            size, pos = varint(pos)
+            name, pos = str(data[pos : pos + size]), pos + size
+
+            regs[name], pos = varint(pos)
+
+        alloc_last, pos = varint(pos)
+        count, pos = varint(pos)
+
+        for i in range(0, count):
+
+            addr, pos = varint(pos)
+            flags, pos = varint(pos)
+            kind, pos = data[pos], pos + 1
+
+            if kind == 0:
+
+                # the same page object as in the previous checkpoint
+                page = pages[addr]
+
+            else:
+
+                size, pos = varint(pos)
+                page = MemPage(addr, size, flags = flags)
+                page.data[:], pos = data[pos : pos + size], pos + size
+
+                if kind == 1: page.valid = None
+                else: page.valid[:], pos = data[pos : pos + size], pos + size
+
+            num = addr >> Mem.PAGE_BITS
+            table = tables.setdefault(num >> Mem.TABLE_BITS, [ None ] * Mem.TABLE_SIZE)
+            table[num & (Mem.TABLE_SIZE - 1)] = saved[addr] = page
+
+        pages.clear()
+        pages.update(saved)
+
+        return regs, ( tables, alloc_last )
+
+    def record_insn(self, cpu, addr):
+
+        if self.interval is not None and self.count > 0 and self.count % self.interval == 0:
+
+            self.checkpoint(cpu)
+
+        data = bytearray()
+        num = self.ids.get(addr)
+
+        if num is None:
+
+            # assign ID to the new instruction
+            self.ids[addr] = len(self.ids)
+
+            data.append(self.REC_INSN_NEW)
+            self._varint(data, addr)
+
+        elif num < self.ID_EXT:
+
+            data.append(self.REC_INSN | (num << 2))
+
+        else:
+
+            data.append(self.REC_INSN | (self.ID_EXT << 2))
+            self._varint(data, num - self.ID_EXT)
+
+        self._put(data)
+        self.count += 1
+
+    def record_mem(self, kind, addr, size, val):
+
+        addr, delta = long(addr), long(addr) - self.last_addr
+        self.last_addr = addr
+
+        data = bytearray([ kind | (self.size_list.index(size) << 2) ])
+
+        # zigzag encoded address delta
+        self._varint(data, (delta << 1) if delta >= 0 else ((-delta << 1) - 1))
+        self._varint(data, val)
+
+        self._put(data)
+
+    def records(self):
+
+        return self.parse()
+
+    def parse(self, checkpoints = False):
+
+        data = bytearray(self.data())
+        pos, addr_list, last_addr = 0, [], 0L
+
+        varint = lambda pos: self._varint_read(data, pos)
+
+        while pos < len(data):
+
+            tag = data[pos]
+            kind, pos = tag & 3, pos + 1
+
+            if tag == self.REC_CHECKPOINT:
+
+                size, pos = varint(pos)
+                
+                if checkpoints: 
+
+                    # instruction count and serialized checkpoint data
+                    count, _ = varint(pos)
+                    yield self.REC_CHECKPOINT, count, None, data[pos : pos + size]
+
+                pos += size
+
+            elif kind == self.REC_INSN_NEW:
+
+                addr, pos = varint(pos)
+                addr_list.append(addr)
+
+                yield self.REC_INSN, addr, None, None
+
+            elif kind == self.REC_INSN:
+
+                num = tag >> 2
+
+                if num == self.ID_EXT:
+
+                    ext, pos = varint(pos)
+                    num += ext
+
+                yield self.REC_INSN, addr_list[num], None, None
+
+            else:
+
+                delta, pos = varint(pos)
+                val, pos = varint(pos)
+
+                last_addr += (delta >> 1) if delta & 1 == 0 else -((delta + 1) >> 1)
+
+                yield kind, last_addr, self.size_list[(tag >> 2) & 3], val
+
+
+class CpuReplay(Cpu):
+
+    # re-executes recorded trace: memory reads are taken from the trace instead of memory
+    def __init__(self, arch, source, mem = None, math = None):
+
+        super(CpuReplay, self).__init__(arch, mem = mem, math = math)
+
+        self.source, self.records = source, None
+
+    def record(self, kind, addr):
+
+        rec_kind, rec_addr, _, val = next(self.records)
+
+        if rec_kind != kind or rec_addr != addr:
+
+            raise TraceError('Execution diverged from the trace at %s' % hex(self.get_ip()))
+
+        return val
+
+    def insn_stm(self, insn, a, b, c):
+
+        val = self.record(Trace.REC_STM, c.get_val())
+
+        # apply recorded write directly, without memory reader and access checks
+        self.mem.alloc(c.get_val(), data = self.mem.pack(insn.a.size, val))
+        return None
+
+    def insn_ldm(self, insn, a, b, c):
+
+        self.reg(insn.c.name).val = self.record(Trace.REC_LDM, a.get_val())
+        return None
+
+    def seek(self, storage, count = None, snapshot = None):
+
+        if snapshot is None:
+
+            # find the nearest checkpoint before specified instruction
+            checkpoints = filter(lambda cp: count is None or cp[0] <= count, 
+                                 self.source.checkpoints)
+
+            if len(checkpoints) == 0: raise TraceError('Checkpoint is not found')
+
+            start, snapshot = checkpoints[-1]
+
+        else: start = 0
+
+        self.restore(snapshot)
+        self.set_storage(storage)
+        self.records, num = self.source.records(), 0
+
+        try:
+
+            for kind, addr, _, _ in self.records:
+
+                if num < start:
+
+                    # skip records before the checkpoint
+                    if kind == Trace.REC_INSN: num += 1
+
+                    continue
+
+                if kind != Trace.REC_INSN: 
+
+                    raise TraceError('Unexpected memory access record')
+
+                self.set_ip(addr)
+
+                if count is not None and num >= count: break
+
+                self.step(storage, addr)
+                num += 1
+
+        except StopIteration:
+
+            # last instruction was interrupted by error
+            pass
+
+        self.set_storage()
+
+        # number of executed machine instructions
+        return num
+
+
+class TestTrace(unittest.TestCase):
+
+    arch = ARCH_X86
+
+    def test(self):
+
+        import tempfile
+
+        code = ( 'mov esi, [esp + 4]',
+                 'xor eax, eax',
+                 'mov ecx, 8',
+                 'l: movzx edx, byte ptr [esi]',
+                 'add eax, edx',
+                 'mov [esi], al',
+                 'inc esi',
+                 'dec ecx',
+                 'jnz l',
+                 'ret' )
+
+        addr, ret, stack, buff = 0x41414141, 0x44444444, 0x42424242, 0x43434000
 
-    def test_code_read(self):
+        # create reader and translator
+        from pyopenreil.utils import asm
+        reader = asm.Reader(self.arch, code, addr = addr)
+        tr = CodeStorageTranslator(reader)
 
-        addr, stack = 0x41414141, 0x42424242
-    
-        # test code that reads itself
-        code = ( 'nop', 'nop', 
-                 'nop', 'nop', 
-                 'mov eax, dword [%Xh]' % addr, 
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+
+        try:
+
+            # use small buffer to check flushing of the records
+            trace = Trace(path = path, buff_size = 0x20, interval = 10)
+
+            cpu = Cpu(self.arch)
+            cpu.trace = trace
+            cpu.mem.alloc(stack, data = struct.pack('II', ret, buff))
+            cpu.mem.alloc(buff, data = '\x01\x02\x03\x04\x05\x06\x07\x08')
+            cpu.reg('esp').val = stack
+
+            try: cpu.run(tr, addr)
+            except CpuReadError as e: 
+
+                if e.addr != ret: raise
+
+            trace.close()
+
+            assert trace.count == 3 + 6 * 8 + 1
+            assert len(trace.checkpoints) == 1 + trace.count / 10
+            assert list(Trace.open(path).records()) == list(trace.records())
+
+            # replay whole trace from the nearest checkpoint
+            replay = CpuReplay(self.arch, trace)
+            assert replay.seek(tr) == trace.count
+
+            for name in [ 'eax', 'ecx', 'edx', 'esi', 'esp', 'eip' ]:
+
+                assert replay.reg(name).val == cpu.reg(name).val
+
+            assert replay.mem.read(buff, 8) == cpu.mem.read(buff, 8)
+
+            # state at the middle of the trace must be the same as after replay from the start
+            replay.seek(tr, 25)
+            state = replay.snapshot()
+            assert replay.reg('ecx').val == 5
+
+            replay = CpuReplay(self.arch, Trace.open(path))
+            assert replay.seek(tr, 25, snapshot = trace.checkpoints[0][1]) == 25
+            assert replay.snapshot()[0] == state[0]
+
+            # checkpoints are loaded from the trace file
+            assert len(replay.source.checkpoints) == len(trace.checkpoints)
+            assert replay.seek(tr, 25) == 25
+            assert replay.snapshot()[0] == state[0]
+
+            # recorded memory writes doesn't need allocated memory
+            replay.seek(tr, snapshot = ( trace.checkpoints[0][1][0], Mem().snapshot() ))
+            assert replay.mem.read(buff, 8) == cpu.mem.read(buff, 8)
+
+        finally:
+
+            os.unlink(path)
+
+
+class ArgLanes(object):
+
+    def __init__(self, size, val):
+
+        self.size, self.val = size, val
+
+
+class MemLanes(Mem):
+
+    # memory of CpuLanes: each lane has its own copy-on-write copy of initial memory,
+    # writes are applied to all lanes while reads are served by the first lane
+
+    def __init__(self, lanes, mem = None):
+
+        mem = Mem() if mem is None else mem
+        snapshot = mem.snapshot()
+
+        self.lanes = []
+        self.strict = mem.strict
+
+        for num in range(0, lanes):
+
+            lane = Mem(reader = mem.reader, strict = mem.strict)
+            lane.alloc_base = mem.alloc_base
+            lane.restore(snapshot)
+
+            self.lanes.append(lane)
+
+    def __len__(self):
+
+        return len(self.lanes)
+
+    def lane(self, num):
+
+        return self.lanes[num]
+
+    @property
+    def reader(self):
+
+        return self.lanes[0].reader
+
+    @reader.setter
+    def reader(self, reader):
+
+        for lane in self.lanes: lane.reader = reader
+
+    def clear(self):
+
+        for lane in self.lanes: lane.clear()
+
+    def snapshot(self):
+
+        return map(lambda lane: lane.snapshot(), self.lanes)
+
+    def restore(self, snapshot):
+
+        for lane, lane_snapshot in zip(self.lanes, snapshot): lane.restore(lane_snapshot)
+
+    def protect(self, addr, size, flags):
+
+        for lane in self.lanes: lane.protect(addr, size, flags)
+
+    def read(self, addr, size):
+
+        return self.lanes[0].read(addr, size)
+
+    def write(self, addr, size, data):
+
+        for lane in self.lanes: lane.write(addr, size, data)
+
+    def alloc(self, addr = None, size = None, data = None, flags = MEM_READ | MEM_WRITE):
+
+        addr = self.lanes[0].alloc(addr = addr, size = size, data = data, flags = flags)
+
+        for lane in self.lanes[1 :]:
+
+            lane.alloc(addr = addr, size = size, data = data, flags = flags)
+            lane.alloc_last = self.lanes[0].alloc_last
+
+        return addr
+
+    def store(self, addr, size, val):
+
+        if isinstance(val, (list, tuple, numpy.ndarray)):
+
+            # store different value for each lane
+            for lane, lane_val in zip(self.lanes, val): lane.store(addr, size, long(lane_val))
+
+        else:
+
+            super(MemLanes, self).store(addr, size, val)
+
+
+class CpuLanes(Cpu):
+
+    # executes IR code for many independent states at once, registers
+    # values are numpy arrays with one element per lane
+
+    DEF_LANES = 8
+
+    def __init__(self, arch, lanes = DEF_LANES, mem = None, math = None):
+
+        self.lanes = lanes
+        self.masks = dict(map(lambda size: ( size, numpy.uint64((1L << Math.map_bits[size]) - 1) ), 
+                              Math.map_bits.keys()))
+
+        super(CpuLanes, self).__init__(arch, mem = mem, math = MathLanes() if math is None else math)
+
+    def lanes_val(self, val):
+
+        if isinstance(val, (list, tuple, numpy.ndarray)):
+
+            assert len(val) == self.lanes
+            return numpy.array(map(long, val), dtype = numpy.uint64)
+
+        # the same value for all lanes
+        return numpy.array([ long(val) ] * self.lanes, dtype = numpy.uint64)
+
+    def reset(self, regs = None, mem = None):
+
+        mem = self.mem if mem is None else mem
+
+        if not isinstance(mem, MemLanes):
+
+            # use separate copy of memory for each lane
+            mem = MemLanes(self.lanes, mem)
+
+        super(CpuLanes, self).reset(regs = regs, mem = mem)
+
+    def snapshot(self):
+
+        regs, mem = super(CpuLanes, self).snapshot()
+
+        # registers values are updated in place by execute()
+        return dict(map(lambda (name, val): ( name, self.lanes_val(val) ), regs.items())), mem
+
+    def restore(self, snapshot):
+
+        regs, mem = snapshot
+
+        # keep snapshot intact, it can be restored many times
+        super(CpuLanes, self).restore(( dict(map(lambda (name, val): ( name, self.lanes_val(val) ),
+                                                 regs.items())), mem ))
+
+    def reg(self, name, val = Cpu.DEF_REG_VAL, is_temp = False):
+
+        reg = super(CpuLanes, self).reg(name, val = val, is_temp = is_temp)
+
+        # value can be assigned by caller as single integer or list
+        if not isinstance(reg.val, numpy.ndarray) or len(reg.val) != self.lanes: 
+
+            reg.val = self.lanes_val(reg.val)
+
+        return reg
+
+    def arg(self, arg, lanes):
+
+        if arg.type == A_REG or arg.type == A_TEMP:
+
+            return ArgLanes(arg.size, self.reg(arg.name, is_temp = arg.type == A_TEMP).val[lanes])
+        
+        if arg.type == A_CONST:
+
+            return ArgLanes(arg.size, numpy.array([ arg.get_val() ] * self.lane_count(lanes), 
+                                                  dtype = numpy.uint64))
+
+        return None
+
+    def lane_count(self, lanes):
+
+        return self.lanes if isinstance(lanes, slice) else len(lanes)
+
+    def lane_list(self, lanes):
+
+        return range(0, self.lanes) if isinstance(lanes, slice) else map(long, lanes)
+
+    def lane_error(self, lane, error):
+
+        self.errors[lane] = error
+        self.live[lane] = False
+
+    def execute_mem(self, insn, lanes, addr, val):
+
+        ret, failed = [], []
+
+        for i, lane in enumerate(self.lane_list(lanes)):
+
+            mem = self.mem.lane(lane)
+
+            try:
+
+                # access memory of each lane separately
+                if insn.op == I_LDM: ret.append(mem.load(long(addr[i]), insn.c.size))
+                else: mem.store(long(addr[i]), insn.a.size, long(val[i]))
+
+            except MemError as e:
+
+                self.lane_error(lane, e)
+                failed.append(i)
+
+            else:
+
+                if insn.op == I_LDM: continue
+                ret.append(0)
+
+        return ret, failed
+
+    def execute(self, insn, lanes):
+
+        # returns lanes that continue execution and condition or None
+        a, b, c = self.arg(insn.a, lanes), self.arg(insn.b, lanes), self.arg(insn.c, lanes)
+
+        if insn.op == I_NONE: 
+
+            return lanes, None
+
+        elif insn.op == I_JCC: 
+
+            return lanes, a.val != 0
+
+        elif insn.op == I_LDM or insn.op == I_STM:
+
+            if insn.op == I_LDM: ret, failed = self.execute_mem(insn, lanes, a.val, None)
+            else: ret, failed = self.execute_mem(insn, lanes, c.val, a.val)
+
+            if len(failed) > 0:
+
+                ok = filter(lambda i: not i in failed, range(0, self.lane_count(lanes)))
+                lanes = numpy.array(map(lambda i: self.lane_list(lanes)[i], ok), dtype = numpy.int64)
+                ret = map(lambda i: ret[i], ok) if insn.op == I_LDM else ret
+
+            if insn.op == I_LDM and len(ret) > 0: 
+
+                reg = self.reg(insn.c.name, is_temp = insn.c.type == A_TEMP)
+                reg.val[lanes] = numpy.array(ret, dtype = numpy.uint64)
+
+            return lanes, None
+
+        else:
+
+            # evaluate all other instructions
+            val = self.math.eval(insn.op, a, b) & self.masks[insn.c.size]
+            self.reg(insn.c.name, is_temp = insn.c.type == A_TEMP).val[lanes] = val
+
+            return lanes, None
+
+    def run(self, storage, addr = 0L):
+
+        self.set_storage(storage)
+
+        # address of the next machine instruction for each lane
+        ip = self.lanes_val(addr)
+
+        self.live = numpy.ones(self.lanes, dtype = numpy.bool_)
+        self.errors = [ None ] * self.lanes
+
+        for reg in self.regs.values():
+
+            # registers values could be assigned by caller
+            if not isinstance(reg.val, numpy.ndarray): reg.val = self.lanes_val(reg.val)
+
+        while self.live.any():
+
+            # run lanes with the lowest address first, so diverged lanes can join again
+            addr = long(ip[self.live].min())
+            lanes = numpy.nonzero(self.live & (ip == addr))[0]
+            
+            if len(lanes) == self.lanes: lanes = slice(None)
+
+            try:
+
+                # query list of IR instructions from storage                
+                insn_list = storage.get_insn(addr)
+
+            except StorageError:
+
+                for lane in self.lane_list(lanes): self.lane_error(lane, CpuReadError(addr))
+                continue
+
+            self.reg(self.arch.Registers.ip).val[lanes] = addr
+
+            for insn in insn_list:
+
+                if not insn.op in REIL_INSN:
+
+                    # invalid opcode
+                    for lane in self.lane_list(lanes): 
+
+                        self.lane_error(lane, CpuInstructionError(insn.addr, insn.inum))
+
+                    break
+
+                # execute single instruction
+                lanes, cond = self.execute(insn, lanes)
+
+                if self.lane_count(lanes) == 0: break
+
+                if cond is not None and cond.any():
+
+                    lane_list = numpy.array(self.lane_list(lanes), dtype = numpy.int64)
+                    target = self.arg(insn.c, lanes).val
+
+                    # lanes that taken JCC continue from the target address
+                    ip[lane_list[cond]] = target[cond]
+
+                    if cond.all(): break
+
+                    lanes = lane_list[~cond]
+
+            else:
+
+                # go to the next machine instruction
+                next, _ = insn.next()
+
+                ip[lanes] = next
+                self.reg(self.arch.Registers.ip).val[lanes] = next
+
+            # remove temp registers
+            self.reset_temp()
+
+        self.set_storage()
+
+        # list of exceptions that stopped each lane
+        return self.errors
+
+
+class TestCpuLanes(unittest.TestCase):
+
+    arch = ARCH_X86
+
+    def test(self):
+
+        code = ( 'mov ecx, [esp + 4]',
+                 'mov edx, [esp + 8]',
+                 'mov eax, 1',
+                 'l: test ecx, 1',
+                 'jz s',
+                 'imul eax, ecx',
+                 'rol eax, 5',
+                 'jmp n',
+                 's: xor eax, ecx',
+                 'n: add [edx], eax',
+                 'dec ecx',
+                 'jnz l',
+                 'mov eax, [edx]',
                  'ret' )
 
+        addr, lanes = 0x41414141, 8
+        args = [ 1, 2, 3, 10, 11, 20, 21, 30 ]
+
         # create reader and translator
         from pyopenreil.utils import asm
         tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
 
-        cpu = Cpu(ARCH_X86)
+        cpu = CpuLanes(self.arch, lanes = lanes)
+        abi = Abi(cpu, tr)
 
-        # set up stack pointer
-        cpu.reg('esp').val = stack
-        
-        # run untill ret
-        try: cpu.run(tr, addr)
-        except MemReadError as e: 
+        val = abi.buff(4)
 
-            # exception on accessing to the stack
-            if e.addr != stack: raise
+        for lane in range(0, lanes):
 
-        # check for correct return value
-        assert cpu.reg('eax').val == 0x90909090
+            # use different initial memory contents for each lane
+            cpu.mem.lane(lane).store(val, U32, lane)
+
+        ret = abi.cdecl(addr, args, val)
+        assert len(set(map(long, ret))) == lanes
+
+        for lane in range(0, lanes):
+
+            # compare results with non-vectorized implementation
+            cpu = Cpu(self.arch)
+            abi = Abi(cpu, tr)
+
+            val = abi.buff(4)
+            cpu.mem.store(val, U32, lane)
+
+            assert abi.cdecl(addr, args[lane], val) == ret[lane]
+
+    def test_snapshot(self):
+
+        code = ( 'inc eax',
+                 'ret' )
+
+        addr, lanes = 0x41414141, 4
+
+        # create reader and translator
+        from pyopenreil.utils import asm
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
+
+        cpu = CpuLanes(self.arch, lanes = lanes)
+        cpu.reg('eax').val = [ 1, 2, 3, 4 ]
+        cpu.run(tr, addr)
+
+        snapshot = cpu.snapshot()
+
+        for i in range(0, 2):
+
+            # run until ret and restore the same snapshot
+            cpu.run(tr, addr)
+            assert map(long, cpu.reg('eax').val) == [ 3, 4, 5, 6 ]
+
+            cpu.restore(snapshot)
+            assert map(long, cpu.reg('eax').val) == [ 2, 3, 4, 5 ]
 
 
 class Stack(object):
@@ -713,6 +2487,15 @@ class Abi(object):
         # reset cpu state
         self.cpu.reset(self.initial_regs())
 
+    def snapshot(self):
+
+        # save state of cpu and memory, see Cpu.snapshot()
+        return self.cpu.snapshot()
+
+    def restore(self, snapshot):
+
+        self.cpu.restore(snapshot)
+
     def reg(self, name, val = None):
 
         # get/set register value
@@ -730,13 +2513,22 @@ class Abi(object):
         try:
 
             # run untill cpu will stop on DUMMY_RET_ADDR
-            self.cpu.run(self.storage, addr)
+            errors = self.cpu.run(self.storage, addr)
 
         except CpuError as e:
 
             if e.addr != self.DUMMY_RET_ADDR:
 
                 raise
+
+        else:
+
+            # CpuLanes returns the error of each lane instead of exception
+            for e in errors or []:
+
+                if not isinstance(e, CpuError) or e.addr != self.DUMMY_RET_ADDR:
+
+                    raise e
     
     def stdcall(self, addr, *args):        
 
@@ -774,6 +2566,7 @@ class Abi(object):
 class TestAbi(unittest.TestCase):
 
     arch = ARCH_X86
+    cpu = Cpu
 
     def test(self):     
 
@@ -787,12 +2580,49 @@ class TestAbi(unittest.TestCase):
         from pyopenreil.utils import asm
         tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
 
-        cpu = Cpu(self.arch)
+        cpu = self.cpu(self.arch)
         abi = Abi(cpu, tr)
 
         # check for correct return value
         assert abi.stdcall(addr, arg) == arg
 
+    def test_snapshot(self):
+
+        code = ( 'mov eax, [esp + 4]', 
+                 'inc dword ptr [eax]', 
+                 'mov eax, [eax]',
+                 'ret' )
+
+        addr = 0x41414141
+
+        # create reader and translator        
+        from pyopenreil.utils import asm
+        tr = CodeStorageTranslator(asm.Reader(self.arch, code, addr = addr))
+
+        cpu = self.cpu(self.arch)
+        abi = Abi(cpu, tr)
+
+        val = abi.buff(Mem.PAGE_SIZE)
+        snapshot = abi.snapshot()
+        
+        for i in range(0, 3):
+
+            # each call must start with the same memory contents
+            assert abi.cdecl(addr, val) == 1
+            abi.restore(snapshot)
+
+        assert abi.read(val, 4) == '\0\0\0\0'
+        
+        abi.cdecl(addr, val)
+        abi.cdecl(addr, val)        
+
+        assert abi.read(val, 4) == '\2\0\0\0'
+
+
+class TestAbiNative(TestAbi):
+
+    cpu = CpuNative
+
 #
 # EoF
 #
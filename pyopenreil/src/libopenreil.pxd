@@ -4,6 +4,10 @@ DEF REIL_ERROR = -1
 
 cdef extern from "libopenreil.h":    
 
+    enum: MAX_INST_LEN
+
+    enum: IOPT_CALL, IOPT_RET, IOPT_BB_END, IOPT_ASM_END
+
     cdef enum _reil_op_t:
 
         I_NONE,     # no operation
@@ -28,7 +32,13 @@ cdef extern from "libopenreil.h":
         I_XOR,      # binary xor
         I_NOT,      # binary not 
         I_EQ,       # equation
-        I_LT        # less than
+        I_LT,       # less than
+        I_SAR,      # arithmetic shift right
+        I_ROL,      # rotate left
+        I_ROR,      # rotate right
+        I_SEXT,     # sign extension
+        I_NEQ,      # not equal
+        I_LE        # less or equal
 
     cdef enum _reil_type_t:
 
@@ -74,6 +84,40 @@ cdef extern from "libopenreil.h":
     ctypedef _reil_inst_t reil_inst_t
     ctypedef _reil_arch_t reil_arch_t
 
-    int reil_translate_insn(reil_t reil, reil_addr_t addr, unsigned char *buff, int len)
-    reil_t reil_init(reil_arch_t arch, reil_inst_handler_t handler, void *context)
-    void reil_close(reil_t reil)    
+    ctypedef void* reil_vm_t
+    ctypedef void* reil_vm_code_read_t
+    ctypedef void* reil_vm_mem_read_t
+    ctypedef void* reil_vm_mem_write_t
+    ctypedef void* reil_vm_taint_handler_t
+
+    int reil_translate_insn(reil_t reil, reil_addr_t addr, unsigned char *buff, int len) nogil
+    int reil_optimize(reil_inst_t *insn_list, int insn_count, unsigned int passes)
+    reil_t reil_init(reil_arch_t arch, reil_inst_handler_t handler, void *context) nogil
+    reil_t reil_init_ex(reil_arch_t arch, unsigned int opts, reil_inst_handler_t handler, void *context) nogil
+    void reil_close(reil_t reil) nogil
+
+    reil_vm_t reil_vm_init(reil_arch_t arch, reil_vm_code_read_t code_read, reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write, void *context)
+    reil_vm_t reil_vm_init_ex(reil_arch_t arch, unsigned int opts, reil_vm_code_read_t code_read, reil_vm_mem_read_t mem_read, reil_vm_mem_write_t mem_write, void *context)
+    void reil_vm_close(reil_vm_t vm)
+    int reil_vm_reg_get(reil_vm_t vm, const char *name, reil_const_t *val)
+    int reil_vm_reg_set(reil_vm_t vm, const char *name, reil_const_t val)
+    int reil_vm_reg_count(reil_vm_t vm)
+    const char *reil_vm_reg_name(reil_vm_t vm, int num)
+    void reil_vm_reset(reil_vm_t vm)
+    void reil_vm_flush(reil_vm_t vm)
+    void reil_vm_invalidate(reil_vm_t vm, reil_addr_t addr, int size)
+    int reil_vm_map(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *buff, int flags)
+    int reil_vm_unmap(reil_vm_t vm, reil_addr_t addr, int size)
+    int reil_vm_run(reil_vm_t vm, reil_addr_t addr, reil_addr_t *err_addr, reil_inum_t *err_inum)
+    void reil_vm_taint_handler(reil_vm_t vm, reil_vm_taint_handler_t handler)
+    void reil_vm_taint_reset(reil_vm_t vm)
+    int reil_vm_taint_reg_get(reil_vm_t vm, const char *name, reil_const_t *taint)
+    int reil_vm_taint_reg_set(reil_vm_t vm, const char *name, reil_const_t taint)
+    int reil_vm_taint_mem_get(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *labels)
+    int reil_vm_taint_mem_set(reil_vm_t vm, reil_addr_t addr, int size, unsigned char *labels)
+    int reil_vm_coverage_set_map(reil_vm_t vm, unsigned char *buff, int size)
+    unsigned char *reil_vm_coverage_get_map(reil_vm_t vm, int *size)
+    int reil_vm_coverage_hits(reil_vm_t vm, reil_addr_t *addr, reil_const_t *hits, int max)
+    void reil_vm_coverage_reset(reil_vm_t vm)
+    int reil_columns_filter(const void *column, int width, int count, reil_const_t lo, reil_const_t hi, unsigned char *mask) nogil
+    int reil_columns_histogram(const void *column, int width, int count, const unsigned char *mask, unsigned int *counts, int max) nogil
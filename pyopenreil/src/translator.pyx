@@ -1,7 +1,25 @@
+from libc.stdlib cimport malloc, realloc, free
+from libc.string cimport memset, memcpy, strncpy, strlen
+from cpython.buffer cimport PyBuffer_FillInfo
+from cpython.pythread cimport PyThread_type_lock, PyThread_allocate_lock, \
+                              PyThread_acquire_lock, PyThread_release_lock, WAIT_LOCK
+
+cdef extern from "Python.h":
+
+    # old style buffer interface is supported by array, bytearray and numpy arrays
+    int PyObject_AsReadBuffer(object obj, const void **buff, Py_ssize_t *size) except -1
+    int PyObject_AsWriteBuffer(object obj, void **buff, Py_ssize_t *size) except -1
+
+import sys
+
 cimport libopenreil
 
 ARCH_X86 = 0
 
+# VEX and libasmir keeps translation state in globals, so calls of
+# different translator instances must not run in parallel
+cdef PyThread_type_lock translator_lock = PyThread_allocate_lock()
+
 # IR instruction attributes
 IATTR_ASM = 0
 IATTR_BIN = 1
@@ -26,43 +44,273 @@ cdef process_arg(libopenreil._reil_arg_t arg):
 
         return ( arg.type, arg.size, arg.val )
 
-cdef int process_insn(libopenreil.reil_inst_t* inst, object context):
+cdef process_arg_tuple(libopenreil._reil_arg_t *arg, object val):
 
-    attr = {}    
+    # convert python tuple to the reil_arg_t
+    memset(arg, 0, sizeof(libopenreil._reil_arg_t))
 
-    cdef unsigned char* data
-    cdef char* str_mnem
-    cdef char* str_op
-    
-    if inst.flags != 0: 
+    if len(val) == 0:
 
-        attr[IATTR_FLAGS] = inst.flags
+        arg.type = libopenreil.A_NONE
+        return
 
-    if inst.inum == 0:
+    arg.type = <libopenreil._reil_type_t>(<int>val[0])
+    arg.size = <libopenreil._reil_size_t>(<int>val[1])
 
-        data = inst.raw_info.data
-        str_mnem = inst.raw_info.str_mnem
-        str_op = inst.raw_info.str_op
+    if arg.type == libopenreil.A_CONST: 
 
-        if data != NULL:
+        arg.val = val[2]
 
-            # instruction bytes
-            attr[IATTR_BIN] = (<char *>data)[:inst.raw_info.size]
+    else:
 
-        if str_mnem != NULL and str_op != NULL:
+        strncpy(arg.name, val[2], sizeof(arg.name) - 1)
 
-            # assembly instruction
-            attr[IATTR_ASM] = ( str(str_mnem), str(str_op) )
-    
-    # convert reil_inst_t to the python tuple
-    raw_info = ( inst.raw_info.addr, inst.raw_info.size )    
-    args = ( process_arg(inst.a), process_arg(inst.b), process_arg(inst.c) )
-    
-    # put instruction into the list
-    context.insert(0, ( raw_info, inst.inum, inst.op, args, attr ))
+cdef process_insn_tuple(libopenreil.reil_inst_t *inst, object val):
+
+    ( addr, size ), inum, op, args, attr = val
+
+    # convert python tuple to the reil_inst_t
+    memset(inst, 0, sizeof(libopenreil.reil_inst_t))
+
+    inst.raw_info.addr = addr
+    inst.raw_info.size = size
+    inst.inum = inum
+    inst.op = <libopenreil._reil_op_t>(<int>op)
+    inst.flags = attr.get(IATTR_FLAGS, 0)
+
+    process_arg_tuple(&inst.a, args[0])
+    process_arg_tuple(&inst.b, args[1])
+    process_arg_tuple(&inst.c, args[2])
+
+DEF INSN_BUFF_SIZE = 0x20
+
+cdef struct insn_info_t:
+
+    # offsets of machine instruction bytes and assembly strings in data buffer or -1
+    int data, str_mnem, str_op
+
+cdef struct insn_buff_t:
+
+    libopenreil.reil_inst_t *insn_list
+    insn_info_t *info_list
+    int count, size
+
+    # bytes and assembly of machine instructions
+    char *data
+    int data_len, data_size
+
+    int error
+
+cdef struct insn_range_t:
+
+    # offset and length of machine instruction (-1 if it wasn't translated)
+    int offs, size
+
+    # range of its IR instructions in insn_buff_t
+    int first, last
+
+cdef int insn_buff_data(insn_buff_t *buff, void *data, int size) nogil:
+
+    cdef int offs = buff.data_len
+    cdef int data_size = buff.data_size
+    cdef char *new_data
+
+    if data == NULL: 
+
+        return -1
+
+    while offs + size > data_size: 
+
+        data_size = max(data_size * 2, 0x100)
+
+    if data_size != buff.data_size:
+
+        new_data = <char *>realloc(buff.data, data_size)
+        if new_data == NULL:
+
+            buff.error = 1
+            return -1
+
+        buff.data, buff.data_size = new_data, data_size
+
+    memcpy(buff.data + offs, data, size)
+    buff.data_len += size
+
+    return offs
+
+cdef int insn_buff_put(libopenreil.reil_inst_t *inst, void *context) nogil:
+
+    cdef insn_buff_t *buff = <insn_buff_t *>context
+    cdef libopenreil.reil_inst_t *insn_list
+    cdef insn_info_t *info_list
+    cdef insn_info_t *info
+    cdef int size
+
+    if buff.count == buff.size:
+
+        size = max(buff.size * 2, INSN_BUFF_SIZE)
+
+        insn_list = <libopenreil.reil_inst_t *>realloc(buff.insn_list, sizeof(libopenreil.reil_inst_t) * size)
+        if insn_list != NULL: buff.insn_list = insn_list
+
+        info_list = <insn_info_t *>realloc(buff.info_list, sizeof(insn_info_t) * size)
+        if info_list != NULL: buff.info_list = info_list
+
+        if insn_list == NULL or info_list == NULL:
+
+            buff.error = 1
+            return 0
+
+        buff.size = size
+
+    memcpy(&buff.insn_list[buff.count], inst, sizeof(libopenreil.reil_inst_t))
+
+    info = &buff.info_list[buff.count]
+    info.data = info.str_mnem = info.str_op = -1
+
+    if inst.inum == 0:
+
+        # raw instruction information is available only while handler is running
+        info.data = insn_buff_data(buff, inst.raw_info.data, inst.raw_info.size)
+
+        if inst.raw_info.str_mnem != NULL and inst.raw_info.str_op != NULL:
+
+            info.str_mnem = insn_buff_data(buff, inst.raw_info.str_mnem, strlen(inst.raw_info.str_mnem) + 1)
+            info.str_op = insn_buff_data(buff, inst.raw_info.str_op, strlen(inst.raw_info.str_op) + 1)
+
+    buff.count += 1
 
     return 1
-    
+
+
+def optimize(insn_list, passes):
+
+    cdef int i, count = len(insn_list)
+    cdef libopenreil.reil_inst_t *c_list
+    cdef libopenreil.reil_inst_t *inst
+
+    attrs, ret = {}, []
+
+    c_list = <libopenreil.reil_inst_t *>malloc(sizeof(libopenreil.reil_inst_t) * max(count, 1))
+    if c_list == NULL: 
+
+        raise MemoryError()
+
+    try:
+
+        for i in range(0, count):
+
+            ( addr, size ), inum, op, args, attr = insn_list[i]
+
+            process_insn_tuple(&c_list[i], insn_list[i])
+
+            # keep information about machine instruction
+            if inum == 0: attrs[addr] = attr
+
+        count = libopenreil.reil_optimize(c_list, count, passes)
+        if count == -1: 
+
+            raise Error('Error while optimizing REIL code')
+
+        for i in range(0, count):
+
+            inst = &c_list[i]
+            attr = {}
+
+            if inst.inum == 0 and attrs.has_key(inst.raw_info.addr): 
+
+                attr = attrs[inst.raw_info.addr].copy()
+
+            if inst.flags != 0: attr[IATTR_FLAGS] = inst.flags
+            elif attr.has_key(IATTR_FLAGS): attr.pop(IATTR_FLAGS)
+
+            # convert reil_inst_t to the python tuple
+            raw_info = ( inst.raw_info.addr, inst.raw_info.size )    
+            args = ( process_arg(inst.a), process_arg(inst.b), process_arg(inst.c) )
+
+            ret.append(( raw_info, inst.inum, inst.op, args, attr ))
+
+    finally:
+
+        free(c_list)
+
+    return ret
+
+
+def columns_filter(column, int width, libopenreil.reil_const_t lo, libopenreil.reil_const_t hi, mask):
+
+    cdef const void *c_column
+    cdef void *c_mask
+    cdef Py_ssize_t column_size, mask_size
+    cdef int count, ret
+
+    PyObject_AsReadBuffer(column, &c_column, &column_size)
+    PyObject_AsWriteBuffer(mask, &c_mask, &mask_size)
+
+    count = column_size / width
+
+    if mask_size < count: 
+
+        raise Error('Mask is too small')
+
+    with nogil:
+
+        # clear mask items of column values that are out of range
+        ret = libopenreil.reil_columns_filter(c_column, width, count, lo, hi, <unsigned char *>c_mask)
+
+    if ret == -1: 
+
+        raise Error('Invalid column width')
+
+    return ret
+
+
+def columns_histogram(column, int width, int limit, mask = None):
+
+    cdef const void *c_column
+    cdef const void *c_mask = NULL
+    cdef unsigned int *counts
+    cdef Py_ssize_t column_size, mask_size
+    cdef int count, ret
+
+    PyObject_AsReadBuffer(column, &c_column, &column_size)
+
+    count = column_size / width
+
+    if mask is not None:
+
+        PyObject_AsReadBuffer(mask, &c_mask, &mask_size)
+
+        if mask_size < count: 
+
+            raise Error('Mask is too small')
+
+    if limit <= 0:
+
+        raise Error('Invalid histogram limit')
+
+    counts = <unsigned int *>malloc(sizeof(unsigned int) * limit)
+    if counts == NULL: 
+
+        raise MemoryError()
+
+    memset(counts, 0, sizeof(unsigned int) * limit)
+
+    with nogil:
+
+        # count occurrences of each value
+        ret = libopenreil.reil_columns_histogram(c_column, width, count, <const unsigned char *>c_mask, counts, limit)
+
+    if ret == -1: 
+
+        free(counts)
+        raise Error('Invalid column width')
+
+    ret_list = [ counts[i] for i in range(limit) ]
+
+    free(counts)
+    return ret_list
+
 
 class Error(Exception):
 
@@ -86,23 +334,114 @@ class TranslationError(Error):
         return 'Error while translating instruction %s to REIL' % hex(self.addr)
 
 
+cdef class InsnBuffer:
+
+    # IR instructions in native format, python tuples are created on access
+    cdef insn_buff_t buff
+
+    def __dealloc__(self):
+
+        free(self.buff.insn_list)
+        free(self.buff.info_list)
+        free(self.buff.data)
+
+    def __len__(self):
+
+        return self.buff.count
+
+    def __getitem__(self, i):
+
+        if isinstance(i, slice):
+
+            return [ self.insn_tuple(n) for n in range(*i.indices(self.buff.count)) ]
+
+        if i < 0: i += self.buff.count
+        if i < 0 or i >= self.buff.count: 
+
+            raise IndexError('Instruction index out of range')
+
+        return self.insn_tuple(i)
+
+    property insn_size:
+
+        # size of reil_inst_t structure in the raw buffer
+        def __get__(self): return sizeof(libopenreil.reil_inst_t)
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+
+        # reil_inst_t array can be accessed directly without conversion
+        PyBuffer_FillInfo(buffer, self, <void *>self.buff.insn_list, 
+                          self.buff.count * sizeof(libopenreil.reil_inst_t), 1, flags)
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+
+        pass
+
+    cdef insn_tuple(self, int i):
+
+        cdef libopenreil.reil_inst_t *inst = &self.buff.insn_list[i]
+        cdef insn_info_t *info = &self.buff.info_list[i]
+
+        attr = {}
+
+        if inst.flags != 0: 
+
+            attr[IATTR_FLAGS] = inst.flags
+
+        if info.data != -1:
+
+            # instruction bytes
+            attr[IATTR_BIN] = (self.buff.data + info.data)[:inst.raw_info.size]
+
+        if info.str_mnem != -1 and info.str_op != -1:
+
+            # assembly instruction
+            attr[IATTR_ASM] = ( str(self.buff.data + info.str_mnem), str(self.buff.data + info.str_op) )
+
+        # convert reil_inst_t to the python tuple
+        raw_info = ( inst.raw_info.addr, inst.raw_info.size )    
+        args = ( process_arg(inst.a), process_arg(inst.b), process_arg(inst.c) )
+
+        return ( raw_info, inst.inum, inst.op, args, attr )
+
+
 cdef class Translator:
 
     cdef libopenreil.reil_t reil
     cdef libopenreil.reil_arch_t reil_arch
-    translated = []
+    cdef insn_buff_t buff
 
-    def __init__(self, arch):
+    def __init__(self, arch, opts = 0):
     
+        cdef unsigned int c_opts = opts
+
         self.reil_arch = self.get_reil_arch(arch)
 
-        # initialize translator
-        self.reil = libopenreil.reil_init(self.reil_arch, 
-            <libopenreil.reil_inst_handler_t>process_insn, <void*>self.translated)
+        memset(&self.buff, 0, sizeof(insn_buff_t))
+
+        with nogil:
+
+            PyThread_acquire_lock(translator_lock, WAIT_LOCK)
+
+            # initialize translator, handler collects instructions without GIL
+            self.reil = libopenreil.reil_init_ex(self.reil_arch, c_opts,
+                <libopenreil.reil_inst_handler_t>insn_buff_put, <void*>&self.buff)
+
+            PyThread_release_lock(translator_lock)
+
+    def __dealloc__(self):
 
-    def __del__(self):
+        if self.reil != NULL: 
 
-        libopenreil.reil_close(self.reil)
+            with nogil:
+
+                PyThread_acquire_lock(translator_lock, WAIT_LOCK)
+                libopenreil.reil_close(self.reil)
+                PyThread_release_lock(translator_lock)
+
+        free(self.buff.insn_list)
+        free(self.buff.info_list)
+        free(self.buff.data)
 
     def get_reil_arch(self, arch):
 
@@ -114,19 +453,430 @@ cdef class Translator:
 
             raise Error('Unknown architecture')
 
-    def to_reil(self, data, addr = 0):
+    def to_reil_buff(self, data, addr = 0):
 
-        ret = []
         cdef unsigned char* c_data = data
         cdef int c_size = len(data)
+        cdef libopenreil.reil_addr_t c_addr = addr
+        cdef InsnBuffer ret = InsnBuffer()
+        cdef int num
+
+        # translate specified binary code, other python threads can run meanwhile
+        with nogil:
+
+            PyThread_acquire_lock(translator_lock, WAIT_LOCK)
+            num = libopenreil.reil_translate_insn(self.reil, c_addr, c_data, c_size)
+            PyThread_release_lock(translator_lock)
+
+        # translated instructions are owned by returned object
+        ret.buff = self.buff
+        memset(&self.buff, 0, sizeof(insn_buff_t))
+
+        if ret.buff.error != 0:
+
+            raise MemoryError()
 
-        # translate specified binary code
-        num = libopenreil.reil_translate_insn(self.reil, addr, c_data, c_size)
         if num == -1: 
 
             raise TranslationError(addr)
 
-        # collect translated instructions
-        while len(self.translated) > 0: ret.append(self.translated.pop())
         return ret
 
+    def to_reil(self, data, addr = 0):
+
+        return list(self.to_reil_buff(data, addr = addr))
+
+    def to_reil_range(self, data, addr = 0, bb = False):
+
+        cdef unsigned char* c_data = data
+        cdef int c_size = len(data)
+        cdef libopenreil.reil_addr_t c_addr = addr
+        cdef unsigned char c_insn[libopenreil.MAX_INST_LEN]
+        cdef insn_range_t *c_list
+        cdef insn_range_t *item
+        cdef bint c_bb = bb
+        cdef int i, p = 0, count = 0, num, data_len
+        cdef InsnBuffer ret = InsnBuffer()
+
+        c_list = <insn_range_t *>malloc(sizeof(insn_range_t) * max(c_size, 1))
+        if c_list == NULL: 
+
+            raise MemoryError()
+
+        # translate all of the instructions with single call
+        with nogil:
+
+            PyThread_acquire_lock(translator_lock, WAIT_LOCK)
+
+            while p < c_size:
+
+                # copy one instruction into the buffer
+                memset(c_insn, 0, libopenreil.MAX_INST_LEN)
+                memcpy(c_insn, c_data + p, min(libopenreil.MAX_INST_LEN, c_size - p))
+
+                item = &c_list[count]
+                item.offs, item.first = p, self.buff.count
+                data_len = self.buff.data_len
+                count += 1
+
+                num = libopenreil.reil_translate_insn(self.reil, c_addr + p, c_insn, libopenreil.MAX_INST_LEN)
+
+                if num == -1 or num > c_size - p:
+
+                    # drop partially translated or truncated instruction
+                    self.buff.count, self.buff.data_len = item.first, data_len
+                    item.size, item.last = -1, item.first
+
+                    if c_bb or num != -1: break
+
+                    # continue from the next byte
+                    p += 1
+                    continue
+
+                item.size, item.last = num, self.buff.count
+                p += num
+
+                if c_bb and item.last > item.first and \
+                   self.buff.insn_list[item.last - 1].flags & (libopenreil.IOPT_BB_END | libopenreil.IOPT_RET):
+
+                    # end of the basic block
+                    break
+
+            PyThread_release_lock(translator_lock)
+
+        # translated instructions are owned by returned object
+        ret.buff = self.buff
+        memset(&self.buff, 0, sizeof(insn_buff_t))
+
+        bounds, errors = [], []
+
+        for i in range(count):
+
+            item = &c_list[i]
+
+            if item.size == -1: 
+
+                errors.append(addr + item.offs)
+
+            else:
+
+                # IR instructions of machine instruction are ret[first : last]
+                bounds.append(( addr + item.offs, item.size, item.first, item.last ))
+
+        free(c_list)
+
+        if ret.buff.error != 0:
+
+            raise MemoryError()
+
+        return ret, bounds, errors
+
+
+# interpreter exit codes
+VM_ERR_CODE = -2
+VM_ERR_READ = -3
+VM_ERR_WRITE = -4
+VM_ERR_INSN = -5
+VM_ERR_TAINT = -6
+
+# access flags of mapped memory
+VM_MEM_READ = 1
+VM_MEM_WRITE = 2
+
+# kinds of tainted values reported to the taint handler
+VM_TAINT_JCC = 1
+VM_TAINT_LDM = 2
+VM_TAINT_STM = 3
+
+cdef int vm_code_read(libopenreil.reil_addr_t addr, libopenreil.reil_inst_t *insn_list, 
+                      int insn_max, void *context):
+
+    cdef Interpreter vm = <Interpreter>context
+    cdef int i
+
+    try:
+
+        # query IR instructions of the machine instruction
+        insn_list_py = vm.code_read(addr)
+        if len(insn_list_py) > insn_max: 
+
+            # buffer is too small
+            return len(insn_list_py)
+
+        for i in range(0, len(insn_list_py)):
+
+            process_insn_tuple(&insn_list[i], insn_list_py[i])
+
+        return len(insn_list_py)
+
+    except Exception as e:
+
+        # interpreter can query code that will be never executed
+        vm.code_error = ( addr, sys.exc_info() )
+        return -1
+
+cdef int vm_mem_read(libopenreil.reil_addr_t addr, int size, 
+                     unsigned char *buff, void *context):
+
+    cdef Interpreter vm = <Interpreter>context
+    cdef char *c_data
+
+    try:
+
+        data = vm.mem_read(addr, size)
+        if len(data) < size:
+
+            # callback returned less data than requested
+            return -1
+
+        c_data = data
+
+        memcpy(buff, c_data, size)
+        return size
+
+    except Exception as e:
+
+        vm.error = sys.exc_info()
+        return -1
+
+cdef int vm_mem_write(libopenreil.reil_addr_t addr, int size, 
+                      unsigned char *buff, void *context):
+
+    cdef Interpreter vm = <Interpreter>context
+
+    try:
+
+        vm.mem_write(addr, (<char *>buff)[:size])
+        return size
+
+    except Exception as e:
+
+        vm.error = sys.exc_info()
+        return -1
+
+cdef int vm_taint(int kind, libopenreil.reil_addr_t addr, libopenreil.reil_inum_t inum,
+                  libopenreil.reil_const_t val, libopenreil.reil_const_t taint, void *context):
+
+    cdef Interpreter vm = <Interpreter>context
+
+    try:
+
+        # handler can raise an exception to stop the execution
+        vm.taint(kind, addr, inum, val, taint)
+        return 0
+
+    except Exception as e:
+
+        vm.error = sys.exc_info()
+        return -1
+
+
+cdef class Interpreter:
+
+    cdef libopenreil.reil_vm_t vm
+    cdef public object code_read, mem_read, mem_write, taint, error
+    cdef object mapped, coverage, code_error
+
+    def __init__(self, arch, code_read, mem_read, mem_write, opts = 0, taint = None):
+
+        self.code_read, self.error = code_read, None
+        self.mem_read, self.mem_write = mem_read, mem_write
+        self.taint = taint
+        self.mapped = {}
+        self.coverage = self.code_error = None
+
+        try: 
+
+            reil_arch = { ARCH_X86: libopenreil.ARCH_X86 }[ arch ]
+
+        except KeyError: 
+
+            raise Error('Unknown architecture')
+
+        # initialize interpreter
+        self.vm = libopenreil.reil_vm_init_ex(reil_arch, opts,
+            <libopenreil.reil_vm_code_read_t>vm_code_read, 
+            <libopenreil.reil_vm_mem_read_t>vm_mem_read, 
+            <libopenreil.reil_vm_mem_write_t>vm_mem_write, <void*>self)
+
+        if self.vm == NULL:
+
+            raise Error('Unable to initialize interpreter')
+
+        if taint is not None:
+
+            # report tainted values, see REIL_VM_OPT_TAINT
+            libopenreil.reil_vm_taint_handler(self.vm, <libopenreil.reil_vm_taint_handler_t>vm_taint)
+
+    def __dealloc__(self):
+
+        if self.vm != NULL: libopenreil.reil_vm_close(self.vm)
+
+    def reg(self, name, val = None):
+
+        cdef libopenreil.reil_const_t c_val = 0
+
+        # get/set register value
+        if val is None: 
+
+            libopenreil.reil_vm_reg_get(self.vm, name, &c_val)
+            return c_val
+
+        libopenreil.reil_vm_reg_set(self.vm, name, val)
+
+    def regs(self):
+
+        cdef int i
+        cdef libopenreil.reil_const_t c_val = 0
+
+        ret = {}
+
+        for i in range(0, libopenreil.reil_vm_reg_count(self.vm)):
+
+            name = libopenreil.reil_vm_reg_name(self.vm, i)
+            libopenreil.reil_vm_reg_get(self.vm, name, &c_val)
+
+            ret[name] = c_val
+
+        return ret
+
+    def reset(self):
+
+        # set all registers to zero
+        libopenreil.reil_vm_reset(self.vm)
+
+    def flush(self):
+
+        # drop predecoded instructions
+        libopenreil.reil_vm_flush(self.vm)
+
+    def invalidate(self, addr, size):
+
+        # drop predecoded instructions of given memory range
+        libopenreil.reil_vm_invalidate(self.vm, addr, size)
+
+    def map(self, addr, bytearray buff, flags = VM_MEM_READ | VM_MEM_WRITE):
+
+        cdef unsigned char *c_buff
+
+        # buffer export keeps bytearray from being resized while it's mapped
+        view = memoryview(buff)
+        c_buff = buff
+
+        # access page aligned memory range directly without callbacks
+        if libopenreil.reil_vm_map(self.vm, addr, len(buff), c_buff, flags) != 0:
+
+            raise Error('Unable to map memory at address 0x%x' % addr)
+
+        self.mapped[addr] = view
+
+    def unmap(self, addr, size):
+
+        if libopenreil.reil_vm_unmap(self.vm, addr, size) != 0:
+
+            raise Error('Unable to unmap memory at address 0x%x' % addr)
+
+        for buff_addr in list(self.mapped.keys()):
+
+            if addr <= buff_addr and buff_addr + len(self.mapped[buff_addr]) <= addr + size:
+
+                del self.mapped[buff_addr]
+
+    def taint_reset(self):
+
+        # clear taint of all registers and memory
+        libopenreil.reil_vm_taint_reset(self.vm)
+
+    def taint_reg(self, name, taint = None):
+
+        cdef libopenreil.reil_const_t c_taint = 0
+
+        # get/set taint labels of register bytes
+        if taint is None: 
+
+            libopenreil.reil_vm_taint_reg_get(self.vm, name, &c_taint)
+            return c_taint
+
+        libopenreil.reil_vm_taint_reg_set(self.vm, name, taint)
+
+    def taint_mem(self, addr, size, labels = None):
+
+        cdef bytearray buff = bytearray(size)
+        cdef unsigned char *c_buff = buff
+
+        # get/set taint labels of memory bytes
+        if labels is None:
+
+            libopenreil.reil_vm_taint_mem_get(self.vm, addr, size, c_buff)
+            return str(buff)
+
+        buff[:] = chr(labels) * size if isinstance(labels, (int, long)) else labels
+        libopenreil.reil_vm_taint_mem_set(self.vm, addr, size, c_buff)
+
+    def coverage_map(self, bytearray buff):
+
+        cdef unsigned char *c_buff
+
+        # buffer export keeps bytearray from being resized while it's used
+        view = memoryview(buff)
+        c_buff = buff
+
+        # use caller buffer as edge coverage map, see REIL_VM_OPT_COVERAGE
+        if libopenreil.reil_vm_coverage_set_map(self.vm, c_buff, len(buff)) != 0:
+
+            raise Error('Invalid coverage map')
+
+        self.coverage = view
+
+    def coverage_hits(self):
+
+        cdef int i, count
+        cdef libopenreil.reil_addr_t *c_addr
+        cdef libopenreil.reil_const_t *c_hits
+
+        ret = {}
+        count = libopenreil.reil_vm_coverage_hits(self.vm, NULL, NULL, 0)
+
+        c_addr = <libopenreil.reil_addr_t *>malloc(sizeof(libopenreil.reil_addr_t) * max(count, 1))
+        c_hits = <libopenreil.reil_const_t *>malloc(sizeof(libopenreil.reil_const_t) * max(count, 1))
+
+        # get hit counters of executed basic blocks
+        count = libopenreil.reil_vm_coverage_hits(self.vm, c_addr, c_hits, count)
+
+        for i in range(count): ret[c_addr[i]] = c_hits[i]
+
+        free(c_addr)
+        free(c_hits)
+
+        return ret
+
+    def coverage_reset(self):
+
+        # clear edge coverage map and hit counters
+        libopenreil.reil_vm_coverage_reset(self.vm)
+
+    def run(self, addr):
+
+        cdef libopenreil.reil_addr_t err_addr = 0
+        cdef libopenreil.reil_inum_t err_inum = 0
+
+        self.error = self.code_error = None
+
+        # execute code until error
+        code = libopenreil.reil_vm_run(self.vm, addr, &err_addr, &err_inum)
+
+        if code == VM_ERR_CODE and self.code_error is not None and \
+           self.code_error[0] == err_addr:
+
+            # code query error of the instruction that execution has reached
+            self.error = self.code_error[1]
+
+        self.code_error = None
+
+        if self.error is not None and code != VM_ERR_INSN:
+
+            # re-raise exception from the python callback
+            error, self.error = self.error, None
+            raise error[0], error[1], error[2]
+
+        return code, err_addr, err_inum
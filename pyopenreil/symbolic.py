@@ -262,7 +262,9 @@ class SymExp(Sym):
                    I_SMUL: '@*', I_SDIV: '@/', I_SMOD: '@%', 
                    I_SHL:  '<<', I_SHR:  '>>', I_AND:   '&',
                    I_OR:    '|', I_XOR:   '^', I_NOT:   '~',
-                   I_EQ:   '==', I_LT:    '<' }[self.op]
+                   I_EQ:   '==', I_LT:    '<', I_SAR: '@>>',
+                   I_ROL: '<<<', I_ROR:  '>>>', I_SEXT:  '@',
+                   I_NEQ:  '!=', I_LE:   '<=' }[self.op]
 
         if self.b is not None:
 
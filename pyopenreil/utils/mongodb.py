@@ -7,6 +7,8 @@ _U64IN = lambda v: -(0xFFFFFFFFFFFFFFFFL + 1L - v) if v > 0x7FFFFFFFFFFFFFFFL el
 
 _U64OUT = lambda v: (0xFFFFFFFFFFFFFFFFL + 1L + v) if v < 0 else v
 
+_SIGN = 0x8000000000000000L
+
 class CodeStorageMongo(REIL.CodeStorageMem):
 
     # mongodb host
@@ -21,6 +23,9 @@ class CodeStorageMongo(REIL.CodeStorageMem):
 
     CACHE_SIZE = 1024
 
+    # maximum number of instructions in single bulk query
+    BULK_SIZE = 1024
+
     def __init__(self, arch, collection, db = None, host = None, port = None):
         
         self.arch = arch
@@ -41,12 +46,6 @@ class CodeStorageMongo(REIL.CodeStorageMem):
         self.collection = self.db[self.collection_name]
         self.collection.ensure_index(self.INDEX)     
 
-    def __iter__(self):
-
-        for item in self.collection.find().sort(self.INDEX): 
-
-            yield REIL.Insn(self._insn_from_item(item))
-
     def _insn_to_item(self, insn):
 
         insn = REIL.Insn(insn)        
@@ -114,7 +113,7 @@ class CodeStorageMongo(REIL.CodeStorageMem):
 
     def _get_key(self, ir_addr):
 
-        return { 'addr': ir_addr[0], 'inum': ir_addr[1] }
+        return { 'addr': _U64IN(ir_addr[0]), 'inum': ir_addr[1] }
 
     def _find(self, ir_addr):
 
@@ -174,6 +173,83 @@ class CodeStorageMongo(REIL.CodeStorageMem):
         # update cache
         self.cache[ir_addr] = insn
 
+    def _range_query(self, start, end):
+
+        ret = []
+
+        #
+        # Addresses are stored as signed values, so range is split into
+        # the parts that belong to the positive and to the negative values.
+        #
+        for lo, hi, sign in [ ( ( 0, 0 ), ( _SIGN, 0 ), { '$gte': 0 } ), 
+                              ( ( _SIGN, 0 ), None, { '$lt': 0 } ) ]:
+
+            first = lo if start is None or start < lo else start
+            last = hi if end is None or (hi is not None and end > hi) else end
+
+            if last is not None and first >= last: continue
+
+            query = [ { 'addr': sign }, 
+                      { '$or': [ { 'addr': { '$gt': _U64IN(first[0]) } }, 
+                                 { 'addr': _U64IN(first[0]), 'inum': { '$gte': first[1] } } ] } ]
+
+            if last is not None and last != hi:
+
+                query.append({ '$or': [ { 'addr': { '$lt': _U64IN(last[0]) } }, 
+                                        { 'addr': _U64IN(last[0]), 'inum': { '$lt': last[1] } } ] })
+
+            ret.append({ '$and': query })
+
+        return ret
+
+    def _iter_range(self, start, end):
+
+        for query in self._range_query(start, end):
+
+            # single query for the whole range instead of query for each instruction
+            for item in self.collection.find(query).sort(self.INDEX): 
+
+                yield self._insn_from_item(item)
+
+    def _del_range(self, start, end):
+
+        ret = 0
+
+        for query in self._range_query(start, end):
+
+            ret += self.collection.find(query).count()
+            self.collection.remove(query)
+
+        # remove deleted items from cache
+        for ir_addr in list(self.cache.keys()):
+
+            if (start is None or ir_addr >= start) and (end is None or ir_addr < end):
+
+                del self.cache[ir_addr]
+
+        return ret
+
+    def _put_many(self, insn_list):
+
+        items = {}
+
+        for insn in insn_list: 
+
+            # last version of the instruction wins
+            items[REIL.Insn_ir_addr(insn)] = insn
+
+        keys = items.keys()
+
+        for i in range(0, len(keys), self.BULK_SIZE):
+
+            chunk = keys[i : i + self.BULK_SIZE]
+
+            # replace existing items using two queries for the whole chunk
+            self.collection.remove({ '$or': map(lambda ir_addr: self._get_key(ir_addr), chunk) })
+            self.collection.insert(map(lambda ir_addr: self._insn_to_item(items[ir_addr]), chunk))
+
+        for ir_addr, insn in items.items(): self.cache[ir_addr] = insn
+
     def size(self): 
 
         return self.collection.find().count()
@@ -7,6 +7,7 @@ if not reil_dir in sys.path: sys.path.append(reil_dir)
 
 from pyopenreil.REIL import *
 from pyopenreil.VM import *
+from pyopenreil.SSA import *
 
 try:
 
@@ -0,0 +1,3 @@
+BITS 32
+xor eax, eax
+ret 8
\ No newline at end of file
@@ -0,0 +1,7 @@
+BITS 32
+mov eax, 1
+_l: mov ebx, eax
+mov eax, 1
+dec ecx
+jnz _l
+ret
\ No newline at end of file